@@ -2,6 +2,8 @@
 #define ACCOUNTS_H
 
 #include <string>
+#include <map>
+#include <vector>
 #include "defines.h"
 #include "../DnDShared/globals.h"
 
@@ -38,13 +40,28 @@ struct UserCharSheet {
 	i32 bizarrePoints;
 };
 
+struct CharSheet {
+	u32 id;
+	StandCharSheet standsheet;
+	UserCharSheet usersheet;
+};
+
+//what the login sends for every sheet, the full sheet is requested with get_sheet when it is opened
+struct SheetSummary {
+	u32 id;
+	std::string name;
+	std::string standName;
+	i32 currentHealth;
+	i32 totalHealth;
+};
+
 struct Account {
 	Socket* socket;
 	std::string name;
 	std::string pass;
-	//TODO(Corbin): allow multiple character sheets per account.
-	StandCharSheet standsheet;
-	UserCharSheet usersheet;
+	std::vector<SheetSummary> sheets;
+	std::map<u32, CharSheet> sheetCache; //sheets received from the server so far
+	u32 activeSheet;
 };
 
 INTERNAL
@@ -82,11 +99,81 @@ void read_user_charsheet(UserCharSheet* sheet, StringList* tokens) {
 	sheet->bizarrePoints = std::stoi(tokens->at(28));
 }
 
+INTERNAL inline
+void append_value(std::string* str, std::string toApp) {
+	str->append(toApp);
+	str->append("|");
+}
+
+//same field order as the server's accounts file
+INTERNAL
+void append_sheet_fields(std::string* str, CharSheet* sheet) {
+	append_value(str, sheet->standsheet.name);
+	append_value(str, sheet->standsheet.standTypes);
+	append_value(str, sheet->standsheet.standAbilityDesc);
+	append_value(str, std::to_string(sheet->standsheet.speed));
+	append_value(str, std::to_string(sheet->standsheet.power));
+	append_value(str, std::to_string(sheet->standsheet.range));
+	append_value(str, std::to_string(sheet->standsheet.precision));
+	append_value(str, std::to_string(sheet->standsheet.durability));
+	append_value(str, std::to_string(sheet->standsheet.learning));
+
+	append_value(str, sheet->usersheet.name);
+	append_value(str, sheet->usersheet.playername);
+	append_value(str, sheet->usersheet.gender);
+	append_value(str, sheet->usersheet.weight);
+	append_value(str, sheet->usersheet.height);
+	append_value(str, sheet->usersheet.bloodType);
+	append_value(str, sheet->usersheet.occupation);
+	append_value(str, sheet->usersheet.nationality);
+	append_value(str, sheet->usersheet.backstory);
+	append_value(str, sheet->usersheet.inventory);
+	append_value(str, std::to_string(sheet->usersheet.brains));
+	append_value(str, std::to_string(sheet->usersheet.brawns));
+	append_value(str, std::to_string(sheet->usersheet.bravery));
+	append_value(str, std::to_string(sheet->usersheet.age));
+	append_value(str, std::to_string(sheet->usersheet.totalHealth));
+	append_value(str, std::to_string(sheet->usersheet.currentHealth));
+	append_value(str, std::to_string(sheet->usersheet.resolveDamage));
+	str->append(std::to_string(sheet->usersheet.bizarrePoints));
+}
+
+//summaries are sent as count|id|name|standName|currentHealth|totalHealth|...
+INTERNAL
+void read_sheet_summaries(Account* account, StringList* tokens, u32 start) {
+	u32 count = std::stoi(tokens->at(start));
+	for (u32 i = 0; i < count; ++i) {
+		u32 offset = start + 1 + (i * 5);
+		SheetSummary summary;
+		summary.id = std::stoi(tokens->at(offset));
+		summary.name = tokens->at(offset + 1);
+		summary.standName = tokens->at(offset + 2);
+		summary.currentHealth = std::stoi(tokens->at(offset + 3));
+		summary.totalHealth = std::stoi(tokens->at(offset + 4));
+
+		if (summary.id < account->sheets.size())
+			account->sheets[summary.id] = summary;
+		else
+			account->sheets.push_back(summary);
+	}
+}
+
+//a full sheet arrives as sheet|id|<fields>, which lines up with the accounts file indices
+INTERNAL
+void load_sheet(Account* account, StringList* tokens) {
+	CharSheet sheet;
+	sheet.id = std::stoi(tokens->at(1));
+	read_stand_charsheet(&sheet.standsheet, tokens);
+	read_user_charsheet(&sheet.usersheet, tokens);
+	account->sheetCache[sheet.id] = sheet;
+}
+
 INTERNAL inline 
 void load_account(Account* account, StringList* tokens) {
-	tokens->erase(tokens->begin());
-	read_stand_charsheet(&account->standsheet, tokens);
-	read_user_charsheet(&account->usersheet, tokens);
+	account->sheets.clear();
+	account->sheetCache.clear();
+	account->activeSheet = 0;
+	read_sheet_summaries(account, tokens, 3);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,94 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <string>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/atomic.hpp>
+#include "../DnDShared/globals.h"
+#include "../DnDShared/recording.h"
+#include "../DnDShared/transport.h"
+
+#define RECONNECT_ATTEMPTS 10
+#define RECONNECT_DELAY    500
+#define MESSAGE_QUEUE_SIZE 4096
+
+//The map, roll log and user list belong to the render thread. The io thread keeps the
+//session bookkeeping (ticket, sequence numbers) for itself and hands every other decoded
+//message to the render thread through the messages ring, which is drained at the start
+//of each frame. Neither side takes a lock, so a slow frame never holds up the socket and
+//a burst of messages never holds up a frame.
+
+struct Connection {
+	Socket* socket;
+	Transport* transport;     //set when the server runs in this process, the socket is not used then
+	boost::asio::ip::tcp::endpoint endpoint;
+	boost::mutex writeMutex;
+	boost::asio::streambuf inbox; //bytes read but not decoded yet, the tail may be half a line
+	boost::lockfree::spsc_queue<StringList*, boost::lockfree::capacity<MESSAGE_QUEUE_SIZE> > messages;
+	std::string loginCommand; //sent again if the session can no longer be resumed
+	std::string ticket;       //empty until the server has issued a session ticket
+	u64 lastSeq;              //last broadcast sequence number received from the server
+	u64 bytesRead;            //since the socket was opened, the server measures the link with it
+	volatile bool lost;
+	Recorder* recorder;       //the session's, off unless it is being recorded
+	//the server's measure of this connection, handed over with each ping. offset is how far
+	//our clock is ahead of the server's. all in us, set on the io thread
+	boost::atomic<i64> rttUs;
+	boost::atomic<i64> jitterUs;
+	boost::atomic<i64> offsetUs;
+	volatile bool synced;     //the three above have been set
+};
+
+//writes a command to the server, a failed write marks the connection as lost so
+//the receive thread can reconnect.
+INTERNAL inline
+void send_command(Connection* conn, const std::string& command) {
+	boost::system::error_code error;
+	bool written = true;
+	conn->writeMutex.lock();
+	if (conn->transport != NULL)
+		written = transport_write(conn->transport, command);
+	else
+		boost::asio::write(*conn->socket, boost::asio::buffer(command, command.size()), error);
+	conn->writeMutex.unlock();
+	record_entry(conn->recorder, RECORD_OUT, conn, command);
+	if (error || !written) {
+		BMT_LOG(WARNING, "Lost connection to server: %s", written ? error.message().c_str() : "the server closed it");
+		conn->lost = true;
+	}
+}
+
+//reopens the socket and presents the session ticket, or logs in from scratch if we never got one.
+INTERNAL inline
+bool reconnect(Connection* conn) {
+	for (u16 attempt = 0; attempt < RECONNECT_ATTEMPTS; ++attempt) {
+		boost::system::error_code error;
+		conn->writeMutex.lock();
+		conn->socket->close(error);
+		conn->socket->connect(conn->endpoint, error);
+		if (!error) {
+			std::string command = conn->loginCommand;
+			if (!conn->ticket.empty()) {
+				command = "resume|";
+				command.append(conn->ticket);
+				command.append("|");
+				command.append(std::to_string(conn->lastSeq));
+				command.append("\n");
+			}
+			boost::asio::write(*conn->socket, boost::asio::buffer(command, command.size()), error);
+		}
+		conn->writeMutex.unlock();
+
+		if (!error) {
+			BMT_LOG(INFO, "Reconnected to server");
+			conn->bytesRead = 0;
+			conn->lost = false;
+			return true;
+		}
+		BMT_LOG(WARNING, "Reconnect attempt %d failed: %s", attempt + 1, error.message().c_str());
+		boost::this_thread::sleep(boost::posix_time::millisec(RECONNECT_DELAY));
+	}
+	return false;
+}
+
+#endif
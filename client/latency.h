@@ -0,0 +1,79 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <algorithm>
+#include "globals.h"
+#include "bahamut.h"
+#include "session.h"
+
+#define FRAME_WINDOW 1.0 //seconds of frames the overlay averages
+
+//Where the time between the server and the screen goes. The network comes from the server's
+//pings, the server is what a move's ack takes beyond the network (waiting for the room's tick
+//and being applied) and the rest is this client's frames. A zeroed overlay is ready to use.
+struct LatencyOverlay {
+	bool visible;
+	f64 lastFrame;
+	f64 windowStart;
+	f64 frameSum;
+	f64 frameMax;
+	u32 frames;
+	f64 averageFrame; //over the last whole window, seconds
+	f64 worstFrame;
+};
+
+//F7 shows the overlay
+INTERNAL inline
+void latency_input(LatencyOverlay* overlay) {
+	if (is_key_pressed(KEY_F7))
+		overlay->visible = !overlay->visible;
+}
+
+//call once a frame
+INTERNAL inline
+void update_latency(LatencyOverlay* overlay, f64 now) {
+	if (overlay->lastFrame != 0) {
+		f64 frame = now - overlay->lastFrame;
+		overlay->frameSum += frame;
+		overlay->frameMax = std::max(overlay->frameMax, frame);
+		overlay->frames++;
+	}
+	else {
+		overlay->windowStart = now;
+	}
+	overlay->lastFrame = now;
+	if (now - overlay->windowStart >= FRAME_WINDOW && overlay->frames != 0) {
+		overlay->averageFrame = overlay->frameSum / overlay->frames;
+		overlay->worstFrame = overlay->frameMax;
+		overlay->frameSum = 0;
+		overlay->frameMax = 0;
+		overlay->frames = 0;
+		overlay->windowStart = now;
+	}
+}
+
+//in screen space
+INTERNAL inline
+void draw_latency_overlay(RenderBatch* batch, const LatencyOverlay* overlay, ClientSession* session, f32 x, f32 y) {
+	if (!overlay->visible)
+		return;
+	Connection* conn = &session->connection;
+	const Motion* motion = &session->state.motion;
+	i64 rtt = conn->rttUs;
+
+	draw_rectangle(batch, x, y, 330, 126, V4(0, 0, 0, 160));
+	//format_text hands back one shared buffer, so each line is drawn before the next is made
+	if (conn->synced) {
+		draw_text(batch, &BODY_FONT, format_text("network rtt %d ms, jitter %d ms", (i32)(rtt / 1000), (i32)(conn->jitterUs / 1000)), x + 8, y + 8, 255, 255, 255);
+		draw_text(batch, &BODY_FONT, format_text("clock %+d ms from the server's", (i32)(conn->offsetUs / 1000)), x + 8, y + 32, 255, 255, 255);
+	}
+	else {
+		draw_text(batch, &BODY_FONT, "waiting for the server's first ping", x + 8, y + 8, 255, 255, 255);
+	}
+	if (conn->synced && motion->acks != 0)
+		draw_text(batch, &BODY_FONT, format_text("server %d ms (move ack less network)", std::max((i32)(motion->rtt * 1000 - rtt / 1000), 0)), x + 8, y + 56, 255, 255, 255);
+	draw_text(batch, &BODY_FONT, format_text("frames %.1f ms, worst %.1f ms", overlay->averageFrame * 1000, overlay->worstFrame * 1000), x + 8, y + 80, 255, 255, 255);
+	draw_text(batch, &BODY_FONT, format_text("%d messages waiting for a frame", (i32)conn->messages.read_available()), x + 8, y + 104, 255, 255, 255);
+}
+
+#endif
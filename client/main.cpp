@@ -10,43 +10,38 @@
 #include <boost/algorithm/string.hpp>
 
 #include "../DnDShared/globals.h"
-#include "accounts.h"
-#include "map.h"
+#include "session.h"
+#include "latency.h"
 #include "../DnDShared/gui.h"
 
 using namespace boost;
 using namespace boost::asio;
 using namespace boost::asio::ip;
 
-typedef ClientMessage User;
-
 // GLOBALS
-INTERNAL io_service service;
-//127.0.0.1
-INTERNAL tcp::endpoint ep(ip::address::from_string("127.0.0.1"), 8001);
-INTERNAL boost::mutex generalMutex;
-INTERNAL boost::mutex userListMutex;
-INTERNAL std::vector<User> userList;
-INTERNAL bool closeThreads = false;
-INTERNAL bool windowOpen = false;
+INTERNAL const char* SERVER_ADDRESS = "127.0.0.1";
+INTERNAL const u16 SERVER_PORT = 8001;
+INTERNAL ClientSession session;
+//the window opens straight away and shows how far the login and these have come until the
+//table can be drawn
+INTERNAL AssetLoader assets;
+INTERNAL LatencyOverlay latency;
+//music the server sent ahead of time, started when it is due so every player hears it together
+INTERNAL std::vector<ClientEvent> cues;
 #define INPUT_SIZE 256
 
-INTERNAL Account account;
-INTERNAL StringList rollLog;
 INTERNAL bool menace = false;
 INTERNAL vec2 menacingPos;
-INTERNAL Map map;
 INTERNAL i32 roundabout = -1;
 // END GLOBALS
 
 // Function Prototypes
-INTERNAL void main_loop(Socket* socket);
-INTERNAL void receive_loop(Socket* socket);
+INTERNAL void main_loop(ClientSession* session);
 INTERNAL void send_handler(const boost::system::error_code& error, std::size_t bytes_transferred);
 
 INTERNAL void map_input(Map* map);
-INTERNAL void draw_log(RenderBatch* batch);
-INTERNAL void roll_prompt(RenderBatch* batch, Socket* sock, GameState& state);
+INTERNAL void draw_log(RenderBatch* batch, StringList* rollLog);
+INTERNAL void roll_prompt(RenderBatch* batch, Panel* panel, Font& font, Connection* conn, GameState& state, TextField* rollField);
 
 // End of Function Prototypes
 
@@ -88,39 +83,57 @@ std::string get_input(std::string message) {
 	return str;
 }
 
-int main() {
+//  tabletop_client [--record file] [--replay file] [--replay-speed fast|realtime]
+//
+//--record writes everything sent to and from the server to file. --replay shows what the server
+//sent in such a recording instead of connecting, nothing is sent anywhere
+int main(int argc, char** argv) {
+	std::string recordPath;
+	std::string replayPath;
+	std::string replaySpeed = "fast";
+	for (i32 i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			BMT_LOG(WARNING, "Missing value for %s", arg.c_str());
+			break;
+		}
+		if (arg == "--record")
+			recordPath = argv[++i];
+		else if (arg == "--replay")
+			replayPath = argv[++i];
+		else if (arg == "--replay-speed")
+			replaySpeed = argv[++i];
+		else
+			BMT_LOG(WARNING, "Unknown argument %s", arg.c_str());
+	}
+
 	try {
 		boost::thread_group threads;
-		Socket* sock = new tcp::socket(service);
+
+		if (!replayPath.empty()) {
+			replay_session(&session, replayPath, replaySpeed == "realtime");
+			threads.create_thread(boost::bind(main_loop, &session));
+			threads.join_all();
+			close_session(&session);
+			return EXIT_SUCCESS;
+		}
 
 		std::cout << "Please log in. If an account does not exist using the entered username, it will be created for you." << std::endl;
 		std::string namebuffer = get_input("Enter username: ");
-		std::string name = "name|";
-		name.append(namebuffer);
-
 		std::string passbuffer = get_input("Enter password: ");
 		i32 hash = hashpass(passbuffer.c_str(), strlen(passbuffer.c_str()));
-		name.append("|pass|");
-
-		account.name = namebuffer;
-		account.pass = to_string(hash);
-		name.append(to_string(hash));
-
-		User user;
-		user.str = namebuffer;
-		user.socket = sock;
-		userList.push_back(user);
 
-		sock->connect(ep);
-		sock->write_some(buffer(name, name.size()));
+		//players at different tables never see each other's maps
+		std::string roombuffer = get_input("Enter table name (leave blank for the default table): ");
 
-		std::cout << "Successfully connected to server on port 8001\n" << std::endl;
-		threads.create_thread(boost::bind(main_loop, sock));
-		threads.create_thread(boost::bind(receive_loop, sock));
+		std::cout << "Connecting to server on port " << SERVER_PORT << "\n" << std::endl;
+		if (!recordPath.empty())
+			record_session(&session, recordPath);
+		connect_session(&session, SERVER_ADDRESS, SERVER_PORT, namebuffer, to_string(hash), roombuffer);
+		threads.create_thread(boost::bind(main_loop, &session));
 
 		threads.join_all();
-		sock->write_some(buffer("exit\n", 4));
-		delete sock;
+		close_session(&session);
 	} catch (std::exception& e) {
 		std::cerr << e.what() << std::endl;
 #ifdef _WIN32
@@ -137,139 +150,58 @@ void send_handler(const boost::system::error_code& error, std::size_t bytes_tran
 
 }
 
+//what the server asked for that only the window cares about
 INTERNAL
-void handle_message(Socket* sock, StringList* tokens) {
-	if (tokens->at(0) == "name") {
-		BMT_LOG(INFO, "User '%s' has connected", tokens->at(1).c_str());
-		userListMutex.lock();
-		User user;
-		user.socket = NULL;
-		user.str = tokens->at(1);
-
-		userList.push_back(user);
-		userListMutex.unlock();
-	}
-	else if (tokens->at(0) == "login_failure") {
-		BMT_LOG(WARNING, "Failed to login. Account exists but the password is incorrect. Program will close.");
-		boost::this_thread::sleep(boost::posix_time::millisec(3000));
-		closeThreads = true;
-	}
-	else if (tokens->at(0) == "login_success") {
-		BMT_LOG(INFO, "Successfully logged in!\n");
-		load_account(&account, tokens);
-		boost::this_thread::sleep(boost::posix_time::millisec(2000));
-		windowOpen = true;
-	}
-	else if (tokens->at(0) == "login_created") {
-		BMT_LOG(INFO, "Created a new account! Logging in...\n");
-		load_account(&account, tokens);
-		boost::this_thread::sleep(boost::posix_time::millisec(3000));
-		windowOpen = true;
+void handle_event(ClientEvent* event) {
+	if (event->at > get_elapsed_time()) {
+		cues.push_back(*event);
+		return;
 	}
-	if (tokens->at(0) == "roll") {
-		if (std::atoi(tokens->at(1).c_str()) == 1) {
-			std::string str = tokens->at(2);
-			str.append(" rolled a dice(1-6): ");
-			str.append(tokens->at(3));
-			rollLog.push_back(str);
-			if (rollLog.size() > 15) {
-				rollLog.erase(rollLog.begin());
-			}
-		}
-	}
-	if (tokens->at(0) == "play_music") {
-		play_sound(music[ std::atoi( tokens->at(1).c_str() ) ]);
+	if (event->type == EVENT_PLAY_MUSIC && assets.done && event->value >= 0 && event->value < 10) {
+		play_sound(music[event->value]);
 	}
-	if (tokens->at(0) == "menacing") {
+	if (event->type == EVENT_MENACING) {
 		menace = true;
 		menacingPos = V2(-100, -100);
 	}
-	if (tokens->at(0) == "move") {
-		map.tokens[std::atoi( tokens->at(1).c_str() )].xPos = std::atoi( tokens->at(2).c_str() );
-		map.tokens[std::atoi( tokens->at(1).c_str() )].yPos = std::atoi( tokens->at(3).c_str() );
-	}
-	if (tokens->at(0) == "update_token") {
-		i32 ndx = std::stoi(tokens->at(1));
-		if (ndx == -1) {
-			Token token = { 0 };
-			map.tokens.push_back(token);
-			ndx = map.tokens.size() - 1;
-		}
-		map.tokens[ndx].bar1.current = std::stoi(tokens->at(2));
-		map.tokens[ndx].bar1.max = std::stoi(tokens->at(3));
-		map.tokens[ndx].bar2.current = std::stoi(tokens->at(4));
-		map.tokens[ndx].bar2.max = std::stoi(tokens->at(5));
-		map.tokens[ndx].bar3.current = std::stoi(tokens->at(6));
-		map.tokens[ndx].bar3.max = std::stoi(tokens->at(7));
-		map.tokens[ndx].name = tokens->at(8);
-		map.tokens[ndx].imgindex = std::stoi(tokens->at(9));
-	}
-	if (tokens->at(0) == "update_map") {
-		map.tokens.clear();
-		map.rects.clear();
-		map = { 0 };
-
-		map.width = std::stoi(tokens->at(1));
-		map.height = std::stoi(tokens->at(2));
-		map.xPos = std::stoi(tokens->at(3));
-		map.yPos = std::stoi(tokens->at(4));
-		map.grid = std::stoi(tokens->at(5));
-		map.fow = std::stoi(tokens->at(6));
-		map.bgColor = { std::stof(tokens->at(10)), std::stof(tokens->at(9)), std::stof(tokens->at(8)), std::stof(tokens->at(7)) };
-		map.gridColor = { std::stof(tokens->at(14)), std::stof(tokens->at(13)), std::stof(tokens->at(12)), std::stof(tokens->at(11)) };
-		//todo: fix colors
-		map.bgColor = WHITE;
-		map.gridColor = GRAY;
-		map.selected = -1;
-	}
-	if (tokens->at(0) == "roundabout") {
+	if (event->type == EVENT_ROUNDABOUT) {
 		roundabout = 2660;
 	}
 }
 
+//drawn instead of the table until the login has gone through and every asset is loaded
 INTERNAL
-void receive_loop(Socket* sock) {
-	for (;;) {
-		if (closeThreads) break;
-
-		if (sock->available()) {
-			generalMutex.lock();
-			char readBuffer[BUFFER_SIZE] = { 0 };
-			int bytesRead = sock->read_some(buffer(readBuffer, BUFFER_SIZE));
-			std::string msg = std::string(readBuffer, bytesRead);
-
-			BMT_LOG(DEBUG, "Received response from server: %s", msg.c_str());
-
-			StringList commands = split_string(msg, '\n');
-			for (u16 i = 0; i < commands.size(); ++i) {
-				StringList tokens = split_string(commands[i], '|');
-				if (tokens.size() > 0) {
-					handle_message(sock, &tokens);
-				}
-			}
-			generalMutex.unlock();
-		}
-
-		boost::this_thread::sleep(boost::posix_time::millisec(1000));
-	}
-	generalMutex.lock();
-	BMT_LOG(INFO, "Closed receive_loop");
-	generalMutex.unlock();
+void draw_startup(RenderBatch* batch, Shader basic) {
+	f32 width = (f32)get_window_width();
+	f32 height = (f32)get_window_height();
+	const char* status = "Loading...";
+	if (session.stage == STARTUP_CONNECTING)
+		status = "Connecting...";
+	else if (session.stage == STARTUP_AUTHENTICATING)
+		status = "Logging in...";
+
+	begin_drawing();
+	begin2D(batch, basic);
+		set_viewport(0, 0, width, height);
+		upload_mat4(basic, "projection", orthographic_projection(0, 0, width, height, -1, 1));
+		draw_text(batch, &BODY_FONT, status, width / 2 - 200, height / 2 - 40, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+		draw_rectangle(batch, width / 2 - 200, height / 2, 400, 20, GRAY);
+		draw_rectangle(batch, width / 2 - 200, height / 2, 400 * asset_progress(&assets), 20, FADED_RED);
+	end2D(batch);
+	end_drawing();
 }
 
 INTERNAL
-void draw_usernames(RenderBatch* batch) {
-	generalMutex.lock();
-	for (u16 i = 0; i < userList.size(); ++i) {
+void draw_usernames(RenderBatch* batch, std::vector<User>* users) {
+	for (u16 i = 0; i < users->size(); ++i) {
 		i32 x = (i * 110) + 20;
 		i32 y = get_window_height() - 40;
-		i32 width = get_string_width(BODY_FONT, userList[i].str.c_str()) + 8;
+		i32 width = get_string_width(BODY_FONT, users->at(i).str.c_str()) + 8;
 		i32 height = 30;
 
 		draw_rectangle(batch, x, y, width, height, FADED_RED);
-		draw_text(batch, &BODY_FONT, userList[i].str, x + 5, y + (height / 2) - (BODY_FONT.characters['t']->texture.height / 2), 255, 255, 255);
+		draw_text(batch, &BODY_FONT, users->at(i).str, x + 5, y + (height / 2) - (BODY_FONT.characters['t']->texture.height / 2), 255, 255, 255);
 	}
-	generalMutex.unlock();
 }
 
 const u8 NUM_COLORS = 9;
@@ -304,7 +236,14 @@ void set_bar_value(StatusBar* bar, TextField* field1, TextField* field2) {
 }
 
 INTERNAL
-void main_loop(Socket* socket) {
+void main_loop(ClientSession* session) {
+	Connection* conn = &session->connection;
+	Map& map = session->state.map;
+	Motion& motion = session->state.motion;
+	Account& account = session->state.account;
+	const bool& isDM = session->state.isDM;
+	std::vector<ClientEvent> events;
+
  	init_window(1400, 800, "Jojo Tabletop", false, true, true);
 	init_audio();
 	set_fps_cap(60);
@@ -313,20 +252,15 @@ void main_loop(Socket* socket) {
 	set_clear_color(FADED_TEAL);
 	set_mouse_state(MOUSE_HIDDEN);
 
-	map = { 0 };
-	map.selected = -1;
-	map.width = map.height = 20;
-	map.bgColor = WHITE;
-	map.gridColor = GRAY;
 	Token token = { 0 };
 	token.xPos = token.yPos = 128;
-	map.tokens.push_back(token);
+	add_token(&map.tokens, &token);
 
 	RenderBatch* batch = &create_batch();
 	Shader basic = load_default_shader_2D();
 	printf("\n\n");
 	GameState state = STATE_IDLE;
-	load_all_textures();
+	start_asset_loading(&assets);
 
 	vec4 colors[NUM_COLORS] = { BLACK, WHITE, RED, BLUE, GREEN, FADED_GREEN, FADED_RED, FADED_BLUE, FADED_BLACK };
 	Font font = load_font("art/opensans-regular.ttf", 24, GL_LINEAR);
@@ -342,6 +276,8 @@ void main_loop(Socket* socket) {
 	TextField bar31 = create_textfield(63, 30, 4, 1, INPUT_NUMBERS_ONLY);
 	TextField bar32 = create_textfield(63, 30, 4, 1, INPUT_NUMBERS_ONLY);
 	TextField imageField = create_textfield(35, 30, 2, 1, INPUT_NUMBERS_ONLY);
+	TextField rollField = create_textfield(350, 30, 24, 1, INPUT_EVERYTHING);
+	rollField.text[0] = "1d20";
 
 	//textfields for stand user sheet
 	TextField standUserName = create_textfield(350, 30, 22, 1, INPUT_EVERYTHING);
@@ -372,7 +308,29 @@ void main_loop(Socket* socket) {
 
 	f64 zoom = .25;
 	while (window_open()) {
-		if (closeThreads) break;
+		if (session->closed) break;
+		events.clear();
+		poll_session(session, get_elapsed_time(), &events);
+		for (u32 i = 0; i < events.size(); ++i)
+			handle_event(&events[i]);
+		for (u32 i = 0; i < cues.size();) {
+			if (cues[i].at > get_elapsed_time()) {
+				++i;
+				continue;
+			}
+			ClientEvent cue = cues[i];
+			cues.erase(cues.begin() + i);
+			handle_event(&cue);
+		}
+		latency_input(&latency);
+		update_latency(&latency, get_elapsed_time());
+		if (!assets.done || session->stage != STARTUP_READY) {
+			upload_assets(&assets);
+			draw_startup(batch, basic);
+			continue;
+		}
+		motion_input(&motion);
+		update_motion(&motion, &map.tokens, get_elapsed_time());
 
 		vec2 mousePos = get_mouse_pos();
 
@@ -390,17 +348,23 @@ void main_loop(Socket* socket) {
 			set_viewport(0, 0, width, height);
 			upload_mat4(basic, "projection", ortho * scale(zoom, zoom, 1));
 			draw_map(batch, &map, zoom);
-			if (state == STATE_IDLE)
-				update_map(batch, &map, socket, state, zoom);
-			draw_tokens(batch, &map, zoom);
+			if (state == STATE_IDLE && isDM && is_key_down(KEY_W))
+				update_walls(batch, &map, conn, zoom);
+			else if (state == STATE_IDLE)
+				update_map(batch, &map, &motion, conn, state, zoom);
+			draw_tokens(batch, &map, &motion, zoom, isDM);
+			if (map.fow && !isDM)
+				draw_fog(batch, &map, zoom);
 		end2D(batch);
 		begin2D(batch, basic);
 		begin_gui(&panel);
 
 			upload_mat4(basic, "projection", ortho);
-			draw_usernames(batch);
-			if (state != STATE_CHARSHEET && state != STATE_STANDSHEET) {
-				draw_log(batch);
+			draw_usernames(batch, &session->state.users);
+			draw_motion_overlay(batch, &motion, width - 340, 10);
+			draw_latency_overlay(batch, &latency, session, width - 340, 170);
+			if (state != STATE_CHARSHEET && state != STATE_STANDSHEET && state != STATE_SHEET_LOADING) {
+				draw_log(batch, &session->state.rollLog);
 				//draw buttons
 				if (draw_text_button(batch, "Roll Dice", width - (250 / 2) - (button_tex_n.width / 1.5), height - 50, FADED_RED, WHITE.xyz)) {
 					state = STATE_ROLL_PROMPT;
@@ -410,51 +374,90 @@ void main_loop(Socket* socket) {
 					state = STATE_IDLE;
 				}
 				if (draw_icon_button(batch, &turn_button, 10, yPos += 34, 1)) {
-
+					if (isDM)
+						send_command(conn, "turncounter\n");
 				}
 				if (draw_icon_button(batch, &char_sheet_icon, 10, yPos += 34, 1)) {
-					standUserName.text[0] = account.usersheet.name;
-					playerName.text[0] = account.usersheet.playername;
-					gender.text[0] = account.usersheet.gender;
-					weightField.text[0] = to_string(account.usersheet.weight);
-					heightField.text[0] = to_string(account.usersheet.height);
-					bloodType.text[0] = account.usersheet.bloodType;
-					occupation.text[0] = account.usersheet.occupation;
-					nationality.text[0] = account.usersheet.nationality;
-					//get_text(&charBackstory) = account.usersheet.backstory;
-					//get_text(&inventory) = account.usersheet.inventory;
-
-					brains.text[0] = to_string(account.usersheet.brains);
-					brawns.text[0] = to_string(account.usersheet.brawns);
-					bravery.text[0] = to_string(account.usersheet.bravery);
-					age.text[0] = to_string(account.usersheet.age);
-					totalHealth.text[0] = to_string(account.usersheet.totalHealth);
-					currentHealth.text[0] = to_string(account.usersheet.currentHealth);
-					resolveDamage.text[0] = to_string(account.usersheet.resolveDamage);
-					bizarrePoints.text[0] = to_string(account.usersheet.bizarrePoints);
-
-					standName.text[0] = account.standsheet.name;
-					standTypes.text[0] = account.standsheet.standTypes;
-					standDesc.text[0] = account.standsheet.standAbilityDesc;
+					request_sheet(session, account.activeSheet);
+					state = STATE_SHEET_LOADING;
+				}
+				//the server only echoes these to the other players, so play them here as well
+				if (isDM) {
+					i32 selected = token_index(&map.tokens, map.selected);
+					if (draw_icon_button(batch, &layers_button, 10, yPos += 34, 1) && selected != -1) {
+						u8* layer = &map.tokens.layer[selected];
+						*layer = (*layer + 1) % (LAYER_TOKEN + 1);
+						send_command(conn, format_text("set_layer|%u|%d\n", map.selected, *layer));
+					}
+					if (draw_icon_button(batch, &roundabout_button, 10, yPos += 34, 1)) {
+						send_command(conn, "roundabout\nplay_music|1\n");
+						roundabout = 2660;
+					}
+					//the music comes back from the server with when to start it
+					if (draw_icon_button(batch, &battle_music_button, 10, yPos += 34, 1)) {
+						send_command(conn, "play_music|0\n");
+					}
+					if (draw_icon_button(batch, &menacing_button, 10, yPos += 34, 1)) {
+						send_command(conn, "menacing\n");
+						menace = true;
+						menacingPos = V2(-100, -100);
+					}
+				}
+			}
+			if (state == STATE_SHEET_LOADING) {
+				//the fields are filled once the server has answered the get_sheet request
+				std::map<u32, CharSheet>::iterator it = account.sheetCache.find(account.activeSheet);
+				if (it != account.sheetCache.end()) {
+					CharSheet* sheet = &it->second;
+					standUserName.text[0] = sheet->usersheet.name;
+					playerName.text[0] = sheet->usersheet.playername;
+					gender.text[0] = sheet->usersheet.gender;
+					weightField.text[0] = sheet->usersheet.weight;
+					heightField.text[0] = sheet->usersheet.height;
+					bloodType.text[0] = sheet->usersheet.bloodType;
+					occupation.text[0] = sheet->usersheet.occupation;
+					nationality.text[0] = sheet->usersheet.nationality;
+					//get_text(&charBackstory) = sheet->usersheet.backstory;
+					//get_text(&inventory) = sheet->usersheet.inventory;
+
+					brains.text[0] = to_string(sheet->usersheet.brains);
+					brawns.text[0] = to_string(sheet->usersheet.brawns);
+					bravery.text[0] = to_string(sheet->usersheet.bravery);
+					age.text[0] = to_string(sheet->usersheet.age);
+					totalHealth.text[0] = to_string(sheet->usersheet.totalHealth);
+					currentHealth.text[0] = to_string(sheet->usersheet.currentHealth);
+					resolveDamage.text[0] = to_string(sheet->usersheet.resolveDamage);
+					bizarrePoints.text[0] = to_string(sheet->usersheet.bizarrePoints);
+
+					standName.text[0] = sheet->standsheet.name;
+					standTypes.text[0] = sheet->standsheet.standTypes;
+					standDesc.text[0] = sheet->standsheet.standAbilityDesc;
 					state = STATE_CHARSHEET;
 				}
+				if (state == STATE_SHEET_LOADING)
+					draw_text(batch, &font, "Loading character sheet...", width / 2 - 130, height / 2, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+			}
+			//the token may have been deleted or hidden while it was being edited
+			if ((state == STATE_TOKEN_TRANSITION || state == STATE_TOKEN) && token_index(&map.tokens, map.selected) == -1) {
+				state = STATE_IDLE;
 			}
 			if (state == STATE_TOKEN_TRANSITION) {
-				Token* current = &map.tokens[map.selected];
-				bar11.text[0] = format_text("%d", current->bar1.current);
-				bar12.text[0] = format_text("%d", current->bar1.max);
-				bar21.text[0] = format_text("%d", current->bar2.current);
-				bar22.text[0] = format_text("%d", current->bar2.max);
-				bar31.text[0] = format_text("%d", current->bar3.current);
-				bar32.text[0] = format_text("%d", current->bar3.max);
-				nameField.text[0] = current->name;
-				imageField.text[0] = format_text("%d", current->imgindex);
+				Token current;
+				get_token(&map.tokens, token_index(&map.tokens, map.selected), &current);
+				bar11.text[0] = format_text("%d", current.bars[0].current);
+				bar12.text[0] = format_text("%d", current.bars[0].max);
+				bar21.text[0] = format_text("%d", current.bars[1].current);
+				bar22.text[0] = format_text("%d", current.bars[1].max);
+				bar31.text[0] = format_text("%d", current.bars[2].current);
+				bar32.text[0] = format_text("%d", current.bars[2].max);
+				nameField.text[0] = current.name;
+				imageField.text[0] = format_text("%d", current.imgindex);
 				state = STATE_TOKEN;
 			}
 			if (state == STATE_TOKEN) {
-				Token* current = &map.tokens[map.selected];
+				i32 ndx = token_index(&map.tokens, map.selected);
 				f32 width = 400;
-				f32 height = 450;
+				f32 height = isDM ? 500 : 450;
 				f32 xPos = (f32)(get_window_width() / 2) - (width / 2);
 				f32 yPos = (f32)(get_window_height() / 2) - (height / 2);
 
@@ -484,26 +487,36 @@ void main_loop(Socket* socket) {
 				draw_text_field(batch, &panel, font, &imageField, xPos + 15, yPos + 350);
 
 				if (draw_text_button(batch, "Save Changes", xPos + 15, yPos + 390, FADED_RED, WHITE.xyz)) {
-					set_bar_value(&map.tokens[map.selected].bar1, &bar11, &bar12);
-					set_bar_value(&map.tokens[map.selected].bar2, &bar21, &bar22);
-					set_bar_value(&map.tokens[map.selected].bar3, &bar31, &bar32);
+					Token current;
+					get_token(&map.tokens, ndx, &current);
+					set_bar_value(&current.bars[0], &bar11, &bar12);
+					set_bar_value(&current.bars[1], &bar21, &bar22);
+					set_bar_value(&current.bars[2], &bar31, &bar32);
 
 					if (imageField.text.size() >= 0 && imageField.text[0] != "") {
 						i32 imageNum = std::stoi(imageField.text[0]);
 						if (imageNum > 0 && imageNum < TOKEN_IMAGE_COUNT)
-							map.tokens[map.selected].imgindex = imageNum;
+							current.imgindex = imageNum;
 					}
-					map.tokens[map.selected].name = nameField.text[0];
-					std::string command = format_text("update_token|%d|%d|%d|%d|%d|%d|%d|%s|%d\n",
-						map.selected, current->bar1.current, current->bar1.max, current->bar2.current, current->bar2.max,
-						current->bar3.current, current->bar3.max, current->name.c_str(), current->imgindex
+					current.name = nameField.text[0];
+					set_token(&map.tokens, ndx, &current);
+					std::string command = format_text("update_token|%u|%d|%d|%d|%d|%d|%d|",
+						map.selected, current.bars[0].current, current.bars[0].max, current.bars[1].current, current.bars[1].max,
+						current.bars[2].current, current.bars[2].max
 					);
-					socket->write_some(boost::asio::buffer(command, command.size()));
+					command.append(current.name);
+					command.append(format_text("|%d\n", current.imgindex));
+					send_command(conn, command);
 					state = STATE_IDLE;
 				}
 				if (draw_text_button(batch, "Cancel", xPos + 185, yPos + 390, FADED_RED, WHITE.xyz)) {
 					state = STATE_IDLE;
 				}
+				if (isDM && draw_text_button(batch, "Delete Token", xPos + 15, yPos + 440, FADED_RED, WHITE.xyz)) {
+					send_command(conn, format_text("delete_token|%u\n", map.selected));
+					remove_token(&map.tokens, map.selected);
+					state = STATE_IDLE;
+				}
 			}
 			if (state == STATE_STANDSHEET) {
 				f32 width = 700;
@@ -526,20 +539,11 @@ void main_loop(Socket* socket) {
 					state = STATE_CHARSHEET;
 				}
 				if (draw_text_button(batch, "Save Changes", xPos + 15, yPos, FADED_RED, WHITE.xyz)) {
-					account.standsheet.name = standName.text[0];
-					account.standsheet.standTypes = get_text(&standTypes);
-					account.standsheet.standAbilityDesc = get_text(&standDesc);
-
-					std::string command = format_text("update_account|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%d|%d\n",
-						account.name.c_str(), account.pass.c_str(), account.standsheet.name.c_str(), account.standsheet.standTypes.c_str(), 
-						account.standsheet.standAbilityDesc.c_str(), account.standsheet.speed, account.standsheet.power, account.standsheet.range, 
-						account.standsheet.precision, account.standsheet.durability, account.standsheet.learning, account.usersheet.name.c_str(), 
-						account.usersheet.playername.c_str(), account.usersheet.gender.c_str(), account.usersheet.weight.c_str(), account.usersheet.height.c_str(),
-						account.usersheet.bloodType.c_str(), account.usersheet.occupation.c_str(), account.usersheet.nationality.c_str(), account.usersheet.backstory.c_str(),
-						account.usersheet.inventory.c_str(), account.usersheet.brains, account.usersheet.brawns, account.usersheet.bravery, account.usersheet.age,
-						account.usersheet.totalHealth, account.usersheet.currentHealth, account.usersheet.resolveDamage, account.usersheet.bizarrePoints
-					);
-					socket->write_some(boost::asio::buffer(command, command.size()));
+					CharSheet* sheet = &account.sheetCache[account.activeSheet];
+					sheet->standsheet.name = standName.text[0];
+					sheet->standsheet.standTypes = get_text(&standTypes);
+					sheet->standsheet.standAbilityDesc = get_text(&standDesc);
+					save_sheet(session, sheet);
 					state = STATE_IDLE;
 				}
 				if (draw_text_button(batch, "Cancel", xPos + 185, yPos, FADED_RED, WHITE.xyz)) {
@@ -603,41 +607,41 @@ void main_loop(Socket* socket) {
 					state = STATE_STANDSHEET;
 				}
 				if (draw_text_button(batch, "Save Changes", xPos + 15, yPos, FADED_RED, WHITE.xyz)) {
-					account.usersheet.name = standUserName.text[0];
-					account.usersheet.playername = playerName.text[0];
-					account.usersheet.gender = gender.text[0];
-					account.usersheet.weight = weightField.text[0];
-					account.usersheet.height = heightField.text[0];
-					account.usersheet.bloodType = bloodType.text[0];
-					account.usersheet.occupation = occupation.text[0];
-					account.usersheet.nationality = nationality.text[0];
-					account.usersheet.backstory = get_text(&charBackstory);
-					account.usersheet.inventory = get_text(&inventory);
-
-					account.usersheet.brains = brains.text[0].size() > 0 ? std::stoi(brains.text[0]) : 0;
-					account.usersheet.brawns = brawns.text[0].size() > 0 ? std::stoi(brawns.text[0]) : 0;
-					account.usersheet.bravery = bravery.text[0].size() > 0 ? std::stoi(bravery.text[0]) : 0;
-					account.usersheet.age = age.text[0].size() > 0 ? std::stoi(age.text[0]) : 0;
-					account.usersheet.totalHealth = totalHealth.text[0].size() > 0 ? std::stoi(totalHealth.text[0]) : 0;
-					account.usersheet.currentHealth = currentHealth.text[0].size() > 0 ? std::stoi(currentHealth.text[0]) : 0;
-					account.usersheet.resolveDamage = resolveDamage.text[0].size() > 0 ? std::stoi(resolveDamage.text[0]) : 0;
-					account.usersheet.bizarrePoints = bizarrePoints.text[0].size() > 0 ? std::stoi(bizarrePoints.text[0]) : 0;
-
-					std::string command = format_text("update_account|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%d|%d\n",
-						account.name.c_str(), account.pass.c_str(), account.standsheet.name.c_str(), account.standsheet.standTypes.c_str(),
-						account.standsheet.standAbilityDesc.c_str(), account.standsheet.speed, account.standsheet.power, account.standsheet.range,
-						account.standsheet.precision, account.standsheet.durability, account.standsheet.learning, account.usersheet.name.c_str(),
-						account.usersheet.playername.c_str(), account.usersheet.gender.c_str(), account.usersheet.weight.c_str(), account.usersheet.height.c_str(),
-						account.usersheet.bloodType.c_str(), account.usersheet.occupation.c_str(), account.usersheet.nationality.c_str(), account.usersheet.backstory.c_str(),
-						account.usersheet.inventory.c_str(), account.usersheet.brains, account.usersheet.brawns, account.usersheet.bravery, account.usersheet.age,
-						account.usersheet.totalHealth, account.usersheet.currentHealth, account.usersheet.resolveDamage, account.usersheet.bizarrePoints
-					);
-					socket->write_some(boost::asio::buffer(command, command.size()));
+					CharSheet* sheet = &account.sheetCache[account.activeSheet];
+					sheet->usersheet.name = standUserName.text[0];
+					sheet->usersheet.playername = playerName.text[0];
+					sheet->usersheet.gender = gender.text[0];
+					sheet->usersheet.weight = weightField.text[0];
+					sheet->usersheet.height = heightField.text[0];
+					sheet->usersheet.bloodType = bloodType.text[0];
+					sheet->usersheet.occupation = occupation.text[0];
+					sheet->usersheet.nationality = nationality.text[0];
+					sheet->usersheet.backstory = get_text(&charBackstory);
+					sheet->usersheet.inventory = get_text(&inventory);
+
+					sheet->usersheet.brains = brains.text[0].size() > 0 ? std::stoi(brains.text[0]) : 0;
+					sheet->usersheet.brawns = brawns.text[0].size() > 0 ? std::stoi(brawns.text[0]) : 0;
+					sheet->usersheet.bravery = bravery.text[0].size() > 0 ? std::stoi(bravery.text[0]) : 0;
+					sheet->usersheet.age = age.text[0].size() > 0 ? std::stoi(age.text[0]) : 0;
+					sheet->usersheet.totalHealth = totalHealth.text[0].size() > 0 ? std::stoi(totalHealth.text[0]) : 0;
+					sheet->usersheet.currentHealth = currentHealth.text[0].size() > 0 ? std::stoi(currentHealth.text[0]) : 0;
+					sheet->usersheet.resolveDamage = resolveDamage.text[0].size() > 0 ? std::stoi(resolveDamage.text[0]) : 0;
+					sheet->usersheet.bizarrePoints = bizarrePoints.text[0].size() > 0 ? std::stoi(bizarrePoints.text[0]) : 0;
+					save_sheet(session, sheet);
 					state = STATE_IDLE;
 				}
 				if (draw_text_button(batch, "Cancel", xPos + 185, yPos, FADED_RED, WHITE.xyz)) {
 					state = STATE_IDLE;
 				}
+				draw_text(batch, &font, format_text("Sheet %d of %d", account.activeSheet + 1, (u32)account.sheets.size()), xPos + 15, yPos + 50, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+				if (draw_text_button(batch, "Next Sheet", xPos + 185, yPos + 45, FADED_RED, WHITE.xyz)) {
+					account.activeSheet = (account.activeSheet + 1) % account.sheets.size();
+					request_sheet(session, account.activeSheet);
+					state = STATE_SHEET_LOADING;
+				}
+				if (draw_text_button(batch, "New Sheet", xPos + 285, yPos + 45, FADED_RED, WHITE.xyz)) {
+					send_command(conn, "new_sheet\n");
+				}
 			}
 
 			if (menace) {
@@ -652,7 +656,7 @@ void main_loop(Socket* socket) {
 				roundabout--;
 			}
 			if (state == STATE_ROLL_PROMPT) {
-				roll_prompt(batch, socket, state);
+				roll_prompt(batch, &panel, font, conn, state, &rollField);
 			}
 			if (roundabout == 0) {
 				draw_rectangle(batch, 0, 0, get_window_width(), get_window_height(), V4(130, 94, 3, 128));
@@ -667,7 +671,6 @@ void main_loop(Socket* socket) {
 		end2D(batch);
 		end_drawing();
 	}
-	closeThreads = true;
 	BMT_LOG(INFO, "Closed main_loop");
 	dispose_window();
 }
@@ -689,50 +692,36 @@ void map_input(Map* map) {
 }
 
 INTERNAL 
-void draw_log(RenderBatch* batch) {
+void draw_log(RenderBatch* batch, StringList* rollLog) {
 	f32 width = (f32)get_window_width();
 	f32 height = (f32)get_window_height();
 
 	draw_rectangle(batch, width - 250, 0, 250, height, WHITE);
 	draw_rectangle(batch, width - 254, 0, 4, height, GRAY);
-	for (u16 i = 0; i < rollLog.size(); ++i) {
-		draw_text(batch, &BODY_FONT, rollLog[i], width - 240, 10 + (i * 25), DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+	for (u16 i = 0; i < rollLog->size(); ++i) {
+		draw_text(batch, &BODY_FONT, rollLog->at(i), width - 240, 10 + (i * 25), DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
 	}
 }
 
-//decide whether to roll privately or publically
+//decide what to roll and whether to roll privately or publically
 INTERNAL
-void roll_prompt(RenderBatch* batch, Socket* socket, GameState& state) {
+void roll_prompt(RenderBatch* batch, Panel* panel, Font& font, Connection* conn, GameState& state, TextField* rollField) {
 	f32 width = (f32)get_window_width();
 	f32 height = (f32)get_window_height();
+	f32 x = (width / 2) - (button_tex_n.width / 2);
+	f32 y = (height / 2) - (button_tex_n.height / 2);
 
-	draw_outline(batch, (width / 2) - (button_tex_n.width / 2) - 190 - 30, (height / 2) - (button_tex_n.height / 2) - 30, 400, 100);
+	draw_outline(batch, x - 190 - 30, y - 80, 400, 150);
+	draw_text(batch, &font, "Roll (e.g. 1d20+3, 4d6kh3, 3d6!)", x - 190, y - 65, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+	draw_text_field(batch, panel, font, rollField, x - 190, y - 40);
 
-	if (draw_text_button(batch, "Roll Privately", (width / 2) - (button_tex_n.width / 2), (height / 2) - (button_tex_n.height / 2), FADED_RED, WHITE.xyz)) {
+	//the server rolls and sends back a roll_result, to everyone or just to us
+	if (draw_text_button(batch, "Roll Privately", x, y, FADED_RED, WHITE.xyz)) {
 		state = STATE_IDLE;
-		i32 num = random_int(1, 6);
-		std::string str = "I rolled a dice(1-6): ";
-		str.append(std::to_string(num));
-		rollLog.push_back(str);
-		if (rollLog.size() > 15) {
-			rollLog.erase(rollLog.begin());
-		}
-		//roll to self
+		send_command(conn, "roll_expr|0|" + get_text(rollField) + "\n");
 	}
-	if (draw_text_button(batch, "Roll Publically", (width / 2) - (button_tex_n.width / 2) - 190, (height / 2) - (button_tex_n.height / 2), FADED_RED, WHITE.xyz)) {
+	if (draw_text_button(batch, "Roll Publically", x - 190, y, FADED_RED, WHITE.xyz)) {
 		state = STATE_IDLE;
-		i32 num = random_int(1, 6);
-		std::string str = "I rolled a dice(1-6): ";
-		str.append(std::to_string(num));
-		rollLog.push_back(str);
-		if (rollLog.size() > 15) {
-			rollLog.erase(rollLog.begin());
-		}
-
-		std::string msg = "roll|1|The DM|";
-		msg.append(std::to_string(num));
-		msg.append("\n");
-		//roll to all clients.
-		socket->write_some(boost::asio::buffer(msg, msg.size()));
+		send_command(conn, "roll_expr|1|" + get_text(rollField) + "\n");
 	}
 }
\ No newline at end of file
@@ -3,9 +3,14 @@
 
 #include "globals.h"
 #include "bahamut.h"
+#include "connection.h"
+#include "tokens.h"
+#include "bitgrid.h"
+#include "motion.h"
 
 enum GameState {
 	STATE_IDLE,
+	STATE_SHEET_LOADING,
 	STATE_CHARSHEET,
 	STATE_STANDSHEET,
 	STATE_TOKEN_TRANSITION,
@@ -16,23 +21,6 @@ enum GameState {
 	STATE_ROLL
 };
 
-struct StatusBar {
-	i32 current;
-	i32 max;
-};
-
-struct Token {
-	u16 imgindex;
-	StatusBar bar1;
-	StatusBar bar2;
-	StatusBar bar3;
-	std::string name;
-	vec4 tintColor;
-	bool anchorToTile;
-	i32 xPos;
-	i32 yPos;
-};
-
 struct RectShape {
 	u8 thickness;
 	Rect dim;
@@ -40,7 +28,6 @@ struct RectShape {
 	vec4 fgcolor;
 };
 
-typedef std::vector<Token> TokenList;
 typedef std::vector<RectShape> RectList;
 
 struct Map {
@@ -52,11 +39,14 @@ struct Map {
 	bool fow;
 	vec4 bgColor;
 	vec4 gridColor;
-	TokenList tokens;
+	TokenStore tokens;
 	RectList rects;
 	Sound music;
+	BitGrid walls;    //only sent to the DM
+	BitGrid explored; //fog of war, tiles a player token has ever seen
+	BitGrid visible;  //and the ones they see right now
 
-	i16 selected;
+	TokenHandle selected;
 };
 
 static inline
@@ -84,7 +74,7 @@ INTERNAL inline
 Map load_map(const char* path) {
 	Map map = { 0 };
 
-	map.selected = -1;
+	map.selected = TOKEN_NONE;
 
 	return map;
 }
@@ -123,46 +113,70 @@ bool draw_icon_button(RenderBatch* batch, Texture* tex, const u16 xPos, const u1
 }
 
 INTERNAL inline
-void update_map(RenderBatch* batch, Map* map, Socket* socket, GameState& state, f64 zoom) {
+void update_map(RenderBatch* batch, Map* map, Motion* motion, Connection* conn, GameState& state, f64 zoom) {
 	vec2 mousePos = get_mouse_pos();
 	mousePos.x /= zoom;
 	mousePos.y /= zoom;
 
 	if (is_button_released(MOUSE_BUTTON_RIGHT))
-		map->selected = -1;
+		map->selected = TOKEN_NONE;
 
-	if (map->selected != -1) {
+	i32 ndx = token_index(&map->tokens, map->selected);
+	if (ndx != -1) {
 		bool mouseInsideMap = false;
 		bool hoveredButton = false;
-		Token* current = &map->tokens[map->selected];
+		i32 xPos = map->tokens.xPos[ndx];
+		i32 yPos = map->tokens.yPos[ndx];
 
 		vec2 tile = V2(roundUp(mousePos.x - map->xPos, TILESIZE) - TILESIZE, roundUp(mousePos.y - map->yPos, TILESIZE) - TILESIZE);
-		Rect button = rect(map->xPos + current->xPos, map->yPos + current->yPos + TILESIZE, settings_icon.width, settings_icon.height);
+		Rect button = rect(map->xPos + xPos, map->yPos + yPos + TILESIZE, settings_icon.width, settings_icon.height);
 		if (tile.x / TILESIZE >= 0 && tile.y / TILESIZE >= 0 && tile.x / TILESIZE < map->width && tile.y / TILESIZE < map->height) mouseInsideMap = true;
 		if (colliding(button, mousePos.x, mousePos.y)) hoveredButton = true;
 
 		if (mouseInsideMap && !hoveredButton)
 			draw_rectangle(batch, tile.x + map->xPos, tile.y + map->yPos, TILESIZE, TILESIZE, V4(150, 40, 150, 120));
 
-		if (draw_icon_button(batch, &settings_icon, map->xPos + current->xPos, map->yPos + current->yPos + TILESIZE, zoom)) {
+		if (draw_icon_button(batch, &settings_icon, map->xPos + xPos, map->yPos + yPos + TILESIZE, zoom)) {
 			state = STATE_TOKEN_TRANSITION;
 		}
 
 		if (is_button_released(MOUSE_BUTTON_LEFT) && mouseInsideMap && !hoveredButton) {
-			current->xPos = tile.x;
-			current->yPos = tile.y;
+			u32 id = predict_move(motion, &map->tokens, map->selected, tile.x, tile.y, get_elapsed_time());
 			std::string command = "move|";
 			command.append(std::to_string(map->selected));
 			command.append("|");
-			command.append(std::to_string(tile.x));
+			command.append(std::to_string((i32)tile.x));
 			command.append("|");
-			command.append(std::to_string(tile.y));
+			command.append(std::to_string((i32)tile.y));
+			command.append("|");
+			command.append(std::to_string(id));
 			command.append("\n");
-			socket->write_some(boost::asio::buffer(command, command.size()));
+			send_command(conn, command);
 		}
 	}
 }
 
+//holding W and clicking a tile adds or removes a wall there, DM only
+INTERNAL inline
+void update_walls(RenderBatch* batch, Map* map, Connection* conn, f64 zoom) {
+	vec2 mousePos = get_mouse_pos();
+	mousePos.x /= zoom;
+	mousePos.y /= zoom;
+
+	i32 x = (i32)floorf((mousePos.x - map->xPos) / TILESIZE);
+	i32 y = (i32)floorf((mousePos.y - map->yPos) / TILESIZE);
+	if (x < 0 || y < 0 || x >= (i32)map->walls.width || y >= (i32)map->walls.height)
+		return;
+	draw_rectangle(batch, map->xPos + x * TILESIZE, map->yPos + y * TILESIZE, TILESIZE, TILESIZE, V4(40, 40, 40, 120));
+	if (!is_button_released(MOUSE_BUTTON_LEFT))
+		return;
+
+	u32 tile = y * map->walls.width + x;
+	bool wall = !get_bit(&map->walls, tile);
+	set_bit(&map->walls, tile, wall);
+	send_command(conn, format_text("set_wall|%d|%d|%d\n", x, y, wall));
+}
+
 INTERNAL inline
 void draw_map(RenderBatch* batch, Map* map, f64 zoom) {
 	vec2 mousePos = get_mouse_pos();
@@ -184,6 +198,8 @@ void draw_map(RenderBatch* batch, Map* map, f64 zoom) {
 		for (u32 y = y0; y < y1; ++y) {
 			draw_rectangle(batch, (map->xPos) + (x * TILESIZE), (map->yPos) + (y * TILESIZE), TILESIZE, TILESIZE, map->gridColor);
 			draw_rectangle(batch, (map->xPos) + ((x * TILESIZE) + 4), (map->yPos) + ((y * TILESIZE) + 4), TILESIZE - 8, TILESIZE - 8, map->bgColor);
+			if (get_tile(&map->walls, x, y))
+				draw_rectangle(batch, (map->xPos) + ((x * TILESIZE) + 4), (map->yPos) + ((y * TILESIZE) + 4), TILESIZE - 8, TILESIZE - 8, DARKGRAY);
 		}
 	}
 
@@ -201,38 +217,96 @@ void draw_map(RenderBatch* batch, Map* map, f64 zoom) {
 }
 
 INTERNAL inline
-void draw_tokens(RenderBatch* batch, Map* map, f64 zoom) {
+void draw_tokens(RenderBatch* batch, Map* map, const Motion* motion, f64 zoom, bool showGM) {
 	vec2 mousePos = get_mouse_pos();
 	mousePos.x /= zoom;
 	mousePos.y /= zoom;
 
-	for (u32 i = 0; i < map->tokens.size(); ++i) {
-		Token* current = &map->tokens[i];
-
-		if (map->selected == i) {
-			const u8 highlightSize = 8;
-			draw_rectangle(batch, map->xPos + current->xPos - highlightSize,
-				map->yPos + current->yPos - highlightSize,
-				TILESIZE + (highlightSize * 2),
-				TILESIZE + (highlightSize * 2),
-				SKYBLUE
-			);
-		}
+	TokenStore* tokens = &map->tokens;
+	u8 layers = showGM ? 0xFF : (u8)~LAYER_BIT(LAYER_GM);
+	i32 hovered = token_at(tokens, mousePos.x - map->xPos, mousePos.y - map->yPos, layers);
+	if (hovered != -1 && is_button_released(MOUSE_BUTTON_LEFT))
+		map->selected = tokens->handles[hovered];
+	i32 selected = token_index(tokens, map->selected);
+
+	//only tokens on screen are drawn, the extra tile around it covers the bars and names.
+	//the server does not send players GM layer tokens, the mask only matters for one that
+	//was just hidden
+	static std::vector<u32> visible;
+	tokens_in_rect(tokens, -map->xPos - TILESIZE, -map->yPos - TILESIZE, get_window_width() / zoom + TILESIZE * 2, get_window_height() / zoom + TILESIZE * 2, layers, &visible);
+
+	//tokens that are gliding are drawn behind where the store has them
+	static std::vector<vec2> drawn;
+	f64 now = get_elapsed_time();
+	drawn.resize(visible.size());
+	for (u32 n = 0; n < visible.size(); ++n) {
+		motion_position(motion, tokens, visible[n], now, &drawn[n].x, &drawn[n].y);
+		drawn[n].x += map->xPos;
+		drawn[n].y += map->yPos;
+	}
 
-		Rect tokenRect = rect(map->xPos + current->xPos, map->yPos + current->yPos, TILESIZE, TILESIZE);
-		if (colliding(tokenRect, mousePos.x, mousePos.y)) {
-			if (is_button_released(MOUSE_BUTTON_LEFT))
-				map->selected = i;
-			draw_texture(batch, tokenimages[current->imgindex], map->xPos + current->xPos, map->yPos + current->yPos, V4(172, 261, 255, 255));
+	if (selected != -1) {
+		const u8 highlightSize = 8;
+		f32 x, y;
+		motion_position(motion, tokens, selected, now, &x, &y);
+		draw_rectangle(batch, map->xPos + x - highlightSize,
+			map->yPos + y - highlightSize,
+			TILESIZE + (highlightSize * 2),
+			TILESIZE + (highlightSize * 2),
+			SKYBLUE
+		);
+	}
+
+	//one pass per column keeps each pass reading a single array
+	for (u32 n = 0; n < visible.size(); ++n) {
+		u32 i = visible[n];
+		f32 x = drawn[n].x;
+		f32 y = drawn[n].y;
+		if ((i32)i == hovered)
+			draw_texture(batch, tokenimages[tokens->imgindex[i]], x, y, V4(172, 261, 255, 255));
+		else
+			draw_texture(batch, tokenimages[tokens->imgindex[i]], x, y, V4(255, 255, 255, tokens->layer[i] == LAYER_GM ? 120 : 255));
+	}
+	const vec4 barColors[TOKEN_BARS] = { GREEN, RED, BLUE };
+	for (u32 bar = 0; bar < TOKEN_BARS; ++bar) {
+		const StatusBar* bars = tokens->bars[bar].data();
+		for (u32 n = 0; n < visible.size(); ++n) {
+			u32 i = visible[n];
+			draw_status_bar(batch, drawn[n].x, drawn[n].y - 5 - (i32)bar * 20, bars[i], barColors[bar]);
 		}
-		else {
-			draw_texture(batch, tokenimages[current->imgindex], map->xPos + current->xPos, map->yPos + current->yPos);
+	}
+	for (u32 n = 0; n < visible.size(); ++n) {
+		u32 i = visible[n];
+		if (!tokens->names[i].empty())
+			draw_text(batch, &BODY_FONT, tokens->names[i], drawn[n].x + 30, drawn[n].y + TILESIZE + 15, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+	}
+	draw_motion_ghosts(batch, motion, map->xPos, map->yPos);
+}
+
+//drawn over the map and tokens: tiles no token has seen are black, tiles that were seen
+//before but are not in sight now are dimmed
+INTERNAL inline
+void draw_fog(RenderBatch* batch, Map* map, f64 zoom) {
+	if (map->explored.width != map->width || map->explored.height != map->height)
+		return;
+
+	i32 x0 = (-map->xPos / (TILESIZE));
+	i32 x1 = (-map->xPos / (TILESIZE)) + ((get_window_width() / zoom) / TILESIZE) + 3;
+	i32 y0 = (-map->yPos / (TILESIZE));
+	i32 y1 = (-map->yPos / (TILESIZE)) + ((get_window_height() / zoom) / TILESIZE) + 3;
+	clamp(x0, 0, map->width);
+	clamp(y0, 0, map->height);
+	clamp(x1, 0, map->width);
+	clamp(y1, 0, map->height);
+
+	for (i32 y = y0; y < y1; ++y) {
+		for (i32 x = x0; x < x1; ++x) {
+			if (!get_tile(&map->explored, x, y))
+				draw_rectangle(batch, map->xPos + x * TILESIZE, map->yPos + y * TILESIZE, TILESIZE, TILESIZE, BLACK);
+			else if (!get_tile(&map->visible, x, y))
+				draw_rectangle(batch, map->xPos + x * TILESIZE, map->yPos + y * TILESIZE, TILESIZE, TILESIZE, V4(0, 0, 0, 150));
 		}
-		draw_status_bar(batch, map->xPos + current->xPos, map->yPos + current->yPos - 5, current->bar1, GREEN);
-		draw_status_bar(batch, map->xPos + current->xPos, map->yPos + current->yPos - 25, current->bar2, RED);
-		draw_status_bar(batch, map->xPos + current->xPos, map->yPos + current->yPos - 45, current->bar3, BLUE);
-		draw_text(batch, &BODY_FONT, current->name, map->xPos + current->xPos + 30, map->yPos + current->yPos + TILESIZE + 15, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
 	}
 }
 
-#endif
\ No newline at end of file
+#endif
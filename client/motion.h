@@ -0,0 +1,308 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "globals.h"
+#include "bahamut.h"
+#include "tokens.h"
+
+//defaults for the tunables, the debug overlay (F3) can change them while playing
+#define MOTION_INTERP_DELAY 0.1  //seconds remote moves are drawn behind the newest one
+#define MOTION_CORRECTION   0.15 //seconds a token glides back when the server disagrees
+#define MOTION_ACK_TIMEOUT  2.0  //seconds before an unanswered local move is given up on
+#define MOTION_MAX_SAMPLES  16
+
+//How tokens get from where the server last put them to where they are drawn.
+//
+//A local move is applied as soon as the token is dropped and sent with an id. The server
+//answers with move_ack|handle|id at the point in the broadcast stream where it applied the
+//move, so a remote move that arrives before the ack happened before ours and one that
+//arrives after it wins. Until every local move of a token is acked, remote moves only
+//update the server position; once they are, the token glides to the server position if
+//the prediction was wrong.
+//
+//Remote moves are not applied to the drawing right away. Each one is a sample with the time
+//it arrived and the token is drawn interp delay behind the newest sample, between the two
+//around that time, so moves that come in bursts or late are still spread out evenly. The
+//token store always holds the final position, for hit testing and selection.
+struct MotionTunables {
+	f64 interpDelay;
+	f64 correction;
+	f64 ackTimeout;
+	bool predict; //off, local moves wait for the ack like remote ones
+	bool overlay;
+};
+
+struct MotionSample {
+	f64 time;
+	f32 x;
+	f32 y;
+};
+
+struct PendingMove {
+	u32 id;
+	i32 x;
+	i32 y;
+	f64 sent;
+};
+
+//only tokens that are gliding or have moves in flight have a track
+struct MotionTrack {
+	std::vector<MotionSample> samples; //oldest first, empty when the token is drawn where the store has it
+	std::vector<PendingMove> pending;  //oldest first
+	i32 serverX;
+	i32 serverY;
+	bool placing; //the next server move puts a token we just heard of down without gliding
+};
+
+struct Motion {
+	MotionTunables tunables;
+	std::map<TokenHandle, MotionTrack> tracks;
+	u32 nextMoveId;
+
+	//for the overlay
+	f64 rtt; //of the last acked move
+	u32 acks;
+	u32 corrections;
+	u32 timeouts;
+};
+
+INTERNAL inline
+void init_motion(Motion* motion) {
+	motion->tunables.interpDelay = MOTION_INTERP_DELAY;
+	motion->tunables.correction = MOTION_CORRECTION;
+	motion->tunables.ackTimeout = MOTION_ACK_TIMEOUT;
+	motion->tunables.predict = true;
+	motion->tunables.overlay = false;
+	motion->tracks.clear();
+	motion->nextMoveId = 1;
+	motion->rtt = 0;
+	motion->acks = 0;
+	motion->corrections = 0;
+	motion->timeouts = 0;
+}
+
+//where a track is drawn at render time t, or false if it is drawn at its store position
+INTERNAL inline
+bool sample_track(const MotionTrack* track, f64 t, f32* x, f32* y) {
+	const std::vector<MotionSample>& samples = track->samples;
+	if (samples.empty())
+		return false;
+	if (t <= samples.front().time || samples.size() == 1) {
+		*x = samples.front().x;
+		*y = samples.front().y;
+		return true;
+	}
+	u32 i = 1;
+	while (i < samples.size() - 1 && samples[i].time < t)
+		i++;
+	const MotionSample* a = &samples[i - 1];
+	const MotionSample* b = &samples[i];
+	f64 span = b->time - a->time;
+	f32 k = span > 0 ? (f32)std::min(1.0, (t - a->time) / span) : 1.0f;
+	*x = a->x + (b->x - a->x) * k;
+	*y = a->y + (b->y - a->y) * k;
+	return true;
+}
+
+//the position a token is drawn at this frame
+INTERNAL inline
+void motion_position(const Motion* motion, const TokenStore* tokens, u32 index, f64 now, f32* x, f32* y) {
+	*x = (f32)tokens->xPos[index];
+	*y = (f32)tokens->yPos[index];
+	if (motion->tracks.empty())
+		return;
+	std::map<TokenHandle, MotionTrack>::const_iterator it = motion->tracks.find(tokens->handles[index]);
+	if (it != motion->tracks.end())
+		sample_track(&it->second, now - motion->tunables.interpDelay, x, y);
+}
+
+//starts drawing the token from where it is drawn now towards (x, y), arriving duration from now
+INTERNAL inline
+void glide_token(Motion* motion, MotionTrack* track, f32 fromX, f32 fromY, i32 x, i32 y, f64 now, f64 duration) {
+	f64 t = now - motion->tunables.interpDelay;
+	track->samples.clear();
+	MotionSample from = { t, fromX, fromY };
+	MotionSample to = { t + duration, (f32)x, (f32)y };
+	track->samples.push_back(from);
+	track->samples.push_back(to);
+}
+
+//moves the token in the store and has it drawn gliding there
+INTERNAL inline
+void settle_token(Motion* motion, TokenStore* tokens, i32 ndx, MotionTrack* track, i32 x, i32 y, f64 now, f64 duration) {
+	if (tokens->xPos[ndx] == x && tokens->yPos[ndx] == y)
+		return;
+	f32 fromX, fromY;
+	motion_position(motion, tokens, ndx, now, &fromX, &fromY);
+	glide_token(motion, track, fromX, fromY, x, y, now, duration);
+	move_token(tokens, ndx, x, y);
+}
+
+INTERNAL inline
+void place_token(Motion* motion, TokenHandle handle) {
+	motion->tracks[handle].placing = true;
+}
+
+//the player dropped a token. returns the id to send with the move
+INTERNAL inline
+u32 predict_move(Motion* motion, TokenStore* tokens, TokenHandle handle, i32 x, i32 y, f64 now) {
+	i32 ndx = token_index(tokens, handle);
+	MotionTrack* track = &motion->tracks[handle];
+	if (track->pending.empty() && ndx != -1) {
+		track->serverX = tokens->xPos[ndx];
+		track->serverY = tokens->yPos[ndx];
+	}
+	PendingMove move = { motion->nextMoveId++, x, y, now };
+	track->pending.push_back(move);
+	if (motion->tunables.predict && ndx != -1) {
+		track->samples.clear();
+		move_token(tokens, ndx, x, y);
+	}
+	return move.id;
+}
+
+//a move from someone else, or one of ours replayed after a reconnect
+INTERNAL inline
+void server_move(Motion* motion, TokenStore* tokens, TokenHandle handle, i32 x, i32 y, f64 now) {
+	i32 ndx = token_index(tokens, handle);
+	if (ndx == -1)
+		return;
+	MotionTrack* track = &motion->tracks[handle];
+	track->serverX = x;
+	track->serverY = y;
+	if (!track->pending.empty())
+		return;
+	if (track->placing) {
+		track->placing = false;
+		track->samples.clear();
+		move_token(tokens, ndx, x, y);
+		return;
+	}
+
+	//still gliding, add to the buffer. at rest, start from where it is drawn
+	f64 t = now - motion->tunables.interpDelay;
+	if (track->samples.empty() || track->samples.back().time <= t) {
+		f32 fromX, fromY;
+		motion_position(motion, tokens, ndx, now, &fromX, &fromY);
+		track->samples.clear();
+		MotionSample from = { t, fromX, fromY };
+		track->samples.push_back(from);
+	}
+	MotionSample to = { now, (f32)x, (f32)y };
+	track->samples.push_back(to);
+	if (track->samples.size() > MOTION_MAX_SAMPLES)
+		track->samples.erase(track->samples.begin());
+	move_token(tokens, ndx, x, y);
+}
+
+INTERNAL inline
+void ack_move(Motion* motion, TokenStore* tokens, TokenHandle handle, u32 id, f64 now) {
+	std::map<TokenHandle, MotionTrack>::iterator it = motion->tracks.find(handle);
+	if (it == motion->tracks.end())
+		return;
+	MotionTrack* track = &it->second;
+	u32 acked = 0;
+	while (acked < track->pending.size() && track->pending[acked].id != id)
+		acked++;
+	if (acked == track->pending.size())
+		return;
+
+	//the server applied this move, the ones before it were either applied or dropped
+	PendingMove* move = &track->pending[acked];
+	track->serverX = move->x;
+	track->serverY = move->y;
+	motion->rtt = now - move->sent;
+	motion->acks++;
+	track->pending.erase(track->pending.begin(), track->pending.begin() + acked + 1);
+
+	i32 ndx = token_index(tokens, handle);
+	if (!track->pending.empty() || ndx == -1)
+		return;
+	bool wrong = tokens->xPos[ndx] != track->serverX || tokens->yPos[ndx] != track->serverY;
+	if (wrong && motion->tunables.predict)
+		motion->corrections++;
+	settle_token(motion, tokens, ndx, track, track->serverX, track->serverY, now, motion->tunables.correction);
+}
+
+//drops finished glides and gives up on moves the server never answered, once per frame
+INTERNAL inline
+void update_motion(Motion* motion, TokenStore* tokens, f64 now) {
+	f64 t = now - motion->tunables.interpDelay;
+	std::map<TokenHandle, MotionTrack>::iterator it = motion->tracks.begin();
+	while (it != motion->tracks.end()) {
+		MotionTrack* track = &it->second;
+		i32 ndx = token_index(tokens, it->first);
+
+		if (!track->pending.empty() && now - track->pending.front().sent > motion->tunables.ackTimeout) {
+			BMT_LOG(WARNING, "Move %d was never acknowledged, putting the token back", track->pending.front().id);
+			track->pending.clear();
+			motion->timeouts++;
+			if (ndx != -1)
+				settle_token(motion, tokens, ndx, track, track->serverX, track->serverY, now, motion->tunables.correction);
+		}
+
+		while (track->samples.size() >= 2 && track->samples[1].time <= t)
+			track->samples.erase(track->samples.begin());
+		if (track->samples.size() == 1 && track->samples[0].time <= t)
+			track->samples.clear();
+
+		if (ndx == -1 || (track->samples.empty() && track->pending.empty() && !track->placing))
+			motion->tracks.erase(it++);
+		else
+			++it;
+	}
+}
+
+//F3 shows the overlay, F4 and F5 change the interp delay, F6 turns prediction on and off
+INTERNAL inline
+void motion_input(Motion* motion) {
+	MotionTunables* tunables = &motion->tunables;
+	if (is_key_pressed(KEY_F3))
+		tunables->overlay = !tunables->overlay;
+	if (!tunables->overlay)
+		return;
+	if (is_key_pressed(KEY_F4))
+		tunables->interpDelay = std::max(0.0, tunables->interpDelay - 0.025);
+	if (is_key_pressed(KEY_F5))
+		tunables->interpDelay = std::min(0.5, tunables->interpDelay + 0.025);
+	if (is_key_pressed(KEY_F6))
+		tunables->predict = !tunables->predict;
+}
+
+//outlines where the server has the tokens that are predicted or gliding, in map space
+INTERNAL inline
+void draw_motion_ghosts(RenderBatch* batch, const Motion* motion, f32 mapX, f32 mapY) {
+	if (!motion->tunables.overlay)
+		return;
+	std::map<TokenHandle, MotionTrack>::const_iterator it;
+	for (it = motion->tracks.begin(); it != motion->tracks.end(); ++it) {
+		const MotionTrack* track = &it->second;
+		vec4 color = track->pending.empty() ? V4(40, 150, 40, 90) : V4(200, 120, 40, 90);
+		draw_rectangle(batch, mapX + track->serverX, mapY + track->serverY, TILESIZE, TILESIZE, color);
+	}
+}
+
+//the tunables and what they are doing, in screen space
+INTERNAL inline
+void draw_motion_overlay(RenderBatch* batch, const Motion* motion, f32 x, f32 y) {
+	if (!motion->tunables.overlay)
+		return;
+	u32 pending = 0;
+	std::map<TokenHandle, MotionTrack>::const_iterator it;
+	for (it = motion->tracks.begin(); it != motion->tracks.end(); ++it)
+		pending += it->second.pending.size();
+
+	const MotionTunables* tunables = &motion->tunables;
+	draw_rectangle(batch, x, y, 330, 150, V4(0, 0, 0, 160));
+	//format_text hands back one shared buffer, so each line is drawn before the next is made
+	draw_text(batch, &BODY_FONT, format_text("interp delay %d ms (F4/F5)", (i32)(tunables->interpDelay * 1000)), x + 8, y + 8, 255, 255, 255);
+	draw_text(batch, &BODY_FONT, format_text("prediction %s (F6)", tunables->predict ? "on" : "off"), x + 8, y + 32, 255, 255, 255);
+	draw_text(batch, &BODY_FONT, format_text("move rtt %d ms, %d acked", (i32)(motion->rtt * 1000), motion->acks), x + 8, y + 56, 255, 255, 255);
+	draw_text(batch, &BODY_FONT, format_text("%d moves in flight, %d tokens tracked", pending, (u32)motion->tracks.size()), x + 8, y + 80, 255, 255, 255);
+	draw_text(batch, &BODY_FONT, format_text("%d corrections, %d timeouts", motion->corrections, motion->timeouts), x + 8, y + 104, 255, 255, 255);
+}
+
+#endif
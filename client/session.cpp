@@ -0,0 +1,492 @@
+#include "session.h"
+#include <boost/bind.hpp>
+
+#define ROLL_LOG_SIZE 15
+#define CUE_MAX_WAIT  2000000 //us, a cue further off than this means the clocks are not worked out yet
+
+ClientSession::ClientSession() : service(), stage(STARTUP_CONNECTING), closed(false) {
+	connection.socket = new Socket(service);
+	connection.transport = NULL;
+	connection.lastSeq = 0;
+	connection.bytesRead = 0;
+	connection.lost = false;
+	connection.recorder = &recorder;
+	connection.rttUs = 0;
+	connection.jitterUs = 0;
+	connection.offsetUs = 0;
+	connection.synced = false;
+
+	state.map = { 0 };
+	state.map.selected = TOKEN_NONE;
+	state.map.width = state.map.height = 20;
+	state.map.bgColor = WHITE;
+	state.map.gridColor = GRAY;
+	init_motion(&state.motion);
+	state.isDM = false;
+}
+
+//the messages that belong to the connection rather than the table, handled on the io thread
+//as they arrive so a reconnect always resumes from the last sequence number received.
+//returns false for anything the polling thread should see
+INTERNAL
+bool handle_session_message(ClientSession* session, StringList* tokens) {
+	Connection* conn = &session->connection;
+	if (tokens->at(0) == "session") {
+		conn->ticket = tokens->at(1);
+		conn->lastSeq = std::stoull(tokens->at(3));
+		BMT_LOG(INFO, "Received session ticket, valid for %s seconds after a disconnect", tokens->at(2).c_str());
+	}
+	else if (tokens->at(0) == "seq") {
+		conn->lastSeq = std::stoull(tokens->at(1));
+	}
+	else if (tokens->at(0) == "ping") {
+		//answered from here so the server sees the link and not how busy the frame is.
+		//format: ping|stamp|rtt|jitter|offset, the last three once the server has worked them out
+		u64 read = clock_us();
+		if (tokens->size() >= 5) {
+			conn->rttUs = std::stoll(tokens->at(2));
+			conn->jitterUs = std::stoll(tokens->at(3));
+			conn->offsetUs = std::stoll(tokens->at(4));
+			conn->synced = true;
+		}
+		send_command(conn, "pong|" + tokens->at(1) + "|" + std::to_string(conn->bytesRead) + "|" + std::to_string(read) + "|" + std::to_string(clock_us()) + "\n");
+	}
+	else if (tokens->at(0) == "resume_success") {
+		//the missed broadcasts follow this message in the same packet
+		BMT_LOG(INFO, "Resumed session");
+		conn->lastSeq = std::stoull(tokens->at(1));
+	}
+	else if (tokens->at(0) == "resume_failure") {
+		BMT_LOG(WARNING, "Session could not be resumed, logging in again");
+		conn->ticket.clear();
+		send_command(conn, conn->loginCommand);
+	}
+	else if (tokens->at(0) == "login_failure") {
+		BMT_LOG(WARNING, "Failed to login. Account exists but the password is incorrect. Program will close.");
+		boost::this_thread::sleep(boost::posix_time::millisec(3000));
+		session->closed = true;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+INTERNAL
+void add_roll(ClientState* state, const std::string& str) {
+	state->rollLog.push_back(str);
+	if (state->rollLog.size() > ROLL_LOG_SIZE) {
+		state->rollLog.erase(state->rollLog.begin());
+	}
+}
+
+//polling thread only, called for each message drained from the ring
+INTERNAL
+void apply_message(ClientSession* session, StringList* tokens, f64 now, std::vector<ClientEvent>* events) {
+	ClientState* state = &session->state;
+	Map* map = &state->map;
+	if (tokens->at(0) == "name") {
+		BMT_LOG(INFO, "User '%s' has connected", tokens->at(1).c_str());
+		User user;
+		user.socket = NULL;
+		user.str = tokens->at(1);
+
+		state->users.push_back(user);
+	}
+	else if (tokens->at(0) == "login_success") {
+		BMT_LOG(INFO, "Successfully logged in!\n");
+		load_account(&state->account, tokens);
+		session->stage = STARTUP_READY;
+	}
+	else if (tokens->at(0) == "login_created") {
+		BMT_LOG(INFO, "Created a new account! Logging in...\n");
+		load_account(&state->account, tokens);
+		session->stage = STARTUP_READY;
+	}
+	else if (tokens->at(0) == "dm") {
+		BMT_LOG(INFO, "Logged in as the DM");
+		state->isDM = true;
+	}
+	else if (tokens->at(0) == "sheet") {
+		load_sheet(&state->account, tokens);
+	}
+	else if (tokens->at(0) == "sheet_summaries") {
+		read_sheet_summaries(&state->account, tokens, 1);
+	}
+	//format: roll_result|id|public|name|expression|totals|faces
+	if (tokens->at(0) == "roll_result" && tokens->size() >= 6) {
+		std::string str = tokens->at(3);
+		str.append(" rolled ");
+		str.append(tokens->at(4));
+		str.append(": ");
+		str.append(tokens->at(5));
+		if (tokens->at(2) == "0")
+			str.append(" (private)");
+		add_roll(state, str);
+		if (tokens->size() >= 7)
+			BMT_LOG(INFO, "Roll %s: %s", tokens->at(1).c_str(), tokens->at(6).c_str());
+	}
+	if (tokens->at(0) == "roll_error" && tokens->size() >= 2) {
+		add_roll(state, "Bad roll: " + tokens->at(1));
+	}
+	//format: play_music|track|start, start is on the server's clock
+	if (tokens->at(0) == "play_music" && tokens->size() >= 2) {
+		ClientEvent event = { EVENT_PLAY_MUSIC, std::atoi(tokens->at(1).c_str()), 0 };
+		Connection* conn = &session->connection;
+		if (tokens->size() >= 3 && conn->synced) {
+			i64 wait = (i64)std::stoull(tokens->at(2)) + conn->offsetUs - (i64)clock_us();
+			event.at = now + std::min(std::max(wait, (i64)0), (i64)CUE_MAX_WAIT) / 1000000.0;
+		}
+		events->push_back(event);
+	}
+	if (tokens->at(0) == "menacing") {
+		ClientEvent event = { EVENT_MENACING, 0, 0 };
+		events->push_back(event);
+	}
+	if (tokens->at(0) == "roundabout") {
+		ClientEvent event = { EVENT_ROUNDABOUT, 0, 0 };
+		events->push_back(event);
+	}
+	if (tokens->at(0) == "move") {
+		server_move(&state->motion, &map->tokens, parse_handle(tokens->at(1)), std::atoi( tokens->at(2).c_str() ), std::atoi( tokens->at(3).c_str() ), now);
+	}
+	//format: move_ack|handle|id, in place of our own move
+	if (tokens->at(0) == "move_ack" && tokens->size() >= 3) {
+		ack_move(&state->motion, &map->tokens, parse_handle(tokens->at(1)), (u32)std::strtoul(tokens->at(2).c_str(), NULL, 10), now);
+	}
+	if (tokens->at(0) == "update_token") {
+		//the server sends a token's whole state the first time we hear of its handle
+		TokenHandle handle = parse_handle(tokens->at(1));
+		if (token_index(&map->tokens, handle) == -1)
+			place_token(&state->motion, handle);
+		i32 ndx = insert_token(&map->tokens, handle);
+		if (ndx != -1) {
+			for (u32 i = 0; i < TOKEN_BARS; ++i) {
+				map->tokens.bars[i][ndx].current = std::stoi(tokens->at(2 + i * 2));
+				map->tokens.bars[i][ndx].max = std::stoi(tokens->at(3 + i * 2));
+			}
+			map->tokens.names[ndx] = tokens->at(8);
+			map->tokens.imgindex[ndx] = std::stoi(tokens->at(9));
+		}
+	}
+	if (tokens->at(0) == "delete_token") {
+		remove_token(&map->tokens, parse_handle(tokens->at(1)));
+	}
+	if (tokens->at(0) == "update_map") {
+		state->motion.tracks.clear();
+		clear_tokens(&map->tokens);
+		map->rects.clear();
+		*map = { 0 };
+
+		map->width = std::stoi(tokens->at(1));
+		map->height = std::stoi(tokens->at(2));
+		map->xPos = std::stoi(tokens->at(3));
+		map->yPos = std::stoi(tokens->at(4));
+		map->grid = std::stoi(tokens->at(5));
+		map->fow = std::stoi(tokens->at(6));
+		map->bgColor = { std::stof(tokens->at(10)), std::stof(tokens->at(9)), std::stof(tokens->at(8)), std::stof(tokens->at(7)) };
+		map->gridColor = { std::stof(tokens->at(14)), std::stof(tokens->at(13)), std::stof(tokens->at(12)), std::stof(tokens->at(11)) };
+		//todo: fix colors
+		map->bgColor = WHITE;
+		map->gridColor = GRAY;
+		map->selected = TOKEN_NONE;
+		resize_bits(&map->walls, map->width, map->height);
+		resize_bits(&map->explored, map->width, map->height);
+		resize_bits(&map->visible, map->width, map->height);
+	}
+	//format: walls|width|height|runs, fog_state|width|height|explored runs|visible runs
+	if (tokens->at(0) == "walls" && tokens->size() >= 4) {
+		resize_bits(&map->walls, std::stoi(tokens->at(1)), std::stoi(tokens->at(2)));
+		if (!read_bit_runs(&map->walls, tokens->at(3)))
+			BMT_LOG(WARNING, "Bad wall runs from the server");
+	}
+	if (tokens->at(0) == "set_wall" && tokens->size() >= 4) {
+		i32 x = std::stoi(tokens->at(1));
+		i32 y = std::stoi(tokens->at(2));
+		if (x >= 0 && y >= 0 && x < (i32)map->walls.width && y < (i32)map->walls.height)
+			set_bit(&map->walls, y * map->walls.width + x, std::stoi(tokens->at(3)) != 0);
+	}
+	if (tokens->at(0) == "fog_state" && tokens->size() >= 5) {
+		resize_bits(&map->explored, std::stoi(tokens->at(1)), std::stoi(tokens->at(2)));
+		resize_bits(&map->visible, map->explored.width, map->explored.height);
+		if (!read_bit_runs(&map->explored, tokens->at(3)) || !read_bit_runs(&map->visible, tokens->at(4)))
+			BMT_LOG(WARNING, "Bad fog runs from the server");
+	}
+	//only the visible tiles that changed, anything that is visible has been explored
+	if (tokens->at(0) == "fog" && tokens->size() >= 2) {
+		if (apply_bit_changes(&map->visible, tokens->at(1)) && map->explored.words.size() == map->visible.words.size()) {
+			for (u32 i = 0; i < map->visible.words.size(); ++i)
+				map->explored.words[i] |= map->visible.words[i];
+		}
+	}
+	if (tokens->at(0) == "set_layer") {
+		TokenHandle handle = parse_handle(tokens->at(1));
+		u8 layer = std::stoi(tokens->at(2));
+		//players are told about a token again if it is revealed
+		if (layer == LAYER_GM && !state->isDM)
+			remove_token(&map->tokens, handle);
+		else if (token_index(&map->tokens, handle) != -1)
+			map->tokens.layer[token_index(&map->tokens, handle)] = layer;
+	}
+}
+
+INTERNAL void start_read(ClientSession* session);
+
+//hands a message to the polling thread. if it has fallen a whole ring behind, waits for it
+//rather than drop the message. returns false, and frees tokens, if the session closes first
+INTERNAL
+bool push_message(ClientSession* session, StringList* tokens) {
+	while (!session->connection.messages.push(tokens)) {
+		if (session->closed) {
+			delete tokens;
+			return false;
+		}
+		boost::this_thread::sleep(boost::posix_time::millisec(1));
+	}
+	return true;
+}
+
+//decodes whole lines, however they came in. false once the session is closed
+INTERNAL
+bool handle_lines(ClientSession* session, const std::string& msg) {
+	Connection* conn = &session->connection;
+	BMT_LOG(DEBUG, "Received response from server: %s", msg.c_str());
+
+	StringList commands = split_string(msg, '\n');
+	for (u16 i = 0; i < commands.size(); ++i) {
+		record_entry(conn->recorder, RECORD_IN, conn, commands[i]);
+		StringList* tokens = new StringList(split_string(commands[i], '|'));
+		if (tokens->size() == 0 || handle_session_message(session, tokens)) {
+			delete tokens;
+			continue;
+		}
+		if (!push_message(session, tokens))
+			return false;
+	}
+	return true;
+}
+
+//runs on the io thread as soon as at least one whole line has come in
+INTERNAL
+void handle_read(ClientSession* session, const boost::system::error_code& error, std::size_t) {
+	Connection* conn = &session->connection;
+	if (session->closed) return;
+
+	if (error) {
+		BMT_LOG(WARNING, "Lost connection to server: %s", error.message().c_str());
+		conn->lost = true;
+	}
+	if (conn->lost) {
+		if (!reconnect(conn)) {
+			BMT_LOG(WARNING, "Could not reconnect to server. Program will close.");
+			session->closed = true;
+			return;
+		}
+		//whatever is left is half a line from the old socket
+		conn->inbox.consume(conn->inbox.size());
+		start_read(session);
+		return;
+	}
+
+	//handle every complete line in the buffer, the last one may still be arriving
+	std::string msg(buffers_begin(conn->inbox.data()), buffers_end(conn->inbox.data()));
+	size_t end = msg.rfind('\n');
+	conn->inbox.consume(end + 1);
+	conn->bytesRead += end + 1;
+	msg.resize(end);
+	if (handle_lines(session, msg))
+		start_read(session);
+}
+
+//the login goes out as soon as the socket is open
+INTERNAL
+void handle_connect(ClientSession* session, const boost::system::error_code& error) {
+	Connection* conn = &session->connection;
+	if (error) {
+		BMT_LOG(WARNING, "Could not connect to server: %s. Program will close.", error.message().c_str());
+		session->closed = true;
+		return;
+	}
+	BMT_LOG(INFO, "Connected to server");
+	session->stage = STARTUP_AUTHENTICATING;
+	send_command(conn, conn->loginCommand);
+	start_read(session);
+}
+
+INTERNAL
+void start_read(ClientSession* session) {
+	Connection* conn = &session->connection;
+	boost::asio::async_read_until(*conn->socket, conn->inbox, '\n', boost::bind(handle_read, session, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+//the session's io thread, messages are decoded the moment they arrive instead of on a poll.
+//returns when close_session stops the service or the server cannot be reached again
+INTERNAL
+void receive_loop(ClientSession* session) {
+	Connection* conn = &session->connection;
+	conn->socket->async_connect(conn->endpoint, boost::bind(handle_connect, session, boost::asio::placeholders::error));
+	session->service.run();
+	BMT_LOG(INFO, "Closed receive_loop");
+}
+
+//the session's io thread when the server is in this process. there is nothing to reconnect
+//to, the connection only ends with close_session or the server
+INTERNAL
+void local_loop(ClientSession* session) {
+	Connection* conn = &session->connection;
+	session->stage = STARTUP_AUTHENTICATING;
+	send_command(conn, conn->loginCommand);
+
+	char buffer[BUFFER_SIZE];
+	std::string inbox;
+	for (;;) {
+		u32 read = transport_read(conn->transport, buffer, sizeof(buffer));
+		if (session->closed)
+			break;
+		if (read == 0) {
+			BMT_LOG(WARNING, "The server has closed the connection. Program will close.");
+			session->closed = true;
+			break;
+		}
+		inbox.append(buffer, read);
+		size_t end = inbox.rfind('\n');
+		if (end == std::string::npos)
+			continue;
+		conn->bytesRead += end + 1;
+		std::string msg = inbox.substr(0, end);
+		inbox.erase(0, end + 1);
+		if (!handle_lines(session, msg))
+			break;
+	}
+	BMT_LOG(INFO, "Closed local_loop");
+}
+
+//the session's io thread when replaying, what the server sent in the recording stands in for the socket
+INTERNAL
+void replay_loop(ClientSession* session, std::string path, bool realtime) {
+	Playback playback;
+	if (!open_playback(&playback, path)) {
+		session->closed = true;
+		return;
+	}
+	session->stage = STARTUP_AUTHENTICATING;
+	u64 start = recording_clock();
+	u64 messages = 0;
+	RecordedEntry entry;
+	while (!session->closed && next_entry(&playback, &entry)) {
+		if (entry.kind != RECORD_IN)
+			continue;
+		if (realtime)
+			wait_for_entry(&entry, start);
+		StringList* tokens = new StringList(split_string(entry.data, '|'));
+		//there is no server to answer
+		if (tokens->size() == 0 || tokens->at(0) == "ping" || tokens->at(0) == "resume_failure" || handle_session_message(session, tokens)) {
+			delete tokens;
+			continue;
+		}
+		if (!push_message(session, tokens))
+			break;
+		messages++;
+	}
+	close_playback(&playback);
+	BMT_LOG(INFO, "Replayed %llu messages in %.3f s", (unsigned long long)messages, (recording_clock() - start) / 1000000.0);
+}
+
+bool record_session(ClientSession* session, const std::string& path) {
+	if (!start_recording(&session->recorder, path))
+		return false;
+	record_entry(&session->recorder, RECORD_OPEN, &session->connection, "");
+	return true;
+}
+
+void replay_session(ClientSession* session, const std::string& path, bool realtime) {
+	session->ioThread = boost::thread(boost::bind(replay_loop, session, path, realtime));
+}
+
+INTERNAL
+void set_login(ClientSession* session, const std::string& name, const std::string& passHash, const std::string& room) {
+	Connection* conn = &session->connection;
+	conn->loginCommand = "name|" + name + "|pass|" + passHash + "|" + room + "\n";
+	session->state.account.name = name;
+	session->state.account.pass = passHash;
+
+	User user;
+	user.str = name;
+	user.socket = conn->socket;
+	session->state.users.push_back(user);
+}
+
+void connect_session(ClientSession* session, const std::string& host, u16 port, const std::string& name, const std::string& passHash, const std::string& room) {
+	session->connection.endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(host), port);
+	set_login(session, name, passHash, room);
+	session->ioThread = boost::thread(boost::bind(receive_loop, session));
+}
+
+void connect_local_session(ClientSession* session, Transport* transport, const std::string& name, const std::string& passHash, const std::string& room) {
+	session->connection.transport = transport;
+	set_login(session, name, passHash, room);
+	session->ioThread = boost::thread(boost::bind(local_loop, session));
+}
+
+void send_command(ClientSession* session, const std::string& command) {
+	send_command(&session->connection, command);
+}
+
+void poll_session(ClientSession* session, f64 now, std::vector<ClientEvent>* events) {
+	StringList* tokens = NULL;
+	while (session->connection.messages.pop(tokens)) {
+		apply_message(session, tokens, now, events);
+		delete tokens;
+	}
+}
+
+void close_session(ClientSession* session) {
+	Connection* conn = &session->connection;
+	session->closed = true;
+	session->service.stop();
+	//wakes a local session's read, the server lets go of a closed connection on its own
+	if (conn->transport != NULL)
+		close_transport(conn->transport);
+	//a replay can be asleep until its next message is due
+	session->ioThread.interrupt();
+	session->ioThread.join();
+
+	StringList* leftover = NULL;
+	while (conn->messages.pop(leftover))
+		delete leftover;
+	if (conn->transport != NULL) {
+		free_transport(conn->transport);
+		conn->transport = NULL;
+	}
+	else {
+		//the server may already be gone
+		boost::system::error_code ignored;
+		conn->socket->write_some(boost::asio::buffer("exit\n", 4), ignored);
+		conn->socket->close(ignored);
+	}
+	record_entry(&session->recorder, RECORD_CLOSE, &session->connection, "");
+	stop_recording(&session->recorder);
+}
+
+void request_sheet(ClientSession* session, u32 id) {
+	if (session->state.account.sheetCache.count(id) != 0)
+		return;
+	send_command(session, format_text("get_sheet|%d\n", id));
+}
+
+void save_sheet(ClientSession* session, CharSheet* sheet) {
+	Account* account = &session->state.account;
+	if (sheet->id < account->sheets.size()) {
+		account->sheets[sheet->id].name = sheet->usersheet.name;
+		account->sheets[sheet->id].standName = sheet->standsheet.name;
+		account->sheets[sheet->id].currentHealth = sheet->usersheet.currentHealth;
+		account->sheets[sheet->id].totalHealth = sheet->usersheet.totalHealth;
+	}
+
+	std::string command = "update_sheet|";
+	command.append(std::to_string(sheet->id));
+	command.append("|");
+	append_sheet_fields(&command, sheet);
+	command.append("\n");
+	send_command(session, command);
+}
@@ -0,0 +1,82 @@
+#ifndef CLIENT_SESSION_H
+#define CLIENT_SESSION_H
+
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include "../DnDShared/globals.h"
+#include "connection.h"
+#include "accounts.h"
+#include "map.h"
+#include "motion.h"
+
+typedef ClientMessage User;
+
+enum StartupStage {
+	STARTUP_CONNECTING,
+	STARTUP_AUTHENTICATING, //login sent, waiting for login_success or login_created
+	STARTUP_READY
+};
+
+//what the server asked for that is not table state, for the front end to show or play
+enum ClientEventType {
+	EVENT_PLAY_MUSIC, //value is the track
+	EVENT_MENACING,
+	EVENT_ROUNDABOUT
+};
+
+struct ClientEvent {
+	ClientEventType type;
+	i32 value;
+	f64 at; //on the clock poll_session was given, when to do it. 0 is at once
+};
+
+//Everything the server has told the session about its table. Only poll_session changes it
+//(and the front end, for things like scrolling the map and moving its own tokens), so the
+//thread that polls can read it between polls without a lock.
+struct ClientState {
+	Account account;
+	Map map;
+	Motion motion;
+	StringList rollLog;
+	std::vector<User> users;
+	bool isDM; //set by the server when this account runs the table
+};
+
+//One player's connection to a table, with no window. The io thread connects, logs in and
+//decodes messages as they arrive; the owner calls poll_session to apply them to the state.
+//The GLFW client is one front end, bots and load tests can drive it the same way.
+struct ClientSession {
+	ClientSession();
+	boost::asio::io_service service;
+	Connection connection;
+	boost::thread ioThread;
+	volatile StartupStage stage;
+	volatile bool closed; //login failed, the server could not be reached again, or close_session
+	ClientState state;
+	Recorder recorder;
+};
+
+//opens the connection on the session's io thread and sends the login once it is up.
+//host is a dotted address
+void connect_session(ClientSession* session, const std::string& host, u16 port, const std::string& name, const std::string& passHash, const std::string& room);
+//logs in over a transport to a server in this process, see connect_local. the session owns
+//the transport from here on and frees it in close_session
+void connect_local_session(ClientSession* session, Transport* transport, const std::string& name, const std::string& passHash, const std::string& room);
+//writes every message to and from the server to path, call before connect_session
+bool record_session(ClientSession* session, const std::string& path);
+//plays the server's side of a recording made with record_session into the session instead of
+//connecting, as fast as the session is polled or at the recorded pace
+void replay_session(ClientSession* session, const std::string& path, bool realtime);
+void send_command(ClientSession* session, const std::string& command);
+//applies every message that has arrived since the last call to the state and appends the
+//ones for the front end to events. now is on the clock the caller draws motion with
+void poll_session(ClientSession* session, f64 now, std::vector<ClientEvent>* events);
+//stops the io thread and tells the server we are leaving
+void close_session(ClientSession* session);
+
+//asks the server for a sheet unless we already have it, the answer fills the sheet cache
+void request_sheet(ClientSession* session, u32 id);
+void save_sheet(ClientSession* session, CharSheet* sheet);
+
+#endif
@@ -1,6 +1,31 @@
 #include "accounts.h"
 #include <fstream>
-#define ACCOUNTS_DIR "data/accounts.txt"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#define DEFAULT_SHEET \
+	/* Stand Char Sheet */ \
+	"enter a name|stand type|stand ability description|0|0|0|0|0|0|" \
+	/* User Char Sheet  */ \
+	"enter a name|player name|gender|weight|height|bloodType|occupation|nationality|backstory|inventory|0|0|0|0|0|0|0|0"
+
+#define MAX_NAME_LENGTH 0xFFFF
+
+INTERNAL AccountStore store;
+
+//which sheet fields (in accounts file order) are text, everything else is a number
+INTERNAL const bool SHEET_FIELD_IS_TEXT[SHEET_FIELD_COUNT] = {
+	true, true, true, false, false, false, false, false, false,
+	true, true, true, true, true, true, true, true, true, true,
+	false, false, false, false, false, false, false, false
+};
+
+//slots of the fields a summary needs
+#define TEXT_STAND_NAME      0
+#define TEXT_USER_NAME       3
+#define VALUE_TOTAL_HEALTH   10
+#define VALUE_CURRENT_HEALTH 11
 
 INTERNAL
 void append_value(std::string* str, std::string toApp) {
@@ -8,168 +33,555 @@ void append_value(std::string* str, std::string toApp) {
 	str->append("|");
 }
 
+bool parse_sheet_value(const std::string& str, i32* out) {
+	const char* start = str.c_str();
+	char* end;
+	errno = 0;
+	long value = strtol(start, &end, 10);
+	if (end == start || *end != '\0' || errno == ERANGE || value < INT_MIN || value > INT_MAX)
+		return false;
+	*out = (i32)value;
+	return true;
+}
+
+//a stat that is not a number, in the accounts file or an old client's sheet, reads as 0
+INTERNAL
+i32 sheet_value(const std::string& str) {
+	i32 value;
+	return parse_sheet_value(str, &value) ? value : 0;
+}
+
+INTERNAL inline
+u32 sheet_offset(u32 id) {
+	return id * SHEET_FIELD_COUNT;
+}
+
+INTERNAL inline
+u32 sheet_count(StringList* tokens) {
+	return tokens->size() < 2 ? 0 : (u32)(tokens->size() - 2) / SHEET_FIELD_COUNT;
+}
+
+//first is the index of the sheet's first field in tokens
+INTERNAL
+void compact_sheet(CompactSheet* sheet, StringList* tokens, u32 first) {
+	u32 text = 0;
+	u32 value = 0;
+	for (u32 i = 0; i < SHEET_FIELD_COUNT; ++i) {
+		if (SHEET_FIELD_IS_TEXT[i])
+			sheet->text[text++] = make_sheet_string(&store.pool, tokens->at(first + i));
+		else
+			sheet->values[value++] = sheet_value(tokens->at(first + i));
+	}
+	sheet->next = ACCOUNT_NONE;
+}
+
+INTERNAL
+void release_sheet(CompactSheet* sheet) {
+	for (u32 i = 0; i < SHEET_TEXT_COUNT; ++i)
+		release_sheet_string(&store.pool, &sheet->text[i]);
+}
+
+INTERNAL
+void append_compact_sheet(std::string* str, CompactSheet* sheet) {
+	u32 text = 0;
+	u32 value = 0;
+	for (u32 i = 0; i < SHEET_FIELD_COUNT; ++i) {
+		if (i != 0) str->append("|");
+		if (SHEET_FIELD_IS_TEXT[i])
+			str->append(get_sheet_string(&store.pool, &sheet->text[text++]));
+		else
+			str->append(std::to_string(sheet->values[value++]));
+	}
+}
+
+INTERNAL
+void read_sheet_summary(SheetSummary* summary, CompactSheet* sheet, u32 id) {
+	summary->id = id;
+	summary->standName = get_sheet_string(&store.pool, &sheet->text[TEXT_STAND_NAME]);
+	summary->name = get_sheet_string(&store.pool, &sheet->text[TEXT_USER_NAME]);
+	summary->totalHealth = sheet->values[VALUE_TOTAL_HEALTH];
+	summary->currentHealth = sheet->values[VALUE_CURRENT_HEALTH];
+}
+
 INTERNAL inline
-StringList read_file() {
-	StringList strings;
+u32 hash_name(const char* name, u32 length) {
+	return (u32)boost::hash_range(name, name + length);
+}
+
+INTERNAL inline
+bool name_equals(StoredAccount* account, const std::string& username) {
+	return account->nameLength == username.size() && memcmp(&store.names[account->nameOffset], username.data(), username.size()) == 0;
+}
+
+INTERNAL
+u32 find_account_index(const std::string& username) {
+	if (store.index.size() == 0)
+		return ACCOUNT_NONE;
+	u32 mask = store.index.size() - 1;
+	for (u32 slot = hash_name(username.data(), username.size()) & mask; store.index[slot] != ACCOUNT_NONE; slot = (slot + 1) & mask) {
+		if (name_equals(&store.accounts[store.index[slot]], username))
+			return store.index[slot];
+	}
+	return ACCOUNT_NONE;
+}
+
+INTERNAL
+StoredAccount* find_account(const std::string& username) {
+	u32 index = find_account_index(username);
+	return index == ACCOUNT_NONE ? NULL : &store.accounts[index];
+}
+
+INTERNAL
+void insert_index(u32 accountIndex) {
+	StoredAccount* account = &store.accounts[accountIndex];
+	u32 mask = store.index.size() - 1;
+	u32 slot = hash_name(&store.names[account->nameOffset], account->nameLength) & mask;
+	while (store.index[slot] != ACCOUNT_NONE)
+		slot = (slot + 1) & mask;
+	store.index[slot] = accountIndex;
+}
+
+//keeps the table at most half full so probes stay short
+INTERNAL
+void grow_index(u32 count) {
+	if (count * 2 <= store.index.size())
+		return;
+	u32 capacity = 64;
+	while (capacity < count * 2)
+		capacity *= 2;
+	store.index.assign(capacity, ACCOUNT_NONE);
+	for (u32 i = 0; i < store.accounts.size(); ++i)
+		insert_index(i);
+}
+
+//returns the id-th sheet of an account
+INTERNAL
+CompactSheet* get_sheet(StoredAccount* account, u32 id) {
+	u32 sheet = account->firstSheet;
+	for (u32 i = 0; i < id && sheet != ACCOUNT_NONE; ++i)
+		sheet = store.sheets[sheet].next;
+	return sheet == ACCOUNT_NONE ? NULL : &store.sheets[sheet];
+}
+
+INTERNAL
+void add_sheet(StoredAccount* account, CompactSheet* sheet) {
+	u32 index = store.sheets.size();
+	store.sheets.push_back(*sheet);
+	if (account->sheetCount == 0)
+		account->firstSheet = index;
+	else
+		get_sheet(account, account->sheetCount - 1)->next = index;
+	account->sheetCount++;
+}
+
+INTERNAL
+std::string get_name(StoredAccount* account) {
+	return std::string(&store.names[account->nameOffset], account->nameLength);
+}
+
+INTERNAL
+std::string get_pass(StoredAccount* account) {
+	return std::string(&store.names[account->nameOffset + account->nameLength], account->passLength);
+}
+
+//tokens is a full accounts file line
+INTERNAL
+StoredAccount* add_account(StringList* tokens) {
+	StoredAccount account = { 0 };
+	account.nameOffset = store.names.size();
+	account.nameLength = (u16)tokens->at(0).size();
+	account.passLength = (u16)tokens->at(1).size();
+	account.firstSheet = ACCOUNT_NONE;
+	store.names.insert(store.names.end(), tokens->at(0).begin(), tokens->at(0).end());
+	store.names.insert(store.names.end(), tokens->at(1).begin(), tokens->at(1).end());
+
+	u32 index = store.accounts.size();
+	store.accounts.push_back(account);
+	grow_index(store.accounts.size());
+	insert_index(index);
+
+	StoredAccount* result = &store.accounts[index];
+	u32 count = sheet_count(tokens);
+	for (u32 i = 0; i < count; ++i) {
+		CompactSheet sheet;
+		compact_sheet(&sheet, tokens, 2 + sheet_offset(i));
+		add_sheet(result, &sheet);
+	}
+	return result;
+}
+
+INTERNAL
+void append_account_line(std::string* str, StoredAccount* account) {
+	append_value(str, get_name(account));
+	str->append(get_pass(account));
+	for (u32 sheet = account->firstSheet; sheet != ACCOUNT_NONE; sheet = store.sheets[sheet].next) {
+		str->append("|");
+		append_compact_sheet(str, &store.sheets[sheet]);
+	}
+}
+
+//every account line, the accounts file as it would be written now
+INTERNAL
+void append_accounts_no_lock(std::string* str) {
+	for (u32 i = 0; i < store.accounts.size(); ++i) {
+		append_account_line(str, &store.accounts[i]);
+		str->append("\n");
+	}
+}
+
+INTERNAL
+std::string log_path() {
+	return store.path + ACCOUNTS_LOG_SUFFIX;
+}
+
+INTERNAL
+bool append_file(const std::string& path, const std::string& text) {
+	std::ofstream outfile;
+	outfile.open(path.c_str(), std::ios_base::binary | std::ios_base::app);
+	if (!outfile.is_open()) {
+		BMT_LOG(WARNING, "Could not open %s for writing", path.c_str());
+		return false;
+	}
+	outfile.write(text.data(), text.size());
+	outfile.close();
+	return !outfile.fail();
+}
+
+//replaces the accounts file with text and empties the update log, which text already holds.
+//the caller holds store.fileMutex but not store.mutex
+INTERNAL
+bool write_accounts_file(const std::string& text) {
+	//write everything to a temporary file first so a crash never leaves a half written accounts file
+	std::string temp = store.path + ".tmp";
+	std::ofstream outfile;
+	outfile.open(temp.c_str(), std::ios_base::binary | std::ios_base::trunc);
+	if (!outfile.is_open()) {
+		BMT_LOG(WARNING, "Could not open %s for writing", temp.c_str());
+		return false;
+	}
+	outfile.write(text.data(), text.size());
+	outfile.close();
+	if (outfile.fail()) {
+		BMT_LOG(WARNING, "Failed to write %s", temp.c_str());
+		return false;
+	}
+
+	if (!replace_file(temp.c_str(), store.path.c_str())) {
+		BMT_LOG(WARNING, "Could not replace %s", store.path.c_str());
+		return false;
+	}
+	//a crash before this replays the log over a file that already has it, which changes nothing
+	remove(log_path().c_str());
+	return true;
+}
+
+//stores a sheet as the account's id-th, one past the last sheet adds a new one
+INTERNAL
+void set_sheet(StoredAccount* account, u32 id, CompactSheet* compact) {
+	if (id == account->sheetCount) {
+		add_sheet(account, compact);
+		return;
+	}
+	CompactSheet* current = get_sheet(account, id);
+	compact->next = current->next;
+	release_sheet(current);
+	*current = *compact;
+}
+
+//applies the sheet updates written since the accounts file was last rewritten.
+//a log line is name|sheet id|sheet fields
+INTERNAL
+void replay_accounts_log() {
+	std::ifstream infile;
+	infile.open(log_path().c_str());
+	if (!infile.is_open())
+		return;
+
 	std::string line;
+	while (getline(infile, line)) {
+		StringList tokens = split_string(line, '|');
+		i32 id;
+		//a crash can cut the last line short
+		if (tokens.size() < 2 + SHEET_FIELD_COUNT || !parse_sheet_value(tokens[1], &id)) continue;
+		StoredAccount* account = find_account(tokens[0]);
+		if (account == NULL || id < 0 || (u32)id > account->sheetCount || id >= MAX_SHEETS) continue;
+
+		CompactSheet compact;
+		compact_sheet(&compact, &tokens, 2);
+		set_sheet(account, (u32)id, &compact);
+		store.logEntries++;
+	}
+	infile.close();
+	BMT_LOG(INFO, "Replayed %d sheet updates from %s", store.logEntries, log_path().c_str());
+}
+
+INTERNAL
+u64 account_store_memory_no_lock() {
+	u64 bytes = sizeof(AccountStore) + string_pool_memory(&store.pool);
+	bytes += store.names.capacity();
+	bytes += store.accounts.capacity() * sizeof(StoredAccount);
+	bytes += store.sheets.capacity() * sizeof(CompactSheet);
+	bytes += store.index.capacity() * sizeof(u32);
+	return bytes;
+}
+
+bool load_accounts(const char* path) {
+	boost::mutex::scoped_lock lock(store.mutex);
+	store.path = path;
+	store.pool = StringPool();
+	store.names.clear();
+	store.accounts.clear();
+	store.sheets.clear();
+	store.index.clear();
+	store.logEntries = 0;
+
 	std::ifstream infile;
-	infile.open(ACCOUNTS_DIR);
-	if (infile.is_open()) {
-		while (!infile.eof()) {
-			getline(infile, line);
-			strings.push_back(line);
+	infile.open(path);
+	if (!infile.is_open()) {
+		BMT_LOG(INFO, "No accounts file at %s, starting with no accounts", path);
+		return false;
+	}
+
+	std::string line;
+	while (getline(infile, line)) {
+		StringList tokens = split_string(line, '|');
+		if (tokens.size() < 2 || tokens[0].size() > MAX_NAME_LENGTH || tokens[1].size() > MAX_NAME_LENGTH) continue;
+		if (find_account(tokens[0]) != NULL) {
+			BMT_LOG(WARNING, "Skipping duplicate account [%s]", tokens[0].c_str());
+			continue;
 		}
+		add_account(&tokens);
 	}
 	infile.close();
-	return strings;
+	replay_accounts_log();
+	store.names.shrink_to_fit();
+	store.accounts.shrink_to_fit();
+	store.sheets.shrink_to_fit();
+
+	BMT_LOG(INFO, "Loaded %d accounts (%d KB)", (u32)store.accounts.size(), (u32)(account_store_memory_no_lock() / 1024));
+	return true;
 }
 
-void write_account_data(Account* acc) {
-	StringList lines = read_file();
-	for (i32 i = 0; i < lines.size(); ++i) {
-		StringList tokens = split_string(lines[i], '|');
-		if (tokens.size() == 0)
-			continue;
+bool save_accounts() {
+	boost::mutex::scoped_lock lock(store.mutex);
+	std::string text;
+	append_accounts_no_lock(&text);
+	store.logEntries = 0;
+	boost::mutex::scoped_lock fileLock(store.fileMutex);
+	lock.unlock();
+	return write_accounts_file(text);
+}
 
-		if (tokens[0] == acc->name) {
-			std::string* curr = &lines[i];
-			curr->clear();
-			append_value(curr, acc->name);
-			append_value(curr, acc->pass);
-
-			append_value(curr, acc->standsheet.name);
-			append_value(curr, acc->standsheet.standTypes);
-			append_value(curr, acc->standsheet.standAbilityDesc);
-			append_value(curr, std::to_string(acc->standsheet.speed));
-			append_value(curr, std::to_string(acc->standsheet.power));
-			append_value(curr, std::to_string(acc->standsheet.range));
-			append_value(curr, std::to_string(acc->standsheet.precision));
-			append_value(curr, std::to_string(acc->standsheet.durability));
-			append_value(curr, std::to_string(acc->standsheet.learning));
-
-			append_value(curr, acc->usersheet.name);
-			append_value(curr, acc->usersheet.playername);
-			append_value(curr, acc->usersheet.gender);
-			append_value(curr, acc->usersheet.weight);
-			append_value(curr, acc->usersheet.height);
-			append_value(curr, acc->usersheet.bloodType);
-			append_value(curr, acc->usersheet.occupation);
-			append_value(curr, acc->usersheet.nationality);
-			append_value(curr, acc->usersheet.backstory);
-			append_value(curr, acc->usersheet.inventory);
-			append_value(curr, std::to_string(acc->usersheet.brains));
-			append_value(curr, std::to_string(acc->usersheet.brawns));
-			append_value(curr, std::to_string(acc->usersheet.bravery));
-			append_value(curr, std::to_string(acc->usersheet.age));
-			append_value(curr, std::to_string(acc->usersheet.totalHealth));
-			append_value(curr, std::to_string(acc->usersheet.currentHealth));
-			append_value(curr, std::to_string(acc->usersheet.resolveDamage));
-			append_value(curr, std::to_string(acc->usersheet.bizarrePoints));
-			break;
-		}
+bool account_exists(const std::string& username) {
+	boost::mutex::scoped_lock lock(store.mutex);
+	return find_account(username) != NULL;
+}
+
+u32 account_count() {
+	boost::mutex::scoped_lock lock(store.mutex);
+	return store.accounts.size();
+}
+
+u64 account_store_memory() {
+	boost::mutex::scoped_lock lock(store.mutex);
+	return account_store_memory_no_lock();
+}
+
+void append_sheet_fields(std::string* str, CharSheet* sheet) {
+	append_value(str, sheet->standsheet.name);
+	append_value(str, sheet->standsheet.standTypes);
+	append_value(str, sheet->standsheet.standAbilityDesc);
+	append_value(str, std::to_string(sheet->standsheet.speed));
+	append_value(str, std::to_string(sheet->standsheet.power));
+	append_value(str, std::to_string(sheet->standsheet.range));
+	append_value(str, std::to_string(sheet->standsheet.precision));
+	append_value(str, std::to_string(sheet->standsheet.durability));
+	append_value(str, std::to_string(sheet->standsheet.learning));
+
+	append_value(str, sheet->usersheet.name);
+	append_value(str, sheet->usersheet.playername);
+	append_value(str, sheet->usersheet.gender);
+	append_value(str, sheet->usersheet.weight);
+	append_value(str, sheet->usersheet.height);
+	append_value(str, sheet->usersheet.bloodType);
+	append_value(str, sheet->usersheet.occupation);
+	append_value(str, sheet->usersheet.nationality);
+	append_value(str, sheet->usersheet.backstory);
+	append_value(str, sheet->usersheet.inventory);
+	append_value(str, std::to_string(sheet->usersheet.brains));
+	append_value(str, std::to_string(sheet->usersheet.brawns));
+	append_value(str, std::to_string(sheet->usersheet.bravery));
+	append_value(str, std::to_string(sheet->usersheet.age));
+	append_value(str, std::to_string(sheet->usersheet.totalHealth));
+	append_value(str, std::to_string(sheet->usersheet.currentHealth));
+	append_value(str, std::to_string(sheet->usersheet.resolveDamage));
+	str->append(std::to_string(sheet->usersheet.bizarrePoints));
+}
+
+void append_sheet_summaries(std::string* str, Account* acc) {
+	str->append(std::to_string(acc->sheets.size()));
+	for (u32 i = 0; i < acc->sheets.size(); ++i) {
+		SheetSummary* summary = &acc->sheets[i];
+		str->append("|");
+		append_value(str, std::to_string(summary->id));
+		append_value(str, summary->name);
+		append_value(str, summary->standName);
+		append_value(str, std::to_string(summary->currentHealth));
+		str->append(std::to_string(summary->totalHealth));
 	}
+}
 
-	std::ofstream outfile;
-	outfile.open(ACCOUNTS_DIR);
-	if (outfile.is_open()) {
-		for (i32 i = 0; i < lines.size(); ++i) {
-			outfile << lines.at(i) << "\n";
-		}
+bool read_sheet(std::string username, u32 id, CharSheet* sheet) {
+	boost::mutex::scoped_lock lock(store.mutex);
+	StoredAccount* account = find_account(username);
+	if (account == NULL || id >= account->sheetCount)
+		return false;
+
+	//expand into the same layout as an accounts file line (name|pass|sheet) and reuse the readers
+	std::string line = "||";
+	append_compact_sheet(&line, get_sheet(account, id));
+	StringList tokens = split_string(line, '|');
+	tokens.resize(2 + SHEET_FIELD_COUNT);
+
+	sheet->id = id;
+	read_stand_charsheet(&sheet->standsheet, &tokens);
+	read_user_charsheet(&sheet->usersheet, &tokens);
+	return true;
+}
+
+bool write_sheet(std::string username, CharSheet* sheet, SheetSummary* summary) {
+	boost::mutex::scoped_lock lock(store.mutex);
+	StoredAccount* account = find_account(username);
+	if (account == NULL || sheet->id > account->sheetCount || sheet->id >= MAX_SHEETS) {
+		BMT_LOG(WARNING, "Could not save sheet %d for [%s]", sheet->id, username.c_str());
+		return false;
+	}
+
+	std::string fields;
+	append_sheet_fields(&fields, sheet);
+	StringList tokens = split_string(fields, '|');
+	tokens.resize(SHEET_FIELD_COUNT);
+
+	//intern the new values before releasing the old ones so unchanged text keeps its pool entry
+	CompactSheet compact;
+	compact_sheet(&compact, &tokens, 0);
+	set_sheet(account, sheet->id, &compact);
+	read_sheet_summary(summary, get_sheet(account, sheet->id), sheet->id);
+
+	//only the changed sheet goes to disk, the whole file is rewritten once the log is long enough
+	std::string entry = username + "|" + std::to_string(sheet->id) + "|" + fields + "\n";
+	std::string text;
+	if (++store.logEntries >= ACCOUNTS_COMPACT_AT) {
+		append_accounts_no_lock(&text);
+		store.logEntries = 0;
 	}
+	//taking the file lock before letting go of the store keeps the disk in the same order as memory
+	boost::mutex::scoped_lock fileLock(store.fileMutex);
+	lock.unlock();
+	bool saved = !text.empty() && write_accounts_file(text);
+	if (!saved && !append_file(log_path(), entry)) {
+		BMT_LOG(WARNING, "Could not save sheet %d for [%s]", sheet->id, username.c_str());
+		return false;
+	}
+	BMT_LOG(INFO, "Saved sheet %d for [%s]", sheet->id, username.c_str());
+	return true;
+}
+
+bool create_sheet(std::string username, u32 id, SheetSummary* summary) {
+	if (id >= MAX_SHEETS) {
+		BMT_LOG(WARNING, "[%s] already has %d sheets, not adding another", username.c_str(), MAX_SHEETS);
+		return false;
+	}
+	StringList tokens = split_string("||" DEFAULT_SHEET, '|');
+	CharSheet sheet;
+	sheet.id = id;
+	read_stand_charsheet(&sheet.standsheet, &tokens);
+	read_user_charsheet(&sheet.usersheet, &tokens);
+	return write_sheet(username, &sheet, summary);
+}
 
-	BMT_LOG(INFO, "Saved new account info for [%s]", acc->name.c_str());
-}
-
-void read_stand_charsheet(StandCharSheet* sheet, StringList* tokens) {
-	sheet->name = tokens->at(2);
-	sheet->standTypes = tokens->at(3);
-	sheet->standAbilityDesc = tokens->at(4);
-	sheet->speed = std::stoi(tokens->at(5));
-	sheet->power = std::stoi(tokens->at(6));
-	sheet->range = std::stoi(tokens->at(7));
-	sheet->precision = std::stoi(tokens->at(8));
-	sheet->durability = std::stoi(tokens->at(9));
-	sheet->learning = std::stoi(tokens->at(10));
-}
-
-void read_user_charsheet(UserCharSheet* sheet, StringList* tokens) {
-	sheet->name = tokens->at(11);
-	sheet->playername = tokens->at(12);
-	sheet->gender = tokens->at(13);
-	sheet->weight = tokens->at(14);
-	sheet->height = tokens->at(15);
-	sheet->bloodType = tokens->at(16);
-	sheet->occupation = tokens->at(17);
-	sheet->nationality = tokens->at(18);
-	sheet->backstory = tokens->at(19);
-	sheet->inventory = tokens->at(20);
-	sheet->brains = std::stoi(tokens->at(21));
-	sheet->brawns = std::stoi(tokens->at(22));
-	sheet->bravery = std::stoi(tokens->at(23));
-	sheet->age = std::stoi(tokens->at(24));
-	sheet->totalHealth = std::stoi(tokens->at(25));
-	sheet->currentHealth = std::stoi(tokens->at(26));
-	sheet->resolveDamage = std::stoi(tokens->at(27));
-	sheet->bizarrePoints = std::stoi(tokens->at(28));
-}
-
-LoginState login(Account* result, std::string username, std::string pass) {
+void read_stand_charsheet(StandCharSheet* sheet, StringList* tokens, u32 offset) {
+	sheet->name = tokens->at(2 + offset);
+	sheet->standTypes = tokens->at(3 + offset);
+	sheet->standAbilityDesc = tokens->at(4 + offset);
+	sheet->speed = sheet_value(tokens->at(5 + offset));
+	sheet->power = sheet_value(tokens->at(6 + offset));
+	sheet->range = sheet_value(tokens->at(7 + offset));
+	sheet->precision = sheet_value(tokens->at(8 + offset));
+	sheet->durability = sheet_value(tokens->at(9 + offset));
+	sheet->learning = sheet_value(tokens->at(10 + offset));
+}
+
+void read_user_charsheet(UserCharSheet* sheet, StringList* tokens, u32 offset) {
+	sheet->name = tokens->at(11 + offset);
+	sheet->playername = tokens->at(12 + offset);
+	sheet->gender = tokens->at(13 + offset);
+	sheet->weight = tokens->at(14 + offset);
+	sheet->height = tokens->at(15 + offset);
+	sheet->bloodType = tokens->at(16 + offset);
+	sheet->occupation = tokens->at(17 + offset);
+	sheet->nationality = tokens->at(18 + offset);
+	sheet->backstory = tokens->at(19 + offset);
+	sheet->inventory = tokens->at(20 + offset);
+	sheet->brains = sheet_value(tokens->at(21 + offset));
+	sheet->brawns = sheet_value(tokens->at(22 + offset));
+	sheet->bravery = sheet_value(tokens->at(23 + offset));
+	sheet->age = sheet_value(tokens->at(24 + offset));
+	sheet->totalHealth = sheet_value(tokens->at(25 + offset));
+	sheet->currentHealth = sheet_value(tokens->at(26 + offset));
+	sheet->resolveDamage = sheet_value(tokens->at(27 + offset));
+	sheet->bizarrePoints = sheet_value(tokens->at(28 + offset));
+}
+
+LoginState login(Account* result, std::string username, std::string pass, bool create) {
 	result->name = username;
 	result->pass = pass;
-	
-	LoginState successful = LOGIN_FAILURE;
+	result->sheets.clear();
 
-	//check if account exists
-	bool doesAccountExist = false;
-	std::string line;
-	std::ifstream infile;
-	infile.open(ACCOUNTS_DIR);
-	if (infile.is_open()) {
-		while (!infile.eof()) {
-			getline(infile, line);
-
-			StringList tokens = split_string(line, '|');
-			if (tokens.size() == 0) continue;
-
-			if (tokens.at(0) == username) {
-				doesAccountExist = true;
-				BMT_LOG(INFO, "Account [%s] exists.", username.c_str());
-				
-				if (tokens.at(1) == pass) {
-					BMT_LOG(INFO, "Account password matches! [%s]", pass.c_str());
-					successful = LOGIN_SUCCESS;
-
-					//TODO(Corbin): now read all the other data into the account.
-					read_stand_charsheet(&result->standsheet, &tokens);
-					read_user_charsheet(&result->usersheet,   &tokens);
-				}
-				else {
-					BMT_LOG(WARNING, "Password is incorrect!");
-					*result = { 0 };
-				}
-				break;
-			}
+	boost::mutex::scoped_lock lock(store.mutex);
+	StoredAccount* account = find_account(username);
+	if (account != NULL) {
+		BMT_LOG(INFO, "Account [%s] exists.", username.c_str());
+		if (get_pass(account) != pass) {
+			BMT_LOG(WARNING, "Password is incorrect!");
+			result->name.clear();
+			result->pass.clear();
+			return LOGIN_FAILURE;
 		}
+		BMT_LOG(INFO, "Account password matches! [%s]", pass.c_str());
+
+		//sheet bodies are sent when the client asks for them
+		result->sheets.resize(account->sheetCount);
+		u32 sheet = account->firstSheet;
+		for (u32 i = 0; i < account->sheetCount; ++i, sheet = store.sheets[sheet].next)
+			read_sheet_summary(&result->sheets[i], &store.sheets[sheet], i);
+		return LOGIN_SUCCESS;
 	}
-	infile.close();
 
-	//create a new account
-	if (doesAccountExist == false) {
-		std::ofstream outfile;
-		outfile.open(ACCOUNTS_DIR, std::ios_base::app);
-		if (outfile.is_open()) {
-			//Write blank data for the new account.
-			outfile << username << "|" << pass << "|" <<
-				/* Stand Char Sheet */
-				"enter a name|stand type|stand ability description|0|0|0|0|0|0|" <<
-				/* User Char Sheet  */
-				"enter a name|player name|gender|weight|height|bloodType|occupation|nationality|backstory|inventory|0|0|0|0|0|0|0|0" <<
-				"\n";
-
-			BMT_LOG(INFO, "Created account for [%s]", username.c_str());
-		}
-		successful = LOGIN_CREATED;
+	if (!create) {
+		BMT_LOG(WARNING, "No account [%s], and it may not be created by logging in", username.c_str());
+		result->name.clear();
+		result->pass.clear();
+		return LOGIN_FAILURE;
 	}
+	if (username.size() > MAX_NAME_LENGTH || pass.size() > MAX_NAME_LENGTH) {
+		BMT_LOG(WARNING, "Name or password too long to create an account");
+		result->name.clear();
+		result->pass.clear();
+		return LOGIN_FAILURE;
+	}
+
+	//create a new account
+	std::string line = username + "|" + pass + "|" + DEFAULT_SHEET;
+	StringList tokens = split_string(line, '|');
+	account = add_account(&tokens);
+	result->sheets.resize(1);
+	read_sheet_summary(&result->sheets[0], get_sheet(account, 0), 0);
 
-	return successful;
-}
\ No newline at end of file
+	//a new account only needs to be appended, the rest of the file is unchanged
+	boost::mutex::scoped_lock fileLock(store.fileMutex);
+	lock.unlock();
+	if (append_file(store.path, line + "\n"))
+		BMT_LOG(INFO, "Created account for [%s]", username.c_str());
+	return LOGIN_CREATED;
+}
@@ -2,8 +2,11 @@
 #define ACCOUNTS_H
 
 #include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
 #include "../DnDShared/defines.h"
 #include "../DnDShared/globals.h"
+#include "stringpool.h"
 
 struct StandCharSheet {
 	std::string name;
@@ -38,13 +41,78 @@ struct UserCharSheet {
 	i32 bizarrePoints;
 };
 
+//number of '|' separated fields a character sheet takes up in the accounts file
+#define SHEET_FIELD_COUNT 27
+
+struct CharSheet {
+	u32 id;
+	StandCharSheet standsheet;
+	UserCharSheet usersheet;
+};
+
+//what the client needs to list a sheet, the full body is only sent when asked for
+struct SheetSummary {
+	u32 id;
+	std::string name;
+	std::string standName;
+	i32 currentHealth;
+	i32 totalHealth;
+};
+
+#define DEFAULT_ROOM 0          //the DM console's table, always the first room opened
+#define ROOM_ALL     0xFFFFFFFF //every connected client
+#define ROOM_NONE    0xFFFFFFFE //not logged in to a room yet
+
 struct Account {
-	Socket* socket;
+	Transport* socket;
 	std::string name;
 	std::string pass;
-	//TODO(Corbin): allow multiple character sheets per account.
-	StandCharSheet standsheet;
-	UserCharSheet usersheet;
+	u32 room;
+	bool dm; //may run the table (music, turn order, map changes)
+	u8 layers; //interest set, the token layers this session is sent
+	std::vector<SheetSummary> sheets;
+};
+
+#define SHEET_TEXT_COUNT  13
+#define SHEET_VALUE_COUNT 14
+#define ACCOUNTS_PATH "data/accounts.txt"
+#define MAX_SHEETS        32 //per account, every new sheet is saved to disk
+#define ACCOUNTS_LOG_SUFFIX ".log" //sheet updates since the accounts file was last rewritten
+#define ACCOUNTS_COMPACT_AT 1024   //updates in the log before it is folded into the accounts file
+
+#define ACCOUNT_NONE 0xFFFFFFFF
+
+//how a sheet is kept in the account store, fields are in accounts file order split by type
+struct CompactSheet {
+	SheetString text[SHEET_TEXT_COUNT];
+	i32 values[SHEET_VALUE_COUNT];
+	u32 next; //index of the account's next sheet or ACCOUNT_NONE
+};
+
+//names and passwords are unique per account, so they are kept back to back in a char arena
+//instead of the string pool
+struct StoredAccount {
+	u32 nameOffset; //the password follows the name
+	u16 nameLength;
+	u16 passLength;
+	u32 firstSheet;
+	u32 sheetCount;
+};
+
+//every account is loaded once at startup. index is an open addressing hash table of
+//account indices keyed by name.
+struct AccountStore {
+	boost::mutex mutex;
+	StringPool pool;
+	std::vector<char> names;
+	std::vector<StoredAccount> accounts;
+	std::vector<CompactSheet> sheets;
+	std::vector<u32> index;
+	std::string path;
+	//held while writing the accounts file or its log, taken before store.mutex is let go so
+	//the disk sees changes in the same order as memory
+	boost::mutex fileMutex;
+	u32 logEntries;
 };
 
 enum LoginState {
@@ -53,9 +121,29 @@ enum LoginState {
 	LOGIN_CREATED
 };
 
-void read_stand_charsheet(StandCharSheet* sheet, StringList* tokens);
-void read_user_charsheet(UserCharSheet* sheet, StringList* tokens);
-void write_account_data(Account* acc);
-LoginState login(Account* result, std::string username, std::string pass);
+//false unless str is a whole number that fits an i32, sheet stats are checked with this
+bool parse_sheet_value(const std::string& str, i32* out);
+//offset is the number of fields before the sheet, relative to the first sheet in an accounts file line
+void read_stand_charsheet(StandCharSheet* sheet, StringList* tokens, u32 offset = 0);
+void read_user_charsheet(UserCharSheet* sheet, StringList* tokens, u32 offset = 0);
+void append_sheet_fields(std::string* str, CharSheet* sheet);
+void append_sheet_summaries(std::string* str, Account* acc);
+bool read_sheet(std::string username, u32 id, CharSheet* sheet);
+//stores a sheet and appends it to the accounts update log, a sheet id one past the last sheet
+//adds a new one. every ACCOUNTS_COMPACT_AT updates the log is folded into the accounts file
+bool write_sheet(std::string username, CharSheet* sheet, SheetSummary* summary);
+//adds a blank sheet as the account's id-th, which must be one past its last. false at MAX_SHEETS
+bool create_sheet(std::string username, u32 id, SheetSummary* summary);
+//an unknown name gets a new account unless create is false, then it fails
+LoginState login(Account* result, std::string username, std::string pass, bool create = true);
+bool account_exists(const std::string& username);
+
+//reads the accounts file and its update log into memory, later changes are written back to the same path
+bool load_accounts(const char* path = ACCOUNTS_PATH);
+//rewrites the accounts file with every change and empties the update log
+bool save_accounts();
+u32 account_count();
+//approximate bytes held by the account store
+u64 account_store_memory();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,179 @@
+//Account store benchmark. Build it as its own executable from this file plus
+//server/accounts.cpp and server/stringpool.cpp, then run
+//
+//  accounts_bench [results.jsonl] [max accounts]
+//
+//For every store size (1k, 10k, 100k, 1M by default) it writes a synthetic accounts
+//file, then measures startup load time, login latency (hit, wrong password, new
+//account), sheet lookups for unknown names and sheet update throughput. Every result
+//is one JSON object per line so runs can be diffed between releases. The store logs
+//each login to stderr, redirect it when running (2>nul or 2>/dev/null).
+
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <stdio.h>
+#include "../accounts.h"
+
+#define BENCH_FILE      "bench_accounts.txt"
+#define BENCH_LOGINS    10000
+#define BENCH_CREATES   1000
+#define BENCH_UPDATES   (2 * ACCOUNTS_COMPACT_AT) //so the max includes the updates that rewrite the file
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct BenchResult {
+	const char* name;
+	u32 accounts;
+	std::vector<f64> samples; //microseconds
+};
+
+INTERNAL inline
+f64 elapsed_us(Clock::time_point start) {
+	return std::chrono::duration<f64, std::micro>(Clock::now() - start).count();
+}
+
+//cheap deterministic generator so every run uses the same data
+INTERNAL inline
+u32 next_random(u32* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+INTERNAL inline
+std::string bench_name(u32 i) {
+	return "bench_user_" + std::to_string(i);
+}
+
+INTERNAL inline
+std::string bench_pass(u32 i) {
+	return std::to_string(1469598103934665603ULL ^ ((u64)i * 1099511628211ULL));
+}
+
+//most accounts keep the default placeholders, some have been filled in by their player
+INTERNAL
+void write_bench_file(u32 count) {
+	std::ofstream outfile;
+	outfile.open(BENCH_FILE, std::ios_base::trunc);
+	u32 state = 0x9E3779B9;
+	std::string line;
+	for (u32 i = 0; i < count; ++i) {
+		line = bench_name(i) + "|" + bench_pass(i) + "|";
+		u32 roll = next_random(&state);
+		if (roll % 4 != 0) {
+			line.append("enter a name|stand type|stand ability description|0|0|0|0|0|0|");
+			line.append("enter a name|player name|gender|weight|height|bloodType|occupation|nationality|backstory|inventory|0|0|0|0|0|0|0|0");
+		}
+		else {
+			std::string id = std::to_string(roll);
+			line.append("Stand " + id + "|close range|stops time for " + id + " seconds|3|4|2|5|1|2|");
+			line.append("User " + id + "|player " + id + "|f|60|170|O|student|japanese|born in " + id + "|arrows|3|2|4|17|40|40|0|" + std::to_string(roll % 10));
+		}
+		outfile << line << "\n";
+	}
+	outfile.close();
+}
+
+INTERNAL
+void write_result(FILE* out, BenchResult* result) {
+	std::vector<f64>* samples = &result->samples;
+	if (samples->size() == 0) return;
+	std::sort(samples->begin(), samples->end());
+
+	f64 total = 0;
+	for (u32 i = 0; i < samples->size(); ++i)
+		total += samples->at(i);
+	f64 mean = total / samples->size();
+	f64 p50 = samples->at(samples->size() / 2);
+	f64 p99 = samples->at((samples->size() * 99) / 100);
+
+	fprintf(out, "{\"bench\":\"%s\",\"accounts\":%u,\"ops\":%u,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f,\"ops_per_sec\":%.1f}\n",
+		result->name, result->accounts, (u32)samples->size(), mean, p50, p99, samples->back(), mean > 0 ? 1000000.0 / mean : 0.0);
+	fflush(out);
+}
+
+INTERNAL
+void run_size(FILE* out, u32 count) {
+	write_bench_file(count);
+	u32 state = count;
+
+	BenchResult load = { "load", count };
+	Clock::time_point start = Clock::now();
+	load_accounts(BENCH_FILE);
+	load.samples.push_back(elapsed_us(start));
+	write_result(out, &load);
+	fprintf(out, "{\"bench\":\"memory\",\"accounts\":%u,\"bytes\":%llu,\"bytes_per_account\":%.1f}\n",
+		count, (unsigned long long)account_store_memory(), (f64)account_store_memory() / count);
+
+	BenchResult hit = { "login_hit", count };
+	BenchResult fail = { "login_wrong_password", count };
+	BenchResult miss = { "sheet_lookup_miss", count };
+	for (u32 i = 0; i < BENCH_LOGINS; ++i) {
+		u32 id = next_random(&state) % count;
+		Account account;
+
+		start = Clock::now();
+		login(&account, bench_name(id), bench_pass(id));
+		hit.samples.push_back(elapsed_us(start));
+
+		start = Clock::now();
+		login(&account, bench_name(id), "wrong");
+		fail.samples.push_back(elapsed_us(start));
+
+		CharSheet sheet;
+		start = Clock::now();
+		read_sheet(bench_name(count + i), 0, &sheet);
+		miss.samples.push_back(elapsed_us(start));
+	}
+	write_result(out, &hit);
+	write_result(out, &fail);
+	write_result(out, &miss);
+
+	//every new account is appended to the accounts file
+	BenchResult created = { "login_create", count };
+	for (u32 i = 0; i < BENCH_CREATES; ++i) {
+		Account account;
+		start = Clock::now();
+		login(&account, "bench_new_" + std::to_string(i), bench_pass(i));
+		created.samples.push_back(elapsed_us(start));
+	}
+	write_result(out, &created);
+
+	//a sheet update is appended to the update log, every ACCOUNTS_COMPACT_AT-th one rewrites the whole file
+	BenchResult update = { "sheet_update", count };
+	for (u32 i = 0; i < BENCH_UPDATES; ++i) {
+		u32 id = next_random(&state) % count;
+		CharSheet sheet;
+		SheetSummary summary;
+		read_sheet(bench_name(id), 0, &sheet);
+		sheet.usersheet.currentHealth = next_random(&state) % 100;
+
+		start = Clock::now();
+		write_sheet(bench_name(id), &sheet, &summary);
+		update.samples.push_back(elapsed_us(start));
+	}
+	write_result(out, &update);
+
+	remove(BENCH_FILE);
+	remove(BENCH_FILE ACCOUNTS_LOG_SUFFIX);
+}
+
+int main(int argc, char** argv) {
+	FILE* out = stdout;
+	if (argc > 1) {
+		out = fopen(argv[1], "w");
+		if (out == NULL) {
+			BMT_LOG(FATAL_ERROR, "Could not open %s", argv[1]);
+		}
+	}
+	u32 maxAccounts = argc > 2 ? std::stoi(argv[2]) : 1000000;
+
+	for (u32 count = 1000; count <= maxAccounts; count *= 10)
+		run_size(out, count);
+
+	if (out != stdout)
+		fclose(out);
+	return EXIT_SUCCESS;
+}
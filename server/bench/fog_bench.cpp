@@ -0,0 +1,190 @@
+//Fog of war benchmark. Build it as its own executable from this file plus server/fog.cpp,
+//server/map.cpp, server/mapfile.cpp, shared/tokens.cpp, shared/spatial.cpp and
+//shared/bitgrid.cpp, then run
+//
+//  fog_bench [results.jsonl] [sources]
+//
+//On a 200x200 map with scattered walls and a few walled rooms it measures update_fog for
+//every source count up to the given one (1, 4, 16 by default): the first update, one source
+//moving a tile (what a single move costs a room tick), every source moving a tile in the
+//same tick, and a wall placed next to a source. Every result is one JSON object per line,
+//like accounts_bench.
+
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include "../fog.h"
+
+#define BENCH_SIDE    200
+#define BENCH_MOVES   2000
+#define BENCH_WALLS   200
+#define BENCH_SOURCES 16
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct BenchResult {
+	const char* name;
+	u32 sources;
+	std::vector<f64> samples; //microseconds
+};
+
+INTERNAL inline
+f64 elapsed_us(Clock::time_point start) {
+	return std::chrono::duration<f64, std::micro>(Clock::now() - start).count();
+}
+
+//cheap deterministic generator so every run uses the same map and moves
+INTERNAL inline
+u32 next_random(u32* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+INTERNAL inline
+bool is_wall(Map* map, i32 x, i32 y) {
+	return x < 0 || y < 0 || x >= (i32)map->width || y >= (i32)map->height || get_bit(&map->walls, y * map->width + x);
+}
+
+//about one tile in twelve is a pillar, and every 40 tiles there is a room whose walls have a gap
+INTERNAL
+void build_bench_map(Map* map, u32* state) {
+	map->width = map->height = BENCH_SIDE;
+	map->fow = true;
+	map->selected = TOKEN_NONE;
+	fit_walls(map);
+	for (u32 i = 0; i < BENCH_SIDE * BENCH_SIDE; ++i)
+		set_bit(&map->walls, i, next_random(state) % 12 == 0);
+	for (u32 room = 0; room < BENCH_SIDE; room += 40) {
+		for (u32 i = 0; i < BENCH_SIDE; ++i) {
+			if (i % 40 == 20) continue;
+			set_bit(&map->walls, room * BENCH_SIDE + i, true);
+			set_bit(&map->walls, i * BENCH_SIDE + room, true);
+		}
+	}
+}
+
+INTERNAL
+void add_sources(Map* map, u32 count, u32* state) {
+	for (u32 i = 0; i < count; ++i) {
+		i32 x, y;
+		do {
+			x = next_random(state) % BENCH_SIDE;
+			y = next_random(state) % BENCH_SIDE;
+		} while (is_wall(map, x, y));
+		Token token = { 0 };
+		token.layer = LAYER_TOKEN;
+		token.xPos = x * TILESIZE;
+		token.yPos = y * TILESIZE;
+		add_token(&map->tokens, &token);
+	}
+}
+
+//one tile in a random direction, staying off walls
+INTERNAL
+void step_token(Map* map, u32 index, u32* state) {
+	const i32 DX[4] = { 1, -1, 0, 0 };
+	const i32 DY[4] = { 0, 0, 1, -1 };
+	u32 dir = next_random(state) % 4;
+	i32 x = map->tokens.xPos[index] / TILESIZE + DX[dir];
+	i32 y = map->tokens.yPos[index] / TILESIZE + DY[dir];
+	if (is_wall(map, x, y)) {
+		x -= 2 * DX[dir];
+		y -= 2 * DY[dir];
+		if (is_wall(map, x, y)) return;
+	}
+	move_token(&map->tokens, index, x * TILESIZE, y * TILESIZE);
+}
+
+INTERNAL
+void write_result(FILE* out, BenchResult* result) {
+	std::vector<f64>* samples = &result->samples;
+	if (samples->size() == 0) return;
+	std::sort(samples->begin(), samples->end());
+
+	f64 total = 0;
+	for (u32 i = 0; i < samples->size(); ++i)
+		total += samples->at(i);
+	f64 mean = total / samples->size();
+	f64 p50 = samples->at(samples->size() / 2);
+	f64 p99 = samples->at((samples->size() * 99) / 100);
+
+	fprintf(out, "{\"bench\":\"%s\",\"map\":\"%dx%d\",\"sources\":%u,\"ops\":%u,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f}\n",
+		result->name, BENCH_SIDE, BENCH_SIDE, result->sources, (u32)samples->size(), mean, p50, p99, samples->back());
+	fflush(out);
+}
+
+INTERNAL
+void run_sources(FILE* out, u32 sources) {
+	u32 state = 0x9E3779B9 ^ sources;
+	Map* map = new Map();
+	Fog* fog = new Fog();
+	build_bench_map(map, &state);
+	add_sources(map, sources, &state);
+	std::string delta;
+
+	BenchResult first = { "fog_first_update", sources };
+	Clock::time_point start = Clock::now();
+	update_fog(fog, map, &delta);
+	first.samples.push_back(elapsed_us(start));
+	write_result(out, &first);
+
+	BenchResult one = { "fog_move_one", sources };
+	for (u32 i = 0; i < BENCH_MOVES; ++i) {
+		step_token(map, next_random(&state) % sources, &state);
+		delta.clear();
+		start = Clock::now();
+		update_fog(fog, map, &delta);
+		one.samples.push_back(elapsed_us(start));
+	}
+	write_result(out, &one);
+
+	BenchResult all = { "fog_move_all", sources };
+	for (u32 i = 0; i < BENCH_MOVES / sources + 1; ++i) {
+		for (u32 t = 0; t < sources; ++t)
+			step_token(map, t, &state);
+		delta.clear();
+		start = Clock::now();
+		update_fog(fog, map, &delta);
+		all.samples.push_back(elapsed_us(start));
+	}
+	write_result(out, &all);
+
+	//a wall next to a source makes it, and any other source in sight range, work out its sight again
+	BenchResult wall = { "fog_wall_change", sources };
+	for (u32 i = 0; i < BENCH_WALLS; ++i) {
+		u32 t = next_random(&state) % sources;
+		i32 x = map->tokens.xPos[t] / TILESIZE + 1;
+		i32 y = map->tokens.yPos[t] / TILESIZE;
+		if (x >= BENCH_SIDE) continue;
+		u32 tile = y * BENCH_SIDE + x;
+		set_bit(&map->walls, tile, !get_bit(&map->walls, tile));
+		delta.clear();
+		start = Clock::now();
+		update_fog(fog, map, &delta);
+		wall.samples.push_back(elapsed_us(start));
+	}
+	write_result(out, &wall);
+
+	delete fog;
+	delete map;
+}
+
+int main(int argc, char** argv) {
+	FILE* out = stdout;
+	if (argc > 1) {
+		out = fopen(argv[1], "w");
+		if (out == NULL) {
+			BMT_LOG(FATAL_ERROR, "Could not open %s", argv[1]);
+		}
+	}
+	u32 maxSources = argc > 2 ? std::stoi(argv[2]) : BENCH_SOURCES;
+
+	for (u32 sources = 1; sources <= maxSources; sources *= 4)
+		run_sources(out, sources);
+
+	if (out != stdout)
+		fclose(out);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+#include "checkpoint.h"
+#include "mapfile.h"
+#include <fstream>
+#include <boost/crc.hpp>
+
+//Log layout, one record per checkpoint:
+//  u32 CHECKPOINT_MAGIC, u64 generation, u32 chunkCount
+//  chunkCount * (u32 key, u32 size, size bytes)
+//  u32 CHECKPOINT_COMMIT, u32 crc32 of everything above in this record
+//A record only counts once its commit marker and checksum are intact, so a crash in the
+//middle of a write falls back to the previous checkpoint.
+#define CHECKPOINT_MAGIC  0x54504B43 //"CKPT"
+#define CHECKPOINT_COMMIT 0x54494D43 //"CMIT"
+
+INTERNAL inline
+u32 chunk_key(ChunkKind kind, u32 index) {
+	return ((u32)kind << 24) | (index & 0xFFFFFF);
+}
+
+INTERNAL inline
+ChunkKind chunk_kind(u32 key) {
+	return (ChunkKind)(key >> 24);
+}
+
+INTERNAL inline
+u32 chunk_index(u32 key) {
+	return key & 0xFFFFFF;
+}
+
+INTERNAL inline
+void append_u32(std::string* str, u32 value) {
+	str->append((const char*)&value, sizeof(value));
+}
+
+INTERNAL inline
+void append_u64(std::string* str, u64 value) {
+	str->append((const char*)&value, sizeof(value));
+}
+
+INTERNAL inline
+bool read_u32(const std::string& str, u32* offset, u32* value) {
+	if (*offset + sizeof(u32) > str.size()) return false;
+	memcpy(value, str.data() + *offset, sizeof(u32));
+	*offset += sizeof(u32);
+	return true;
+}
+
+INTERNAL
+void append_strings(std::string* out, const StringList& strings) {
+	append_u32(out, strings.size());
+	for (u32 i = 0; i < strings.size(); ++i) {
+		append_u32(out, strings[i].size());
+		out->append(strings[i]);
+	}
+}
+
+INTERNAL
+bool read_strings(const std::string& chunk, StringList* strings) {
+	u32 offset = 0;
+	u32 count = 0;
+	if (!read_u32(chunk, &offset, &count)) return false;
+	strings->clear();
+	for (u32 i = 0; i < count; ++i) {
+		u32 length = 0;
+		if (!read_u32(chunk, &offset, &length) || offset + length > chunk.size()) return false;
+		strings->push_back(chunk.substr(offset, length));
+		offset += length;
+	}
+	return true;
+}
+
+INTERNAL
+ChunkData serialize_chunk(u32 key, Map* map, StringList* rollLog, Server* server) {
+	std::string* out = new std::string();
+
+	switch (chunk_kind(key)) {
+	case CHUNK_MAP_INFO: {
+		MapInfoRecord info;
+		pack_map_info(&info, map);
+		out->append((const char*)&info, sizeof(info));
+		append_u32(out, token_count(&map->tokens));
+		append_u32(out, map->rects.size());
+	} break;
+	case CHUNK_TOKENS: {
+		u32 first = chunk_index(key) * TOKENS_PER_CHUNK;
+		u32 last = first + TOKENS_PER_CHUNK;
+		if (last > token_count(&map->tokens))
+			last = token_count(&map->tokens);
+		u32 count = last > first ? last - first : 0;
+		std::string names;
+		append_u32(out, count);
+		for (u32 i = first; i < last; ++i) {
+			TokenRecord record;
+			pack_token(&record, &map->tokens, i, names.size());
+			out->append((const char*)&record, sizeof(record));
+			names.append(map->tokens.names[i]);
+		}
+		out->append(names);
+	} break;
+	case CHUNK_RECTS: {
+		append_u32(out, map->rects.size());
+		for (u32 i = 0; i < map->rects.size(); ++i) {
+			RectRecord record;
+			pack_rect(&record, &map->rects[i]);
+			out->append((const char*)&record, sizeof(record));
+		}
+	} break;
+	case CHUNK_WALLS: {
+		append_u32(out, map->walls.width);
+		append_u32(out, map->walls.height);
+		out->append((const char*)map->walls.words.data(), map->walls.words.size() * sizeof(u64));
+	} break;
+	case CHUNK_ROLL_LOG: {
+		append_strings(out, *rollLog);
+	} break;
+	case CHUNK_ACCOUNTS: {
+		StringList names;
+		server->userListMutex.lock();
+		for (u32 i = 0; i < server->users.size(); ++i)
+			names.push_back(server->users[i].name);
+		server->userListMutex.unlock();
+		append_strings(out, names);
+	} break;
+	}
+
+	return ChunkData(out);
+}
+
+INTERNAL
+bool write_record(std::ofstream* out, u64 generation, ChunkMap* chunks, u64* bytesWritten) {
+	std::string record;
+	append_u32(&record, CHECKPOINT_MAGIC);
+	append_u64(&record, generation);
+	append_u32(&record, chunks->size());
+	for (ChunkMap::iterator it = chunks->begin(); it != chunks->end(); ++it) {
+		append_u32(&record, it->first);
+		append_u32(&record, it->second->size());
+		record.append(*it->second);
+	}
+	boost::crc_32_type crc;
+	crc.process_bytes(record.data(), record.size());
+	append_u32(&record, CHECKPOINT_COMMIT);
+	append_u32(&record, crc.checksum());
+
+	out->write(record.data(), record.size());
+	out->flush();
+	*bytesWritten = record.size();
+	return !out->fail();
+}
+
+//rewrites the log as a single record holding the whole live state
+INTERNAL
+void compact_log(Checkpointer* cp, u64 generation) {
+	std::string tempPath = cp->path + ".tmp";
+	std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+	u64 size = 0;
+	if (!out.is_open() || !write_record(&out, generation, &cp->live, &size)) {
+		BMT_LOG(WARNING, "Could not compact checkpoint log '%s'", cp->path.c_str());
+		return;
+	}
+	out.close();
+	//the old log stays until a complete new one takes its place
+	if (out.fail() || !replace_file(tempPath.c_str(), cp->path.c_str())) {
+		BMT_LOG(WARNING, "Could not compact checkpoint log '%s'", cp->path.c_str());
+		return;
+	}
+	cp->logSize = size;
+}
+
+INTERNAL
+void writer_loop(Checkpointer* cp) {
+	for (;;) {
+		boost::unique_lock<boost::mutex> lock(cp->mutex);
+		while (cp->pending.empty() && !cp->close)
+			cp->wake.wait(lock);
+		if (cp->pending.empty() && cp->close)
+			break;
+		CheckpointBatch batch = cp->pending.front();
+		cp->pending.pop();
+		lock.unlock();
+
+		std::ofstream out(cp->path.c_str(), std::ios::binary | std::ios::app);
+		u64 written = 0;
+		if (!out.is_open() || !write_record(&out, batch.generation, &batch.chunks, &written)) {
+			BMT_LOG(WARNING, "Could not write checkpoint %d to '%s'", (u32)batch.generation, cp->path.c_str());
+			continue;
+		}
+		out.close();
+		cp->logSize += written;
+
+		u64 liveSize = 0;
+		for (ChunkMap::iterator it = batch.chunks.begin(); it != batch.chunks.end(); ++it)
+			cp->live[it->first] = it->second;
+		for (ChunkMap::iterator it = cp->live.begin(); it != cp->live.end(); ++it)
+			liveSize += it->second->size() + 8;
+
+		BMT_LOG(DEBUG, "Checkpoint %d: %d chunks, %d bytes", (u32)batch.generation, batch.chunks.size(), (u32)written);
+		if (cp->logSize > liveSize * CHECKPOINT_COMPACT_RATIO)
+			compact_log(cp, batch.generation);
+	}
+	BMT_LOG(INFO, "Closed checkpoint writer");
+}
+
+void start_checkpointer(Checkpointer* cp, const char* path) {
+	cp->path = path;
+	cp->generation = 0;
+	cp->accountsVersion = 0;
+	cp->lastCheckpoint = 0;
+	cp->close = false;
+	cp->live.clear();
+
+	std::ifstream existing(path, std::ios::binary | std::ios::ate);
+	cp->logSize = existing.is_open() ? (u64)existing.tellg() : 0;
+	existing.close();
+
+	//the first checkpoint after startup has to contain everything since the
+	//restored state may have come from a map file instead of the log
+	cp->tokenCount = 0;
+	cp->rectCount = 0;
+	cp->replaced = true;
+	cp->mutex.lock();
+	cp->dirty.insert(chunk_key(CHUNK_ROLL_LOG, 0));
+	cp->dirty.insert(chunk_key(CHUNK_ACCOUNTS, 0));
+	cp->mutex.unlock();
+
+	cp->writer = boost::thread(boost::bind(writer_loop, cp));
+}
+
+void stop_checkpointer(Checkpointer* cp, Map* map, StringList* rollLog, Server* server) {
+	checkpoint_tick(cp, map, rollLog, server, cp->lastCheckpoint + CHECKPOINT_INTERVAL);
+	cp->mutex.lock();
+	cp->close = true;
+	cp->mutex.unlock();
+	cp->wake.notify_one();
+	cp->writer.join();
+}
+
+void mark_map_dirty(Checkpointer* cp) {
+	cp->mutex.lock();
+	cp->dirty.insert(chunk_key(CHUNK_MAP_INFO, 0));
+	cp->mutex.unlock();
+}
+
+void mark_map_replaced(Checkpointer* cp) {
+	cp->replaced = true;
+}
+
+void mark_token_dirty(Checkpointer* cp, u32 index) {
+	cp->mutex.lock();
+	cp->dirty.insert(chunk_key(CHUNK_TOKENS, index / TOKENS_PER_CHUNK));
+	cp->mutex.unlock();
+}
+
+void mark_rects_dirty(Checkpointer* cp) {
+	cp->mutex.lock();
+	cp->dirty.insert(chunk_key(CHUNK_RECTS, 0));
+	cp->mutex.unlock();
+}
+
+void mark_walls_dirty(Checkpointer* cp) {
+	cp->mutex.lock();
+	cp->dirty.insert(chunk_key(CHUNK_WALLS, 0));
+	cp->mutex.unlock();
+}
+
+void mark_roll_log_dirty(Checkpointer* cp) {
+	cp->mutex.lock();
+	cp->dirty.insert(chunk_key(CHUNK_ROLL_LOG, 0));
+	cp->mutex.unlock();
+}
+
+void checkpoint_tick(Checkpointer* cp, Map* map, StringList* rollLog, Server* server, f64 time) {
+	if (time - cp->lastCheckpoint < CHECKPOINT_INTERVAL)
+		return;
+	cp->lastCheckpoint = time;
+
+	if (server->userListVersion != cp->accountsVersion) {
+		cp->accountsVersion = server->userListVersion;
+		cp->mutex.lock();
+		cp->dirty.insert(chunk_key(CHUNK_ACCOUNTS, 0));
+		cp->mutex.unlock();
+	}
+
+	cp->mutex.lock();
+	std::set<u32> dirty;
+	dirty.swap(cp->dirty);
+	cp->mutex.unlock();
+
+	//the token and rect counts live in the map info chunk
+	if (token_count(&map->tokens) != cp->tokenCount || map->rects.size() != cp->rectCount) {
+		cp->tokenCount = token_count(&map->tokens);
+		cp->rectCount = map->rects.size();
+		dirty.insert(chunk_key(CHUNK_MAP_INFO, 0));
+	}
+	//a replaced map makes every chunk suspect, rewrite all of them
+	if (cp->replaced) {
+		cp->replaced = false;
+		u32 chunkCount = (token_count(&map->tokens) + TOKENS_PER_CHUNK - 1) / TOKENS_PER_CHUNK;
+		for (u32 i = 0; i < chunkCount; ++i)
+			dirty.insert(chunk_key(CHUNK_TOKENS, i));
+		dirty.insert(chunk_key(CHUNK_MAP_INFO, 0));
+		dirty.insert(chunk_key(CHUNK_RECTS, 0));
+		dirty.insert(chunk_key(CHUNK_WALLS, 0));
+	}
+	if (dirty.empty())
+		return;
+
+	CheckpointBatch batch;
+	batch.generation = ++cp->generation;
+	for (std::set<u32>::iterator it = dirty.begin(); it != dirty.end(); ++it) {
+		batch.chunks[*it] = serialize_chunk(*it, map, rollLog, server);
+	}
+
+	cp->mutex.lock();
+	cp->pending.push(batch);
+	cp->mutex.unlock();
+	cp->wake.notify_one();
+}
+
+INTERNAL
+bool apply_chunk(u32 key, const std::string& chunk, Map* map, StringList* rollLog) {
+	u32 offset = 0;
+	switch (chunk_kind(key)) {
+	case CHUNK_MAP_INFO: {
+		u32 tokenCount = 0;
+		u32 rectCount = 0;
+		if (chunk.size() < sizeof(MapInfoRecord)) return false;
+		if (!unpack_map_info(map, (const MapInfoRecord*)chunk.data())) return false;
+		offset = sizeof(MapInfoRecord);
+		if (!read_u32(chunk, &offset, &tokenCount) || !read_u32(chunk, &offset, &rectCount)) return false;
+		resize_tokens(&map->tokens, tokenCount);
+		map->rects.resize(rectCount);
+	} break;
+	case CHUNK_TOKENS: {
+		u32 count = 0;
+		if (!read_u32(chunk, &offset, &count)) return false;
+		if (offset + (u64)count * sizeof(TokenRecord) > chunk.size()) return false;
+		const TokenRecord* records = (const TokenRecord*)(chunk.data() + offset);
+		const char* names = chunk.data() + offset + count * sizeof(TokenRecord);
+		u32 namesSize = chunk.size() - offset - count * sizeof(TokenRecord);
+		u32 first = chunk_index(key) * TOKENS_PER_CHUNK;
+		if (token_count(&map->tokens) < first + count)
+			resize_tokens(&map->tokens, first + count);
+		for (u32 i = 0; i < count; ++i) {
+			TokenRecord record;
+			memcpy(&record, &records[i], sizeof(record));
+			unpack_token(&map->tokens, first + i, &record, names, namesSize);
+		}
+	} break;
+	case CHUNK_RECTS: {
+		u32 count = 0;
+		if (!read_u32(chunk, &offset, &count)) return false;
+		if (offset + (u64)count * sizeof(RectRecord) > chunk.size()) return false;
+		map->rects.resize(count);
+		for (u32 i = 0; i < count; ++i) {
+			RectRecord record;
+			memcpy(&record, chunk.data() + offset + i * sizeof(RectRecord), sizeof(record));
+			unpack_rect(&map->rects[i], &record);
+		}
+	} break;
+	case CHUNK_WALLS: {
+		u32 width = 0;
+		u32 height = 0;
+		if (!read_u32(chunk, &offset, &width) || !read_u32(chunk, &offset, &height)) return false;
+		//walls from before the map was resized no longer fit
+		if (width != map->walls.width || height != map->walls.height) break;
+		if (offset + map->walls.words.size() * sizeof(u64) > chunk.size()) return false;
+		memcpy(map->walls.words.data(), chunk.data() + offset, map->walls.words.size() * sizeof(u64));
+	} break;
+	case CHUNK_ROLL_LOG: {
+		if (!read_strings(chunk, rollLog)) return false;
+	} break;
+	case CHUNK_ACCOUNTS: {
+		StringList names;
+		if (!read_strings(chunk, &names)) return false;
+		for (u32 i = 0; i < names.size(); ++i)
+			BMT_LOG(INFO, "[%s] was connected before the restart", names[i].c_str());
+	} break;
+	default: break;
+	}
+	return true;
+}
+
+bool restore_checkpoint(const char* path, Map* map, StringList* rollLog) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open())
+		return false;
+	std::string log((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+
+	//replay every committed record into the newest version of each chunk
+	ChunkMap chunks;
+	u64 generation = 0;
+	u32 offset = 0;
+	for (;;) {
+		u32 start = offset;
+		u32 magic = 0;
+		u32 chunkCount = 0;
+		u64 recordGeneration = 0;
+		if (!read_u32(log, &offset, &magic) || magic != CHECKPOINT_MAGIC) break;
+		if (offset + sizeof(u64) > log.size()) break;
+		memcpy(&recordGeneration, log.data() + offset, sizeof(u64));
+		offset += sizeof(u64);
+		if (!read_u32(log, &offset, &chunkCount)) break;
+
+		ChunkMap record;
+		bool complete = true;
+		for (u32 i = 0; i < chunkCount && complete; ++i) {
+			u32 key = 0;
+			u32 size = 0;
+			complete = read_u32(log, &offset, &key) && read_u32(log, &offset, &size) && offset + size <= log.size();
+			if (complete) {
+				record[key] = ChunkData(new std::string(log, offset, size));
+				offset += size;
+			}
+		}
+
+		u32 commit = 0;
+		u32 checksum = 0;
+		boost::crc_32_type crc;
+		crc.process_bytes(log.data() + start, offset - start);
+		if (!complete || !read_u32(log, &offset, &commit) || !read_u32(log, &offset, &checksum) ||
+			commit != CHECKPOINT_COMMIT || checksum != crc.checksum()) {
+			BMT_LOG(WARNING, "Checkpoint log '%s' ends with an incomplete record, ignoring it", path);
+			break;
+		}
+
+		for (ChunkMap::iterator it = record.begin(); it != record.end(); ++it)
+			chunks[it->first] = it->second;
+		generation = recordGeneration;
+	}
+
+	if (chunks.count(chunk_key(CHUNK_MAP_INFO, 0)) == 0)
+		return false;
+
+	*map = { 0 };
+	rollLog->clear();
+	//map info first so the token and rect counts are known before the chunks fill them in
+	if (!apply_chunk(chunk_key(CHUNK_MAP_INFO, 0), *chunks[chunk_key(CHUNK_MAP_INFO, 0)], map, rollLog)) {
+		BMT_LOG(WARNING, "Checkpoint map info is corrupt or too large, not restoring it");
+		return false;
+	}
+	u32 tokenCount = token_count(&map->tokens);
+	for (ChunkMap::iterator it = chunks.begin(); it != chunks.end(); ++it) {
+		if (chunk_kind(it->first) == CHUNK_MAP_INFO) continue;
+		if (!apply_chunk(it->first, *it->second, map, rollLog)) {
+			BMT_LOG(WARNING, "Checkpoint chunk %x is corrupt, skipping it", it->first);
+		}
+	}
+	//token chunks from before the map shrank may still be in the log
+	resize_tokens(&map->tokens, tokenCount);
+	index_rects(map);
+	map->selected = TOKEN_NONE;
+
+	BMT_LOG(INFO, "Restored checkpoint %d from '%s' (%d tokens, %d log lines)", (u32)generation, path, token_count(&map->tokens), rollLog->size());
+	return true;
+}
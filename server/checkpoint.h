@@ -0,0 +1,72 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <map>
+#include <set>
+#include "../DnDShared/globals.h"
+#include "map.h"
+
+#define CHECKPOINT_PATH      "data/checkpoint.log"
+#define CHECKPOINT_INTERVAL  5   //seconds between checkpoints
+#define TOKENS_PER_CHUNK     64
+#define CHECKPOINT_COMPACT_RATIO 8 //rewrite the log once it is this many times larger than the live state
+
+//The game state is split into chunks. Whenever something changes the owning chunk is
+//marked dirty, and at the next checkpoint only dirty chunks are serialized (on the game
+//thread, which is cheap) and handed to a writer thread that appends them to the log.
+//Serialized chunks are immutable and shared between checkpoints, so clean chunks are
+//never copied again.
+enum ChunkKind {
+	CHUNK_MAP_INFO = 1,
+	CHUNK_TOKENS   = 2,
+	CHUNK_RECTS    = 3,
+	CHUNK_ROLL_LOG = 4,
+	CHUNK_ACCOUNTS = 5,
+	CHUNK_WALLS    = 6
+};
+
+typedef boost::shared_ptr<const std::string> ChunkData;
+typedef std::map<u32, ChunkData> ChunkMap;
+
+struct CheckpointBatch {
+	u64 generation;
+	ChunkMap chunks;
+};
+
+struct Checkpointer {
+	boost::mutex mutex;
+	boost::condition_variable wake;
+	std::set<u32> dirty;
+	std::queue<CheckpointBatch> pending;
+	u64 generation;
+	u32 accountsVersion;
+	u32 tokenCount;
+	u32 rectCount;
+	volatile bool replaced;
+	f64 lastCheckpoint;
+	boost::thread writer;
+	volatile bool close;
+
+	//only touched by the writer thread
+	ChunkMap live;
+	u64 logSize;
+	std::string path;
+};
+
+void start_checkpointer(Checkpointer* cp, const char* path = CHECKPOINT_PATH);
+//writes any pending state and joins the writer thread
+void stop_checkpointer(Checkpointer* cp, Map* map, StringList* rollLog, Server* server);
+
+void mark_map_dirty(Checkpointer* cp); //dimensions or colors changed
+void mark_map_replaced(Checkpointer* cp);
+void mark_token_dirty(Checkpointer* cp, u32 index);
+void mark_rects_dirty(Checkpointer* cp);
+void mark_walls_dirty(Checkpointer* cp);
+void mark_roll_log_dirty(Checkpointer* cp);
+
+//called once per frame by the thread that owns the game state
+void checkpoint_tick(Checkpointer* cp, Map* map, StringList* rollLog, Server* server, f64 time);
+//rebuilds the state from the last complete checkpoint in the log
+bool restore_checkpoint(const char* path, Map* map, StringList* rollLog);
+
+#endif
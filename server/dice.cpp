@@ -0,0 +1,324 @@
+#include "dice.h"
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <atomic>
+
+#define DICE_MAX_DICE 100000 //dice in one whole roll, repeats included
+#define DICE_BATCH    32     //generator outputs produced per block
+#define DICE_STR2(x) #x
+#define DICE_STR(x) DICE_STR2(x)
+
+//xoshiro256**, small and fast enough that one instance per thread costs nothing
+struct DiceRng {
+	u64 state[4];
+	bool seeded;
+	u32 generation; //of the seed it was drawn from, see seed_dice
+};
+
+INTERNAL thread_local DiceRng rng;
+INTERNAL std::atomic<u64> rollCount(0);
+INTERNAL std::atomic<u64> diceSeed(0);
+INTERNAL std::atomic<u32> seedGeneration(0); //0 until seed_dice, every generator draws from the OS until then
+
+INTERNAL inline
+u64 rotl(u64 x, i32 k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+INTERNAL inline
+u64 splitmix64(u64* x) {
+	u64 z = (*x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+INTERNAL
+void seed_rng(DiceRng* rng) {
+	rng->generation = seedGeneration.load();
+	u64 seed = diceSeed.load();
+	if (rng->generation == 0) {
+		std::random_device device;
+		seed = ((u64)device() << 32) ^ device();
+	}
+	for (u32 i = 0; i < 4; ++i)
+		rng->state[i] = splitmix64(&seed);
+	rng->seeded = true;
+}
+
+INTERNAL inline
+u64 next_u64(DiceRng* rng) {
+	u64* s = rng->state;
+	u64 result = rotl(s[1] * 5, 7) * 9;
+	u64 t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+void seed_dice(u64 seed) {
+	diceSeed.store(seed);
+	seedGeneration.fetch_add(1);
+}
+
+//Lemire's multiply-shift maps a 32 bit value onto [0, sides) without a division per die,
+//only the few values in the biased range are thrown away. Every 64 bit output gives two
+//candidates, and the raw values are produced a block at a time so both loops stay tight.
+void roll_faces(u32 sides, u32 count, u32* out) {
+	if (!rng.seeded || rng.generation != seedGeneration.load(std::memory_order_relaxed))
+		seed_rng(&rng);
+
+	u32 threshold = (0u - sides) % sides;
+	u32 raw[DICE_BATCH * 2];
+	u32 filled = 0;
+	while (filled < count) {
+		u32 block = std::min((u32)DICE_BATCH, (count - filled) / 2 + 1);
+		for (u32 i = 0; i < block; ++i) {
+			u64 value = next_u64(&rng);
+			raw[i * 2] = (u32)value;
+			raw[i * 2 + 1] = (u32)(value >> 32);
+		}
+		for (u32 i = 0; i < block * 2 && filled < count; ++i) {
+			u64 m = (u64)raw[i] * sides;
+			if ((u32)m < threshold) continue;
+			out[filled++] = (u32)(m >> 32) + 1;
+		}
+	}
+}
+
+INTERNAL
+bool read_number(const std::string& text, u32* pos, u32* value) {
+	u32 start = *pos;
+	u64 result = 0;
+	while (*pos < text.size() && text[*pos] >= '0' && text[*pos] <= '9') {
+		result = result * 10 + (text[*pos] - '0');
+		if (result > 0xFFFFFFF) result = 0xFFFFFFF; //large enough to fail every limit
+		(*pos)++;
+	}
+	*value = (u32)result;
+	return *pos > start;
+}
+
+INTERNAL inline
+bool fail(std::string* error, const char* message, u32 pos) {
+	*error = message;
+	error->append(" at character ");
+	error->append(std::to_string(pos + 1));
+	return false;
+}
+
+bool compile_dice(const std::string& input, DiceExpr* expr, std::string* error) {
+	std::string text;
+	for (u32 i = 0; i < input.size(); ++i) {
+		char c = input[i];
+		if (c == ' ' || c == '\t') continue;
+		text.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+	}
+
+	*expr = { 0 };
+	expr->repeat = 1;
+	u32 pos = 0;
+	u32 totalDice = 0;
+
+	size_t hash = text.find('#');
+	if (hash != std::string::npos) {
+		if (!read_number(text, &pos, &expr->repeat) || pos != hash)
+			return fail(error, "expected a repeat count before #", pos);
+		if (expr->repeat == 0 || expr->repeat > DICE_MAX_REPEAT)
+			return fail(error, "repeat count must be between 1 and " DICE_STR(DICE_MAX_REPEAT), 0);
+		pos++;
+	}
+
+	i32 sign = 1;
+	if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+		sign = text[pos] == '-' ? -1 : 1;
+		pos++;
+	}
+	for (;;) {
+		if (expr->termCount == DICE_MAX_TERMS)
+			return fail(error, "too many terms", pos);
+
+		DiceTerm term = { 0 };
+		term.sign = sign;
+		u32 number = 0;
+		bool hasNumber = read_number(text, &pos, &number);
+		if (pos < text.size() && text[pos] == 'd') {
+			pos++;
+			term.count = hasNumber ? number : 1;
+			if (pos < text.size() && text[pos] == '%') {
+				term.sides = 100;
+				pos++;
+			}
+			else if (!read_number(text, &pos, &term.sides)) {
+				return fail(error, "expected the number of sides", pos);
+			}
+			if (term.count == 0 || term.count > DICE_MAX_COUNT)
+				return fail(error, "dice count must be between 1 and " DICE_STR(DICE_MAX_COUNT), pos);
+			if (term.sides == 0 || term.sides > DICE_MAX_SIDES)
+				return fail(error, "sides must be between 1 and " DICE_STR(DICE_MAX_SIDES), pos);
+
+			if (pos < text.size() && text[pos] == 'k') {
+				pos++;
+				if (pos < text.size() && (text[pos] == 'h' || text[pos] == 'l')) {
+					term.keepLowest = text[pos] == 'l';
+					pos++;
+				}
+				if (!read_number(text, &pos, &term.keep) || term.keep == 0 || term.keep > term.count)
+					return fail(error, "expected how many dice to keep", pos);
+			}
+			if (pos < text.size() && text[pos] == '!') {
+				if (term.sides == 1)
+					return fail(error, "a one sided die cannot explode", pos);
+				term.explode = true;
+				pos++;
+			}
+			totalDice += term.count;
+		}
+		else if (hasNumber) {
+			term.sides = number;
+		}
+		else {
+			return fail(error, "expected a number or dice", pos);
+		}
+		expr->terms[expr->termCount++] = term;
+
+		if (pos == text.size())
+			break;
+		if (text[pos] == '+')
+			sign = 1;
+		else if (text[pos] == '-')
+			sign = -1;
+		else
+			return fail(error, "unexpected character", pos);
+		pos++;
+	}
+
+	if ((u64)totalDice * expr->repeat > DICE_MAX_DICE)
+		return fail(error, "too many dice in one roll", 0);
+	return true;
+}
+
+void roll_dice(const DiceExpr* expr, DiceResult* result) {
+	result->totals.clear();
+	result->faces.clear();
+	std::vector<u32> kept;
+
+	for (u32 r = 0; r < expr->repeat; ++r) {
+		i64 total = 0;
+		for (u32 i = 0; i < expr->termCount; ++i) {
+			const DiceTerm* term = &expr->terms[i];
+			if (term->count == 0) {
+				total += term->sign * (i64)term->sides;
+				continue;
+			}
+
+			u32 start = result->faces.size();
+			result->faces.resize(start + term->count);
+			roll_faces(term->sides, term->count, &result->faces[start]);
+			if (term->explode) {
+				u32 extra = 0;
+				for (u32 j = start; j < result->faces.size() && extra < DICE_MAX_EXPLODE; ++j) {
+					if (result->faces[j] != term->sides) continue;
+					u32 face;
+					roll_faces(term->sides, 1, &face);
+					result->faces.push_back(face);
+					extra++;
+				}
+			}
+
+			u32 rolled = result->faces.size() - start;
+			i64 sum = 0;
+			if (term->keep != 0 && term->keep < rolled) {
+				kept.assign(result->faces.begin() + start, result->faces.end());
+				if (term->keepLowest)
+					std::nth_element(kept.begin(), kept.begin() + term->keep, kept.end());
+				else
+					std::nth_element(kept.begin(), kept.begin() + term->keep, kept.end(), std::greater<u32>());
+				for (u32 j = 0; j < term->keep; ++j)
+					sum += kept[j];
+			}
+			else {
+				for (u32 j = start; j < result->faces.size(); ++j)
+					sum += result->faces[j];
+			}
+			total += term->sign * sum;
+		}
+		result->totals.push_back(total);
+	}
+}
+
+std::string dice_to_string(const DiceExpr* expr) {
+	std::string str;
+	if (expr->repeat > 1) {
+		str.append(std::to_string(expr->repeat));
+		str.append("#");
+	}
+	for (u32 i = 0; i < expr->termCount; ++i) {
+		const DiceTerm* term = &expr->terms[i];
+		if (term->sign < 0)
+			str.append("-");
+		else if (i > 0)
+			str.append("+");
+
+		if (term->count == 0) {
+			str.append(std::to_string(term->sides));
+			continue;
+		}
+		str.append(std::to_string(term->count));
+		str.append("d");
+		str.append(std::to_string(term->sides));
+		if (term->keep != 0) {
+			str.append(term->keepLowest ? "kl" : "kh");
+			str.append(std::to_string(term->keep));
+		}
+		if (term->explode)
+			str.append("!");
+	}
+	return str;
+}
+
+u64 next_roll_id() {
+	return ++rollCount;
+}
+
+INTERNAL
+void append_totals(std::string* out, const DiceResult* result) {
+	for (u32 i = 0; i < result->totals.size(); ++i) {
+		if (i > 0) out->append(",");
+		out->append(std::to_string(result->totals[i]));
+	}
+}
+
+void append_roll_result(std::string* out, u64 id, bool isPublic, const std::string& name, const DiceExpr* expr, const DiceResult* result) {
+	out->append("roll_result|");
+	out->append(std::to_string(id));
+	out->append(isPublic ? "|1|" : "|0|");
+	out->append(name);
+	out->append("|");
+	out->append(dice_to_string(expr));
+	out->append("|");
+	append_totals(out, result);
+	out->append("|");
+	u32 shown = std::min((u32)result->faces.size(), (u32)DICE_SHOWN_FACES);
+	for (u32 i = 0; i < shown; ++i) {
+		if (i > 0) out->append(" ");
+		out->append(std::to_string(result->faces[i]));
+	}
+	if (shown < result->faces.size())
+		out->append(" ...");
+	out->append("\n");
+}
+
+std::string roll_log_line(const std::string& name, const DiceExpr* expr, const DiceResult* result) {
+	std::string line = name;
+	line.append(" rolled ");
+	line.append(dice_to_string(expr));
+	line.append(": ");
+	append_totals(&line, result);
+	return line;
+}
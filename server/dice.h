@@ -0,0 +1,61 @@
+#ifndef DICE_H
+#define DICE_H
+
+#include <string>
+#include <vector>
+#include "../DnDShared/defines.h"
+
+//Dice expressions are compiled once into a flat list of terms and then evaluated with a
+//per-thread generator, so rolling never takes a lock. Supported syntax:
+//
+//  8d6+3       dice and constants joined with + and -
+//  4d6kh3      keep the highest 3 (kl keeps the lowest)
+//  3d10!       exploding, every highest face rolls another die
+//  12#1d20+4   roll the whole expression 12 times, for groups of NPCs
+
+#define DICE_MAX_TERMS   16
+#define DICE_MAX_COUNT   10000   //dice in one term
+#define DICE_MAX_SIDES   1000000
+#define DICE_MAX_REPEAT  100
+#define DICE_MAX_EXPLODE 1000    //extra dice one exploding term may add
+#define DICE_SHOWN_FACES 100     //faces listed in a roll_result, the totals always cover every die
+
+struct DiceTerm {
+	i32 sign;        //+1 or -1
+	u32 count;       //0 for a constant
+	u32 sides;       //the constant's value when count is 0
+	u32 keep;        //dice kept, 0 keeps them all
+	bool keepLowest;
+	bool explode;
+};
+
+struct DiceExpr {
+	u32 repeat;
+	u32 termCount;
+	DiceTerm terms[DICE_MAX_TERMS];
+};
+
+struct DiceResult {
+	std::vector<i64> totals; //one per repeat
+	std::vector<u32> faces;  //every die rolled, in order, dropped and exploded dice included
+};
+
+//returns false and fills error if text is not a valid expression
+bool compile_dice(const std::string& text, DiceExpr* expr, std::string* error);
+void roll_dice(const DiceExpr* expr, DiceResult* result);
+//the expression in its canonical form, e.g. "4d6kh3+2"
+std::string dice_to_string(const DiceExpr* expr);
+//count uniform rolls in [1, sides] from the calling thread's generator
+void roll_faces(u32 sides, u32 count, u32* out);
+//every thread's generator starts over from seed at its next roll, so the same rolls in the same
+//order give the same faces. a recorded session keeps its seed for the replay
+void seed_dice(u64 seed);
+
+//every roll gets a server wide id, it is in the result and the server log so a roll can be checked later
+u64 next_roll_id();
+//format: roll_result|id|public|name|expression|total,total,...|face face ...\n
+void append_roll_result(std::string* out, u64 id, bool isPublic, const std::string& name, const DiceExpr* expr, const DiceResult* result);
+//the line added to the roll log, e.g. "Jotaro rolled 4d6kh3: 14"
+std::string roll_log_line(const std::string& name, const DiceExpr* expr, const DiceResult* result);
+
+#endif
@@ -0,0 +1,230 @@
+#include "fog.h"
+#include <algorithm>
+
+INTERNAL inline
+i32 floor_div(i64 num, i64 den) {
+	return (i32)(num >= 0 ? num / den : -((-num + den - 1) / den));
+}
+
+//depth * num / den rounded to the nearest column, halves up or down
+INTERNAL inline
+i32 round_ties_up(i32 depth, i32 num, i32 den) {
+	return floor_div(2 * (i64)depth * num + den, 2 * (i64)den);
+}
+
+INTERNAL inline
+i32 round_ties_down(i32 depth, i32 num, i32 den) {
+	return -floor_div(den - 2 * (i64)depth * num, 2 * (i64)den);
+}
+
+//a floor tile is only lit if its center is inside the row's slopes, which is what makes
+//sight symmetric: if a can see b then b can see a
+INTERNAL inline
+bool is_symmetric(const ShadowRow* row, i32 col) {
+	return (i64)col * row->startDen >= (i64)row->depth * row->startNum &&
+		(i64)col * row->endDen <= (i64)row->depth * row->endNum;
+}
+
+//quadrants are north, south, east and west of the origin, depth grows away from it
+INTERNAL inline
+void quadrant_tile(u32 quadrant, i32 originX, i32 originY, i32 depth, i32 col, i32* x, i32* y) {
+	switch (quadrant) {
+	case 0: *x = originX + col; *y = originY - depth; break;
+	case 1: *x = originX + col; *y = originY + depth; break;
+	case 2: *x = originX + depth; *y = originY + col; break;
+	default: *x = originX - depth; *y = originY + col; break;
+	}
+}
+
+//the edge of the map blocks sight like a wall
+INTERNAL inline
+bool blocks_sight(const BitGrid* walls, i32 x, i32 y) {
+	if (x < 0 || y < 0 || x >= (i32)walls->width || y >= (i32)walls->height)
+		return true;
+	return get_bit(walls, y * walls->width + x);
+}
+
+INTERNAL inline
+void reveal(Fog* fog, const BitGrid* walls, i32 x, i32 y, std::vector<u32>* out) {
+	if (x < 0 || y < 0 || x >= (i32)walls->width || y >= (i32)walls->height)
+		return;
+	u32 tile = y * walls->width + x;
+	if (fog->stamps[tile] == fog->stamp)
+		return;
+	fog->stamps[tile] = fog->stamp;
+	out->push_back(tile);
+}
+
+void compute_sight(Fog* fog, const BitGrid* walls, i32 tileX, i32 tileY, i32 radius, std::vector<u32>* out) {
+	out->clear();
+	if (tileX < 0 || tileY < 0 || tileX >= (i32)walls->width || tileY >= (i32)walls->height)
+		return;
+	//stamps mark the tiles already listed so the quadrants' shared edges are only added once
+	if (fog->stamps.size() != (u64)walls->width * walls->height) {
+		fog->stamps.assign((u64)walls->width * walls->height, 0);
+		fog->stamp = 0;
+	}
+	if (++fog->stamp == 0) {
+		std::fill(fog->stamps.begin(), fog->stamps.end(), 0);
+		fog->stamp = 1;
+	}
+
+	reveal(fog, walls, tileX, tileY, out);
+	//rounder than a plain r^2 test, single tiles do not stick out at the four points
+	i64 maxDistance = (i64)radius * radius + radius;
+	std::vector<ShadowRow>* rows = &fog->rows;
+	for (u32 quadrant = 0; quadrant < 4; ++quadrant) {
+		ShadowRow first = { 1, -1, 1, 1, 1 };
+		rows->push_back(first);
+		while (!rows->empty()) {
+			ShadowRow row = rows->back();
+			rows->pop_back();
+			if (row.depth > radius)
+				continue;
+
+			i32 minCol = round_ties_up(row.depth, row.startNum, row.startDen);
+			i32 maxCol = round_ties_down(row.depth, row.endNum, row.endDen);
+			i32 prev = -1; //-1 before the first tile, then 0 for floor and 1 for wall
+			for (i32 col = minCol; col <= maxCol; ++col) {
+				i32 x, y;
+				quadrant_tile(quadrant, tileX, tileY, row.depth, col, &x, &y);
+				bool wall = blocks_sight(walls, x, y);
+				if ((wall || is_symmetric(&row, col)) && (i64)col * col + (i64)row.depth * row.depth <= maxDistance)
+					reveal(fog, walls, x, y, out);
+
+				//a wall after floor ends a lit span, scan the next row under it
+				if (prev == 0 && wall) {
+					ShadowRow next = { row.depth + 1, row.startNum, row.startDen, 2 * col - 1, 2 * row.depth };
+					rows->push_back(next);
+				}
+				//floor after a wall starts a new one
+				if (prev == 1 && !wall) {
+					row.startNum = 2 * col - 1;
+					row.startDen = 2 * row.depth;
+				}
+				prev = wall ? 1 : 0;
+			}
+			if (prev == 0) {
+				ShadowRow next = { row.depth + 1, row.startNum, row.startDen, row.endNum, row.endDen };
+				rows->push_back(next);
+			}
+		}
+	}
+}
+
+void reset_fog(Fog* fog, u32 width, u32 height) {
+	fog->width = width;
+	fog->height = height;
+	resize_bits(&fog->visible, width, height);
+	resize_bits(&fog->explored, width, height);
+	resize_bits(&fog->sent, width, height);
+	resize_bits(&fog->walls, width, height);
+	fog->seenBy.assign((u64)width * height, 0);
+	fog->sources.clear();
+}
+
+INTERNAL
+void add_sight(Fog* fog, FogSource* source, const BitGrid* walls) {
+	compute_sight(fog, walls, source->tileX, source->tileY, FOG_SIGHT_RADIUS, &source->tiles);
+	for (u32 i = 0; i < source->tiles.size(); ++i) {
+		u32 tile = source->tiles[i];
+		if (fog->seenBy[tile]++ == 0) {
+			set_bit(&fog->visible, tile, true);
+			set_bit(&fog->explored, tile, true);
+		}
+	}
+}
+
+INTERNAL
+void remove_sight(Fog* fog, FogSource* source) {
+	for (u32 i = 0; i < source->tiles.size(); ++i) {
+		u32 tile = source->tiles[i];
+		if (--fog->seenBy[tile] == 0)
+			set_bit(&fog->visible, tile, false);
+	}
+	source->tiles.clear();
+}
+
+//sources near a wall that was added or removed have to look again
+INTERNAL
+void mark_wall_changes(Fog* fog, const BitGrid* walls) {
+	for (u32 w = 0; w < walls->words.size(); ++w) {
+		u64 changed = walls->words[w] ^ fog->walls.words[w];
+		for (u32 bit = 0; changed != 0; ++bit, changed >>= 1) {
+			if ((changed & 1) == 0)
+				continue;
+			i32 x = (w * 64 + bit) % walls->width;
+			i32 y = (w * 64 + bit) / walls->width;
+			for (u32 i = 0; i < fog->sources.size(); ++i) {
+				FogSource* source = &fog->sources[i];
+				if (abs(source->tileX - x) <= FOG_SIGHT_RADIUS && abs(source->tileY - y) <= FOG_SIGHT_RADIUS)
+					source->stale = true;
+			}
+		}
+		fog->walls.words[w] = walls->words[w];
+	}
+}
+
+bool update_fog(Fog* fog, const Map* map, std::string* delta) {
+	if (map->width != fog->width || map->height != fog->height || map->revision != fog->revision) {
+		reset_fog(fog, map->width, map->height);
+		fog->revision = map->revision;
+	}
+	if (map->walls.width != fog->width || map->walls.height != fog->height)
+		return false;
+	mark_wall_changes(fog, &map->walls);
+
+	//the token layer in handle order, so it can be walked alongside the sources
+	const TokenStore* tokens = &map->tokens;
+	std::vector<u64> order;
+	for (u32 i = 0; i < token_count(tokens); ++i) {
+		if (tokens->layer[i] == LAYER_TOKEN)
+			order.push_back(((u64)tokens->handles[i] << 32) | i);
+	}
+	std::sort(order.begin(), order.end());
+
+	std::vector<FogSource> next;
+	next.reserve(order.size());
+	u32 s = 0;
+	for (u32 n = 0; n < order.size(); ++n) {
+		TokenHandle handle = (TokenHandle)(order[n] >> 32);
+		u32 ndx = (u32)order[n];
+		i32 tileX = floor_div(tokens->xPos[ndx] + TOKEN_SIZE / 2, TILESIZE);
+		i32 tileY = floor_div(tokens->yPos[ndx] + TOKEN_SIZE / 2, TILESIZE);
+		for (; s < fog->sources.size() && fog->sources[s].handle < handle; ++s)
+			remove_sight(fog, &fog->sources[s]);
+
+		next.push_back(FogSource());
+		FogSource* source = &next.back();
+		if (s < fog->sources.size() && fog->sources[s].handle == handle) {
+			std::swap(*source, fog->sources[s++]);
+			if (!source->stale && source->tileX == tileX && source->tileY == tileY)
+				continue;
+			remove_sight(fog, source);
+		}
+		source->handle = handle;
+		source->tileX = tileX;
+		source->tileY = tileY;
+		source->stale = false;
+		add_sight(fog, source, &map->walls);
+	}
+	for (; s < fog->sources.size(); ++s)
+		remove_sight(fog, &fog->sources[s]);
+	fog->sources.swap(next);
+
+	u64 before = delta->size();
+	if (fog->sent.words != fog->visible.words) {
+		append_bit_changes(delta, &fog->sent, &fog->visible);
+		fog->sent.words = fog->visible.words;
+	}
+	return delta->size() != before;
+}
+
+void append_fog_state(std::string* out, const Fog* fog) {
+	//runs on the room workers, so not through format_text's shared buffer
+	out->append("fog_state|" + std::to_string(fog->width) + "|" + std::to_string(fog->height) + "|");
+	append_bit_runs(out, &fog->explored);
+	out->append("|");
+	append_bit_runs(out, &fog->visible);
+	out->append("\n");
+}
@@ -0,0 +1,60 @@
+#ifndef FOG_H
+#define FOG_H
+
+#include "map.h"
+#include "bitgrid.h"
+
+#define FOG_SIGHT_RADIUS 12 //tiles
+
+//Fog of war for one map. Every token on the token layer is a light source that sees the
+//tiles in FOG_SIGHT_RADIUS it has a line of sight to, worked out with symmetric
+//shadowcasting against the map's wall tiles. A tile is visible while at least one source
+//sees it, and explored once one ever has.
+//
+//Each source keeps the list of tiles it sees and every tile counts the sources that see it,
+//so an update only redoes the sources that moved (or had a wall change near them) and
+//leaves the rest of the map alone.
+struct FogSource {
+	TokenHandle handle;
+	i32 tileX;
+	i32 tileY;
+	std::vector<u32> tiles; //tile indices, each listed once
+	bool stale;             //a wall near it changed
+};
+
+//a row of tiles at one distance from the origin, between two slopes. slopes are kept as
+//exact fractions (den > 0) so the shadows come out the same from both ends of a line
+struct ShadowRow {
+	i32 depth;
+	i32 startNum, startDen;
+	i32 endNum, endDen;
+};
+
+struct Fog {
+	u32 width;
+	u32 height;
+	u32 revision;    //of the map the fog was worked out for
+	BitGrid visible;
+	BitGrid explored;
+	BitGrid sent;    //visible as of the last delta
+	BitGrid walls;   //as of the last update, to find the walls that changed
+	std::vector<u16> seenBy;
+	std::vector<FogSource> sources; //sorted by handle
+
+	//scratch space for the shadowcaster
+	std::vector<ShadowRow> rows;
+	std::vector<u32> stamps;
+	u32 stamp;
+};
+
+//forgets every source and what has been explored
+void reset_fog(Fog* fog, u32 width, u32 height);
+//brings the fog up to date with the map's tokens and walls and appends the visible tiles
+//that changed since the last call to delta (see append_bit_changes). returns true if any did
+bool update_fog(Fog* fog, const Map* map, std::string* delta);
+//the explored and visible masks as runs (see append_bit_runs), for players who just joined
+void append_fog_state(std::string* out, const Fog* fog);
+//the tiles a token standing on (tileX, tileY) can see, for tests and tools
+void compute_sight(Fog* fog, const BitGrid* walls, i32 tileX, i32 tileY, i32 radius, std::vector<u32>* out);
+
+#endif
@@ -0,0 +1,106 @@
+#include <csignal>
+#include <random>
+#include "../DnDShared/globals.h"
+#include "accounts.h"
+#include "networking.h"
+#include "rooms.h"
+#include "replay.h"
+#include "dice.h"
+
+//Dedicated server without a window, GL or audio. Every room, the default table included,
+//is run by the room workers, and the DM plays from a normal client whose account was
+//named with --dm. Usage:
+//
+//  tabletop_server_headless [--port 8001] [--dm name]... [--workers 4] [--tick-rate 30] [--admin-port 9101]
+//                           [--record file] [--replay file] [--replay-speed fast|realtime]
+//
+//Metrics are served to local scrapers on 127.0.0.1:<admin port>, 0 turns that off.
+//--record writes every message to and from the clients to file, without passwords or session
+//tickets, and the seed the dice are drawn from. --replay plays the clients' side of such a
+//recording against this server, logs how long it took and exits.
+
+INTERNAL volatile std::sig_atomic_t running = 1;
+
+INTERNAL
+void handle_signal(int) {
+	running = 0;
+}
+
+int main(int argc, char** argv) {
+	Server server;
+	RoomManager rooms;
+	u32 port = 8001;
+	u32 workers = ROOM_WORKERS;
+	u32 tickRate = TICK_RATE;
+	u32 adminPort = METRICS_PORT;
+	std::string recordPath;
+	std::string replayPath;
+	std::string replaySpeed = "fast";
+
+	for (i32 i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			BMT_LOG(WARNING, "Missing value for %s", arg.c_str());
+			break;
+		}
+		if (arg == "--port")
+			port = std::stoi(argv[++i]);
+		else if (arg == "--dm")
+			add_dm(&server, argv[++i]);
+		else if (arg == "--workers")
+			workers = std::stoi(argv[++i]);
+		else if (arg == "--tick-rate")
+			tickRate = std::stoi(argv[++i]);
+		else if (arg == "--admin-port")
+			adminPort = std::stoi(argv[++i]);
+		else if (arg == "--record")
+			recordPath = argv[++i];
+		else if (arg == "--replay")
+			replayPath = argv[++i];
+		else if (arg == "--replay-speed")
+			replaySpeed = argv[++i];
+		else
+			BMT_LOG(WARNING, "Unknown argument %s", arg.c_str());
+	}
+	if (server.dmNames.size() == 0)
+		BMT_LOG(WARNING, "No DM accounts given (--dm name), nobody can change the map or play music");
+
+	std::signal(SIGINT, handle_signal);
+	std::signal(SIGTERM, handle_signal);
+
+	server.rooms = &rooms;
+	start_rooms(&rooms, &server, workers, tickRate);
+	open_room(&rooms, DEFAULT_ROOM_NAME);
+
+	load_accounts(ACCOUNTS_PATH);
+	for (u32 i = 0; i < server.dmNames.size(); ++i) {
+		if (!account_exists(server.dmNames[i]))
+			BMT_LOG(WARNING, "DM account '%s' does not exist and nobody can log in with it. Log in with the name once on a server started without --dm to create it", server.dmNames[i].c_str());
+	}
+	if (!recordPath.empty() && start_recording(&server.recorder, recordPath)) {
+		std::random_device device;
+		u64 seed = ((u64)device() << 32) ^ device();
+		seed_dice(seed);
+		record_seed(&server.recorder, seed);
+	}
+	start_server(&server, port);
+	if (adminPort != 0)
+		start_admin(&server, adminPort);
+
+	if (!replayPath.empty()) {
+		ReplayStats stats;
+		if (replay_recording(&server, replayPath, replaySpeed == "realtime", &stats)) {
+			BMT_LOG(INFO, "Replayed %llu messages from %d connections in %.3f s (%.0f messages/s)", (unsigned long long)stats.messages, stats.connections, stats.seconds, stats.seconds > 0 ? stats.messages / stats.seconds : 0.0);
+			BMT_LOG(INFO, "The server answered with %llu bytes, %llu when recorded", (unsigned long long)stats.bytesReceived, (unsigned long long)stats.recordedOut);
+		}
+		running = 0;
+	}
+
+	while (running)
+		boost::this_thread::sleep(boost::posix_time::millisec(SHORT_SLEEP));
+
+	stop_server(&server);
+	stop_rooms(&rooms);
+	stop_recording(&server.recorder);
+	return 0;
+}
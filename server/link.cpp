@@ -0,0 +1,148 @@
+#include "link.h"
+#include <cmath>
+
+Link::Link() : bytesSent(0), bytesAcked(0), ackedAt(0), pingSentAt(0), nextPing(0), nextLossy(0), samples(0), rtt(0), srtt(0), minRtt(0), rate(LINK_MIN_RATE), jitter(0), offset(0), clockSamples(0) {}
+
+u64 link_now() {
+	return clock_us();
+}
+
+void link_sent(Link* link, u64 bytes) {
+	link->bytesSent += bytes;
+}
+
+std::string link_ping(Link* link, u64 now) {
+	//one ping at a time, a client that does not answer is asked again now and then
+	if (link->pingSentAt != 0 && now - link->pingSentAt < (u64)(LINK_PING_TIMEOUT * 1000000))
+		return "";
+	//a congested link is probed as soon as the last pong is in, so it is let go of quickly once it drains
+	if (now < link->nextPing && !link_congested(link, now))
+		return "";
+	link->pingSentAt = now;
+	link->nextPing = now + (u64)(LINK_PING_INTERVAL * 1000000);
+	//format: ping|stamp|rtt|jitter|offset, all in us. the estimates are left off until there are any
+	std::string ping = "ping|" + std::to_string(now);
+	if (link->samples != 0) {
+		ping.append("|" + std::to_string((i64)(link->rtt * 1000000)));
+		ping.append("|" + std::to_string((i64)(link->jitter * 1000000)));
+		ping.append("|" + std::to_string((i64)(link->offset * 1000000)));
+	}
+	ping.append("\n");
+	return ping;
+}
+
+void link_pong(Link* link, u64 stamp, u64 received, u64 clientRead, u64 clientSent, u64 now) {
+	if (stamp != link->pingSentAt || now < stamp || received < link->bytesAcked || received > link->bytesSent)
+		return;
+	//the time the client took to answer is not the network's
+	f64 answering = clientSent >= clientRead ? (clientSent - clientRead) / 1000000.0 : 0;
+	f64 rtt = std::max((now - stamp) / 1000000.0 - answering, 0.0);
+	if (link->samples == 0) {
+		link->srtt = rtt;
+		link->minRtt = rtt;
+	}
+	else {
+		link->jitter += (std::abs(rtt - link->rtt) - link->jitter) / 16;
+		link->srtt += (rtt - link->srtt) / 8;
+		link->minRtt = std::min(link->minRtt, rtt);
+		//what the client read between two pongs. on a quiet link that is only what we sent, so
+		//the estimate keeps the best recent sample and only slowly forgets it
+		f64 seconds = (now - link->ackedAt) / 1000000.0;
+		if (seconds > 0)
+			link->rate = std::max(link->rate * LINK_RATE_DECAY, (received - link->bytesAcked) / seconds);
+		link->rate = std::max(link->rate, (f64)LINK_MIN_RATE);
+	}
+	link->rtt = rtt;
+	link->bytesAcked = received;
+	link->ackedAt = now;
+	link->pingSentAt = 0;
+	link->samples++;
+
+	if (clientRead == 0)
+		return;
+	//the client's clock less ours, if the ping took as long to get there as the pong took to come back
+	ClockSample* sample = &link->clock[link->clockSamples % LINK_CLOCK_SAMPLES];
+	sample->rtt = rtt;
+	sample->offset = (((i64)clientRead - (i64)stamp) + ((i64)clientSent - (i64)now)) / 2000000.0;
+	link->clockSamples++;
+	//the quickest exchange spent the least time queued, and queues are what make the two ways differ
+	u32 count = std::min(link->clockSamples, (u32)LINK_CLOCK_SAMPLES);
+	ClockSample* best = &link->clock[0];
+	for (u32 i = 1; i < count; ++i) {
+		if (link->clock[i].rtt < best->rtt)
+			best = &link->clock[i];
+	}
+	link->offset = best->offset;
+}
+
+bool link_congested(const Link* link, u64 now) {
+	if (link->samples == 0)
+		return false;
+	//the last ping waited behind a queue
+	if (link->rtt - link->minRtt > LINK_QUEUE_TARGET)
+		return true;
+	//or more has been sent since than the client could have read at its rate
+	f64 drained = link->rate * (now - link->ackedAt) / 1000000.0;
+	f64 queued = (f64)(link->bytesSent - link->bytesAcked) - drained;
+	return queued > LINK_MIN_WINDOW + link->rate * LINK_QUEUE_TARGET;
+}
+
+//the token a message is about, for the commands whose second field is a handle
+INTERNAL
+bool message_handle(const std::string& message, std::string* command, TokenHandle* handle) {
+	size_t bar = message.find('|');
+	if (bar == std::string::npos)
+		return false;
+	*command = message.substr(0, bar);
+	*handle = parse_handle(message.substr(bar + 1, message.find('|', bar + 1) - bar - 1));
+	return true;
+}
+
+bool is_lossy_message(const std::string& message, TokenHandle* handle) {
+	//a single move line, moves with more lines after them carry something that has to arrive
+	if (message.compare(0, 5, "move|") != 0 || message.find('\n') != message.size() - 1)
+		return false;
+	std::string command;
+	return message_handle(message, &command, handle);
+}
+
+bool hold_lossy(Link* link, TokenHandle handle, const std::string& message) {
+	std::string* slot = &link->held[handle];
+	bool replaced = !slot->empty();
+	*slot = message;
+	return replaced;
+}
+
+void release_before(Link* link, const std::string& message, std::string* packet) {
+	if (link->held.empty())
+		return;
+	std::string command;
+	TokenHandle handle;
+	if (!message_handle(message, &command, &handle))
+		return;
+	//a new map makes every old handle stale
+	if (command == "update_map") {
+		link->held.clear();
+		return;
+	}
+	if (command != "update_token" && command != "set_layer" && command != "delete_token" && command != "move_ack")
+		return;
+	std::map<TokenHandle, std::string>::iterator it = link->held.find(handle);
+	if (it == link->held.end())
+		return;
+	packet->append(it->second);
+	link->held.erase(it);
+}
+
+u64 release_held(Link* link, u64 now, std::string* packet) {
+	if (link->held.empty() || now < link->nextLossy || link_congested(link, now))
+		return 0;
+	u64 bytes = 0;
+	for (std::map<TokenHandle, std::string>::iterator it = link->held.begin(); it != link->held.end(); ++it) {
+		packet->append(it->second);
+		bytes += it->second.size();
+	}
+	link->held.clear();
+	link->nextLossy = now + (u64)(bytes / (link->rate * LINK_LOSSY_SHARE) * 1000000);
+	return bytes;
+}
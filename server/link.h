@@ -0,0 +1,79 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <map>
+#include "../DnDShared/globals.h"
+#include "tokens.h"
+
+#define LINK_PING_INTERVAL  1.0        //seconds between pings on a healthy link
+#define LINK_PING_TIMEOUT   10.0       //seconds before a ping without a pong is given up on
+#define LINK_QUEUE_TARGET   0.1        //seconds of queued data before lossy updates are held back
+#define LINK_MIN_WINDOW     (16 * 1024) //bytes a link may always have queued
+#define LINK_MIN_RATE       (32 * 1024) //bytes per second assumed until the client shows it can take more
+#define LINK_RATE_DECAY     0.98       //per pong, lets the rate estimate come down after the link gets worse
+#define LINK_LOSSY_SHARE    0.5        //part of the estimated rate held back moves may use while catching up
+#define LINK_CLOCK_SAMPLES  8          //pongs the clock offset is picked from
+
+struct ClockSample {
+	f64 rtt;
+	f64 offset;
+};
+
+//What the server knows about one client's connection. Pings go out in the same stream as
+//everything else, so the time to the pong includes whatever was queued ahead of the ping and
+//rises when the client cannot keep up. The pong also carries how many bytes the client has
+//read, which gives the delivery rate between two pongs.
+//
+//The pong carries the client's clock when the ping arrived and when it answered as well, so
+//the two clocks can be compared the way NTP does. Each ping hands the client what was worked
+//out from the pongs before it, so both ends know the round trip and the offset.
+//
+//Moves are the only updates a client can miss without harm, it only needs the newest position
+//of each token. While a link is congested they are held here, one per token, and go out paced
+//to the link's rate once it drains. Everything else is always sent in full and in order.
+struct Link {
+	Link();
+	u64 bytesSent;
+	u64 bytesAcked;  //bytes the client had read when it sent its last pong
+	u64 ackedAt;     //us, when that pong arrived
+	u64 pingSentAt;  //us, 0 while no ping is waiting for its pong, one is outstanding at a time
+	u64 nextPing;
+	u64 nextLossy;   //us, held moves wait until then
+	u32 samples;     //pongs seen, a client that never answers is never held back
+	f64 rtt;         //seconds, the last ping
+	f64 srtt;
+	f64 minRtt;
+	f64 rate;        //bytes per second, the best recent delivery rate
+	f64 jitter;      //seconds, how much the round trip changes from one ping to the next
+	f64 offset;      //seconds the client's clock is ahead of ours
+	ClockSample clock[LINK_CLOCK_SAMPLES];
+	u32 clockSamples;
+	std::map<TokenHandle, std::string> held; //newest move per token that has not been sent
+	std::string inbox; //read from the client after its last newline
+};
+
+typedef std::map<Transport*, Link> LinkTable;
+
+//microseconds on the clock the links are measured with
+u64 link_now();
+void link_sent(Link* link, u64 bytes);
+//the ping line to write if one is due, or an empty string
+std::string link_ping(Link* link, u64 now);
+//a pong for the ping stamped stamp, from a client that had read received bytes when it sent it.
+//clientRead and clientSent are the client's clock when it read the ping and sent the pong, 0
+//from clients that do not send them
+void link_pong(Link* link, u64 stamp, u64 received, u64 clientRead, u64 clientSent, u64 now);
+//true when lossy updates to this client should be held back
+bool link_congested(const Link* link, u64 now);
+
+//messages that may be merged, moves. sets handle to the token it is about
+bool is_lossy_message(const std::string& message, TokenHandle* handle);
+//holds a lossy message, returns true if it replaced an older one for the same token
+bool hold_lossy(Link* link, TokenHandle handle, const std::string& message);
+//appends what is held for messages that have to be seen after it (the same token's updates,
+//acks and deletes) and drops what a new map makes stale
+void release_before(Link* link, const std::string& message, std::string* packet);
+//appends every held message if the link has drained and the pacing allows it, returns the bytes appended
+u64 release_held(Link* link, u64 now, std::string* packet);
+
+#endif
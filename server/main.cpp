@@ -8,23 +8,29 @@
 #include "../DnDShared/font.h"
 #include "../DnDShared/gui.h"
 
-#include "map.h"
+#include "mapview.h"
 
 #include "accounts.h"
 #include "networking.h"
+#include "checkpoint.h"
+#include "simulation.h"
+#include "rooms.h"
+#include "dice.h"
 
 using namespace boost::asio;
 using namespace boost::asio::ip;
 
-INTERNAL StringList rollLog;
-INTERNAL Map map;
+INTERNAL RoomManager rooms;
+INTERNAL Room* table; //the DM console's own room
 INTERNAL boost::mutex mutex;
+//music the console starts when the players do, see music_cue
+INTERNAL i32 cueTrack = -1;
+INTERNAL u64 cueStart;
 
-INTERNAL void receive(Server* server, Socket* sender, StringList* message);
 INTERNAL void draw_usernames(RenderBatch* batch, Server* server);
 INTERNAL void map_input(Map* map);
 INTERNAL void draw_log(RenderBatch* batch);
-INTERNAL void roll_prompt(RenderBatch* batch, Server* server, GameState& state);
+INTERNAL void roll_prompt(RenderBatch* batch, Panel* panel, Font& font, Server* server, GameState& state, TextField* rollField);
 
 const u8 NUM_COLORS = 9;
 
@@ -59,8 +65,7 @@ void set_bar_value(StatusBar* bar, TextField* field1, TextField* field2) {
 
 int main() {
 	Server server;
-	set_receive_callback(&server, receive);
-	start_server(&server);
+	server.rooms = &rooms;
 
 	init_window(1400, 800, "Jojo Tabletop DM Console", false, true, true);
 	init_audio();
@@ -71,19 +76,14 @@ int main() {
 
 	RenderBatch* batch = &create_batch();
 
-	map = { 0 };
-	map.selected = -1;
-	map.width = map.height = 20;
-	map.bgColor = WHITE;
-	map.gridColor = GRAY;
-	Token token = { 0 };
-	token.imgindex = 2;
-	token.xPos = token.yPos = 128;
-	map.tokens.push_back(token);
-	token = { 0 };
-	token.imgindex = 1;
-	token.xPos = token.yPos = 256;
-	map.tokens.push_back(token);
+	//the DM's table is updated by this frame loop, every other room by the room workers
+	start_rooms(&rooms, &server);
+	table = open_room(&rooms, DEFAULT_ROOM_NAME, true);
+
+	//clients are only accepted once there is a map snapshot to send them
+	load_accounts(ACCOUNTS_PATH);
+	start_server(&server);
+	start_admin(&server);
 
 	Shader basic = load_default_shader_2D();
 	GameState state = STATE_IDLE;
@@ -103,6 +103,8 @@ int main() {
 	TextField bar31 = create_textfield(63, 30, 4, 1, INPUT_NUMBERS_ONLY);
 	TextField bar32 = create_textfield(63, 30, 4, 1, INPUT_NUMBERS_ONLY);
 	TextField imageField = create_textfield(35, 30, 2, 1, INPUT_NUMBERS_ONLY);
+	TextField rollField = create_textfield(350, 30, 24, 1, INPUT_EVERYTHING);
+	rollField.text[0] = "1d20";
 
 	//textfields for stand user sheet
 	TextField standUserName = create_textfield(350, 30, 22, 1, INPUT_EVERYTHING);
@@ -133,9 +135,15 @@ int main() {
 
 	f64 zoom = .75;
 	while (window_open()) {
+		apply_commands(&table->sim, &table->checkpointer);
+		if (cueTrack != -1 && clock_us() >= cueStart) {
+			play_sound(music[cueTrack]);
+			cueTrack = -1;
+		}
+
 		vec2 mousePos = get_mouse_pos();
 		zoom += get_scroll_y() * 0.015625f;
-		map_input(&map);
+		map_input(&table->sim.map);
 
 		f32 width  = (f32)get_window_width();
 		f32 height = (f32)get_window_height();
@@ -146,10 +154,16 @@ int main() {
 		begin2D(batch, basic);
 			set_viewport(0, 0, width, height);
 			upload_mat4(basic, "projection", ortho * scale(zoom, zoom, 1));
-			draw_map(batch, &map, zoom);
-			if(state == STATE_IDLE)
-				update_map(batch, &map, &server, state, zoom);
-			draw_tokens(batch, &map, zoom);
+			draw_map(batch, &table->sim.map, zoom);
+			if (state == STATE_IDLE && is_key_down(KEY_W)) {
+				if (update_walls(batch, &table->sim.map, &server, zoom)) {
+					mark_walls_changed(&table->sim, &table->checkpointer);
+				}
+			}
+			else if (state == STATE_IDLE && update_map(batch, &table->sim.map, &server, state, zoom)) {
+				mark_token_changed(&table->sim, &table->checkpointer, token_index(&table->sim.map.tokens, table->sim.map.selected));
+			}
+			draw_tokens(batch, &table->sim.map, zoom);
 		end2D(batch);
 
 		//draw stuff that doesnt scale with zoom
@@ -174,22 +188,27 @@ int main() {
 				}
 				//draw_text(BODY_FONT, "Foreground Color", 56, 38, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
 			}
+			//a player's command may have deleted the token while it was being edited
+			if ((state == STATE_TOKEN_TRANSITION || state == STATE_TOKEN) && token_index(&table->sim.map.tokens, table->sim.map.selected) == -1) {
+				state = STATE_IDLE;
+			}
 			if (state == STATE_TOKEN_TRANSITION) {
-				Token* current = &map.tokens[map.selected];
-				bar11.text[0] = format_text("%d", current->bar1.current);
-				bar12.text[0] = format_text("%d", current->bar1.max);
-				bar21.text[0] = format_text("%d", current->bar2.current);
-				bar22.text[0] = format_text("%d", current->bar2.max);
-				bar31.text[0] = format_text("%d", current->bar3.current);
-				bar32.text[0] = format_text("%d", current->bar3.max);
-				nameField.text[0] = current->name;
-				imageField.text[0] = format_text("%d", current->imgindex);
+				Token current;
+				get_token(&table->sim.map.tokens, token_index(&table->sim.map.tokens, table->sim.map.selected), &current);
+				bar11.text[0] = format_text("%d", current.bars[0].current);
+				bar12.text[0] = format_text("%d", current.bars[0].max);
+				bar21.text[0] = format_text("%d", current.bars[1].current);
+				bar22.text[0] = format_text("%d", current.bars[1].max);
+				bar31.text[0] = format_text("%d", current.bars[2].current);
+				bar32.text[0] = format_text("%d", current.bars[2].max);
+				nameField.text[0] = current.name;
+				imageField.text[0] = format_text("%d", current.imgindex);
 				state = STATE_TOKEN;
 			}
 			if (state == STATE_TOKEN) {
-				Token* current = &map.tokens[map.selected];
+				i32 ndx = token_index(&table->sim.map.tokens, table->sim.map.selected);
 				f32 width = 400;
-				f32 height = 450;
+				f32 height = 500;
 				f32 xPos = (f32)(get_window_width() / 2) - (width / 2);
 				f32 yPos = (f32)(get_window_height() / 2) - (height / 2);
 
@@ -219,25 +238,37 @@ int main() {
 				draw_text_field(batch, &panel, font, &imageField, xPos + 15, yPos + 350);
 
 				if (draw_text_button(batch, "Save Changes", xPos + 15, yPos + 390, FADED_RED, WHITE.xyz)) {
-					set_bar_value(&map.tokens[map.selected].bar1, &bar11, &bar12);
-					set_bar_value(&map.tokens[map.selected].bar2, &bar21, &bar22);
-					set_bar_value(&map.tokens[map.selected].bar3, &bar31, &bar32);
+					Token current;
+					get_token(&table->sim.map.tokens, ndx, &current);
+					set_bar_value(&current.bars[0], &bar11, &bar12);
+					set_bar_value(&current.bars[1], &bar21, &bar22);
+					set_bar_value(&current.bars[2], &bar31, &bar32);
 
 					if (imageField.text.size() >= 0 && imageField.text[0] != "") {
 						i32 imageNum = std::stoi(imageField.text[0]);
 						if(imageNum > 0 && imageNum < TOKEN_IMAGE_COUNT)
-							map.tokens[map.selected].imgindex = imageNum;
+							current.imgindex = imageNum;
 					}
-					map.tokens[map.selected].name = nameField.text[0];
-					send_packet_all(&server, format_text("update_token|%d|%d|%d|%d|%d|%d|%d|%s|%d\n",
-						map.selected, current->bar1.current, current->bar1.max, current->bar2.current, current->bar2.max,
-						current->bar3.current, current->bar3.max, current->name.c_str(), current->imgindex)
+					current.name = nameField.text[0];
+					set_token(&table->sim.map.tokens, ndx, &current);
+					mark_token_changed(&table->sim, &table->checkpointer, ndx);
+					std::string command = format_text("update_token|%u|%d|%d|%d|%d|%d|%d|",
+						table->sim.map.selected, current.bars[0].current, current.bars[0].max, current.bars[1].current, current.bars[1].max,
+						current.bars[2].current, current.bars[2].max
 					);
+					command.append(current.name);
+					command.append(format_text("|%d\n", current.imgindex));
+					send_packet_room(&server, DEFAULT_ROOM, command);
 					state = STATE_IDLE;
 				}
 				if (draw_text_button(batch, "Cancel", xPos + 185, yPos + 390, FADED_RED, WHITE.xyz)) {
 					state = STATE_IDLE;
 				}
+				if (draw_text_button(batch, "Delete Token", xPos + 15, yPos + 440, FADED_RED, WHITE.xyz)) {
+					send_packet_room(&server, DEFAULT_ROOM, format_text("delete_token|%u\n", table->sim.map.selected));
+					delete_token(&table->sim, &table->checkpointer, table->sim.map.selected);
+					state = STATE_IDLE;
+				}
 			}
 			if (state == STATE_STANDSHEET) {
 				f32 width = 700;
@@ -342,25 +373,34 @@ int main() {
 					state = STATE_CIRCLE;
 				}
 				if (draw_icon_button(batch, &turn_button, 10, yPos += 34, 1)) {
-					send_packet_all(&server, "turncounter\n");
+					send_packet_room(&server, DEFAULT_ROOM, "turncounter\n");
 				}
 				if (draw_icon_button(batch, &layers_button, 10, yPos += 34, 1)) {
-
+					//moves the selected token to the next layer, players are never sent GM layer tokens
+					i32 ndx = token_index(&table->sim.map.tokens, table->sim.map.selected);
+					if (ndx != -1) {
+						u8* layer = &table->sim.map.tokens.layer[ndx];
+						*layer = (*layer + 1) % (LAYER_TOKEN + 1);
+						mark_token_changed(&table->sim, &table->checkpointer, ndx);
+						send_packet_room(&server, DEFAULT_ROOM, format_text("set_layer|%u|%d\n", table->sim.map.selected, *layer));
+					}
 				}
 				if (draw_icon_button(batch, &roundabout_button, 10, yPos += 34, 1)) {
-					send_packet_all(&server, "roundabout\nplay_music|1\n");
-					play_sound(music[1]);
+					send_packet_room(&server, DEFAULT_ROOM, "roundabout\n" + music_cue(1));
+					cueTrack = 1;
+					cueStart = clock_us() + (u64)(CUE_LEAD * 1000000);
 				}
 				if (draw_icon_button(batch, &battle_music_button, 10, yPos += 34, 1)) {
-					send_packet_all(&server, "play_music|0\n");
-					play_sound(music[0]);
+					send_packet_room(&server, DEFAULT_ROOM, music_cue(0));
+					cueTrack = 0;
+					cueStart = clock_us() + (u64)(CUE_LEAD * 1000000);
 				}
 				if (draw_icon_button(batch, &menacing_button, 10, yPos += 34, 1)) {
-					send_packet_all(&server, "menacing\n");
+					send_packet_room(&server, DEFAULT_ROOM, "menacing\n");
 				}
 			}
 			if (state == STATE_ROLL_PROMPT) {
-				roll_prompt(batch, &server, state);
+				roll_prompt(batch, &panel, font, &server, state, &rollField);
 			}
 
 			draw_texture(batch, cursor, (i32)mousePos.x, (i32)mousePos.y);
@@ -368,102 +408,26 @@ int main() {
 		end_gui(&panel);
 		end2D(batch);
 		end_drawing();
+
+		tick_fog(table);
+		publish_snapshot(&table->sim);
+		checkpoint_tick(&table->checkpointer, &table->sim.map, &table->sim.rollLog, &server, get_elapsed_time());
 	}
 	stop_server(&server);
+	stop_rooms(&rooms);
 	dispose_window();
 
 	return 0;
 }
 
-//receive messages from clients (these are automatically sent back to other connected clients as well)
-INTERNAL
-void receive(Server* server, Socket* sender, StringList* message) {
-	if (message->at(0) == "roll") {
-		std::string str;
-		str.append(message->at(2));
-		str.append(" rolled a dice(1-6): ");
-		str.append(message->at(3));
-		str.pop_back();
-		rollLog.push_back(str);
-		if (rollLog.size() > 15) {
-			rollLog.erase(rollLog.begin());
-		}
-	}
-	if (message->at(0) == "move") {
-		map.tokens[std::atoi( message->at(1).c_str() )].xPos = std::atoi( message->at(2).c_str() );
-		map.tokens[std::atoi( message->at(1).c_str() )].yPos = std::atoi( message->at(3).c_str() );
-	}
-	if (message->at(0) == "update_token") {
-		i32 ndx = std::stoi(message->at(1));
-		if (ndx == -1) {
-			Token token = { 0 };
-			map.tokens.push_back(token);
-			ndx = map.tokens.size() - 1;
-		}
-		map.tokens[ndx].bar1.current = std::stoi(message->at(2));
-		map.tokens[ndx].bar1.max = std::stoi(message->at(3));
-		map.tokens[ndx].bar2.current = std::stoi(message->at(4));
-		map.tokens[ndx].bar2.max = std::stoi(message->at(5));
-		map.tokens[ndx].bar3.current = std::stoi(message->at(6));
-		map.tokens[ndx].bar3.max = std::stoi(message->at(7));
-		map.tokens[ndx].name = message->at(8);
-		map.tokens[ndx].imgindex = std::stoi(message->at(9));
-	}
-	if (message->at(0) == "name") {
-		//format: update_map|width|height|xPos|yPos|grid|fow|bgColor|gridColor|selected\n
-		send_packet_all(server, format_text("update_map|%d|%d|%d|%d|%d|%d|%f|%f|%f|%f|%f|%f|%f|%f|%d\n",
-			map.width, map.height, map.xPos, map.yPos, map.grid, map.fow, map.bgColor.x, map.bgColor.y, map.bgColor.z, map.bgColor.w,
-			map.gridColor.x, map.gridColor.y, map.gridColor.z, map.gridColor.w, -1)
-		);
-
-		for (int i = 0; i < map.tokens.size(); ++i) {
-			Token* current = &map.tokens[i];
-			std::string command = format_text("update_token|-1|%d|%d|%d|%d|%d|%d|%s|%d\n",
-				current->bar1.current, current->bar1.max, current->bar2.current, current->bar2.max,
-				current->bar3.current, current->bar3.max, current->name.c_str(), current->imgindex
-			);
-			send_packet_all(server, command);
-		}
-	}
-	if (message->at(0) == "update_map") {
-		map.tokens.clear();
-		map.rects.clear();
-		map = { 0 };
-
-		map.width = std::stoi(message->at(1));
-		map.height = std::stoi(message->at(2));
-		map.xPos = std::stoi(message->at(3));
-		map.yPos = std::stoi(message->at(4));
-		map.grid = std::stoi(message->at(5));
-		map.fow = std::stoi(message->at(6));
-		map.bgColor = { std::stof(message->at(7)), std::stof(message->at(8)), std::stof(message->at(9)), std::stof(message->at(10)) };
-		map.gridColor = { std::stof(message->at(11)), std::stof(message->at(12)), std::stof(message->at(13)), std::stof(message->at(14)) };
-		map.selected = std::stoi(message->at(15));
-	}
-	if (message->at(0) == "update_account") {
-		server->userListMutex.lock();
-		for (u32 i = 0; i < server->users.size(); ++i) {
-			if (message->at(1) == server->users.at(i).name) {
-				message->erase(message->begin());
-				Account acc;
-				acc.name = message->at(0);
-				acc.pass = message->at(1);
-				read_stand_charsheet(&acc.standsheet, message);
-				read_user_charsheet(&acc.usersheet, message);
-				write_account_data(&acc);
-				break;
-			}
-		}
-		server->userListMutex.unlock();
-	}
-}
-
 //draw the names of the connected players at the bottom of the screen
 INTERNAL
 void draw_usernames(RenderBatch* batch, Server* server) {
 	server->userListMutex.lock();
+	i32 shown = 0;
 	for (int i = 0; i < server->users.size(); ++i) {
-		i32 x = (i * 110) + 20;
+		if (server->users[i].room != DEFAULT_ROOM) continue;
+		i32 x = (shown++ * 110) + 20;
 		i32 y = get_window_height() - 40;
 		i32 width = get_string_width(BODY_FONT, server->users[i].name.c_str()) + 8;
 		i32 height = 30;
@@ -474,40 +438,40 @@ void draw_usernames(RenderBatch* batch, Server* server) {
 	server->userListMutex.unlock();
 }
 
-//decide whether to roll privately or publically
+//decide what to roll and whether to roll privately or publically
 INTERNAL
-void roll_prompt(RenderBatch* batch, Server* server, GameState& state) {
+void roll_prompt(RenderBatch* batch, Panel* panel, Font& font, Server* server, GameState& state, TextField* rollField) {
 	f32 width = (f32)get_window_width();
 	f32 height = (f32)get_window_height();
-
-	draw_outline(batch, (width / 2) - (button_tex_n.width / 2) - 190 - 30, (height / 2) - (button_tex_n.height / 2) - 30, 400, 100);
-
-	if (draw_text_button(batch, "Roll Privately", (width / 2) - (button_tex_n.width / 2), (height / 2) - (button_tex_n.height / 2), FADED_RED, WHITE.xyz)) {
-		state = STATE_IDLE;
-		i32 num = random_int(1, 6);
-		std::string str = "I rolled a dice(1-6): ";
-		str.append(std::to_string(num));
-		rollLog.push_back(str);
-		if (rollLog.size() > 15) {
-			rollLog.erase(rollLog.begin());
-		}
-		//roll to self
+	f32 x = (width / 2) - (button_tex_n.width / 2);
+	f32 y = (height / 2) - (button_tex_n.height / 2);
+
+	draw_outline(batch, x - 190 - 30, y - 80, 400, 150);
+	draw_text(batch, &font, "Roll (e.g. 1d20+3, 4d6kh3, 8#1d20)", x - 190, y - 65, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+	draw_text_field(batch, panel, font, rollField, x - 190, y - 40);
+
+	bool privately = draw_text_button(batch, "Roll Privately", x, y, FADED_RED, WHITE.xyz);
+	bool publically = draw_text_button(batch, "Roll Publically", x - 190, y, FADED_RED, WHITE.xyz);
+	if (!privately && !publically)
+		return;
+	state = STATE_IDLE;
+
+	DiceExpr expr;
+	std::string error;
+	if (!compile_dice(get_text(rollField), &expr, &error)) {
+		add_roll(&table->sim, &table->checkpointer, "Bad roll: " + error);
+		return;
 	}
-	if (draw_text_button(batch, "Roll Publically", (width / 2) - (button_tex_n.width / 2) - 190, (height / 2) - (button_tex_n.height / 2), FADED_RED, WHITE.xyz)) {
-		state = STATE_IDLE;
-		i32 num = random_int(1, 6);
-		std::string str = "I rolled a dice(1-6): ";
-		str.append(std::to_string(num));
-		rollLog.push_back(str);
-		if (rollLog.size() > 15) {
-			rollLog.erase(rollLog.begin());
-		}
-
-		std::string msg = "roll|1|The DM|";
-		msg.append(std::to_string(num));
-		msg.append("\n");
-		//roll to all clients.
-		send_packet_all(server, msg);
+	DiceResult result;
+	roll_dice(&expr, &result);
+	u64 id = next_roll_id();
+	add_roll(&table->sim, &table->checkpointer, roll_log_line("The DM", &expr, &result));
+
+	//private rolls only go into the DM's own log
+	if (publically) {
+		std::string msg;
+		append_roll_result(&msg, id, true, "The DM", &expr, &result);
+		send_packet_room(server, DEFAULT_ROOM, msg);
 	}
 }
 
@@ -515,8 +479,8 @@ INTERNAL
 void draw_log(RenderBatch* batch) {
 	draw_outline(batch, get_window_width() - 255, 0, 255, get_window_height());
 
-	for (u16 i = 0; i < rollLog.size(); ++i) {
-		draw_text(batch, &BODY_FONT, rollLog[i], get_window_width() - 240, 10 + (i * 25), DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+	for (u16 i = 0; i < table->sim.rollLog.size(); ++i) {
+		draw_text(batch, &BODY_FONT, table->sim.rollLog[i], get_window_width() - 240, 10 + (i * 25), DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
 	}
 }
 
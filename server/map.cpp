@@ -1,2 +1,237 @@
 #include "map.h"
+#include "mapfile.h"
+#include <fstream>
 
+INTERNAL inline
+void copy_color(f32* dest, vec4 color) {
+	dest[0] = color.x;
+	dest[1] = color.y;
+	dest[2] = color.z;
+	dest[3] = color.w;
+}
+
+INTERNAL inline
+vec4 read_color(const f32* src) {
+	return V4(src[0], src[1], src[2], src[3]);
+}
+
+void pack_map_info(MapInfoRecord* record, Map* map) {
+	*record = { 0 };
+	record->width = map->width;
+	record->height = map->height;
+	record->xPos = map->xPos;
+	record->yPos = map->yPos;
+	record->grid = map->grid;
+	record->fow = map->fow;
+	copy_color(record->bgColor, map->bgColor);
+	copy_color(record->gridColor, map->gridColor);
+}
+
+bool unpack_map_info(Map* map, const MapInfoRecord* record) {
+	if (!map_size_valid(record->width, record->height))
+		return false;
+	map->width = record->width;
+	map->height = record->height;
+	map->xPos = record->xPos;
+	map->yPos = record->yPos;
+	map->grid = record->grid != 0;
+	map->fow = record->fow != 0;
+	map->bgColor = read_color(record->bgColor);
+	map->gridColor = read_color(record->gridColor);
+	fit_walls(map);
+	return true;
+}
+
+void pack_token(TokenRecord* record, const TokenStore* tokens, u32 index, u32 nameOffset) {
+	*record = { 0 };
+	record->imgindex = tokens->imgindex[index];
+	record->anchorToTile = tokens->anchorToTile[index];
+	record->layer = tokens->layer[index];
+	record->xPos = tokens->xPos[index];
+	record->yPos = tokens->yPos[index];
+	for (u32 i = 0; i < TOKEN_BARS; ++i) {
+		record->bars[i * 2] = tokens->bars[i][index].current;
+		record->bars[i * 2 + 1] = tokens->bars[i][index].max;
+	}
+	copy_color(record->tintColor, tokens->tintColor[index]);
+	record->nameOffset = nameOffset;
+	record->nameLength = tokens->names[index].size();
+}
+
+void unpack_token(TokenStore* tokens, u32 index, const TokenRecord* record, const char* strings, u32 stringsSize) {
+	tokens->imgindex[index] = record->imgindex < TOKEN_IMAGE_COUNT ? record->imgindex : 0;
+	tokens->anchorToTile[index] = record->anchorToTile != 0;
+	tokens->layer[index] = record->layer <= LAYER_TOKEN ? record->layer : LAYER_MAP;
+	move_token(tokens, index, record->xPos, record->yPos);
+	for (u32 i = 0; i < TOKEN_BARS; ++i) {
+		tokens->bars[i][index].current = record->bars[i * 2];
+		tokens->bars[i][index].max = record->bars[i * 2 + 1];
+	}
+	tokens->tintColor[index] = read_color(record->tintColor);
+	tokens->names[index].clear();
+	if (strings != NULL && (u64)record->nameOffset + record->nameLength <= stringsSize)
+		tokens->names[index].assign(strings + record->nameOffset, record->nameLength);
+}
+
+void pack_rect(RectRecord* record, RectShape* shape) {
+	*record = { 0 };
+	record->dim[0] = shape->dim.x;
+	record->dim[1] = shape->dim.y;
+	record->dim[2] = shape->dim.width;
+	record->dim[3] = shape->dim.height;
+	copy_color(record->bgcolor, shape->bgcolor);
+	copy_color(record->fgcolor, shape->fgcolor);
+	record->thickness = shape->thickness;
+}
+
+void unpack_rect(RectShape* shape, const RectRecord* record) {
+	shape->dim = rect(record->dim[0], record->dim[1], record->dim[2], record->dim[3]);
+	shape->bgcolor = read_color(record->bgcolor);
+	shape->fgcolor = read_color(record->fgcolor);
+	shape->thickness = record->thickness;
+}
+
+INTERNAL
+void add_section(std::string* file, std::vector<MapSection>* table, MapSectionId id, u32 elementSize, u32 count, const void* data) {
+	while (file->size() % MAP_FILE_ALIGN != 0)
+		file->push_back('\0');
+
+	MapSection section = { 0 };
+	section.id = id;
+	section.elementSize = elementSize;
+	section.count = count;
+	section.offset = file->size();
+	section.size = (u64)elementSize * count;
+	table->push_back(section);
+
+	file->append((const char*)data, section.size);
+}
+
+void index_rects(Map* map) {
+	spatial_clear(&map->rectGrid);
+	for (u32 i = 0; i < map->rects.size(); ++i) {
+		Rect dim = map->rects[i].dim;
+		spatial_insert(&map->rectGrid, i, dim.x, dim.y, dim.width, dim.height);
+	}
+}
+
+void fit_walls(Map* map) {
+	if (map->walls.width != map->width || map->walls.height != map->height || map->walls.words.empty())
+		resize_bits(&map->walls, map->width, map->height);
+}
+
+bool load_map(Map* map, const char* path) {
+	MapFile file;
+	if (!open_map_file(&file, path))
+		return false;
+
+	u32 count = 0;
+	const MapInfoRecord* info = (const MapInfoRecord*)find_section(&file, SECTION_MAP_INFO, sizeof(MapInfoRecord), &count);
+	if (info == NULL || count != 1) {
+		BMT_LOG(WARNING, "Map file '%s' has no map info", path);
+		close_map_file(&file);
+		return false;
+	}
+	if (!map_size_valid(info->width, info->height)) {
+		BMT_LOG(WARNING, "Map file '%s' is %ux%u, the most is %dx%d", path, info->width, info->height, MAP_MAX_SIDE, MAP_MAX_SIDE);
+		close_map_file(&file);
+		return false;
+	}
+
+	u32 stringsSize = 0;
+	const char* strings = (const char*)find_section(&file, SECTION_STRINGS, 1, &stringsSize);
+
+	clear_tokens(&map->tokens);
+	map->rects.clear();
+	unpack_map_info(map, info);
+	map->selected = TOKEN_NONE;
+
+	//handles are not saved, the tokens get new ones every time the map is loaded
+	const TokenRecord* tokens = (const TokenRecord*)find_section(&file, SECTION_TOKENS, sizeof(TokenRecord), &count);
+	resize_tokens(&map->tokens, count);
+	for (u32 i = 0; i < token_count(&map->tokens); ++i) {
+		unpack_token(&map->tokens, i, &tokens[i], strings, stringsSize);
+	}
+
+	const RectRecord* rects = (const RectRecord*)find_section(&file, SECTION_RECTS, sizeof(RectRecord), &count);
+	map->rects.resize(count);
+	for (u32 i = 0; i < count; ++i) {
+		unpack_rect(&map->rects[i], &rects[i]);
+	}
+	index_rects(map);
+
+	//maps saved before walls existed have no tiles section
+	clear_bits(&map->walls);
+	const u8* tiles = (const u8*)find_section(&file, SECTION_TILES, 1, &count);
+	if (tiles != NULL && count == (u64)map->width * map->height) {
+		for (u32 i = 0; i < count; ++i)
+			set_bit(&map->walls, i, (tiles[i] & TILE_WALL) != 0);
+	}
+
+	close_map_file(&file);
+	BMT_LOG(INFO, "Loaded map '%s' (%dx%d, %d tokens, %d rects)", path, map->width, map->height, token_count(&map->tokens), map->rects.size());
+	return true;
+}
+
+bool save_map(Map* map, const char* path) {
+	MapInfoRecord info;
+	pack_map_info(&info, map);
+
+	std::string strings;
+	std::vector<TokenRecord> tokens(token_count(&map->tokens));
+	for (u32 i = 0; i < tokens.size(); ++i) {
+		pack_token(&tokens[i], &map->tokens, i, strings.size());
+		strings.append(map->tokens.names[i]);
+	}
+
+	std::vector<RectRecord> rects(map->rects.size());
+	for (u32 i = 0; i < map->rects.size(); ++i) {
+		pack_rect(&rects[i], &map->rects[i]);
+	}
+
+	std::vector<u8> tiles((u64)map->width * map->height, 0);
+	for (u32 i = 0; i < tiles.size() && i < (u64)map->walls.width * map->walls.height; ++i) {
+		if (get_bit(&map->walls, i))
+			tiles[i] |= TILE_WALL;
+	}
+
+	//lay the sections out after a placeholder header and table, then fill those in
+	const u16 sectionCount = 5;
+	std::string file(sizeof(MapFileHeader) + sectionCount * sizeof(MapSection), '\0');
+	std::vector<MapSection> table;
+	add_section(&file, &table, SECTION_MAP_INFO, sizeof(MapInfoRecord), 1, &info);
+	add_section(&file, &table, SECTION_TOKENS, sizeof(TokenRecord), tokens.size(), tokens.data());
+	add_section(&file, &table, SECTION_RECTS, sizeof(RectRecord), rects.size(), rects.data());
+	add_section(&file, &table, SECTION_STRINGS, 1, strings.size(), strings.data());
+	add_section(&file, &table, SECTION_TILES, 1, tiles.size(), tiles.data());
+
+	MapFileHeader header = { 0 };
+	header.magic = MAP_FILE_MAGIC;
+	header.version = MAP_FILE_VERSION;
+	header.sectionCount = sectionCount;
+	header.fileSize = file.size();
+	memcpy(&file[0], &header, sizeof(header));
+	memcpy(&file[sizeof(header)], table.data(), sectionCount * sizeof(MapSection));
+
+	//write next to the old file and swap it in so a crash never leaves a half written map
+	std::string tempPath = path;
+	tempPath.append(".tmp");
+	std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		BMT_LOG(WARNING, "Could not write map file '%s'", tempPath.c_str());
+		return false;
+	}
+	out.write(file.data(), file.size());
+	out.close();
+	if (out.fail()) {
+		BMT_LOG(WARNING, "Could not write map file '%s'", tempPath.c_str());
+		return false;
+	}
+	if (!replace_file(tempPath.c_str(), path)) {
+		BMT_LOG(WARNING, "Could not replace map file '%s'", path);
+		return false;
+	}
+
+	BMT_LOG(INFO, "Saved map '%s' (%d bytes)", path, file.size());
+	return true;
+}
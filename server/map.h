@@ -3,44 +3,27 @@
 
 #include "globals.h"
 #include "networking.h"
-#include "../DnDShared/gui.h"
+#include "tokens.h"
+#include "bitgrid.h"
 #include <bahamut.h>
 
-enum Layer {
-	LAYER_MAP,
-	LAYER_GM,
-	LAYER_TOKEN
-};
+//Game state only, shared by the DM console and the headless server. Anything that draws
+//or reads input lives in mapview.h.
 
-enum GameState {
-	STATE_IDLE,
-	STATE_CHARSHEET,
-	STATE_STANDSHEET,
-	STATE_TOKEN_TRANSITION,
-	STATE_TOKEN,
-	STATE_SQUARE,
-	STATE_SQUARE_SELECT,
-	STATE_CIRCLE,
-	STATE_ROLL_PROMPT,
-	STATE_ROLL
-};
+//a session's interest set is a mask of the layers it is sent updates for
+#define LAYERS_PLAYER    (LAYER_BIT(LAYER_MAP) | LAYER_BIT(LAYER_TOKEN))
+#define LAYERS_DM        (LAYERS_PLAYER | LAYER_BIT(LAYER_GM))
+#define LAYER_ANY        0xFF //messages that are not about one token
 
-struct StatusBar {
-	i32 current;
-	i32 max;
-};
+//widest and tallest map in tiles. walls and fog take a bit per tile, so this bounds what a
+//map file, checkpoint or update_map can make the server allocate
+#define MAP_MAX_SIDE     4096
 
-struct Token {
-	u16 imgindex;
-	StatusBar bar1;
-	StatusBar bar2;
-	StatusBar bar3;
-	std::string name;
-	vec4 tintColor;
-	bool anchorToTile;
-	i32 xPos;
-	i32 yPos;
-};
+//whether a session with the given interest set is sent a token on this layer
+INTERNAL inline
+bool can_see(u8 layers, u8 layer) {
+	return (layers & LAYER_BIT(layer)) != 0;
+}
 
 struct RectShape {
 	u8 thickness;
@@ -49,7 +32,6 @@ struct RectShape {
 	vec4 fgcolor;
 };
 
-typedef std::vector<Token> TokenList;
 typedef std::vector<RectShape> RectList;
 
 struct Map {
@@ -61,11 +43,13 @@ struct Map {
 	bool fow;
 	vec4 bgColor;
 	vec4 gridColor;
-	TokenList tokens;
+	TokenStore tokens;
 	RectList rects;
-	Sound music;
+	SpatialGrid rectGrid; //rects by index, rebuilt with index_rects whenever rects changes
+	BitGrid walls;        //tiles that block sight, always width x height
+	u32 revision;         //bumped whenever the map is replaced by a new one
 
-	i16 selected;
+	TokenHandle selected;
 };
 
 static inline
@@ -89,160 +73,18 @@ i32 roundUp(i32 numToRound, i32 multiple) {
 		return numToRound + multiple - remainder;
 }
 
+//false for a map with no tiles or a side over MAP_MAX_SIDE
 INTERNAL inline
-Map load_map(const char* path) {
-	Map map = { 0 };
-
-	map.selected = -1;
-
-	return map;
-}
-
-INTERNAL inline
-void save_map(Map* map, const char* path) {
-
+bool map_size_valid(u64 width, u64 height) {
+	return width > 0 && height > 0 && width <= MAP_MAX_SIDE && height <= MAP_MAX_SIDE;
 }
 
-INTERNAL inline
-void draw_status_bar(RenderBatch* batch, i32 x, i32 y, StatusBar bar, vec4 color) {
-	if (bar.max != 0) {
-		draw_rectangle(batch, x-1, y-1, TILESIZE+4, 16, BLACK);
-		draw_rectangle(batch, x + 2, y + 2, TILESIZE - 2, 10, WHITE);
-		f32 width = (f32)((f32)bar.current / (f32)bar.max) * (TILESIZE - 2);
-		draw_rectangle(batch, x + 2, y + 2, width, 10, color);
-	}
-}
+void index_rects(Map* map);
+//sizes walls to the map, clearing them if the size changed
+void fit_walls(Map* map);
 
-INTERNAL inline
-bool draw_icon_button(RenderBatch* batch, Texture* tex, const u16 xPos, const u16 yPos, const f64 zoom) {
-	const Rect button = rect(xPos, yPos, tex->width, tex->height);
-	vec2 mouse_pos = get_mouse_pos();
-	mouse_pos.x /= zoom;
-	mouse_pos.y /= zoom;
-	const bool collided = colliding(button, mouse_pos.x, mouse_pos.y);
-	const bool buttonReleased = is_button_released(MOUSE_BUTTON_LEFT);
-
-	if (collided) {
-		draw_texture(batch, *tex, xPos, yPos);
-	}
-	else
-		draw_texture(batch, *tex, xPos, yPos, V4(200, 200, 200, 200)); //highlight if mouse is on button
-
-	return collided & buttonReleased;
-}
-
-INTERNAL inline
-void update_map(RenderBatch* batch, Map* map, Server* server, GameState& state, f64 zoom) {
-	vec2 mousePos = get_mouse_pos();
-	mousePos.x /= zoom;
-	mousePos.y /= zoom;
-
-	if (is_button_released(MOUSE_BUTTON_RIGHT))
-		map->selected = -1;
-
-	if (map->selected != -1) {
-		bool mouseInsideMap = false;
-		bool hoveredButton = false;
-		Token* current = &map->tokens[map->selected];
-
-		vec2 tile = V2(roundUp(mousePos.x - map->xPos, TILESIZE) - TILESIZE, roundUp(mousePos.y - map->yPos, TILESIZE) - TILESIZE);
-		Rect button = rect(map->xPos + current->xPos, map->yPos + current->yPos + TILESIZE, settings_icon.width, settings_icon.height);
-		if (tile.x / TILESIZE >= 0 && tile.y / TILESIZE >= 0 && tile.x / TILESIZE < map->width && tile.y / TILESIZE < map->height) mouseInsideMap = true;
-		if (colliding(button, mousePos.x, mousePos.y)) hoveredButton = true;
-
-		if (mouseInsideMap && !hoveredButton)
-			draw_rectangle(batch, tile.x + map->xPos, tile.y + map->yPos, TILESIZE, TILESIZE, V4(150, 40, 150, 120));
-
-		if (draw_icon_button(batch, &settings_icon, map->xPos + current->xPos, map->yPos + current->yPos + TILESIZE, zoom)) {
-			state = STATE_TOKEN_TRANSITION;
-		}
-
-		if (is_button_released(MOUSE_BUTTON_LEFT) && mouseInsideMap && !hoveredButton) {
-			current->xPos = tile.x;
-			current->yPos = tile.y;
-			std::string command = "move|";
-			command.append(std::to_string(map->selected));
-			command.append("|");
-			command.append(std::to_string(tile.x));
-			command.append("|");
-			command.append(std::to_string(tile.y));
-			command.append("\n");
-			send_packet_all(server, command);
-		}
-	}
-}
-
-INTERNAL inline
-void draw_map(RenderBatch* batch, Map* map, f64 zoom) {
-	vec2 mousePos = get_mouse_pos();
-	mousePos.x /= zoom;
-	mousePos.y /= zoom;
-
-#define PADDING 3
-	i32 x0 = (-map->xPos / (TILESIZE));
-	i32 x1 = (-map->xPos / (TILESIZE)) + ((get_window_width() / zoom) / TILESIZE) + PADDING;
-	i32 y0 = (-map->yPos / (TILESIZE));
-	i32 y1 = (-map->yPos / (TILESIZE)) + ((get_window_height() / zoom) / TILESIZE) + PADDING;
-	clamp(x0, 0, map->width);
-	clamp(y0, 0, map->height);
-	clamp(x1, 0, map->width);
-	clamp(y1, 0, map->height);
-#undef PADDING
-
-	for (u32 x = x0; x < x1; ++x) {
-		for (u32 y = y0; y < y1; ++y) {
-			draw_rectangle(batch, (map->xPos) + (x * TILESIZE), (map->yPos) + (y * TILESIZE), TILESIZE, TILESIZE, map->gridColor);
-			draw_rectangle(batch, (map->xPos) + ((x * TILESIZE) + 4), (map->yPos) + ((y * TILESIZE) + 4), TILESIZE - 8, TILESIZE - 8, map->bgColor);
-		}
-	}
-
-	for (u16 i = 0; i < map->rects.size(); ++i) {
-		RectShape* curr = &map->rects[i];
-		draw_rectangle(batch, curr->dim.x, curr->dim.y, curr->dim.width, curr->dim.height, curr->bgcolor);
-		draw_rectangle(
-			batch,
-			curr->dim.x + curr->thickness,
-			curr->dim.y + curr->thickness,
-			curr->dim.width - curr->thickness * 2,
-			curr->dim.height - curr->thickness * 2,
-			curr->fgcolor
-		);
-	}
-}
-
-INTERNAL inline
-void draw_tokens(RenderBatch* batch, Map* map, f64 zoom) {
-	vec2 mousePos = get_mouse_pos();
-	mousePos.x /= zoom;
-	mousePos.y /= zoom;
-
-	for (u32 i = 0; i < map->tokens.size(); ++i) {
-		Token* current = &map->tokens[i];
-
-		if (map->selected == i) {
-			const u8 highlightSize = 8;
-			draw_rectangle(batch, map->xPos + current->xPos - highlightSize,
-				map->yPos + current->yPos - highlightSize,
-				TILESIZE + (highlightSize * 2),
-				TILESIZE + (highlightSize * 2),
-				SKYBLUE
-			);
-		}
-
-		Rect tokenRect = rect(map->xPos + current->xPos, map->yPos + current->yPos, TILESIZE, TILESIZE);
-		if (colliding(tokenRect, mousePos.x, mousePos.y)) {
-			if (is_button_released(MOUSE_BUTTON_LEFT))
-				map->selected = i;
-			draw_texture(batch, tokenimages[current->imgindex], map->xPos + current->xPos, map->yPos + current->yPos, V4(172, 261, 255, 255));
-		}
-		else {
-			draw_texture(batch, tokenimages[current->imgindex], map->xPos + current->xPos, map->yPos + current->yPos);
-		}
-		draw_status_bar(batch, map->xPos + current->xPos, map->yPos + current->yPos-5, current->bar1, GREEN);
-		draw_status_bar(batch, map->xPos + current->xPos, map->yPos + current->yPos-25, current->bar2, RED);
-		draw_status_bar(batch, map->xPos + current->xPos, map->yPos + current->yPos-45, current->bar3, BLUE);
-		draw_text(batch, &BODY_FONT, current->name, map->xPos + current->xPos + 30, map->yPos + current->yPos + TILESIZE + 15, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
-	}
-}
+//map files are described in mapfile.h
+bool load_map(Map* map, const char* path);
+bool save_map(Map* map, const char* path);
 
-#endif
\ No newline at end of file
+#endif
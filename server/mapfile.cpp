@@ -0,0 +1,71 @@
+#include "mapfile.h"
+
+bool open_map_file(MapFile* file, const char* path) {
+	using namespace boost::interprocess;
+	try {
+		file->file = file_mapping(path, read_only);
+		file->region = mapped_region(file->file, read_only);
+	}
+	catch (interprocess_exception& e) {
+		BMT_LOG(WARNING, "Could not open map file '%s': %s", path, e.what());
+		return false;
+	}
+
+	file->data = (const u8*)file->region.get_address();
+	file->size = file->region.get_size();
+	file->header = (const MapFileHeader*)file->data;
+
+	if (file->size < sizeof(MapFileHeader) || file->header->magic != MAP_FILE_MAGIC) {
+		BMT_LOG(WARNING, "'%s' is not a map file", path);
+		close_map_file(file);
+		return false;
+	}
+	if (file->header->version > MAP_FILE_VERSION) {
+		BMT_LOG(WARNING, "Map file '%s' is version %d, this server only reads up to version %d", path, file->header->version, MAP_FILE_VERSION);
+		close_map_file(file);
+		return false;
+	}
+
+	//validate the section table once so find_section can hand out pointers without checks
+	u64 tableEnd = sizeof(MapFileHeader) + (u64)file->header->sectionCount * sizeof(MapSection);
+	if (tableEnd > file->size || file->header->fileSize != file->size) {
+		BMT_LOG(WARNING, "Map file '%s' is truncated", path);
+		close_map_file(file);
+		return false;
+	}
+	file->sections = (const MapSection*)(file->data + sizeof(MapFileHeader));
+	for (u16 i = 0; i < file->header->sectionCount; ++i) {
+		const MapSection* section = &file->sections[i];
+		if (section->offset % MAP_FILE_ALIGN != 0 || section->offset + section->size > file->size ||
+			(u64)section->elementSize * section->count > section->size) {
+			BMT_LOG(WARNING, "Map file '%s' has a corrupt section table", path);
+			close_map_file(file);
+			return false;
+		}
+	}
+	return true;
+}
+
+void close_map_file(MapFile* file) {
+	file->region = boost::interprocess::mapped_region();
+	file->file = boost::interprocess::file_mapping();
+	file->data = NULL;
+	file->size = 0;
+	file->header = NULL;
+	file->sections = NULL;
+}
+
+const void* find_section(MapFile* file, MapSectionId id, u32 elementSize, u32* count) {
+	for (u16 i = 0; i < file->header->sectionCount; ++i) {
+		if (file->sections[i].id == id) {
+			if (file->sections[i].elementSize != elementSize) {
+				BMT_LOG(WARNING, "Map section %d has %d byte records, expected %d", id, file->sections[i].elementSize, elementSize);
+				break;
+			}
+			*count = file->sections[i].count;
+			return file->data + file->sections[i].offset;
+		}
+	}
+	*count = 0;
+	return NULL;
+}
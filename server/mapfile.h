@@ -0,0 +1,115 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "../DnDShared/defines.h"
+
+//On-disk layout of a map (all values little endian, every section 8 byte aligned):
+//
+//  MapFileHeader
+//  MapSection[header.sectionCount]   <- section table
+//  section data...
+//
+//Sections are flat arrays of the fixed size records below so a mapped file can be
+//used in place. Readers skip section ids they do not know about, which lets newer
+//versions add sections (layers) without breaking older servers.
+
+#define MAP_FILE_MAGIC   0x504D5454 //"TTMP"
+#define MAP_FILE_VERSION 1
+#define MAP_FILE_ALIGN   8
+
+enum MapSectionId {
+	SECTION_MAP_INFO = 1,
+	SECTION_TOKENS   = 2,
+	SECTION_RECTS    = 3,
+	SECTION_STRINGS  = 4,
+	SECTION_TILES    = 5, //u8 TILE_ flags per tile, row major, width * height of them
+	SECTION_LAYERS   = 6  //reserved
+};
+
+struct MapFileHeader {
+	u32 magic;
+	u16 version;
+	u16 sectionCount;
+	u64 fileSize;
+};
+
+struct MapSection {
+	u32 id;
+	u32 elementSize;
+	u32 count;
+	u32 reserved;
+	u64 offset;
+	u64 size;
+};
+
+struct MapInfoRecord {
+	u32 width;
+	u32 height;
+	f32 xPos;
+	f32 yPos;
+	f32 bgColor[4];
+	f32 gridColor[4];
+	u8 grid;
+	u8 fow;
+	u8 reserved[6];
+};
+
+#define TILE_WALL 0x01 //blocks sight
+
+struct TokenRecord {
+	u16 imgindex;
+	u8 anchorToTile;
+	u8 layer; //LAYER_MAP in files written before tokens had layers
+	i32 xPos;
+	i32 yPos;
+	i32 bars[6]; //current/max pairs for bar1, bar2 and bar3
+	f32 tintColor[4];
+	u32 nameOffset; //into SECTION_STRINGS
+	u32 nameLength;
+};
+
+struct RectRecord {
+	f32 dim[4];
+	f32 bgcolor[4];
+	f32 fgcolor[4];
+	u8 thickness;
+	u8 reserved[3];
+};
+
+static_assert(sizeof(MapFileHeader) == 16, "map file header layout changed");
+static_assert(sizeof(MapSection) == 32, "map section layout changed");
+static_assert(sizeof(MapInfoRecord) == 56, "map info record layout changed");
+static_assert(sizeof(TokenRecord) == 60, "token record layout changed");
+static_assert(sizeof(RectRecord) == 52, "rect record layout changed");
+
+struct Map;
+struct TokenStore;
+struct RectShape;
+
+//conversions between the in memory structs and their records, shared with checkpoint.cpp
+void pack_map_info(MapInfoRecord* record, Map* map);
+//false, leaving the map unchanged, when the record's size fails map_size_valid
+bool unpack_map_info(Map* map, const MapInfoRecord* record);
+void pack_token(TokenRecord* record, const TokenStore* tokens, u32 index, u32 nameOffset);
+void unpack_token(TokenStore* tokens, u32 index, const TokenRecord* record, const char* strings, u32 stringsSize);
+void pack_rect(RectRecord* record, RectShape* shape);
+void unpack_rect(RectShape* shape, const RectRecord* record);
+
+//a read only view of a map file. sections point straight into the mapping.
+struct MapFile {
+	boost::interprocess::file_mapping file;
+	boost::interprocess::mapped_region region;
+	const u8* data;
+	u64 size;
+	const MapFileHeader* header;
+	const MapSection* sections;
+};
+
+bool open_map_file(MapFile* file, const char* path);
+void close_map_file(MapFile* file);
+//returns the records of a section or NULL if the file does not contain it with the expected record size
+const void* find_section(MapFile* file, MapSectionId id, u32 elementSize, u32* count);
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef MAPVIEW_H
+#define MAPVIEW_H
+
+#include "map.h"
+#include "../DnDShared/gui.h"
+
+//drawing and mouse handling for the DM console's map view
+
+enum GameState {
+	STATE_IDLE,
+	STATE_CHARSHEET,
+	STATE_STANDSHEET,
+	STATE_TOKEN_TRANSITION,
+	STATE_TOKEN,
+	STATE_SQUARE,
+	STATE_SQUARE_SELECT,
+	STATE_CIRCLE,
+	STATE_ROLL_PROMPT,
+	STATE_ROLL
+};
+
+INTERNAL inline
+void draw_status_bar(RenderBatch* batch, i32 x, i32 y, StatusBar bar, vec4 color) {
+	if (bar.max != 0) {
+		draw_rectangle(batch, x-1, y-1, TILESIZE+4, 16, BLACK);
+		draw_rectangle(batch, x + 2, y + 2, TILESIZE - 2, 10, WHITE);
+		f32 width = (f32)((f32)bar.current / (f32)bar.max) * (TILESIZE - 2);
+		draw_rectangle(batch, x + 2, y + 2, width, 10, color);
+	}
+}
+
+INTERNAL inline
+bool draw_icon_button(RenderBatch* batch, Texture* tex, const u16 xPos, const u16 yPos, const f64 zoom) {
+	const Rect button = rect(xPos, yPos, tex->width, tex->height);
+	vec2 mouse_pos = get_mouse_pos();
+	mouse_pos.x /= zoom;
+	mouse_pos.y /= zoom;
+	const bool collided = colliding(button, mouse_pos.x, mouse_pos.y);
+	const bool buttonReleased = is_button_released(MOUSE_BUTTON_LEFT);
+
+	if (collided) {
+		draw_texture(batch, *tex, xPos, yPos);
+	}
+	else
+		draw_texture(batch, *tex, xPos, yPos, V4(200, 200, 200, 200)); //highlight if mouse is on button
+
+	return collided & buttonReleased;
+}
+
+//returns true if the selected token was moved this frame
+INTERNAL inline
+bool update_map(RenderBatch* batch, Map* map, Server* server, GameState& state, f64 zoom) {
+	vec2 mousePos = get_mouse_pos();
+	mousePos.x /= zoom;
+	mousePos.y /= zoom;
+
+	if (is_button_released(MOUSE_BUTTON_RIGHT))
+		map->selected = TOKEN_NONE;
+
+	i32 ndx = token_index(&map->tokens, map->selected);
+	if (ndx != -1) {
+		bool mouseInsideMap = false;
+		bool hoveredButton = false;
+		i32 xPos = map->tokens.xPos[ndx];
+		i32 yPos = map->tokens.yPos[ndx];
+
+		vec2 tile = V2(roundUp(mousePos.x - map->xPos, TILESIZE) - TILESIZE, roundUp(mousePos.y - map->yPos, TILESIZE) - TILESIZE);
+		Rect button = rect(map->xPos + xPos, map->yPos + yPos + TILESIZE, settings_icon.width, settings_icon.height);
+		if (tile.x / TILESIZE >= 0 && tile.y / TILESIZE >= 0 && tile.x / TILESIZE < map->width && tile.y / TILESIZE < map->height) mouseInsideMap = true;
+		if (colliding(button, mousePos.x, mousePos.y)) hoveredButton = true;
+
+		if (mouseInsideMap && !hoveredButton)
+			draw_rectangle(batch, tile.x + map->xPos, tile.y + map->yPos, TILESIZE, TILESIZE, V4(150, 40, 150, 120));
+
+		if (draw_icon_button(batch, &settings_icon, map->xPos + xPos, map->yPos + yPos + TILESIZE, zoom)) {
+			state = STATE_TOKEN_TRANSITION;
+		}
+
+		if (is_button_released(MOUSE_BUTTON_LEFT) && mouseInsideMap && !hoveredButton) {
+			move_token(&map->tokens, ndx, tile.x, tile.y);
+			std::string command = "move|";
+			command.append(std::to_string(map->selected));
+			command.append("|");
+			command.append(std::to_string(tile.x));
+			command.append("|");
+			command.append(std::to_string(tile.y));
+			command.append("\n");
+			send_packet_room(server, DEFAULT_ROOM, command);
+			return true;
+		}
+	}
+	return false;
+}
+
+//holding W and clicking a tile adds or removes a wall there, returns true if a wall changed
+INTERNAL inline
+bool update_walls(RenderBatch* batch, Map* map, Server* server, f64 zoom) {
+	vec2 mousePos = get_mouse_pos();
+	mousePos.x /= zoom;
+	mousePos.y /= zoom;
+
+	i32 x = (i32)floorf((mousePos.x - map->xPos) / TILESIZE);
+	i32 y = (i32)floorf((mousePos.y - map->yPos) / TILESIZE);
+	if (x < 0 || y < 0 || x >= (i32)map->walls.width || y >= (i32)map->walls.height)
+		return false;
+	draw_rectangle(batch, map->xPos + x * TILESIZE, map->yPos + y * TILESIZE, TILESIZE, TILESIZE, V4(40, 40, 40, 120));
+	if (!is_button_released(MOUSE_BUTTON_LEFT))
+		return false;
+
+	u32 tile = y * map->walls.width + x;
+	bool wall = !get_bit(&map->walls, tile);
+	set_bit(&map->walls, tile, wall);
+	send_packet_room(server, DEFAULT_ROOM, format_text("set_wall|%d|%d|%d\n", x, y, wall));
+	return true;
+}
+
+INTERNAL inline
+void draw_map(RenderBatch* batch, Map* map, f64 zoom) {
+	vec2 mousePos = get_mouse_pos();
+	mousePos.x /= zoom;
+	mousePos.y /= zoom;
+
+#define PADDING 3
+	i32 x0 = (-map->xPos / (TILESIZE));
+	i32 x1 = (-map->xPos / (TILESIZE)) + ((get_window_width() / zoom) / TILESIZE) + PADDING;
+	i32 y0 = (-map->yPos / (TILESIZE));
+	i32 y1 = (-map->yPos / (TILESIZE)) + ((get_window_height() / zoom) / TILESIZE) + PADDING;
+	clamp(x0, 0, map->width);
+	clamp(y0, 0, map->height);
+	clamp(x1, 0, map->width);
+	clamp(y1, 0, map->height);
+#undef PADDING
+
+	for (u32 x = x0; x < x1; ++x) {
+		for (u32 y = y0; y < y1; ++y) {
+			draw_rectangle(batch, (map->xPos) + (x * TILESIZE), (map->yPos) + (y * TILESIZE), TILESIZE, TILESIZE, map->gridColor);
+			draw_rectangle(batch, (map->xPos) + ((x * TILESIZE) + 4), (map->yPos) + ((y * TILESIZE) + 4), TILESIZE - 8, TILESIZE - 8, map->bgColor);
+			if (get_tile(&map->walls, x, y))
+				draw_rectangle(batch, (map->xPos) + ((x * TILESIZE) + 4), (map->yPos) + ((y * TILESIZE) + 4), TILESIZE - 8, TILESIZE - 8, DARKGRAY);
+		}
+	}
+
+	static std::vector<u32> visible;
+	visible.clear();
+	spatial_query_rect(&map->rectGrid, 0, 0, get_window_width() / zoom, get_window_height() / zoom, &visible);
+	std::sort(visible.begin(), visible.end()); //later rects are drawn on top
+	for (u32 i = 0; i < visible.size(); ++i) {
+		RectShape* curr = &map->rects[visible[i]];
+		draw_rectangle(batch, curr->dim.x, curr->dim.y, curr->dim.width, curr->dim.height, curr->bgcolor);
+		draw_rectangle(
+			batch,
+			curr->dim.x + curr->thickness,
+			curr->dim.y + curr->thickness,
+			curr->dim.width - curr->thickness * 2,
+			curr->dim.height - curr->thickness * 2,
+			curr->fgcolor
+		);
+	}
+}
+
+INTERNAL inline
+void draw_tokens(RenderBatch* batch, Map* map, f64 zoom) {
+	vec2 mousePos = get_mouse_pos();
+	mousePos.x /= zoom;
+	mousePos.y /= zoom;
+
+	TokenStore* tokens = &map->tokens;
+	i32 hovered = token_at(tokens, mousePos.x - map->xPos, mousePos.y - map->yPos, LAYER_ANY);
+	if (hovered != -1 && is_button_released(MOUSE_BUTTON_LEFT))
+		map->selected = tokens->handles[hovered];
+	i32 selected = token_index(tokens, map->selected);
+
+	//only tokens on screen are drawn, the extra tile around it covers the bars and names
+	static std::vector<u32> visible;
+	tokens_in_rect(tokens, -map->xPos - TILESIZE, -map->yPos - TILESIZE, get_window_width() / zoom + TILESIZE * 2, get_window_height() / zoom + TILESIZE * 2, LAYER_ANY, &visible);
+
+	if (selected != -1) {
+		const u8 highlightSize = 8;
+		draw_rectangle(batch, map->xPos + tokens->xPos[selected] - highlightSize,
+			map->yPos + tokens->yPos[selected] - highlightSize,
+			TILESIZE + (highlightSize * 2),
+			TILESIZE + (highlightSize * 2),
+			SKYBLUE
+		);
+	}
+
+	//one pass per column keeps each pass reading a single array
+	for (u32 n = 0; n < visible.size(); ++n) {
+		u32 i = visible[n];
+		f32 x = map->xPos + tokens->xPos[i];
+		f32 y = map->yPos + tokens->yPos[i];
+		if ((i32)i == hovered)
+			draw_texture(batch, tokenimages[tokens->imgindex[i]], x, y, V4(172, 261, 255, 255));
+		else //GM layer tokens are faded, only the DM can see them
+			draw_texture(batch, tokenimages[tokens->imgindex[i]], x, y, V4(255, 255, 255, tokens->layer[i] == LAYER_GM ? 120 : 255));
+	}
+	const vec4 barColors[TOKEN_BARS] = { GREEN, RED, BLUE };
+	for (u32 bar = 0; bar < TOKEN_BARS; ++bar) {
+		const StatusBar* bars = tokens->bars[bar].data();
+		for (u32 n = 0; n < visible.size(); ++n) {
+			u32 i = visible[n];
+			draw_status_bar(batch, map->xPos + tokens->xPos[i], map->yPos + tokens->yPos[i] - 5 - (i32)bar * 20, bars[i], barColors[bar]);
+		}
+	}
+	for (u32 n = 0; n < visible.size(); ++n) {
+		u32 i = visible[n];
+		if (!tokens->names[i].empty())
+			draw_text(batch, &BODY_FONT, tokens->names[i], map->xPos + tokens->xPos[i] + 30, map->yPos + tokens->yPos[i] + TILESIZE + 15, DARKGRAY.x, DARKGRAY.y, DARKGRAY.z);
+	}
+}
+
+#endif
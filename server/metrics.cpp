@@ -0,0 +1,261 @@
+#include "metrics.h"
+#include "networking.h"
+#include "rooms.h"
+#include <stdarg.h>
+
+INTERNAL const char* OPCODE_NAMES[OP_COUNT] = {
+	"name", "resume", "move", "update_token", "update_map", "set_layer", "delete_token", "set_wall",
+	"roll", "roll_expr", "get_sheet", "update_sheet", "new_sheet", "play_music", "turncounter",
+	"roundabout", "menacing", "pong", "other"
+};
+
+INTERNAL
+void clear_histogram(Histogram* histogram) {
+	for (u32 i = 0; i < LATENCY_BUCKETS; ++i)
+		histogram->buckets[i] = 0;
+	histogram->sumUs = 0;
+}
+
+Metrics::Metrics() {
+	for (u32 i = 0; i < OP_COUNT; ++i) {
+		inbound[i].messages = 0;
+		inbound[i].bytes = 0;
+		clear_histogram(&inbound[i].latency);
+	}
+	accepts = 0;
+	disconnects = 0;
+	packetsOut = 0;
+	bytesOut = 0;
+	clear_histogram(&tick);
+	tickOverruns = 0;
+	clear_histogram(&rtt);
+	movesMerged = 0;
+}
+
+Opcode find_opcode(const std::string& name) {
+	for (u32 i = 0; i < OP_OTHER; ++i) {
+		if (name == OPCODE_NAMES[i])
+			return (Opcode)i;
+	}
+	return OP_OTHER;
+}
+
+const char* opcode_name(Opcode op) {
+	return OPCODE_NAMES[op < OP_COUNT ? op : OP_OTHER];
+}
+
+void record_latency(Histogram* histogram, u64 us) {
+	//bucket i holds everything up to 2^i us
+	u32 bucket = 0;
+	while (bucket < LATENCY_BUCKETS - 1 && us > ((u64)1 << bucket))
+		bucket++;
+	histogram->buckets[bucket].fetch_add(1, boost::memory_order_relaxed);
+	histogram->sumUs.fetch_add(us, boost::memory_order_relaxed);
+}
+
+void record_message(Metrics* metrics, Opcode op, u64 bytes, u64 us) {
+	OpcodeMetrics* stats = &metrics->inbound[op];
+	stats->messages.fetch_add(1, boost::memory_order_relaxed);
+	stats->bytes.fetch_add(bytes, boost::memory_order_relaxed);
+	record_latency(&stats->latency, us);
+}
+
+void record_packet(Metrics* metrics, u64 bytes) {
+	metrics->packetsOut.fetch_add(1, boost::memory_order_relaxed);
+	metrics->bytesOut.fetch_add(bytes, boost::memory_order_relaxed);
+}
+
+//format_text shares one buffer between threads, scrapes come in on the io thread
+INTERNAL
+void append_line(std::string* out, const char* format, ...) {
+	char line[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	out->append(line);
+	out->append("\n");
+}
+
+INTERNAL
+void append_header(std::string* out, const char* name, const char* type, const char* help) {
+	append_line(out, "# HELP %s %s", name, help);
+	append_line(out, "# TYPE %s %s", name, type);
+}
+
+//labels is empty or like op="move"
+INTERNAL
+void append_histogram(std::string* out, const char* name, const std::string& labels, const Histogram* histogram) {
+	std::string prefix = labels.empty() ? "" : labels + ",";
+	std::string braced = labels.empty() ? "" : "{" + labels + "}";
+	u64 total = 0;
+	for (u32 i = 0; i < LATENCY_BUCKETS; ++i) {
+		total += histogram->buckets[i].load(boost::memory_order_relaxed);
+		if (i < LATENCY_BUCKETS - 1)
+			append_line(out, "%s_bucket{%sle=\"%g\"} %llu", name, prefix.c_str(), ((u64)1 << i) / 1000000.0, (unsigned long long)total);
+	}
+	append_line(out, "%s_bucket{%sle=\"+Inf\"} %llu", name, prefix.c_str(), (unsigned long long)total);
+	append_line(out, "%s_sum%s %f", name, braced.c_str(), histogram->sumUs.load(boost::memory_order_relaxed) / 1000000.0);
+	append_line(out, "%s_count%s %llu", name, braced.c_str(), (unsigned long long)total);
+}
+
+void append_metrics(Server* server, std::string* out) {
+	Metrics* metrics = &server->metrics;
+
+	append_header(out, "tabletop_messages_total", "counter", "Messages received from clients, by opcode.");
+	for (u32 i = 0; i < OP_COUNT; ++i)
+		append_line(out, "tabletop_messages_total{op=\"%s\"} %llu", OPCODE_NAMES[i], (unsigned long long)metrics->inbound[i].messages.load());
+	append_header(out, "tabletop_message_bytes_total", "counter", "Bytes received from clients, by opcode.");
+	for (u32 i = 0; i < OP_COUNT; ++i)
+		append_line(out, "tabletop_message_bytes_total{op=\"%s\"} %llu", OPCODE_NAMES[i], (unsigned long long)metrics->inbound[i].bytes.load());
+	append_header(out, "tabletop_handler_seconds", "histogram", "Time the receive thread spent handling one message, by opcode.");
+	for (u32 i = 0; i < OP_COUNT; ++i) {
+		std::string labels = "op=\"";
+		labels.append(OPCODE_NAMES[i]);
+		labels.append("\"");
+		append_histogram(out, "tabletop_handler_seconds", labels, &metrics->inbound[i].latency);
+	}
+
+	append_header(out, "tabletop_packets_sent_total", "counter", "Packets written to clients.");
+	append_line(out, "tabletop_packets_sent_total %llu", (unsigned long long)metrics->packetsOut.load());
+	append_header(out, "tabletop_bytes_sent_total", "counter", "Bytes written to clients.");
+	append_line(out, "tabletop_bytes_sent_total %llu", (unsigned long long)metrics->bytesOut.load());
+	append_header(out, "tabletop_accepts_total", "counter", "Connections accepted, the accept rate is its rate.");
+	append_line(out, "tabletop_accepts_total %llu", (unsigned long long)metrics->accepts.load());
+	append_header(out, "tabletop_disconnects_total", "counter", "Connections closed.");
+	append_line(out, "tabletop_disconnects_total %llu", (unsigned long long)metrics->disconnects.load());
+
+	server->mutex.lock();
+	u32 sessions = server->clients.size();
+	u32 serverQueue = server->messageQueue.size();
+	u32 congested = 0;
+	u64 now = link_now();
+	std::vector<std::pair<Transport*, Link> > measured;
+	for (LinkTable::iterator it = server->links.begin(); it != server->links.end(); ++it) {
+		congested += link_congested(&it->second, now) ? 1 : 0;
+		if (it->second.samples != 0)
+			measured.push_back(*it);
+	}
+	server->mutex.unlock();
+	append_header(out, "tabletop_sessions", "gauge", "Connected clients.");
+	append_line(out, "tabletop_sessions %d", sessions);
+	append_header(out, "tabletop_broadcast_queue_depth", "gauge", "Broadcasts to every client waiting to be sent.");
+	append_line(out, "tabletop_broadcast_queue_depth %d", serverQueue);
+	append_header(out, "tabletop_congested_sessions", "gauge", "Clients whose moves are being held back and merged.");
+	append_line(out, "tabletop_congested_sessions %d", congested);
+	append_header(out, "tabletop_moves_merged_total", "counter", "Moves to congested clients replaced by a newer move of the same token before being sent.");
+	append_line(out, "tabletop_moves_merged_total %llu", (unsigned long long)metrics->movesMerged.load());
+	append_header(out, "tabletop_link_rtt_seconds", "histogram", "Ping to pong on client connections, the time spent queued behind other data included.");
+	append_histogram(out, "tabletop_link_rtt_seconds", "", &metrics->rtt);
+
+	//only sessions that have answered a ping and logged in, by account
+	std::vector<std::string> names;
+	server->userListMutex.lock();
+	for (u32 i = 0; i < measured.size(); ++i) {
+		std::string name;
+		for (u32 j = 0; j < server->users.size() && name.empty(); ++j) {
+			if (server->users[j].socket == measured[i].first && !server->users[j].pass.empty())
+				name = server->users[j].name;
+		}
+		names.push_back(name);
+	}
+	server->userListMutex.unlock();
+	append_header(out, "tabletop_session_rtt_seconds", "gauge", "Last ping to pong of each session, less the time the client took to answer.");
+	for (u32 i = 0; i < measured.size(); ++i) {
+		if (!names[i].empty())
+			append_line(out, "tabletop_session_rtt_seconds{user=\"%s\"} %f", names[i].c_str(), measured[i].second.rtt);
+	}
+	append_header(out, "tabletop_session_jitter_seconds", "gauge", "How much each session's round trip changes from one ping to the next.");
+	for (u32 i = 0; i < measured.size(); ++i) {
+		if (!names[i].empty())
+			append_line(out, "tabletop_session_jitter_seconds{user=\"%s\"} %f", names[i].c_str(), measured[i].second.jitter);
+	}
+	append_header(out, "tabletop_session_clock_offset_seconds", "gauge", "How far each session's clock is ahead of the server's.");
+	for (u32 i = 0; i < measured.size(); ++i) {
+		if (!names[i].empty())
+			append_line(out, "tabletop_session_clock_offset_seconds{user=\"%s\"} %f", names[i].c_str(), measured[i].second.offset);
+	}
+
+	append_header(out, "tabletop_tick_seconds", "histogram", "Time one room's tick took on its worker.");
+	append_histogram(out, "tabletop_tick_seconds", "", &metrics->tick);
+	append_header(out, "tabletop_tick_overruns_total", "counter", "Worker ticks that took longer than the tick period.");
+	append_line(out, "tabletop_tick_overruns_total %llu", (unsigned long long)metrics->tickOverruns.load());
+
+	if (server->rooms == NULL)
+		return;
+
+	//rooms are only closed under the server mutex, so it keeps them alive while their queues are read
+	RoomManager* manager = server->rooms;
+	server->mutex.lock();
+	manager->mutex.lock();
+	std::vector<Room*> rooms;
+	std::vector<u32> members;
+	for (u32 i = 0; i < manager->rooms.size(); ++i) {
+		if (manager->rooms[i] == NULL)
+			continue;
+		rooms.push_back(manager->rooms[i]);
+		members.push_back(manager->rooms[i]->members.size());
+	}
+	manager->mutex.unlock();
+
+	append_header(out, "tabletop_room_members", "gauge", "Players in each room.");
+	for (u32 i = 0; i < rooms.size(); ++i)
+		append_line(out, "tabletop_room_members{room=\"%s\"} %d", rooms[i]->name.c_str(), members[i]);
+	append_header(out, "tabletop_inbound_queue_depth", "gauge", "Commands waiting for a room to apply them.");
+	for (u32 i = 0; i < rooms.size(); ++i)
+		append_line(out, "tabletop_inbound_queue_depth{room=\"%s\"} %d", rooms[i]->name.c_str(), rooms[i]->sim.queued.load());
+	append_header(out, "tabletop_outbound_queue_depth", "gauge", "Broadcasts waiting for a room's next tick.");
+	for (u32 i = 0; i < rooms.size(); ++i) {
+		rooms[i]->outboxMutex.lock();
+		u32 depth = rooms[i]->outbox.size();
+		rooms[i]->outboxMutex.unlock();
+		append_line(out, "tabletop_outbound_queue_depth{room=\"%s\"} %d", rooms[i]->name.c_str(), depth);
+	}
+	append_header(out, "tabletop_persist_queue_depth", "gauge", "Checkpoints waiting for the writer thread, and chunks waiting for the next checkpoint.");
+	for (u32 i = 0; i < rooms.size(); ++i) {
+		Checkpointer* cp = &rooms[i]->checkpointer;
+		cp->mutex.lock();
+		u32 batches = cp->pending.size();
+		u32 chunks = cp->dirty.size();
+		cp->mutex.unlock();
+		append_line(out, "tabletop_persist_queue_depth{room=\"%s\",kind=\"batches\"} %d", rooms[i]->name.c_str(), batches);
+		append_line(out, "tabletop_persist_queue_depth{room=\"%s\",kind=\"dirty_chunks\"} %d", rooms[i]->name.c_str(), chunks);
+	}
+	server->mutex.unlock();
+}
+
+INTERNAL
+void handle_admin_accept(Server* server, Socket* socket, const boost::system::error_code& error) {
+	if (error) {
+		delete socket;
+		return;
+	}
+	//a scrape is one request: connect, read the text, get disconnected
+	std::string text;
+	append_metrics(server, &text);
+	boost::system::error_code ignored;
+	boost::asio::write(*socket, boost::asio::buffer(text), ignored);
+	socket->shutdown(boost::asio::ip::PROTOCOL::socket::shutdown_both, ignored);
+	socket->close(ignored);
+	delete socket;
+
+	Socket* next = new Socket(server->service);
+	server->adminAcceptor.async_accept(*next, boost::bind(handle_admin_accept, server, next, boost::asio::placeholders::error));
+}
+
+void start_admin(Server* server, u32 port) {
+	boost::asio::ip::PROTOCOL::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+	boost::system::error_code error;
+	server->adminAcceptor.open(endpoint.protocol(), error);
+	if (!error) server->adminAcceptor.set_option(boost::asio::ip::PROTOCOL::acceptor::reuse_address(true), error);
+	if (!error) server->adminAcceptor.bind(endpoint, error);
+	if (!error) server->adminAcceptor.listen(boost::asio::socket_base::max_connections, error);
+	if (error) {
+		BMT_LOG(WARNING, "Could not open the metrics socket on port %d: %s", port, error.message().c_str());
+		return;
+	}
+	BMT_LOG(INFO, "Serving metrics on 127.0.0.1:%d", port);
+
+	Socket* socket = new Socket(server->service);
+	server->adminAcceptor.async_accept(*socket, boost::bind(handle_admin_accept, server, socket, boost::asio::placeholders::error));
+}
@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <boost/atomic.hpp>
+#include "../DnDShared/globals.h"
+
+#define METRICS_PORT      9101 //admin socket, only bound on 127.0.0.1
+#define LATENCY_BUCKETS   18   //powers of two from 1 us, the last one also counts everything slower
+
+//Counters the server bumps as it works, read by scrapers through the admin socket. Every
+//value is a relaxed atomic so recording never takes a lock. Queue depths and the session
+//count are not stored here, they are read from the server and rooms when a scrape comes in.
+enum Opcode {
+	OP_NAME,
+	OP_RESUME,
+	OP_MOVE,
+	OP_UPDATE_TOKEN,
+	OP_UPDATE_MAP,
+	OP_SET_LAYER,
+	OP_DELETE_TOKEN,
+	OP_SET_WALL,
+	OP_ROLL,
+	OP_ROLL_EXPR,
+	OP_GET_SHEET,
+	OP_UPDATE_SHEET,
+	OP_NEW_SHEET,
+	OP_PLAY_MUSIC,
+	OP_TURNCOUNTER,
+	OP_ROUNDABOUT,
+	OP_MENACING,
+	OP_PONG,
+	OP_OTHER,
+	OP_COUNT
+};
+
+struct Histogram {
+	boost::atomic<u64> buckets[LATENCY_BUCKETS];
+	boost::atomic<u64> sumUs;
+};
+
+struct OpcodeMetrics {
+	boost::atomic<u64> messages;
+	boost::atomic<u64> bytes;
+	Histogram latency; //time spent handling one message on the receive thread
+};
+
+struct Metrics {
+	Metrics();
+	OpcodeMetrics inbound[OP_COUNT];
+	boost::atomic<u64> accepts;
+	boost::atomic<u64> disconnects;
+	boost::atomic<u64> packetsOut;
+	boost::atomic<u64> bytesOut;
+	Histogram tick; //one room's tick on its worker
+	boost::atomic<u64> tickOverruns;
+	Histogram rtt; //ping to pong, queueing on the way included
+	boost::atomic<u64> movesMerged;
+};
+
+Opcode find_opcode(const std::string& name);
+const char* opcode_name(Opcode op);
+
+void record_latency(Histogram* histogram, u64 us);
+void record_message(Metrics* metrics, Opcode op, u64 bytes, u64 us);
+void record_packet(Metrics* metrics, u64 bytes);
+
+struct Server;
+//the whole registry in the plain text exposition format (one "name{labels} value" per line)
+void append_metrics(Server* server, std::string* out);
+//serves append_metrics to anything that connects to 127.0.0.1:port, on the server's io thread.
+//call after start_server
+void start_admin(Server* server, u32 port = METRICS_PORT);
+
+#endif
@@ -1,16 +1,64 @@
 #include "networking.h"
+#include "rooms.h"
+#include "dice.h"
+#include <algorithm>
 
-INTERNAL void send_packet_no_lock(Server* server, Socket* client, std::string message);
+INTERNAL void send_packet_no_lock(Server* server, Transport* client, std::string message);
 
+//room broadcasts wait in their room's outbox, everything else in the server queue.
+//the caller holds server->mutex
 INTERNAL
-void handle_accept(Server* server, Socket* client) {
-	server->mutex.lock();
+void queue_broadcast(Server* server, Broadcast* msg) {
+	if (server->rooms == NULL || msg->room == ROOM_ALL || !queue_room_broadcast(server->rooms, msg))
+		server->messageQueue.push(*msg);
+}
+
+//the caller holds server->mutex, NULL once the client has disconnected
+INTERNAL
+Link* find_link(Server* server, Transport* client) {
+	LinkTable::iterator it = server->links.find(client);
+	return it != server->links.end() ? &it->second : NULL;
+}
+
+//every write to a client goes through here so its link knows how much is on the way
+INTERNAL
+void count_sent(Server* server, Transport* client, const std::string& packet) {
+	record_packet(&server->metrics, packet.size());
+	record_entry(&server->recorder, RECORD_OUT, client, packet);
+	Link* link = find_link(server, client);
+	if (link != NULL)
+		link_sent(link, packet.size());
+}
+
+//a client has something to read or has closed. runs on whichever thread noticed, the
+//receive thread takes it from there
+INTERNAL
+void client_ready(void* user, Transport* client) {
+	Server* server = (Server*)user;
+	server->readyMutex.lock();
+	server->ready.push_back(client);
+	server->readyMutex.unlock();
+	server->readyWake.notify_one();
+}
+
+//the caller holds server->mutex
+INTERNAL
+void add_client(Server* server, Transport* client) {
 	server->clients.push_back(client);
+	server->links[client] = Link();
+	record_entry(&server->recorder, RECORD_OPEN, client, "");
+	server->metrics.accepts.fetch_add(1, boost::memory_order_relaxed);
+	watch_transport(client, client_ready, server);
+}
+
+INTERNAL
+void handle_accept(Server* server, Socket* socket) {
+	server->mutex.lock();
+	add_client(server, tcp_transport(socket));
 	BMT_LOG(INFO, "A new client has connected! %d total clients", server->clients.size());
 	server->mutex.unlock();
 	Socket* clientNew = new Socket(server->service);
 	server->acceptor.async_accept(*clientNew, boost::bind(handle_accept, server, clientNew));
-	boost::this_thread::sleep(boost::posix_time::millisec(LONG_SLEEP));
 }
 
 INTERNAL
@@ -23,73 +71,317 @@ void stop_service(Server* server) {
 	server->service.stop();
 }
 
+//the caller holds server->mutex, and is the receive thread, which is the only one that reads
+//from clients and so the only one that may free them
 INTERNAL
-void disconnect_client(Server* server, Socket* client, u16 index) {
-	client->shutdown(boost::asio::ip::PROTOCOL::socket::shutdown_both);
-	client->close();
-	server->clients.erase(server->clients.begin() + index);
-
+void disconnect_client(Server* server, Transport* client) {
+	ClientList::iterator it = std::find(server->clients.begin(), server->clients.end(), client);
+	if (it == server->clients.end())
+		return;
+	close_transport(client);
+	server->clients.erase(it);
+	server->links.erase(client);
+	record_entry(&server->recorder, RECORD_CLOSE, client, "");
+	detach_session(&server->sessions, client);
+	if (server->rooms != NULL)
+		leave_room(server->rooms, client);
+
+	//users are added as they log in, not as they connect, so index does not find them
 	server->userListMutex.lock();
-	server->users.erase(server->users.begin() + index);
+	for (u32 i = 0; i < server->users.size(); ++i) {
+		if (server->users[i].socket == client) {
+			server->users.erase(server->users.begin() + i);
+			server->userListVersion++;
+			break;
+		}
+	}
 	server->userListMutex.unlock();
 
-	delete client;
+	free_transport(client);
+	server->metrics.disconnects.fetch_add(1, boost::memory_order_relaxed);
 
 	BMT_LOG(INFO, "Client has disconnected! %d total clients", server->clients.size());
 }
 
 INTERNAL
-void handle_new_connection(Server* server, Socket* socket, std::string name, std::string pass) {
+void handle_new_connection(Server* server, Transport* socket, std::string name, std::string pass, std::string roomName) {
+	//a DM account has to exist before the server starts, otherwise whoever logs in with the
+	//name first would get to run the table
+	bool dm = std::find(server->dmNames.begin(), server->dmNames.end(), name) != server->dmNames.end();
 	Account account;
-	LoginState success = login(&account, name, pass);
+	LoginState success = login(&account, name, pass, !dm);
 	account.socket = socket;
+	account.room = ROOM_NONE;
+	account.dm = false;
+	account.layers = 0;
 
 	if (success == LOGIN_SUCCESS || success == LOGIN_CREATED) {
-		//send names of all other users already connected to the new client.
+		account.dm = dm;
+		//only the DM sees the GM layer
+		account.layers = account.dm ? LAYERS_DM : LAYERS_PLAYER;
+		if (server->rooms != NULL)
+			account.room = join_room(server->rooms, socket, roomName, account.layers, account.dm);
+		else
+			account.room = DEFAULT_ROOM;
+
+		//send names of all other users already at the same table to the new client.
+		std::string names;
 		server->userListMutex.lock();
 		for (u16 j = 0; j < server->users.size(); ++j) {
-			std::string command = "name|";
-			command.append(server->users[j].name);
-			command.append("\n");
-			account.socket->write_some(boost::asio::buffer(command, command.size()));
-			boost::this_thread::sleep(boost::posix_time::millisec(LONG_SLEEP));
+			if (server->users[j].room != account.room) continue;
+			names.append("name|");
+			names.append(server->users[j].name);
+			names.append("\n");
 		}
 		server->users.push_back(account);
+		server->userListVersion++;
 		server->userListMutex.unlock();
-
-		if (success == LOGIN_SUCCESS) {
-			std::string command = format_text("login_success|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%d|%d\n",
-				account.name.c_str(), account.pass.c_str(), account.standsheet.name.c_str(), account.standsheet.standTypes.c_str(),
-				account.standsheet.standAbilityDesc.c_str(), account.standsheet.speed, account.standsheet.power, account.standsheet.range,
-				account.standsheet.precision, account.standsheet.durability, account.standsheet.learning, account.usersheet.name.c_str(),
-				account.usersheet.playername.c_str(), account.usersheet.gender.c_str(), account.usersheet.weight.c_str(), account.usersheet.height.c_str(),
-				account.usersheet.bloodType.c_str(), account.usersheet.occupation.c_str(), account.usersheet.nationality.c_str(), account.usersheet.backstory.c_str(),
-				account.usersheet.inventory.c_str(), account.usersheet.brains, account.usersheet.brawns, account.usersheet.bravery, account.usersheet.age,
-				account.usersheet.totalHealth, account.usersheet.currentHealth, account.usersheet.resolveDamage, account.usersheet.bizarrePoints
-			);
-			send_packet_no_lock(server, socket, command);
+		if (!names.empty())
+			send_packet(server, socket, names);
+
+		//only sheet summaries go out with the login, the client asks for full sheets with get_sheet
+		std::string command = success == LOGIN_SUCCESS ? "login_success|" : "login_created|";
+		command.append(account.name);
+		command.append("|");
+		command.append(account.pass);
+		command.append("|");
+		append_sheet_summaries(&command, &account);
+		command.append("\n");
+		send_packet(server, socket, command);
+
+		//hand out a ticket so the client can resume this session after a dropped connection
+		std::string ticket = issue_session(&server->sessions, &account, socket);
+		command = "session|";
+		command.append(ticket);
+		command.append("|");
+		command.append(std::to_string(SESSION_TICKET_TTL));
+		command.append("|");
+		command.append(std::to_string(get_last_seq(&server->sessions)));
+		command.append("\n");
+		send_packet(server, socket, command);
+
+		if (account.dm) {
+			BMT_LOG(INFO, "User '%s' is the DM", account.name.c_str());
+			send_packet(server, socket, "dm\n");
 		}
-		else {
-			std::string command = format_text("login_created|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%d|%d\n",
-				account.name.c_str(), account.pass.c_str(), account.standsheet.name.c_str(), account.standsheet.standTypes.c_str(),
-				account.standsheet.standAbilityDesc.c_str(), account.standsheet.speed, account.standsheet.power, account.standsheet.range,
-				account.standsheet.precision, account.standsheet.durability, account.standsheet.learning, account.usersheet.name.c_str(),
-				account.usersheet.playername.c_str(), account.usersheet.gender.c_str(), account.usersheet.weight.c_str(), account.usersheet.height.c_str(),
-				account.usersheet.bloodType.c_str(), account.usersheet.occupation.c_str(), account.usersheet.nationality.c_str(), account.usersheet.backstory.c_str(),
-				account.usersheet.inventory.c_str(), account.usersheet.brains, account.usersheet.brawns, account.usersheet.bravery, account.usersheet.age,
-				account.usersheet.totalHealth, account.usersheet.currentHealth, account.usersheet.resolveDamage, account.usersheet.bizarrePoints
-			);
+
+		//only the new player needs the table, everyone else already has it. the room is only
+		//kept open under the server mutex
+		if (server->rooms != NULL) {
+			command.clear();
+			server->mutex.lock();
+			append_room_state(server->rooms, account.room, account.layers, &command);
 			send_packet_no_lock(server, socket, command);
+			server->mutex.unlock();
 		}
 	}
 	if(success == LOGIN_FAILURE) {
 		account.name = "Attempting connection...";
 		server->userListMutex.lock();
 		server->users.push_back(account);
+		server->userListVersion++;
 		server->userListMutex.unlock();
 
-		send_packet_no_lock(server, socket, "login_failure\n");
+		send_packet(server, socket, "login_failure\n");
+	}
+}
+
+INTERNAL
+void handle_resume(Server* server, Transport* socket, const std::string& ticket, u64 lastSeq) {
+	Account account;
+	std::string missed;
+	Transport* stale;
+	ResumeState state = resume_session(&server->sessions, ticket, lastSeq, socket, &account, &missed, &stale);
+	//a blip can bring the client back before its old connection is noticed as dead
+	if (stale != NULL) {
+		BMT_LOG(INFO, "A resume took over a session from a connection that is still open");
+		server->mutex.lock();
+		disconnect_client(server, stale);
+		server->mutex.unlock();
+	}
+	//an empty room is closed after a while, a login opens it again if it is the DM's
+	if (state == RESUME_SUCCESS && server->rooms != NULL && !rejoin_room(server->rooms, socket, account.room, account.layers)) {
+		detach_session(&server->sessions, socket);
+		state = RESUME_EXPIRED;
+	}
+
+	if (state == RESUME_SUCCESS) {
+		BMT_LOG(INFO, "User '%s' resumed their session", account.name.c_str());
+		server->userListMutex.lock();
+		server->users.push_back(account);
+		server->userListVersion++;
+		server->userListMutex.unlock();
+
+		std::string command = "resume_success|";
+		command.append(std::to_string(get_last_seq(&server->sessions)));
+		command.append("\n");
+		command.append(missed);
+		send_packet(server, socket, command);
+	}
+	else {
+		//the client falls back to a full login and resync
+		BMT_LOG(INFO, "Could not resume session (%s)", state == RESUME_EXPIRED ? "expired" : "history lost");
+		send_packet(server, socket, "resume_failure\n");
+	}
+}
+
+INTERNAL
+Account* find_user(Server* server, Transport* socket) {
+	for (u32 i = 0; i < server->users.size(); ++i) {
+		if (server->users[i].socket == socket)
+			return &server->users[i];
+	}
+	return NULL;
+}
+
+INTERNAL
+u32 find_user_room(Server* server, Transport* socket, bool* dm) {
+	server->userListMutex.lock();
+	Account* account = find_user(server, socket);
+	u32 room = account != NULL ? account->room : ROOM_NONE;
+	*dm = account != NULL && account->dm;
+	server->userListMutex.unlock();
+	return room;
+}
+
+//rolls are made here and never by the client. public results go to the whole room, the
+//roller included, and into the room's roll log. private ones only go back to the roller.
+//the old roll|public|name|result from clients is treated as a 1d6 and its result ignored
+INTERNAL
+void handle_roll(Server* server, Transport* client, u32 room, StringList* tokens) {
+	bool isPublic = tokens->size() > 1 && tokens->at(1) == "1";
+	std::string text = "1d6";
+	if (tokens->at(0) == "roll_expr" && tokens->size() > 2)
+		text = tokens->at(2);
+
+	DiceExpr expr;
+	std::string error;
+	if (!compile_dice(text, &expr, &error)) {
+		send_packet(server, client, "roll_error|" + error + "\n");
+		return;
+	}
+	DiceResult result;
+	roll_dice(&expr, &result);
+
+	server->userListMutex.lock();
+	Account* account = find_user(server, client);
+	std::string name = account != NULL ? account->name : "Someone";
+	server->userListMutex.unlock();
+
+	u64 id = next_roll_id();
+	std::string line = roll_log_line(name, &expr, &result);
+	BMT_LOG(INFO, "Roll %llu (%s): %s", (unsigned long long)id, isPublic ? "public" : "private", line.c_str());
+
+	Broadcast cm;
+	cm.socket = NULL;
+	cm.room = room;
+	cm.layer = LAYER_ANY;
+	append_roll_result(&cm.str, id, isPublic, name, &expr, &result);
+	if (!isPublic) {
+		send_packet(server, client, cm.str);
+		return;
+	}
+	server->mutex.lock();
+	queue_broadcast(server, &cm);
+	if (server->rooms != NULL)
+		post_roll_to_room(server->rooms, room, client, line);
+	server->mutex.unlock();
+}
+
+//commands that change the table for everyone, only a DM may send them
+INTERNAL inline
+bool is_dm_command(const std::string& command) {
+	return command == "update_map" || command == "set_layer" || command == "delete_token" || command == "set_wall" || command == "play_music" || command == "turncounter" || command == "roundabout" || command == "menacing";
+}
+
+//false unless str is a whole, unsigned number. fields from clients are checked with this
+//before they are used, a throwing std::stoull would take the server down
+INTERNAL
+bool parse_u64(const std::string& str, u64* out) {
+	char* end;
+	*out = strtoull(str.c_str(), &end, 10);
+	return !str.empty() && str[0] != '-' && *end == '\0';
+}
+
+//the stats of a sheet line that read_stand_charsheet and read_user_charsheet take as numbers
+INTERNAL
+bool sheet_numbers_valid(const StringList* fields) {
+	for (u32 i = 5; i <= 28; ++i) {
+		if (i == 11)
+			i = 21;
+		i32 value;
+		if (!parse_sheet_value(fields->at(i), &value))
+			return false;
+	}
+	return true;
+}
+
+//character sheet requests are answered to the sender only and never broadcast. the store
+//does its own locking, the user list is not held while a sheet is read or saved
+INTERNAL
+void handle_sheet_command(Server* server, Transport* socket, StringList* tokens) {
+	server->userListMutex.lock();
+	Account* account = find_user(server, socket);
+	if (account == NULL || account->pass.empty()) {
+		server->userListMutex.unlock();
+		return;
+	}
+	std::string name = account->name;
+	u32 sheetCount = account->sheets.size();
+	server->userListMutex.unlock();
+
+	std::string command;
+	if (tokens->at(0) == "get_sheet" && tokens->size() >= 2) {
+		CharSheet sheet;
+		u64 id;
+		if (parse_u64(tokens->at(1), &id) && id < sheetCount && read_sheet(name, (u32)id, &sheet)) {
+			command = "sheet|";
+			command.append(std::to_string(sheet.id));
+			command.append("|");
+			append_sheet_fields(&command, &sheet);
+			command.append("\n");
+		}
+	}
+	else if (tokens->at(0) == "update_sheet" && tokens->size() >= 2 + SHEET_FIELD_COUNT) {
+		//drop the id so the fields line up with an accounts file line (name|pass|sheet)
+		CharSheet sheet;
+		u64 id;
+		StringList fields(tokens->begin() + 2, tokens->end());
+		fields.insert(fields.begin(), 2, std::string());
+		if (!parse_u64(tokens->at(1), &id) || id >= sheetCount || !sheet_numbers_valid(&fields)) {
+			BMT_LOG(WARNING, "Dropped a malformed update_sheet from '%s'", name.c_str());
+			return;
+		}
+		sheet.id = (u32)id;
+		read_stand_charsheet(&sheet.standsheet, &fields);
+		read_user_charsheet(&sheet.usersheet, &fields);
+
+		SheetSummary summary;
+		if (write_sheet(name, &sheet, &summary)) {
+			server->userListMutex.lock();
+			account = find_user(server, socket);
+			if (account != NULL && summary.id < account->sheets.size())
+				account->sheets[summary.id] = summary;
+			server->userListMutex.unlock();
+		}
+	}
+	else if (tokens->at(0) == "new_sheet") {
+		Account single;
+		single.sheets.resize(1);
+		if (create_sheet(name, sheetCount, &single.sheets[0])) {
+			server->userListMutex.lock();
+			account = find_user(server, socket);
+			if (account != NULL && account->sheets.size() == sheetCount)
+				account->sheets.push_back(single.sheets[0]);
+			server->userListMutex.unlock();
+			command = "sheet_summaries|";
+			append_sheet_summaries(&command, &single);
+			command.append("\n");
+		}
 	}
+
+	if (!command.empty())
+		send_packet(server, socket, command);
 }
 
 INTERNAL
@@ -97,89 +389,228 @@ void read_handler(const boost::system::error_code) {
 
 }
 
+//handles one line from a client on the receive thread, without the server mutex so a slow
+//command (a login opening a room, a sheet save) does not hold up every other room's traffic.
+//returns the line's opcode for the metrics
 INTERNAL
-void receive_loop(Server* server) {
-	for (;;) {
-		if (server->close) break;
+Opcode handle_command(Server* server, Transport* client, const std::string& line) {
+	StringList tokens = split_string(line, '|');
+	if (tokens.size() == 0)
+		return OP_OTHER;
+	Opcode op = find_opcode(tokens[0]);
+
+	//reconnecting clients present their session ticket instead of logging in again
+	if (tokens[0] == "resume") {
+		u64 lastSeq;
+		if (tokens.size() >= 3 && parse_u64(tokens[2], &lastSeq))
+			handle_resume(server, client, tokens[1], lastSeq);
+		else
+			send_packet(server, client, "resume_failure\n");
+		return op;
+	}
+	//format: pong|stamp|bytes read|client clock when the ping was read|and when answered. see Link
+	if (tokens[0] == "pong") {
+		u64 stamp, received;
+		u64 clientRead = 0;
+		u64 clientSent = 0;
+		//a pong with a field that is not a number is ignored, the next ping asks again
+		bool valid = tokens.size() >= 3 && parse_u64(tokens[1], &stamp) && parse_u64(tokens[2], &received);
+		if (valid && tokens.size() >= 5)
+			valid = parse_u64(tokens[3], &clientRead) && parse_u64(tokens[4], &clientSent);
+		server->mutex.lock();
+		Link* link = find_link(server, client);
+		if (link != NULL && valid) {
+			u64 samples = link->samples;
+			link_pong(link, stamp, received, clientRead, clientSent, link_now());
+			if (link->samples != samples)
+				record_latency(&server->metrics.rtt, (u64)(link->rtt * 1000000));
+		}
+		server->mutex.unlock();
+		return op;
+	}
+	if (tokens[0] == "get_sheet" || tokens[0] == "update_sheet" || tokens[0] == "new_sheet") {
+		handle_sheet_command(server, client, &tokens);
+		return op;
+	}
+	//handle new connection (new clients send their name immediately after connecting)
+	if (tokens[0] == "name") {
+		BMT_LOG(INFO, "User '%s' is attempting to connect with hashed password '%s'...", tokens[1].c_str(), tokens[3].c_str());
+		handle_new_connection(server, client, tokens[1], tokens[3], tokens.size() > 4 ? tokens[4] : DEFAULT_ROOM_NAME);
+	}
 
+	//players only talk to their own table, and not at all until they have logged in
+	bool dm;
+	u32 room = find_user_room(server, client, &dm);
+	if (room == ROOM_NONE)
+		return op;
+	if (is_dm_command(tokens[0]) && !dm) {
+		BMT_LOG(WARNING, "Dropped '%s' from a player who is not the DM", tokens[0].c_str());
+		return op;
+	}
+	if (tokens[0] == "roll" || tokens[0] == "roll_expr") {
+		handle_roll(server, client, room, &tokens);
+		return op;
+	}
+	if (server->receiveCallback != NULL)
+		server->receiveCallback(server, client, &tokens);
+
+	//put received command into a queue to be sent back to the rest of the room
+	Broadcast cm;
+	cm.socket = client;
+	cm.room = room;
+	cm.layer = LAYER_ANY;
+	cm.str = line;
+	cm.str.append("\n");
+	//the rest of the room only needs the name, never the password hash
+	if (tokens[0] == "name")
+		cm.str = "name|" + tokens[1] + "\n";
+	//format: move|handle|x|y|id. a client that numbers its moves is told where in the
+	//stream each one landed, the others only see a plain move
+	if (tokens[0] == "move" && tokens.size() >= 5) {
+		cm.str = "move|" + tokens[1] + "|" + tokens[2] + "|" + tokens[3] + "\n";
+		cm.ack = "move_ack|" + tokens[1] + "|" + tokens[4] + "\n";
+	}
+	//the DM hears the music when everyone else does
+	if (tokens[0] == "play_music" && tokens.size() >= 2) {
+		cm.str = music_cue(std::atoi(tokens[1].c_str()));
+		cm.ack = cm.str;
+	}
+	server->mutex.lock();
+	if (server->rooms != NULL)
+		post_to_room(server->rooms, room, client, &tokens);
+	queue_broadcast(server, &cm);
+	server->mutex.unlock();
+	return op;
+}
+
+//reads one buffer from a client and handles the whole lines in it. a client with more to
+//read goes to the back of the queue, so one busy client can not hold up the rest
+INTERNAL
+void receive_from(Server* server, Transport* client) {
+	//the client may have been disconnected since it was queued
+	server->mutex.lock();
+	bool connected = std::find(server->clients.begin(), server->clients.end(), client) != server->clients.end();
+	server->mutex.unlock();
+	if (!connected || (transport_available(client) == 0 && transport_open(client)))
+		return;
+
+	//there is something to read or the client is gone, so this does not wait
+	char readBuffer[BUFFER_SIZE];
+	u32 bytesRead = transport_read(client, readBuffer, BUFFER_SIZE);
+	std::string msg(readBuffer, bytesRead);
+	//nothing read means the connection is gone
+	if (bytesRead == 0 || msg == "exit") {
 		server->mutex.lock();
-		for (u16 i = 0; i < server->clients.size(); ++i) {
-			Socket* client = server->clients[i];
-
-			if (client->available()) {
-				char readBuffer[BUFFER_SIZE] = { 0 };
-				boost::system::error_code error;
-				//TODO(Corbin): check if client->read_some is thread safe or not. (or actually just make this async)
-				server->mutex.unlock();
-				int bytesRead = client->read_some(boost::asio::buffer(readBuffer, BUFFER_SIZE), error);
-				server->mutex.lock();
-
-				//check for if should disconnect
-				if ((boost::asio::error::eof == error) || (boost::asio::error::connection_reset == error) || (boost::asio::error::connection_aborted == error)) {
-					disconnect_client(server, client, i);
-					break;
-				}
-				std::string msg(readBuffer, bytesRead);
-				BMT_LOG(DEBUG, "Received instruction from client %d: %s", i, msg.c_str());
-				if (msg == "exit") {
-					disconnect_client(server, client, i);
-					break;
-				}
+		disconnect_client(server, client);
+		server->mutex.unlock();
+		return;
+	}
+	BMT_LOG(DEBUG, "Received instruction from a client: %s", msg.c_str());
 
-				//split string
-				StringList commands = split_string(msg, '\n');
-				for (u16 i = 0; i < commands.size(); ++i) {
-					StringList tokens = split_string(msg, '|');
-					//handle new connection (new clients send their name immediately after connecting)
-					if (tokens.size() > 0) {
-						if (tokens[0] == "name") {
-							BMT_LOG(INFO, "User '%s' is attempting to connect with hashed password '%s'...", tokens[1].c_str(), tokens[3].c_str());
-							handle_new_connection(server, client, tokens[1], tokens[3]);
-						}
-					}
-					server->mutex.unlock();
-					server->receiveCallback(server, client, &tokens);
-					server->mutex.lock();
-
-					//put received command into a queue to be sent back to all clients
-					ClientMessage cm;
-					cm.socket = client;
-					cm.str = msg;
-					server->messageQueue.push(cm);
-				}
-			}
+	//a read can end halfway through a line, the rest of it comes with the next one
+	server->mutex.lock();
+	Link* link = find_link(server, client);
+	bool whole = true;
+	if (link != NULL) {
+		link->inbox.append(msg);
+		size_t end = link->inbox.rfind('\n');
+		whole = end != std::string::npos;
+		if (whole) {
+			msg = link->inbox.substr(0, end);
+			link->inbox.erase(0, end + 1);
+		}
+	}
+	server->mutex.unlock();
+
+	if (whole) {
+		StringList commands = split_string(msg, '\n');
+		for (u16 j = 0; j < commands.size(); ++j) {
+			record_entry(&server->recorder, RECORD_IN, client, commands[j]);
+			boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+			Opcode op = handle_command(server, client, commands[j]);
+			u64 us = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+			record_message(&server->metrics, op, commands[j].size() + 1, us);
 		}
-		server->mutex.unlock();
-		//boost::this_thread::sleep(boost::posix_time::millisec(LONG_SLEEP));
+	}
+	if (transport_available(client) > 0 || !transport_open(client))
+		client_ready(server, client);
+}
+
+//waits for clients with something to read instead of polling them. this is the only thread
+//that reads from or disconnects clients
+INTERNAL
+void receive_loop(Server* server) {
+	for (;;) {
+		boost::unique_lock<boost::mutex> lock(server->readyMutex);
+		while (server->ready.empty() && !server->close)
+			server->readyWake.wait(lock);
+		if (server->close)
+			break;
+		Transport* client = server->ready.front();
+		server->ready.pop_front();
+		lock.unlock();
+		receive_from(server, client);
 	}
 	BMT_LOG(INFO, "Closed receive_loop");
 }
 
+//pings every client and sends the moves that were held back from links that have drained
+//since, so a quiet room still catches up
+INTERNAL
+void service_links(Server* server) {
+	server->mutex.lock();
+	u64 now = link_now();
+	std::string packet;
+	for (u32 i = 0; i < server->clients.size(); ++i) {
+		Link* link = find_link(server, server->clients[i]);
+		if (link == NULL)
+			continue;
+		//the ping goes behind the moves so it measures the queue they add to
+		packet.clear();
+		release_held(link, now, &packet);
+		packet.append(link_ping(link, now));
+		if (packet.empty())
+			continue;
+		transport_write(server->clients[i], packet);
+		count_sent(server, server->clients[i], packet);
+	}
+	server->mutex.unlock();
+}
+
+//only carries broadcasts to every client, rooms flush their own on their tick
 INTERNAL
 void response_loop(Server* server) {
+	std::vector<Broadcast> batch;
 	for (;;) {
 		if (server->close) break;
 
-		if (!server->messageQueue.empty()) {
-			ClientMessage msg = server->messageQueue.front();
-			server->mutex.lock();
-			for (u16 i = 0; i < server->clients.size(); ++i) {
-				if (server->clients[i] != msg.socket)
-					server->clients[i]->write_some(boost::asio::buffer(msg.str, msg.str.size()));
-			}
+		server->mutex.lock();
+		while (!server->messageQueue.empty()) {
+			batch.push_back(server->messageQueue.front());
 			server->messageQueue.pop();
-			server->mutex.unlock();
 		}
-		boost::this_thread::sleep(boost::posix_time::millisec(LONG_SLEEP));
+		server->mutex.unlock();
+
+		flush_broadcasts(server, ROOM_ALL, &batch);
+		batch.clear();
+		service_links(server);
+		boost::this_thread::sleep(boost::posix_time::millisec(1000 / TICK_RATE));
 	}
 	BMT_LOG(INFO, "Closed response_loop");
 }
 
-Server::Server() : service(), acceptor( service, boost::asio::ip::PROTOCOL::endpoint(boost::asio::ip::PROTOCOL::v4(), 8001) ) {}
+Server::Server() : userListVersion(0), rooms(NULL), service(), acceptor(service), adminAcceptor(service), receiveCallback(NULL) {}
 
 void start_server(Server* server, u32 port) {
 	server->close = false;
 
+	boost::asio::ip::PROTOCOL::endpoint endpoint(boost::asio::ip::PROTOCOL::v4(), port);
+	server->acceptor.open(endpoint.protocol());
+	server->acceptor.set_option(boost::asio::ip::PROTOCOL::acceptor::reuse_address(true));
+	server->acceptor.bind(endpoint);
+	server->acceptor.listen();
+	BMT_LOG(INFO, "Listening on port %d", port);
+
 	Socket* client = new Socket(server->service);
 	server->acceptor.async_accept(*client, boost::bind(handle_accept, server, client));
 	boost::this_thread::sleep(boost::posix_time::millisec(SHORT_SLEEP));
@@ -197,17 +628,27 @@ void start_server(Server* server, u32 port) {
 void stop_server(Server* server) {
 	BMT_LOG(INFO, "------------------------------- Stopping server -------------------------------");
 	server->close = true;
+	server->readyMutex.lock();
+	server->readyWake.notify_all();
+	server->readyMutex.unlock();
 	server->mutex.lock();
 	server->service.stop();
 	server->acceptor.cancel();
+	if (server->adminAcceptor.is_open())
+		server->adminAcceptor.close();
+	//the receive thread may be waiting for the lock to finish a command
+	server->mutex.unlock();
 	BMT_LOG(INFO, "joining threads...");
 	server->threads.join_all();
 	BMT_LOG(INFO, "threads joined");
 	BMT_LOG(INFO, "-------------------------------- Stopped server -------------------------------");
-	server->mutex.unlock();
 }
 
-void set_receive_callback(Server* server, void(*callback)(Server*, Socket*, StringList*)) {
+void add_dm(Server* server, std::string name) {
+	server->dmNames.push_back(name);
+}
+
+void set_receive_callback(Server* server, void(*callback)(Server*, Transport*, StringList*)) {
 	server->receiveCallback = callback;
 }
  
@@ -216,24 +657,131 @@ void packet_sent_handler(const boost::system::error_code& error, std::size_t byt
 
 }
 
-void send_packet(Server* server, Socket* client, std::string message) {
+Transport* connect_local(Server* server) {
+	Transport* serverEnd;
+	Transport* clientEnd;
+	loopback_pair(&serverEnd, &clientEnd);
+	server->mutex.lock();
+	add_client(server, serverEnd);
+	BMT_LOG(INFO, "A local client has connected! %d total clients", server->clients.size());
+	server->mutex.unlock();
+	return clientEnd;
+}
+
+void send_packet(Server* server, Transport* client, std::string message) {
 	server->mutex.lock();
-	client->write_some( boost::asio::buffer(message, message.size()) );
+	transport_write(client, message);
+	count_sent(server, client, message);
 	//client->async_write_some(boost::asio::buffer(message, message.size()), packet_sent_handler);
 	server->mutex.unlock();
 }
 
+std::string music_cue(u32 track) {
+	u64 start = link_now() + (u64)(CUE_LEAD * 1000000);
+	return "play_music|" + std::to_string(track) + "|" + std::to_string(start) + "\n";
+}
+
 //sends a message to all connected clients
 void send_packet_all(Server* server, std::string message) {
+	send_packet_room(server, ROOM_ALL, message);
+}
+
+//sends a message to every player in a room
+void send_packet_room(Server* server, u32 room, std::string message) {
 	server->mutex.lock();
-	ClientMessage cm;
+	Broadcast cm;
 	cm.socket = NULL;
+	cm.room = room;
+	cm.layer = LAYER_ANY;
 	cm.str = message;
-	server->messageQueue.push(cm);
+	queue_broadcast(server, &cm);
+	server->mutex.unlock();
+}
+
+void flush_broadcasts(Server* server, u32 room, std::vector<Broadcast>* messages) {
+	if (messages->size() == 0)
+		return;
+
+	server->mutex.lock();
+	MemberList recipients;
+	if (room == ROOM_ALL || server->rooms == NULL) {
+		for (u32 i = 0; i < server->clients.size(); ++i) {
+			RoomMember member = { server->clients[i], LAYERS_DM };
+			recipients.push_back(member);
+		}
+	}
+	else {
+		get_room_members(server->rooms, room, &recipients);
+	}
+
+	//every broadcast is stamped with a sequence number so clients can tell the server
+	//what they last saw when resuming a session, a client only needs the newest one
+	u64 seq = 0;
+	bool filtered = false;
+	std::string everything;
+	for (u32 i = 0; i < messages->size(); ++i) {
+		Broadcast* msg = &messages->at(i);
+		seq = record_broadcast(&server->sessions, msg->socket, msg->room, msg->layer, msg->str, msg->ack);
+		everything.append(msg->str);
+		filtered |= msg->layer != LAYER_ANY;
+	}
+	std::string seqCommand = "seq|";
+	seqCommand.append(std::to_string(seq));
+	seqCommand.append("\n");
+	everything.append(seqCommand);
+
+	//the common case, nobody in the room sent anything, every message is for everyone
+	//and nobody is falling behind
+	u64 now = link_now();
+	std::string packet;
+	for (u32 i = 0; i < recipients.size(); ++i) {
+		RoomMember* member = &recipients[i];
+		bool sender = false;
+		for (u32 j = 0; j < messages->size() && !sender; ++j)
+			sender = messages->at(j).socket == member->socket;
+		Link* link = find_link(server, member->socket);
+		bool holding = link != NULL && (!link->held.empty() || link_congested(link, now));
+
+		if (!sender && !holding && (!filtered || member->layers == LAYERS_DM)) {
+			transport_write(member->socket, everything);
+			count_sent(server, member->socket, everything);
+			continue;
+		}
+		packet.clear();
+		for (u32 j = 0; j < messages->size(); ++j) {
+			Broadcast* msg = &messages->at(j);
+			//a held move must not land after anything the client does to the same token
+			if (msg->socket == member->socket) {
+				if (link != NULL) {
+					release_before(link, msg->str, &packet);
+					release_before(link, msg->ack, &packet);
+				}
+				packet.append(msg->ack);
+				continue;
+			}
+			if (msg->layer != LAYER_ANY && !(member->layers & LAYER_BIT(msg->layer)))
+				continue;
+			TokenHandle handle;
+			if (holding && is_lossy_message(msg->str, &handle)) {
+				if (hold_lossy(link, handle, msg->str))
+					server->metrics.movesMerged.fetch_add(1, boost::memory_order_relaxed);
+				continue;
+			}
+			if (link != NULL)
+				release_before(link, msg->str, &packet);
+			packet.append(msg->str);
+		}
+		if (link != NULL)
+			release_held(link, now, &packet);
+		packet.append(seqCommand);
+		transport_write(member->socket, packet);
+		count_sent(server, member->socket, packet);
+	}
 	server->mutex.unlock();
 }
 
 INTERNAL
-void send_packet_no_lock(Server* server, Socket* client, std::string message) {
-	client->write_some( boost::asio::buffer(message, message.size()) );
+void send_packet_no_lock(Server* server, Transport* client, std::string message) {
+	transport_write(client, message);
+	count_sent(server, client, message);
 }
\ No newline at end of file
@@ -3,27 +3,74 @@
 
 #include "../DnDShared/globals.h"
 #include "accounts.h"
+#include "session.h"
+#include "metrics.h"
+#include "link.h"
+#include "recording.h"
+#include "transport.h"
+#include <deque>
+
+#define TICK_RATE 30 //default server ticks per second, broadcasts go out once per tick
+#define CUE_LEAD  0.3 //seconds between music being sent and every player starting it
+
+struct RoomManager;
+
+struct Broadcast {
+	Transport* socket; //the client the message came from, it only gets the ack and sequence number back
+	u32 room;
+	u8 layer; //layer of the token the message is about, or LAYER_ANY
+	std::string str;
+	std::string ack; //sent to that client in str's place, if not empty
+};
 
 struct Server {
 	Server();
 	boost::mutex mutex;
 	boost::mutex userListMutex;
-	ClientList clients;
+	ClientList clients; //added by the accept and local connect paths, only removed by the receive thread
+	boost::mutex readyMutex;
+	boost::condition_variable readyWake;
+	std::deque<Transport*> ready; //clients with something to read, see receive_loop
 	std::vector<Account> users;
-	MessageQueue messageQueue;
+	volatile u32 userListVersion; //bumped whenever users changes
+	SessionTable sessions;
+	LinkTable links; //one per connected client
+	std::queue<Broadcast> messageQueue;
+	RoomManager* rooms;
+	StringList dmNames; //accounts that log in as a DM
 	boost::asio::io_service service;
 	boost::asio::ip::PROTOCOL::acceptor acceptor;
+	boost::asio::ip::PROTOCOL::acceptor adminAcceptor; //see start_admin
+	Metrics metrics;
+	Recorder recorder; //off unless started, see start_recording
 	boost::thread_group threads;
 	volatile bool close;
 
-	void(*receiveCallback)(Server*, Socket*, StringList*);
+	void(*receiveCallback)(Server*, Transport*, StringList*);
 };
 
 void start_server(Server* server, u32 port = 8001);
 void stop_server(Server* server);
-void set_receive_callback(Server* server, void(*callback)(Server*, Socket*, StringList*));
-void send_packet(Server* server, Socket* client, std::string message);
+void set_receive_callback(Server* server, void(*callback)(Server*, Transport*, StringList*));
+void send_packet(Server* server, Transport* client, std::string message);
+//Connects a client in the same process, a player on the DM's machine or a bot. It is
+//handled like one that came in over TCP, from the login on, but its messages are handed
+//over through memory. Returns the client's end for connect_local_session or for writing
+//commands directly, free it with free_transport once done.
+Transport* connect_local(Server* server);
+//lets an account send DM only commands once it has logged in, call before start_server
+void add_dm(Server* server, std::string name);
 //sends a message to all connected clients
 void send_packet_all(Server* server, std::string message);
+//sends a message to every player in a room, it goes out with the room's next tick
+void send_packet_room(Server* server, u32 room, std::string message);
+//format: play_music|track|start. start is on the server's clock, CUE_LEAD from now. clients
+//that know their offset from it (see Link) start the track then, so everyone hears it together
+std::string music_cue(u32 track);
+//sends a tick's worth of broadcasts, one packet per client. messages from a client are
+//not echoed back to it, it only gets the sequence number. moves to a congested client are
+//held back and merged, see Link. packets are only queued on each client's transport, so a
+//tick never waits for a slow socket
+void flush_broadcasts(Server* server, u32 room, std::vector<Broadcast>* messages);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "replay.h"
+#include "networking.h"
+#include "dice.h"
+#include "accounts.h"
+#include <map>
+
+#define REPLAY_SETTLE 500 //ms without an answer before the server is taken to be done
+
+//the replay's side of every recorded connection, keyed by recorded stream
+struct ReplayClient {
+	Transport* transport;
+	std::string pending;   //answer read up to a line that is not finished yet
+	bool awaitingTicket;   //sent a login that has not been answered yet
+};
+
+typedef std::map<u32, ReplayClient> ReplayClients;
+//what a recorded stream was issued during the replay
+struct ReplayTicket {
+	std::string ticket;
+	std::string lastSeq; //of the last broadcast it was sent, a resume asks for everything after it
+};
+
+typedef std::map<u32, ReplayTicket> ReplayTickets;
+
+//the tickets the server issues now stand in for the aliases in the recording.
+//format: session|ticket|seconds|seq and seq|seq
+INTERNAL
+void read_answers(ReplayClient* client, u32 stream, ReplayTickets* tickets) {
+	std::string* pending = &client->pending;
+	size_t start = 0;
+	size_t end;
+	while ((end = pending->find('\n', start)) != std::string::npos) {
+		if (pending->compare(start, 8, "session|") == 0) {
+			StringList fields = split_string(pending->substr(start, end - start), '|');
+			if (fields.size() >= 4) {
+				(*tickets)[stream].ticket = fields[1];
+				(*tickets)[stream].lastSeq = fields[3];
+			}
+			client->awaitingTicket = false;
+		}
+		else if (pending->compare(start, 4, "seq|") == 0 && tickets->count(stream) != 0) {
+			(*tickets)[stream].lastSeq = pending->substr(start + 4, end - start - 4);
+		}
+		else if (pending->compare(start, 14, "login_failure\n") == 0) {
+			client->awaitingTicket = false;
+		}
+		start = end + 1;
+	}
+	pending->erase(0, start);
+}
+
+//reads whatever the server has answered so far, so it never blocks writing to us
+INTERNAL
+void drain_clients(ReplayClients* clients, ReplayTickets* tickets, ReplayStats* stats) {
+	char buffer[16 * 1024];
+	for (ReplayClients::iterator it = clients->begin(); it != clients->end(); ++it) {
+		while (transport_available(it->second.transport) > 0) {
+			u32 bytes = transport_read(it->second.transport, buffer, sizeof(buffer));
+			stats->bytesReceived += bytes;
+			it->second.pending.append(buffer, bytes);
+		}
+		read_answers(&it->second, it->first, tickets);
+	}
+}
+
+//a login sent as fast as possible may not have been answered yet when its connection closes or
+//its ticket is presented again, so wait for it. gives up after REPLAY_SETTLE
+INTERNAL
+void wait_for_ticket(ReplayClients* clients, ReplayTickets* tickets, ReplayStats* stats, u32 stream) {
+	u64 start = recording_clock();
+	for (;;) {
+		drain_clients(clients, tickets, stats);
+		ReplayClients::iterator it = clients->find(stream);
+		if (it == clients->end() || !it->second.awaitingTicket || recording_clock() - start > REPLAY_SETTLE * 1000)
+			return;
+		boost::this_thread::sleep(boost::posix_time::millisec(1));
+	}
+}
+
+//format: resume|@stream|last seq, see RECORDING_ALIAS. the sequence numbers are the replay's
+//own, so the last one the stream saw now is asked for. an alias of a stream that was never
+//issued a ticket is sent as it is, and fails like the resume did when it was recorded
+INTERNAL
+void swap_ticket(std::string* line, ReplayClients* clients, ReplayTickets* tickets, ReplayStats* stats) {
+	if (line->compare(0, 8, "resume|@") != 0)
+		return;
+	u32 stream = (u32)std::strtoul(line->c_str() + 8, NULL, 10);
+	wait_for_ticket(clients, tickets, stats, stream);
+	ReplayTickets::iterator it = tickets->find(stream);
+	if (it != tickets->end())
+		*line = "resume|" + it->second.ticket + "|" + it->second.lastSeq;
+}
+
+bool replay_recording(Server* server, const std::string& path, bool realtime, ReplayStats* stats) {
+	Playback playback;
+	if (!open_playback(&playback, path))
+		return false;
+	stats->connections = 0;
+	stats->messages = 0;
+	stats->bytesSent = 0;
+	stats->bytesReceived = 0;
+	stats->recordedOut = 0;
+	BMT_LOG(INFO, "Replaying %s %s", path.c_str(), realtime ? "at the recorded pace" : "as fast as the server takes it");
+
+	//logins are never created for a DM name, so the recorded DM gets its account up front
+	for (u32 i = 0; i < server->dmNames.size(); ++i) {
+		Account account;
+		if (!account_exists(server->dmNames[i]))
+			login(&account, server->dmNames[i], RECORDING_REDACTED);
+	}
+
+	ReplayClients clients;
+	ReplayTickets tickets;
+	u64 start = recording_clock();
+	RecordedEntry entry;
+	while (next_entry(&playback, &entry)) {
+		if (realtime)
+			wait_for_entry(&entry, start);
+		if (entry.kind == RECORD_OUT) {
+			stats->recordedOut += entry.data.size();
+			continue;
+		}
+		//the dice roll what they rolled when the session was recorded
+		if (entry.kind == RECORD_SEED) {
+			seed_dice(std::strtoull(entry.data.c_str(), NULL, 10));
+			continue;
+		}
+
+		ReplayClients::iterator it = clients.find(entry.stream);
+		if (entry.kind == RECORD_OPEN) {
+			ReplayClient client;
+			client.transport = connect_local(server);
+			client.awaitingTicket = false;
+			clients[entry.stream] = client;
+			stats->connections++;
+		}
+		else if (it == clients.end()) {
+			continue;
+		}
+		else if (entry.kind == RECORD_CLOSE) {
+			wait_for_ticket(&clients, &tickets, stats, entry.stream);
+			free_transport(it->second.transport);
+			clients.erase(it);
+		}
+		else {
+			if (entry.data.compare(0, 5, "name|") == 0)
+				it->second.awaitingTicket = true;
+			swap_ticket(&entry.data, &clients, &tickets, stats);
+			entry.data.append("\n");
+			transport_write(it->second.transport, entry.data);
+			stats->messages++;
+			stats->bytesSent += entry.data.size();
+		}
+		drain_clients(&clients, &tickets, stats);
+	}
+	close_playback(&playback);
+
+	//the last commands are still being handled and broadcast
+	u64 lastAnswer = recording_clock();
+	while (recording_clock() - lastAnswer < REPLAY_SETTLE * 1000) {
+		u64 received = stats->bytesReceived;
+		drain_clients(&clients, &tickets, stats);
+		if (stats->bytesReceived != received)
+			lastAnswer = recording_clock();
+		boost::this_thread::sleep(boost::posix_time::millisec(10));
+	}
+	stats->seconds = (lastAnswer - start) / 1000000.0;
+
+	for (ReplayClients::iterator it = clients.begin(); it != clients.end(); ++it)
+		free_transport(it->second.transport);
+	return true;
+}
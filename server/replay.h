@@ -0,0 +1,30 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "../DnDShared/globals.h"
+#include "recording.h"
+
+struct Server;
+
+struct ReplayStats {
+	u32 connections;
+	u64 messages;      //sent to the server
+	u64 bytesSent;
+	u64 bytesReceived; //what the server answered with
+	u64 recordedOut;   //what it answered with when the recording was made
+	f64 seconds;
+};
+
+//Plays what the clients sent in a server recording against a running server. Every recorded
+//connection gets its own in-process connection (see connect_local), so the commands go
+//through the same login and dispatch as they did live while the timing is not left to the
+//network stack. With realtime off they are sent as fast as the server
+//reads them, otherwise at the recorded pace. The answers are read and thrown away, except
+//for the session tickets the recording's resumes are rewritten to. The dice are seeded as
+//they were when recorded. Logins carry RECORDING_REDACTED as their password, so replay
+//against a server whose accounts file does not have the recorded names yet. DM accounts
+//that do not exist are created with that password before the replay starts.
+//returns false if the recording could not be opened
+bool replay_recording(Server* server, const std::string& path, bool realtime, ReplayStats* stats);
+
+#endif
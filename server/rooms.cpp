@@ -0,0 +1,454 @@
+#include "rooms.h"
+#include "mapfile.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <algorithm>
+
+RoomManager::RoomManager() : tickRate(TICK_RATE), server(NULL), close(false) {}
+
+//room names end up in file names, so only keep characters that are safe everywhere
+INTERNAL
+std::string clean_room_name(std::string name) {
+	std::string result;
+	for (u32 i = 0; i < name.size() && result.size() < 32; ++i) {
+		char c = name[i];
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-')
+			result.push_back(c);
+	}
+	return result.empty() ? DEFAULT_ROOM_NAME : result;
+}
+
+INTERNAL
+void init_default_map(Map* map) {
+	map->selected = TOKEN_NONE;
+	map->width = map->height = 20;
+	map->bgColor = WHITE;
+	map->gridColor = GRAY;
+	fit_walls(map);
+	Token token = { 0 };
+	token.imgindex = 2;
+	token.xPos = token.yPos = 128;
+	add_token(&map->tokens, &token);
+	token = { 0 };
+	token.imgindex = 1;
+	token.xPos = token.yPos = 256;
+	add_token(&map->tokens, &token);
+}
+
+INTERNAL inline
+f64 elapsed_ms(boost::posix_time::ptime start) {
+	return (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.0;
+}
+
+INTERNAL inline
+void add_tick(TickStats* stats, f64 ms, bool overrun) {
+	stats->ticks++;
+	stats->totalMs += ms;
+	if (ms > stats->maxMs) stats->maxMs = ms;
+	if (overrun) stats->overruns++;
+}
+
+INTERNAL
+void tick_room(RoomManager* manager, Room* room, f64 time) {
+	if (!room->hosted) {
+		apply_commands(&room->sim, &room->checkpointer, ROOM_COMMAND_BUDGET);
+		tick_fog(room);
+		publish_snapshot(&room->sim);
+		checkpoint_tick(&room->checkpointer, &room->sim.map, &room->sim.rollLog, manager->server, time);
+	}
+
+	std::vector<Broadcast> batch;
+	room->outboxMutex.lock();
+	batch.swap(room->outbox);
+	room->outboxMutex.unlock();
+	flush_broadcasts(manager->server, room->id, &batch);
+}
+
+//applies what is left, stops the checkpointer and saves the map. the room must not be
+//reachable from the manager any more
+INTERNAL
+void free_room(RoomManager* manager, Room* room) {
+	//anything still queued was already echoed to the players, so keep it
+	apply_commands(&room->sim, &room->checkpointer);
+	stop_checkpointer(&room->checkpointer, &room->sim.map, &room->sim.rollLog, manager->server);
+	save_map(&room->sim.map, room->mapPath.c_str());
+	delete room;
+}
+
+//true once the room has been closed and freed. called by the room's worker after its tick
+INTERNAL
+bool close_if_idle(RoomManager* manager, u32 shard, Room* room, f64 time) {
+	if (room->hosted || room->name == DEFAULT_ROOM_NAME)
+		return false;
+	manager->mutex.lock();
+	bool empty = room->members.empty();
+	manager->mutex.unlock();
+	if (!empty) {
+		room->emptySince = -1;
+		return false;
+	}
+	if (room->emptySince < 0)
+		room->emptySince = time;
+	if (time - room->emptySince < ROOM_IDLE_CLOSE)
+		return false;
+
+	//the network threads only use a room under the server mutex, so once it is unlinked
+	//under both locks nobody else can still be holding it
+	manager->server->mutex.lock();
+	manager->mutex.lock();
+	empty = room->members.empty();
+	if (empty) {
+		manager->rooms[room->id] = NULL;
+		std::vector<Room*>* rooms = &manager->shards[shard];
+		rooms->erase(std::find(rooms->begin(), rooms->end(), room));
+	}
+	manager->mutex.unlock();
+	manager->server->mutex.unlock();
+	if (!empty)
+		return false;
+	BMT_LOG(INFO, "Closing room '%s', it has been empty for %d seconds", room->name.c_str(), ROOM_IDLE_CLOSE);
+	forget_history(&manager->server->sessions, room->id);
+	free_room(manager, room);
+	return true;
+}
+
+INTERNAL
+void room_worker(RoomManager* manager, u32 shard) {
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	boost::posix_time::time_duration period = boost::posix_time::microseconds(1000000 / manager->tickRate);
+	boost::posix_time::ptime nextTick = start;
+	f64 nextReport = TICK_REPORT_INTERVAL;
+	TickStats* stats = &manager->workerStats[shard];
+	std::vector<Room*> rooms;
+	while (!manager->close) {
+		boost::posix_time::ptime tickStart = boost::posix_time::microsec_clock::universal_time();
+		manager->mutex.lock();
+		rooms = manager->shards[shard];
+		manager->mutex.unlock();
+
+		f64 time = (tickStart - start).total_microseconds() / 1000000.0;
+		for (u32 i = 0; i < rooms.size(); ++i) {
+			boost::posix_time::ptime roomStart = boost::posix_time::microsec_clock::universal_time();
+			tick_room(manager, rooms[i], time);
+			f64 ms = elapsed_ms(roomStart);
+			add_tick(&rooms[i]->tickStats, ms, false);
+			record_latency(&manager->server->metrics.tick, (u64)(ms * 1000));
+			close_if_idle(manager, shard, rooms[i], time);
+		}
+
+		//a late tick starts the next one right away instead of trying to catch up
+		nextTick += period;
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		bool overrun = now > nextTick;
+		add_tick(stats, elapsed_ms(tickStart), overrun);
+		if (overrun) {
+			nextTick = now;
+			manager->server->metrics.tickOverruns.fetch_add(1, boost::memory_order_relaxed);
+		}
+		else
+			boost::this_thread::sleep(nextTick);
+
+		if (time >= nextReport) {
+			BMT_LOG(DEBUG, "Worker %d: %d rooms, %d ticks, avg %.3f ms, max %.3f ms, %d overruns at %d Hz",
+				shard, (u32)rooms.size(), (u32)stats->ticks, stats->totalMs / stats->ticks, stats->maxMs, (u32)stats->overruns, manager->tickRate);
+			nextReport += TICK_REPORT_INTERVAL;
+		}
+	}
+}
+
+void start_rooms(RoomManager* manager, Server* server, u32 workers, u32 tickRate) {
+	manager->server = server;
+	manager->close = false;
+	manager->tickRate = tickRate > 0 ? tickRate : TICK_RATE;
+	manager->shards.resize(workers > 0 ? workers : 1);
+	manager->workerStats.assign(manager->shards.size(), TickStats());
+	for (u32 i = 0; i < manager->shards.size(); ++i)
+		manager->workers.create_thread(boost::bind(room_worker, manager, i));
+}
+
+void stop_rooms(RoomManager* manager) {
+	manager->close = true;
+	manager->workers.join_all();
+
+	manager->mutex.lock();
+	for (u32 i = 0; i < manager->rooms.size(); ++i) {
+		if (manager->rooms[i] != NULL)
+			free_room(manager, manager->rooms[i]);
+	}
+	manager->rooms.clear();
+	manager->shards.clear();
+	manager->mutex.unlock();
+}
+
+INTERNAL
+Room* find_room(RoomManager* manager, const std::string& name) {
+	for (u32 i = 0; i < manager->rooms.size(); ++i) {
+		if (manager->rooms[i] != NULL && manager->rooms[i]->name == name)
+			return manager->rooms[i];
+	}
+	return NULL;
+}
+
+INTERNAL
+u32 count_open_rooms(RoomManager* manager) {
+	u32 count = 0;
+	for (u32 i = 0; i < manager->rooms.size(); ++i)
+		count += manager->rooms[i] != NULL ? 1 : 0;
+	return count;
+}
+
+INTERNAL
+Room* open_room_no_lock(RoomManager* manager, std::string name, bool hosted) {
+	name = clean_room_name(name);
+	Room* room = find_room(manager, name);
+	if (room != NULL)
+		return room;
+
+	room = new Room;
+	room->id = manager->rooms.size();
+	room->name = name;
+	room->hosted = hosted;
+	room->tickStats = TickStats();
+	room->fog = Fog();
+	room->emptySince = -1;
+	if (name == DEFAULT_ROOM_NAME) {
+		room->checkpointPath = CHECKPOINT_PATH;
+		room->mapPath = MAP_PATH;
+	}
+	else {
+		room->checkpointPath = "data/room_" + name + ".log";
+		room->mapPath = "data/room_" + name + ".ttm";
+	}
+
+	room->sim.map = { 0 };
+	if (!restore_checkpoint(room->checkpointPath.c_str(), &room->sim.map, &room->sim.rollLog) && !load_map(&room->sim.map, room->mapPath.c_str()))
+		init_default_map(&room->sim.map);
+	start_checkpointer(&room->checkpointer, room->checkpointPath.c_str());
+	//players joining get the snapshot, so there has to be one before the room is visible
+	publish_snapshot(&room->sim);
+
+	manager->rooms.push_back(room);
+	if (manager->shards.size() > 0) {
+		u32 emptiest = 0;
+		for (u32 i = 1; i < manager->shards.size(); ++i) {
+			if (manager->shards[i].size() < manager->shards[emptiest].size())
+				emptiest = i;
+		}
+		manager->shards[emptiest].push_back(room);
+	}
+	BMT_LOG(INFO, "Opened room '%s' (%d tokens)", name.c_str(), token_count(&room->sim.map.tokens));
+	return room;
+}
+
+Room* open_room(RoomManager* manager, std::string name, bool hosted) {
+	manager->mutex.lock();
+	Room* room = open_room_no_lock(manager, name, hosted);
+	manager->mutex.unlock();
+	return room;
+}
+
+Room* get_room(RoomManager* manager, u32 id) {
+	manager->mutex.lock();
+	Room* room = id < manager->rooms.size() ? manager->rooms[id] : NULL;
+	manager->mutex.unlock();
+	return room;
+}
+
+u32 join_room(RoomManager* manager, Transport* socket, std::string name, u8 layers, bool create) {
+	manager->mutex.lock();
+	Room* room = find_room(manager, clean_room_name(name));
+	if (room == NULL && (!create || count_open_rooms(manager) >= ROOM_LIMIT)) {
+		if (create)
+			BMT_LOG(WARNING, "Could not open room '%s', %d rooms are open already", clean_room_name(name).c_str(), ROOM_LIMIT);
+		name = DEFAULT_ROOM_NAME;
+	}
+	if (room == NULL)
+		room = open_room_no_lock(manager, name, false);
+	RoomMember member = { socket, layers };
+	room->members.push_back(member);
+	u32 id = room->id;
+	manager->mutex.unlock();
+	return id;
+}
+
+bool rejoin_room(RoomManager* manager, Transport* socket, u32 id, u8 layers) {
+	manager->mutex.lock();
+	bool open = id < manager->rooms.size() && manager->rooms[id] != NULL;
+	if (open) {
+		RoomMember member = { socket, layers };
+		manager->rooms[id]->members.push_back(member);
+	}
+	manager->mutex.unlock();
+	return open;
+}
+
+void leave_room(RoomManager* manager, Transport* socket) {
+	manager->mutex.lock();
+	for (u32 i = 0; i < manager->rooms.size(); ++i) {
+		if (manager->rooms[i] == NULL)
+			continue;
+		MemberList* members = &manager->rooms[i]->members;
+		for (u32 j = 0; j < members->size(); ++j) {
+			if (members->at(j).socket == socket) {
+				members->erase(members->begin() + j);
+				break;
+			}
+		}
+	}
+	manager->mutex.unlock();
+}
+
+void get_room_members(RoomManager* manager, u32 id, MemberList* members) {
+	manager->mutex.lock();
+	if (id < manager->rooms.size() && manager->rooms[id] != NULL)
+		*members = manager->rooms[id]->members;
+	else
+		members->clear();
+	manager->mutex.unlock();
+}
+
+bool post_to_room(RoomManager* manager, u32 id, Transport* sender, StringList* message) {
+	Room* room = get_room(manager, id);
+	return room != NULL && post_command(&room->sim, sender, message);
+}
+
+void post_roll_to_room(RoomManager* manager, u32 id, Transport* sender, std::string line) {
+	Room* room = get_room(manager, id);
+	if (room != NULL)
+		post_roll(&room->sim, sender, line);
+}
+
+//format_text shares one buffer and this runs on the io thread and every room worker at once
+INTERNAL
+void append_format(std::string* out, const char* format, ...) {
+	char line[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	out->append(line);
+}
+
+//the full state of a token as sent when it becomes visible, the client adds the token if it
+//does not have its handle yet
+INTERNAL
+void append_token_update(std::string* out, const Token* token, TokenHandle handle, u8 layer) {
+	append_format(out, "update_token|%u|%d|%d|%d|%d|%d|%d|", handle,
+		token->bars[0].current, token->bars[0].max, token->bars[1].current, token->bars[1].max,
+		token->bars[2].current, token->bars[2].max
+	);
+	//names can be longer than the line buffer
+	out->append(token->name);
+	append_format(out, "|%d\nmove|%u|%d|%d\n", token->imgindex, handle, token->xPos, token->yPos);
+	if (layer != LAYER_MAP)
+		append_format(out, "set_layer|%u|%d\n", handle, layer);
+}
+
+void tick_fog(Room* room) {
+	Map* map = &room->sim.map;
+	boost::shared_ptr<const std::string> state = boost::atomic_load(&room->fogState);
+	if (!map->fow) {
+		if (state != NULL) {
+			reset_fog(&room->fog, 0, 0);
+			boost::atomic_store(&room->fogState, boost::shared_ptr<const std::string>());
+		}
+		return;
+	}
+	//fog only changes when tokens, walls or the map do
+	if (!room->sim.changed && state != NULL)
+		return;
+
+	std::string delta = "fog|";
+	if (!update_fog(&room->fog, map, &delta) && state != NULL)
+		return;
+	//players joining get the whole state, the ones already here only what changed
+	std::string* next = new std::string();
+	append_fog_state(next, &room->fog);
+	boost::atomic_store(&room->fogState, boost::shared_ptr<const std::string>(next));
+	if (delta.size() > 4) {
+		Broadcast msg;
+		msg.socket = NULL;
+		msg.room = room->id;
+		msg.layer = LAYER_ANY;
+		msg.str = delta;
+		msg.str.append("\n");
+		room->outboxMutex.lock();
+		room->outbox.push_back(msg);
+		room->outboxMutex.unlock();
+	}
+}
+
+bool queue_room_broadcast(RoomManager* manager, Broadcast* msg) {
+	Room* room = get_room(manager, msg->room);
+	if (room == NULL)
+		return false;
+
+	//move|handle|..., update_token|handle|..., set_layer|handle|layer and delete_token|handle
+	//are about a single token. walls are hidden from players like GM layer tokens
+	msg->layer = LAYER_ANY;
+	size_t split = msg->str.find('|');
+	if (split != std::string::npos) {
+		std::string type = msg->str.substr(0, split);
+		if (type == "set_wall") {
+			msg->layer = LAYER_GM;
+		}
+		else if (type == "move" || type == "update_token" || type == "set_layer" || type == "delete_token") {
+			char* end = NULL;
+			TokenHandle handle = (TokenHandle)std::strtoul(msg->str.c_str() + split + 1, &end, 10);
+			boost::shared_ptr<const MapSnapshot> map = get_snapshot(&room->sim);
+			i32 ndx = snapshot_index(map.get(), handle);
+			//the token was deleted or never existed, nobody needs to hear about it
+			if (ndx == -1)
+				return true;
+			const Token* token = snapshot_token(map.get(), ndx);
+
+			//everyone hears about a layer change, players who could not see the token
+			//before need all of it now
+			if (type == "set_layer") {
+				u8 layer = (u8)std::atoi(end != NULL && *end == '|' ? end + 1 : "0");
+				if (!can_see(LAYERS_PLAYER, token->layer) && can_see(LAYERS_PLAYER, layer))
+					append_token_update(&msg->str, token, handle, layer);
+			}
+			else {
+				msg->layer = token->layer;
+			}
+		}
+	}
+
+	room->outboxMutex.lock();
+	room->outbox.push_back(*msg);
+	room->outboxMutex.unlock();
+	return true;
+}
+
+void append_room_state(RoomManager* manager, u32 id, u8 layers, std::string* out) {
+	Room* room = get_room(manager, id);
+	if (room == NULL)
+		return;
+
+	boost::shared_ptr<const MapSnapshot> map = get_snapshot(&room->sim);
+	//format: update_map|width|height|xPos|yPos|grid|fow|bgColor|gridColor|selected\n
+	append_format(out, "update_map|%d|%d|%d|%d|%d|%d|%f|%f|%f|%f|%f|%f|%f|%f|%d\n",
+		map->width, map->height, (i32)map->xPos, (i32)map->yPos, map->grid, map->fow, map->bgColor.x, map->bgColor.y, map->bgColor.z, map->bgColor.w,
+		map->gridColor.x, map->gridColor.y, map->gridColor.z, map->gridColor.w, -1
+	);
+
+	//tokens the session can not see are left out entirely, it is told about them if they are revealed
+	for (u32 i = 0; i < map->chunks.size(); ++i) {
+		const SnapshotChunk* chunk = map->chunks[i].get();
+		for (u32 j = 0; j < chunk->tokens.size(); ++j) {
+			if (can_see(layers, chunk->tokens[j].layer))
+				append_token_update(out, &chunk->tokens[j], chunk->handles[j], chunk->tokens[j].layer);
+		}
+	}
+
+	//format: walls|width|height|runs and fog_state|width|height|explored runs|visible runs
+	if (can_see(layers, LAYER_GM)) {
+		append_format(out, "walls|%d|%d|", map->walls->width, map->walls->height);
+		append_bit_runs(out, map->walls.get());
+		out->append("\n");
+	}
+	boost::shared_ptr<const std::string> fogState = boost::atomic_load(&room->fogState);
+	if (map->fow && fogState != NULL)
+		out->append(*fogState);
+}
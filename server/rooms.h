@@ -0,0 +1,100 @@
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <vector>
+#include "../DnDShared/globals.h"
+#include "simulation.h"
+#include "checkpoint.h"
+#include "fog.h"
+#include "session.h"
+
+#define DEFAULT_ROOM_NAME   "default"
+#define ROOM_WORKERS        4
+#define ROOM_COMMAND_BUDGET 256 //commands a room applies per tick
+#define TICK_REPORT_INTERVAL 60 //seconds between tick timing reports in the log
+#define MAP_PATH            "data/map.ttm"
+#define ROOM_LIMIT          64 //rooms open at once, the default room included
+#define ROOM_IDLE_CLOSE     SESSION_TICKET_TTL //seconds a room stays open without players, so dropped ones can resume into it
+
+//A room is one table: its own map, roll log, checkpoint and players. Rooms are spread
+//over a few worker threads that tick at a fixed rate. Each tick a room applies a
+//bounded number of commands, so a busy table cannot starve the quiet ones sharing its
+//worker, then sends everything broadcast to it since the last tick as one packet per
+//player. The default room keeps the old data/map.ttm and data/checkpoint.log files.
+//Only a DM can open a room, and a room other than the default one is written out and freed
+//once it has been empty for ROOM_IDLE_CLOSE. Its id is not reused.
+struct TickStats {
+	u64 ticks;
+	u64 overruns; //ticks that took longer than the tick period
+	f64 totalMs;
+	f64 maxMs;
+};
+
+struct RoomMember {
+	Transport* socket;
+	u8 layers; //the session's interest set
+};
+
+typedef std::vector<RoomMember> MemberList;
+
+struct Room {
+	u32 id;
+	std::string name;
+	Simulation sim;
+	Checkpointer checkpointer;
+	std::string checkpointPath;
+	std::string mapPath;
+	MemberList members; //guarded by the manager mutex
+	bool hosted;        //commands are applied by the DM console's frame loop, the worker only sends broadcasts
+	boost::mutex outboxMutex;
+	std::vector<Broadcast> outbox;
+	TickStats tickStats; //time spent on this room per tick, written by its worker
+	Fog fog;             //owned by whichever thread applies the room's commands
+	boost::shared_ptr<const std::string> fogState; //fog_state message for players joining, empty while fow is off
+	f64 emptySince;      //worker time the room was last seen empty, -1 while it has players
+};
+
+struct RoomManager {
+	RoomManager();
+	boost::mutex mutex;
+	std::vector<Room*> rooms; //indexed by room id, NULL once a room is closed
+	std::vector< std::vector<Room*> > shards;
+	boost::thread_group workers;
+	std::vector<TickStats> workerStats; //whole ticks, one per worker
+	u32 tickRate;
+	Server* server;
+	volatile bool close;
+};
+
+void start_rooms(RoomManager* manager, Server* server, u32 workers = ROOM_WORKERS, u32 tickRate = TICK_RATE);
+//joins the workers, then writes out and frees every room
+void stop_rooms(RoomManager* manager);
+//finds a room by name or loads it from disk (or creates an empty one)
+Room* open_room(RoomManager* manager, std::string name, bool hosted = false);
+//NULL if there is no such room or it was closed. outside the room workers the room may only be
+//used while holding the server mutex, rooms are closed under it
+Room* get_room(RoomManager* manager, u32 id);
+//adds socket to the named room and returns the room id. a room that is not open yet is only
+//opened if create is set (the session is a DM's) and ROOM_LIMIT allows, otherwise the
+//session joins the default room
+u32 join_room(RoomManager* manager, Transport* socket, std::string name, u8 layers, bool create);
+//false if the room has been closed since
+bool rejoin_room(RoomManager* manager, Transport* socket, u32 id, u8 layers);
+void leave_room(RoomManager* manager, Transport* socket);
+void get_room_members(RoomManager* manager, u32 id, MemberList* members);
+//queues a client message on a room's simulation, returns false if it is not a game command
+bool post_to_room(RoomManager* manager, u32 id, Transport* sender, StringList* message);
+//adds a line to a room's roll log
+void post_roll_to_room(RoomManager* manager, u32 id, Transport* sender, std::string line);
+//holds a broadcast for the room's next tick, returns false if there is no such room.
+//messages about a token are tagged with its layer so only sessions that can see it get them,
+//and dropped if the room has no token with that handle
+bool queue_room_broadcast(RoomManager* manager, Broadcast* msg);
+//updates the room's fog of war after its commands were applied and queues what changed for
+//its players. called by the room's worker, or the DM console's frame loop for the hosted room
+void tick_fog(Room* room);
+//the commands that rebuild a room's whole map on a client, sent when a player joins.
+//tokens outside the interest set are left out, and walls are only sent to the DM
+void append_room_state(RoomManager* manager, u32 id, u8 layers, std::string* out);
+
+#endif
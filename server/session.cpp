@@ -0,0 +1,161 @@
+#include "session.h"
+#include "map.h"
+#include <stdio.h>
+
+RoomHistory::RoomHistory() : dropped(0) {}
+
+SessionTable::SessionTable() : nextSeq(1), nextId(1) {}
+
+//random_device reads the OS's random source, a seeded generator would give every ticket away
+//once one of them is known
+INTERNAL
+std::string new_ticket() {
+	std::random_device device;
+	std::string ticket;
+	for (u32 i = 0; i < SESSION_TICKET_BYTES / 4; ++i) {
+		char hex[9];
+		snprintf(hex, sizeof(hex), "%08x", (u32)device());
+		ticket.append(hex);
+	}
+	return ticket;
+}
+
+INTERNAL
+void prune_expired(SessionTable* table) {
+	boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+	for (u32 i = 0; i < table->sessions.size();) {
+		Session* session = &table->sessions[i];
+		if (session->socket == NULL && session->expires < now) {
+			BMT_LOG(INFO, "Session for [%s] expired", session->account.name.c_str());
+			table->sessions.erase(table->sessions.begin() + i);
+			continue;
+		}
+		++i;
+	}
+}
+
+std::string issue_session(SessionTable* table, Account* account, Transport* socket) {
+	table->mutex.lock();
+	prune_expired(table);
+
+	Session session;
+	session.ticket = new_ticket();
+	session.id = table->nextId++;
+	session.account = *account;
+	session.socket = socket;
+	table->sessions.push_back(session);
+
+	table->mutex.unlock();
+	return session.ticket;
+}
+
+void detach_session(SessionTable* table, Transport* socket) {
+	table->mutex.lock();
+	for (u32 i = 0; i < table->sessions.size(); ++i) {
+		Session* session = &table->sessions[i];
+		if (session->socket == socket) {
+			session->socket = NULL;
+			session->account.socket = NULL;
+			session->expires = boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(SESSION_TICKET_TTL);
+			break;
+		}
+	}
+	table->mutex.unlock();
+}
+
+//index of the first message after seq
+INTERNAL
+u32 first_after(const std::deque<SequencedMessage>* messages, u64 seq) {
+	u32 i = messages->size();
+	while (i > 0 && messages->at(i - 1).seq > seq)
+		i--;
+	return i;
+}
+
+ResumeState resume_session(SessionTable* table, const std::string& ticket, u64 lastSeq, Transport* socket, Account* account, std::string* missed, Transport** stale) {
+	table->mutex.lock();
+	prune_expired(table);
+	*stale = NULL;
+
+	Session* session = NULL;
+	for (u32 i = 0; i < table->sessions.size(); ++i) {
+		if (table->sessions[i].ticket == ticket) {
+			session = &table->sessions[i];
+			break;
+		}
+	}
+	if (session == NULL) {
+		table->mutex.unlock();
+		return RESUME_EXPIRED;
+	}
+
+	//the client needs everything after lastSeq, which is only possible if neither its room
+	//nor ROOM_ALL has pushed out anything newer
+	RoomHistory* histories[2] = { &table->history[session->account.room], &table->history[ROOM_ALL] };
+	if (lastSeq >= table->nextSeq || histories[0]->dropped > lastSeq || histories[1]->dropped > lastSeq) {
+		table->mutex.unlock();
+		return RESUME_OUT_OF_HISTORY;
+	}
+
+	//both are in sequence order, so they are merged as they are read
+	u32 next[2] = { first_after(&histories[0]->messages, lastSeq), first_after(&histories[1]->messages, lastSeq) };
+	missed->clear();
+	for (;;) {
+		bool room = next[0] < histories[0]->messages.size();
+		bool all = next[1] < histories[1]->messages.size();
+		if (!room && !all)
+			break;
+		u32 pick = !room || (all && histories[1]->messages[next[1]].seq < histories[0]->messages[next[0]].seq) ? 1 : 0;
+		SequencedMessage* msg = &histories[pick]->messages[next[pick]++];
+		if (msg->sender == session->id)
+			missed->append(msg->ack);
+		else if (msg->layer == LAYER_ANY || (session->account.layers & LAYER_BIT(msg->layer)))
+			missed->append(msg->str);
+	}
+
+	if (session->socket != socket)
+		*stale = session->socket;
+	session->socket = socket;
+	session->account.socket = socket;
+	*account = session->account;
+
+	table->mutex.unlock();
+	return RESUME_SUCCESS;
+}
+
+u64 record_broadcast(SessionTable* table, Transport* sender, u32 room, u8 layer, const std::string& message, const std::string& ack) {
+	table->mutex.lock();
+	SequencedMessage msg;
+	msg.seq = table->nextSeq++;
+	msg.sender = 0;
+	for (u32 i = 0; i < table->sessions.size() && sender != NULL; ++i) {
+		if (table->sessions[i].socket == sender) {
+			msg.sender = table->sessions[i].id;
+			break;
+		}
+	}
+	msg.layer = layer;
+	msg.str = message;
+	msg.ack = ack;
+	RoomHistory* history = &table->history[room];
+	history->messages.push_back(msg);
+	if (history->messages.size() > SESSION_HISTORY_SIZE) {
+		history->dropped = history->messages.front().seq;
+		history->messages.pop_front();
+	}
+	table->mutex.unlock();
+	return msg.seq;
+}
+
+u64 get_last_seq(SessionTable* table) {
+	table->mutex.lock();
+	u64 seq = table->nextSeq - 1;
+	table->mutex.unlock();
+	return seq;
+}
+
+void forget_history(SessionTable* table, u32 room) {
+	table->mutex.lock();
+	table->history.erase(room);
+	table->mutex.unlock();
+}
@@ -0,0 +1,70 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <deque>
+#include <map>
+#include "../DnDShared/globals.h"
+#include "accounts.h"
+
+#define SESSION_TICKET_TTL   300  //seconds a dropped session stays resumable
+#define SESSION_HISTORY_SIZE 2048 //broadcast messages kept around per room for resuming clients
+#define SESSION_TICKET_BYTES 16   //random bytes in a ticket, sent as hex
+
+//A ticket lets a client back in without its password, so it is drawn from the OS's random
+//source and never shown to anyone but its owner. Everything else refers to a session by id.
+struct Session {
+	std::string ticket;
+	u64 id;
+	Account account;
+	Transport* socket; //NULL while the client is disconnected
+	boost::posix_time::ptime expires;
+};
+
+struct SequencedMessage {
+	u64 seq;
+	u64 sender; //id of the session the message came from, or 0
+	u8 layer;
+	std::string str;
+	std::string ack; //replayed to the sender in str's place
+};
+
+//Sequence numbers are shared by every room, but each room keeps its own window of them, so a
+//busy table does not push a quiet one's messages out before its players can resume.
+struct RoomHistory {
+	RoomHistory();
+	std::deque<SequencedMessage> messages;
+	u64 dropped; //sequence number of the newest message pushed out, 0 if none was
+};
+
+struct SessionTable {
+	SessionTable();
+	boost::mutex mutex;
+	std::vector<Session> sessions;
+	std::map<u32, RoomHistory> history; //by room, ROOM_ALL has its own
+	u64 nextSeq;
+	u64 nextId;
+};
+
+enum ResumeState {
+	RESUME_SUCCESS,
+	RESUME_EXPIRED,
+	RESUME_OUT_OF_HISTORY
+};
+
+//creates a session slot for a freshly logged in account and returns its ticket
+std::string issue_session(SessionTable* table, Account* account, Transport* socket);
+//marks the session owned by socket as dropped, it can be resumed until the ticket expires
+void detach_session(SessionTable* table, Transport* socket);
+//reattaches a session to a new socket. on success account is restored and missed holds every
+//broadcast the account would have been sent with a sequence number greater than lastSeq. a
+//session whose old connection has not been noticed as dead yet is taken over, stale is then
+//that connection for the caller to close, otherwise NULL
+ResumeState resume_session(SessionTable* table, const std::string& ticket, u64 lastSeq, Transport* socket, Account* account, std::string* missed, Transport** stale);
+//stores a broadcast in the history and returns the sequence number it was given. like live
+//delivery, a replay gives the sender its ack rather than its own message back
+u64 record_broadcast(SessionTable* table, Transport* sender, u32 room, u8 layer, const std::string& message, const std::string& ack);
+u64 get_last_seq(SessionTable* table);
+//drops a closed room's history, nobody can resume into it anymore
+void forget_history(SessionTable* table, u32 room);
+
+#endif
@@ -0,0 +1,265 @@
+#include "simulation.h"
+#include <algorithm>
+
+Simulation::Simulation() : inbox(COMMAND_QUEUE_SIZE), queued(0), wallsChanged(false), replaced(true), changed(true) {}
+
+bool post_command(Simulation* sim, Transport* sender, StringList* message) {
+	GameCommandType type;
+	if (message->at(0) == "move" && message->size() >= 4)
+		type = COMMAND_MOVE;
+	else if (message->at(0) == "update_token" && message->size() >= 10)
+		type = COMMAND_UPDATE_TOKEN;
+	else if (message->at(0) == "update_map" && message->size() >= 16)
+		type = COMMAND_UPDATE_MAP;
+	else if (message->at(0) == "set_layer" && message->size() >= 3)
+		type = COMMAND_SET_LAYER;
+	else if (message->at(0) == "delete_token" && message->size() >= 2)
+		type = COMMAND_DELETE_TOKEN;
+	else if (message->at(0) == "set_wall" && message->size() >= 4)
+		type = COMMAND_SET_WALL;
+	else
+		return false;
+
+	GameCommand* command = new GameCommand;
+	command->type = type;
+	command->sender = sender;
+	command->args.assign(message->begin() + 1, message->end());
+	sim->queued.fetch_add(1, boost::memory_order_relaxed);
+	sim->inbox.push(command);
+	return true;
+}
+
+void post_roll(Simulation* sim, Transport* sender, std::string line) {
+	GameCommand* command = new GameCommand;
+	command->type = COMMAND_ROLL;
+	command->sender = sender;
+	command->args.push_back(line);
+	sim->queued.fetch_add(1, boost::memory_order_relaxed);
+	sim->inbox.push(command);
+}
+
+void add_roll(Simulation* sim, Checkpointer* cp, std::string str) {
+	sim->rollLog.push_back(str);
+	if (sim->rollLog.size() > ROLL_LOG_SIZE) {
+		sim->rollLog.erase(sim->rollLog.begin());
+	}
+	mark_roll_log_dirty(cp);
+	sim->changed = true;
+}
+
+void delete_token(Simulation* sim, Checkpointer* cp, TokenHandle handle) {
+	Map* map = &sim->map;
+	i32 ndx = token_index(&map->tokens, handle);
+	if (ndx == -1)
+		return;
+	//the last token moves into the deleted one's place, so both of their chunks change
+	mark_token_changed(sim, cp, ndx);
+	mark_token_changed(sim, cp, token_count(&map->tokens) - 1);
+	remove_token(&map->tokens, handle);
+	if (map->selected == handle)
+		map->selected = TOKEN_NONE;
+	sim->changed = true;
+}
+
+void set_wall(Simulation* sim, Checkpointer* cp, i32 x, i32 y, bool wall) {
+	Map* map = &sim->map;
+	if (x < 0 || y < 0 || x >= (i32)map->walls.width || y >= (i32)map->walls.height)
+		return;
+	set_bit(&map->walls, y * map->walls.width + x, wall);
+	mark_walls_changed(sim, cp);
+}
+
+void mark_token_changed(Simulation* sim, Checkpointer* cp, u32 index) {
+	mark_token_dirty(cp, index);
+	sim->dirtyChunks.insert(index / TOKENS_PER_CHUNK);
+	sim->changed = true;
+}
+
+void mark_walls_changed(Simulation* sim, Checkpointer* cp) {
+	mark_walls_dirty(cp);
+	sim->wallsChanged = true;
+	sim->changed = true;
+}
+
+//reads count whole numbers from args, starting at first. false if any of them is not one,
+//a client can send anything and the command is dropped then
+INTERNAL
+bool parse_ints(const StringList* args, u32 first, u32 count, i32* out) {
+	for (u32 i = 0; i < count; ++i) {
+		const char* str = args->at(first + i).c_str();
+		char* end;
+		out[i] = (i32)strtol(str, &end, 10);
+		if (end == str || *end != '\0')
+			return false;
+	}
+	return true;
+}
+
+INTERNAL
+bool parse_floats(const StringList* args, u32 first, u32 count, f32* out) {
+	for (u32 i = 0; i < count; ++i) {
+		const char* str = args->at(first + i).c_str();
+		char* end;
+		out[i] = strtof(str, &end);
+		if (end == str || *end != '\0')
+			return false;
+	}
+	return true;
+}
+
+INTERNAL
+void apply_command(Simulation* sim, Checkpointer* cp, GameCommand* command) {
+	Map* map = &sim->map;
+	StringList* args = &command->args;
+	i32 values[6];
+	f32 colors[8];
+
+	switch (command->type) {
+	case COMMAND_ROLL: {
+		add_roll(sim, cp, args->at(0));
+	} break;
+	case COMMAND_MOVE: {
+		i32 ndx = token_index(&map->tokens, parse_handle(args->at(0)));
+		if (ndx == -1 || !parse_ints(args, 1, 2, values))
+			break;
+		move_token(&map->tokens, ndx, values[0], values[1]);
+		mark_token_changed(sim, cp, ndx);
+	} break;
+	case COMMAND_UPDATE_TOKEN: {
+		//tokens are only created by the server, an update for a handle it does not know is dropped
+		i32 ndx = token_index(&map->tokens, parse_handle(args->at(0)));
+		i32 image;
+		if (ndx == -1 || !parse_ints(args, 1, TOKEN_BARS * 2, values) || !parse_ints(args, 8, 1, &image))
+			break;
+		for (u32 i = 0; i < TOKEN_BARS; ++i) {
+			map->tokens.bars[i][ndx].current = values[i * 2];
+			map->tokens.bars[i][ndx].max = values[i * 2 + 1];
+		}
+		map->tokens.names[ndx] = args->at(7);
+		map->tokens.imgindex[ndx] = image;
+		mark_token_changed(sim, cp, ndx);
+	} break;
+	case COMMAND_UPDATE_MAP: {
+		if (!parse_ints(args, 0, 6, values) || !parse_floats(args, 6, 8, colors) || !map_size_valid(values[0], values[1]))
+			return;
+		//clearing rather than resetting the store keeps the old handles stale
+		clear_tokens(&map->tokens);
+		map->rects.clear();
+		index_rects(map);
+
+		map->width = values[0];
+		map->height = values[1];
+		map->xPos = values[2];
+		map->yPos = values[3];
+		map->grid = values[4];
+		map->fow = values[5];
+		map->bgColor = { colors[0], colors[1], colors[2], colors[3] };
+		map->gridColor = { colors[4], colors[5], colors[6], colors[7] };
+		map->selected = TOKEN_NONE;
+		resize_bits(&map->walls, map->width, map->height);
+		map->revision++;
+		mark_map_replaced(cp);
+		sim->replaced = true;
+	} break;
+	case COMMAND_SET_LAYER: {
+		i32 ndx = token_index(&map->tokens, parse_handle(args->at(0)));
+		i32 layer;
+		if (ndx == -1 || !parse_ints(args, 1, 1, &layer) || layer < LAYER_MAP || layer > LAYER_TOKEN)
+			break;
+		map->tokens.layer[ndx] = (u8)layer;
+		mark_token_changed(sim, cp, ndx);
+	} break;
+	case COMMAND_DELETE_TOKEN: {
+		delete_token(sim, cp, parse_handle(args->at(0)));
+	} break;
+	case COMMAND_SET_WALL: {
+		if (parse_ints(args, 0, 3, values))
+			set_wall(sim, cp, values[0], values[1], values[2] != 0);
+	} break;
+	}
+	sim->changed = true;
+}
+
+u32 apply_commands(Simulation* sim, Checkpointer* cp, u32 maxCommands) {
+	u32 applied = 0;
+	GameCommand* command;
+	while (applied < maxCommands && sim->inbox.pop(command)) {
+		sim->queued.fetch_sub(1, boost::memory_order_relaxed);
+		apply_command(sim, cp, command);
+		delete command;
+		applied++;
+	}
+	return applied;
+}
+
+INTERNAL
+SnapshotChunk* copy_chunk(const TokenStore* tokens, u32 chunk) {
+	SnapshotChunk* copy = new SnapshotChunk;
+	u32 first = chunk * TOKENS_PER_CHUNK;
+	u32 last = std::min(first + TOKENS_PER_CHUNK, token_count(tokens));
+	copy->tokens.resize(last - first);
+	for (u32 i = first; i < last; ++i)
+		get_token(tokens, i, &copy->tokens[i - first]);
+	copy->handles.assign(tokens->handles.begin() + first, tokens->handles.begin() + last);
+	return copy;
+}
+
+void publish_snapshot(Simulation* sim) {
+	if (!sim->changed)
+		return;
+	const Map* map = &sim->map;
+	const TokenStore* tokens = &map->tokens;
+	boost::shared_ptr<const MapSnapshot> last = get_snapshot(sim);
+	bool rebuild = last == NULL || sim->replaced;
+
+	MapSnapshot* next = new MapSnapshot;
+	next->width = map->width;
+	next->height = map->height;
+	next->xPos = map->xPos;
+	next->yPos = map->yPos;
+	next->grid = map->grid;
+	next->fow = map->fow;
+	next->bgColor = map->bgColor;
+	next->gridColor = map->gridColor;
+	next->tokenCount = token_count(tokens);
+
+	//only chunks that were marked are copied, the last one is also copied whenever it grew or shrank
+	u32 chunks = (next->tokenCount + TOKENS_PER_CHUNK - 1) / TOKENS_PER_CHUNK;
+	next->chunks.resize(chunks);
+	for (u32 i = 0; i < chunks; ++i) {
+		u32 size = std::min((u32)TOKENS_PER_CHUNK, next->tokenCount - i * TOKENS_PER_CHUNK);
+		if (!rebuild && i < last->chunks.size() && last->chunks[i]->handles.size() == size && sim->dirtyChunks.count(i) == 0)
+			next->chunks[i] = last->chunks[i];
+		else
+			next->chunks[i].reset(copy_chunk(tokens, i));
+	}
+	//slots only change when tokens are added or removed
+	if (rebuild || next->tokenCount != last->tokenCount)
+		next->slots.reset(new std::vector<u32>(tokens->slots));
+	else
+		next->slots = last->slots;
+	if (rebuild || sim->wallsChanged)
+		next->walls.reset(new BitGrid(map->walls));
+	else
+		next->walls = last->walls;
+
+	boost::atomic_store(&sim->snapshot, boost::shared_ptr<const MapSnapshot>(next));
+	sim->dirtyChunks.clear();
+	sim->wallsChanged = false;
+	sim->replaced = false;
+	sim->changed = false;
+}
+
+boost::shared_ptr<const MapSnapshot> get_snapshot(Simulation* sim) {
+	return boost::atomic_load(&sim->snapshot);
+}
+
+i32 snapshot_index(const MapSnapshot* snapshot, TokenHandle handle) {
+	u32 slot = handle & TOKEN_SLOT_MASK;
+	if (slot >= snapshot->slots->size())
+		return -1;
+	u32 index = (*snapshot->slots)[slot];
+	if (index >= snapshot->tokenCount || snapshot->chunks[index / TOKENS_PER_CHUNK]->handles[index % TOKENS_PER_CHUNK] != handle)
+		return -1;
+	return index;
+}
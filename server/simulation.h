@@ -0,0 +1,95 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include "../DnDShared/globals.h"
+#include "map.h"
+#include "checkpoint.h"
+
+#define COMMAND_QUEUE_SIZE 1024
+#define ROLL_LOG_SIZE      15
+
+enum GameCommandType {
+	COMMAND_ROLL,
+	COMMAND_MOVE,
+	COMMAND_UPDATE_TOKEN,
+	COMMAND_UPDATE_MAP,
+	COMMAND_SET_LAYER,
+	COMMAND_DELETE_TOKEN,
+	COMMAND_SET_WALL
+};
+
+struct GameCommand {
+	GameCommandType type;
+	Transport* sender;
+	StringList args;
+};
+
+//What other threads read of the map. Tokens are published in the checkpoint's chunks, and a
+//new snapshot shares every chunk (and the walls and slots) that did not change with the last
+//one, so publishing costs about as much as the change.
+struct SnapshotChunk {
+	std::vector<Token> tokens;
+	std::vector<TokenHandle> handles;
+};
+
+struct MapSnapshot {
+	u32 width;
+	u32 height;
+	f32 xPos;
+	f32 yPos;
+	bool grid;
+	bool fow;
+	vec4 bgColor;
+	vec4 gridColor;
+	u32 tokenCount;
+	std::vector<boost::shared_ptr<const SnapshotChunk> > chunks;
+	boost::shared_ptr<const std::vector<u32> > slots; //the store's slots, to look up handles
+	boost::shared_ptr<const BitGrid> walls;
+};
+
+//The map and roll log belong to a single thread (the DM console's frame loop). The
+//network thread never touches them; it posts decoded commands to the inbox, which the
+//owner drains at the start of a frame. Other threads read the last published snapshot,
+//an immutable copy that is swapped in whenever the state changed. Whatever changes the map
+//marks what it changed, for the next snapshot as well as the checkpoint.
+struct Simulation {
+	Simulation();
+	Map map;
+	StringList rollLog;
+	boost::lockfree::queue<GameCommand*> inbox;
+	boost::atomic<u32> queued; //commands in the inbox, for the metrics
+	boost::shared_ptr<const MapSnapshot> snapshot;
+	std::set<u32> dirtyChunks; //token chunks changed since the last snapshot
+	bool wallsChanged;
+	bool replaced;             //the whole map is new, nothing of the last snapshot is kept
+	bool changed;
+};
+
+//decodes a client message, returns false if it is not a game command. safe to call from any thread.
+bool post_command(Simulation* sim, Transport* sender, StringList* message);
+//queues a line for the roll log, rolls are made by the server so they never come from post_command
+void post_roll(Simulation* sim, Transport* sender, std::string line);
+//applies up to maxCommands queued commands, owner thread only. returns the number applied.
+u32 apply_commands(Simulation* sim, Checkpointer* cp, u32 maxCommands = 0xFFFFFFFF);
+void add_roll(Simulation* sim, Checkpointer* cp, std::string str);
+//owner thread only, does nothing if the handle is stale
+void delete_token(Simulation* sim, Checkpointer* cp, TokenHandle handle);
+//owner thread only, does nothing if the tile is off the map
+void set_wall(Simulation* sim, Checkpointer* cp, i32 x, i32 y, bool wall);
+//owner thread only, for edits made directly to the map
+void mark_token_changed(Simulation* sim, Checkpointer* cp, u32 index);
+void mark_walls_changed(Simulation* sim, Checkpointer* cp);
+//publishes a new snapshot if anything changed since the last one, owner thread only
+void publish_snapshot(Simulation* sim);
+boost::shared_ptr<const MapSnapshot> get_snapshot(Simulation* sim);
+//index of a live token in a snapshot, or -1
+i32 snapshot_index(const MapSnapshot* snapshot, TokenHandle handle);
+INTERNAL inline
+const Token* snapshot_token(const MapSnapshot* snapshot, u32 index) {
+	return &snapshot->chunks[index / TOKENS_PER_CHUNK]->tokens[index % TOKENS_PER_CHUNK];
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include "stringpool.h"
+#include <string.h>
+
+#define POOL_ID_OFFSET 3 //keeps the id 4 byte aligned inside the struct
+
+INTERNAL inline
+u32 interned_id(const SheetString* str) {
+	u32 id;
+	memcpy(&id, str->chars + POOL_ID_OFFSET, sizeof(id));
+	return id;
+}
+
+INTERNAL
+u32 intern(StringPool* pool, const std::string& value) {
+	boost::unordered_map<boost::string_ref, u32, StringRefHash>::iterator it = pool->lookup.find(boost::string_ref(value));
+	if (it != pool->lookup.end()) {
+		pool->refs[it->second]++;
+		return it->second;
+	}
+
+	u32 id;
+	if (pool->freeIds.size() > 0) {
+		id = pool->freeIds.back();
+		pool->freeIds.pop_back();
+		pool->strings[id] = value;
+		pool->refs[id] = 1;
+	}
+	else {
+		id = pool->strings.size();
+		pool->strings.push_back(value);
+		pool->refs.push_back(1);
+	}
+	pool->lookup[boost::string_ref(pool->strings[id])] = id;
+	return id;
+}
+
+SheetString make_sheet_string(StringPool* pool, const std::string& value) {
+	SheetString str = { 0 };
+	if (value.size() <= SHEET_STRING_INLINE) {
+		str.length = (u8)value.size();
+		memcpy(str.chars, value.data(), value.size());
+	}
+	else {
+		str.length = SHEET_STRING_INTERNED;
+		u32 id = intern(pool, value);
+		memcpy(str.chars + POOL_ID_OFFSET, &id, sizeof(id));
+	}
+	return str;
+}
+
+void release_sheet_string(StringPool* pool, SheetString* str) {
+	if (str->length == SHEET_STRING_INTERNED) {
+		u32 id = interned_id(str);
+		if (--pool->refs[id] == 0) {
+			pool->lookup.erase(boost::string_ref(pool->strings[id]));
+			std::string().swap(pool->strings[id]);
+			pool->freeIds.push_back(id);
+		}
+	}
+	str->length = 0;
+}
+
+std::string get_sheet_string(StringPool* pool, const SheetString* str) {
+	if (str->length == SHEET_STRING_INTERNED)
+		return pool->strings[interned_id(str)];
+	return std::string(str->chars, str->length);
+}
+
+u64 string_pool_memory(StringPool* pool) {
+	u64 bytes = sizeof(StringPool);
+	for (u32 i = 0; i < pool->strings.size(); ++i) {
+		bytes += sizeof(std::string);
+		if (pool->strings[i].capacity() > 15)
+			bytes += pool->strings[i].capacity() + 1;
+	}
+	bytes += pool->refs.capacity() * sizeof(u32);
+	bytes += pool->freeIds.capacity() * sizeof(u32);
+	//one node per entry plus the bucket array
+	bytes += pool->lookup.size() * (sizeof(boost::string_ref) + sizeof(u32) + sizeof(void*) * 2);
+	bytes += pool->lookup.bucket_count() * sizeof(void*);
+	return bytes;
+}
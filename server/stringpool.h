@@ -0,0 +1,46 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/functional/hash.hpp>
+#include "../DnDShared/defines.h"
+
+//Character sheet text is mostly short values or the same placeholders over and over
+//("enter a name", "stand type", ...). A SheetString keeps values of up to 7 bytes
+//inline and interns anything longer in a reference counted pool, so a repeated
+//placeholder is stored once no matter how many accounts use it.
+
+#define SHEET_STRING_INLINE   7
+#define SHEET_STRING_INTERNED 0xFF
+
+struct SheetString {
+	u8 length;                       //SHEET_STRING_INTERNED when the value lives in the pool
+	char chars[SHEET_STRING_INLINE]; //the inline value, or the pool id in the last 4 bytes
+};
+
+static_assert(sizeof(SheetString) == 8, "sheet string layout changed");
+
+struct StringRefHash {
+	std::size_t operator()(boost::string_ref str) const {
+		return boost::hash_range(str.begin(), str.end());
+	}
+};
+
+struct StringPool {
+	std::deque<std::string> strings; //deque so the lookup keys never move
+	std::vector<u32> refs;
+	std::vector<u32> freeIds;
+	boost::unordered_map<boost::string_ref, u32, StringRefHash> lookup;
+};
+
+SheetString make_sheet_string(StringPool* pool, const std::string& value);
+void release_sheet_string(StringPool* pool, SheetString* str);
+std::string get_sheet_string(StringPool* pool, const SheetString* str);
+//approximate heap and struct bytes used by the pool
+u64 string_pool_memory(StringPool* pool);
+
+#endif
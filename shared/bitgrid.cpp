@@ -0,0 +1,133 @@
+#include "bitgrid.h"
+#include <stdlib.h>
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+INTERNAL inline
+u32 lowest_bit(u64 word) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+INTERNAL inline
+u32 bit_count(const BitGrid* grid) {
+	return grid->width * grid->height;
+}
+
+void resize_bits(BitGrid* grid, u32 width, u32 height) {
+	grid->width = width;
+	grid->height = height;
+	grid->words.assign(((u64)width * height + 63) / 64, 0);
+}
+
+void clear_bits(BitGrid* grid) {
+	std::fill(grid->words.begin(), grid->words.end(), 0);
+}
+
+//index of the first bit at or after start whose value is not value, or end.
+//whole words that match are skipped without looking at their bits
+INTERNAL
+u32 find_run_end(const std::vector<u64>& words, u32 start, u32 end, bool value) {
+	u32 pos = start;
+	while (pos < end) {
+		u64 word = words[pos >> 6];
+		if (value) word = ~word;
+		word >>= (pos & 63);
+		if (word != 0) {
+			pos += lowest_bit(word);
+			return pos < end ? pos : end;
+		}
+		pos = (pos | 63) + 1;
+	}
+	return end;
+}
+
+void append_bit_runs(std::string* out, const BitGrid* grid) {
+	u32 end = bit_count(grid);
+	u32 pos = 0;
+	bool value = false;
+	do {
+		u32 next = find_run_end(grid->words, pos, end, value);
+		if (value || pos > 0) out->append(",");
+		out->append(std::to_string(next - pos));
+		pos = next;
+		value = !value;
+	} while (pos < end);
+}
+
+bool read_bit_runs(BitGrid* grid, const std::string& runs) {
+	clear_bits(grid);
+	u32 end = bit_count(grid);
+	u32 pos = 0;
+	bool value = false;
+	const char* c = runs.c_str();
+	while (*c != '\0') {
+		char* next = NULL;
+		u32 length = (u32)strtoul(c, &next, 10);
+		if (next == c || (u64)pos + length > end)
+			return false;
+		for (u32 i = 0; value && i < length; ++i)
+			set_bit(grid, pos + i, true);
+		pos += length;
+		value = !value;
+		c = *next == ',' ? next + 1 : next;
+		if (*next != ',' && *next != '\0')
+			return false;
+	}
+	return pos == end;
+}
+
+void append_bit_changes(std::string* out, const BitGrid* before, const BitGrid* after) {
+	std::vector<u64> diff(after->words.size());
+	for (u32 i = 0; i < diff.size(); ++i)
+		diff[i] = before->words[i] ^ after->words[i];
+
+	u32 end = bit_count(after);
+	u32 pos = 0;
+	bool first = true;
+	while (pos < end) {
+		//skip what did not change, then split what did into runs of one value
+		pos = find_run_end(diff, pos, end, false);
+		if (pos == end)
+			break;
+		u32 changedEnd = find_run_end(diff, pos, end, true);
+		while (pos < changedEnd) {
+			bool value = get_bit(after, pos);
+			u32 next = find_run_end(after->words, pos, changedEnd, value);
+			if (!first) out->append(",");
+			out->append(std::to_string(pos));
+			out->append(",");
+			out->append(std::to_string(next - pos));
+			out->append(value ? ",1" : ",0");
+			first = false;
+			pos = next;
+		}
+	}
+}
+
+bool apply_bit_changes(BitGrid* grid, const std::string& changes) {
+	u32 end = bit_count(grid);
+	const char* c = changes.c_str();
+	while (*c != '\0') {
+		u32 values[3];
+		for (u32 i = 0; i < 3; ++i) {
+			char* next = NULL;
+			values[i] = (u32)strtoul(c, &next, 10);
+			if (next == c || (*next != ',' && *next != '\0'))
+				return false;
+			c = *next == ',' ? next + 1 : next;
+		}
+		if ((u64)values[0] + values[1] > end)
+			return false;
+		for (u32 i = 0; i < values[1]; ++i)
+			set_bit(grid, values[0] + i, values[2] != 0);
+	}
+	return true;
+}
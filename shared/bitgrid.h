@@ -0,0 +1,50 @@
+#ifndef BITGRID_H
+#define BITGRID_H
+
+#include <vector>
+#include <string>
+#include "bahamut.h"
+
+//One bit per map tile, row major, 64 tiles to a word. Used for walls and fog of war.
+struct BitGrid {
+	u32 width;
+	u32 height;
+	std::vector<u64> words;
+};
+
+//clears every bit
+void resize_bits(BitGrid* grid, u32 width, u32 height);
+void clear_bits(BitGrid* grid);
+
+INTERNAL inline
+bool get_bit(const BitGrid* grid, u32 index) {
+	return (grid->words[index >> 6] >> (index & 63)) & 1;
+}
+
+INTERNAL inline
+void set_bit(BitGrid* grid, u32 index, bool value) {
+	if (value)
+		grid->words[index >> 6] |= (u64)1 << (index & 63);
+	else
+		grid->words[index >> 6] &= ~((u64)1 << (index & 63));
+}
+
+//out of bounds tiles read as false
+INTERNAL inline
+bool get_tile(const BitGrid* grid, i32 x, i32 y) {
+	if (x < 0 || y < 0 || x >= (i32)grid->width || y >= (i32)grid->height)
+		return false;
+	return get_bit(grid, y * grid->width + x);
+}
+
+//The whole grid as run lengths, alternating between runs of clear and set bits and
+//starting with a clear run, e.g. "0,3,12" is three set tiles followed by twelve clear ones.
+void append_bit_runs(std::string* out, const BitGrid* grid);
+//returns false if the runs do not add up to the grid's size
+bool read_bit_runs(BitGrid* grid, const std::string& runs);
+//Only the bits that differ between two grids of the same size, as start,length,value
+//triples. Applying them sets bits rather than flipping them, so applying twice is harmless.
+void append_bit_changes(std::string* out, const BitGrid* before, const BitGrid* after);
+bool apply_bit_changes(BitGrid* grid, const std::string& changes);
+
+#endif
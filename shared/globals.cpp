@@ -25,57 +25,145 @@ Sound music[10];
 Font BODY_FONT;
 Font HEADER_FONT;
 
+struct ImageAsset {
+	Texture* texture; //NULL for the menu sheet, which is cut up into menu_tex
+	const char* path;
+};
+
+struct SoundAsset {
+	Sound* sound;
+	const char* path;
+};
+
+INTERNAL const ImageAsset IMAGE_ASSETS[] = {
+	{ &cursor, "art/cursor.png" },
+	{ &button_tex_n, "art/button_n.png" },
+	{ &button_tex_h, "art/button_h.png" },
+	{ &button_tex_p, "art/button_p.png" },
+
+	{ &tokenimages[0], "art/jojo.png" },
+	{ &tokenimages[1], "art/io.png" },
+	{ &tokenimages[2], "art/Dont_ask.png" },
+	{ &tokenimages[3], "art/VigilanteSquare.png" },
+	{ &tokenimages[4], "art/GoldVigilanteSquare.png" },
+	{ &tokenimages[5], "art/jojo.png" },
+	{ &tokenimages[6], "art/jojo.png" },
+	{ &tokenimages[7], "art/jojo.png" },
+	{ &tokenimages[8], "art/jojo.png" },
+	{ &tokenimages[9], "art/jojo.png" },
+
+	{ &select_button, "art/select_button.png" },
+	{ &layers_button, "art/layers_button.png" },
+	{ &square_button, "art/square_button.png" },
+	{ &circle_button, "art/circle_button.png" },
+	{ &char_sheet_icon, "art/char_sheet_icon.png" },
+	{ &turn_button, "art/turn_button.png" },
+	{ &roundabout_button, "art/roundabout_button.png" },
+	{ &battle_music_button, "art/battle_music_button.png" },
+	{ &menacing_button, "art/menacing_button.png" },
+
+	{ &menacing, "art/menacing.png" },
+	{ &to_be_continued, "art/to_be_continued.png" },
+	{ &settings_icon, "art/settings.png" },
+	{ &exit_icon, "art/exit.png" },
+
+	{ NULL, "art/menu.png" }
+};
+
+INTERNAL const SoundAsset SOUND_ASSETS[] = {
+	{ &music[0], "audio/001.wav" },
+	{ &music[1], "audio/002.wav" },
+	{ &music[2], "audio/001.wav" },
+	{ &music[3], "audio/001.wav" },
+	{ &music[4], "audio/001.wav" },
+	{ &music[5], "audio/001.wav" },
+	{ &music[6], "audio/001.wav" },
+	{ &music[7], "audio/001.wav" },
+	{ &music[8], "audio/001.wav" },
+	{ &music[9], "audio/001.wav" }
+};
+
+#define IMAGE_ASSET_COUNT (sizeof(IMAGE_ASSETS) / sizeof(IMAGE_ASSETS[0]))
+#define SOUND_ASSET_COUNT (sizeof(SOUND_ASSETS) / sizeof(SOUND_ASSETS[0]))
+
+AssetLoader::AssetLoader() : nextJob(0), soundsLoaded(0), imagesUploaded(0), fontsLoaded(false), done(false) {}
+
+//sounds are the slowest to decode so they are handed out first. openal is fine with being
+//called from any thread, gl is not, so images stop at the decoded pixels
+INTERNAL
+void decode_assets(AssetLoader* loader) {
+	for (;;) {
+		u32 job = loader->nextJob.fetch_add(1);
+		if (job < SOUND_ASSET_COUNT) {
+			*SOUND_ASSETS[job].sound = load_sound(SOUND_ASSETS[job].path);
+			loader->soundsLoaded.fetch_add(1);
+		}
+		else if (job < SOUND_ASSET_COUNT + IMAGE_ASSET_COUNT) {
+			DecodedImage image;
+			image.asset = job - SOUND_ASSET_COUNT;
+			image.pixels = SOIL_load_image(IMAGE_ASSETS[image.asset].path, &image.width, &image.height, 0, SOIL_LOAD_RGBA);
+			loader->mutex.lock();
+			loader->decoded.push_back(image);
+			loader->mutex.unlock();
+		}
+		else {
+			break;
+		}
+	}
+}
+
+void start_asset_loading(AssetLoader* loader, u32 workers) {
+	for (u32 i = 0; i < workers; ++i)
+		loader->workers.create_thread(boost::bind(decode_assets, loader));
+}
+
+bool upload_assets(AssetLoader* loader) {
+	if (loader->done)
+		return true;
+	if (!loader->fontsLoaded) {
+		BODY_FONT = load_font("art/OpenSans-Regular.ttf", 24, GL_LINEAR);
+		HEADER_FONT = load_font("art/OpenSans-Regular.ttf", 24, GL_LINEAR);
+		loader->fontsLoaded = true;
+	}
+
+	std::vector<DecodedImage> batch;
+	loader->mutex.lock();
+	batch.swap(loader->decoded);
+	loader->mutex.unlock();
+
+	for (u32 i = 0; i < batch.size(); ++i) {
+		DecodedImage* image = &batch[i];
+		const ImageAsset* asset = &IMAGE_ASSETS[image->asset];
+		if (image->pixels == NULL) {
+			BMT_LOG(WARNING, "[%s] Texture could not be loaded!", asset->path);
+		}
+		else if (asset->texture != NULL) {
+			*asset->texture = load_texture(image->pixels, image->width, image->height, TEXTURE_PARAM);
+		}
+		else {
+			u32 n = 0;
+			for (int x = 0; x < 3; ++x)
+				for (int y = 0; y < 3; ++y)
+					menu_tex[n++] = getSubImage(image->pixels, image->width, x * (image->width / 3), y * (image->height / 3), image->width / 3, image->height / 3);
+		}
+		SOIL_free_image_data(image->pixels);
+	}
+	loader->imagesUploaded += batch.size();
+
+	if (loader->imagesUploaded == IMAGE_ASSET_COUNT && loader->soundsLoaded.load() == SOUND_ASSET_COUNT) {
+		loader->workers.join_all();
+		loader->done = true;
+	}
+	return loader->done;
+}
+
+f32 asset_progress(const AssetLoader* loader) {
+	return (f32)(loader->imagesUploaded + loader->soundsLoaded.load()) / (IMAGE_ASSET_COUNT + SOUND_ASSET_COUNT);
+}
+
 void load_all_textures() {
-	cursor = load_texture("art/cursor.png", TEXTURE_PARAM);
-	BODY_FONT = load_font("art/OpenSans-Regular.ttf", 24, GL_LINEAR);
-	HEADER_FONT = load_font("art/OpenSans-Regular.ttf", 24, GL_LINEAR);
-
-	button_tex_n = load_texture("art/button_n.png", TEXTURE_PARAM);
-	button_tex_h = load_texture("art/button_h.png", TEXTURE_PARAM);
-	button_tex_p = load_texture("art/button_p.png", TEXTURE_PARAM);
-
-	tokenimages[0] = load_texture("art/jojo.png", TEXTURE_PARAM);
-	tokenimages[1] = load_texture("art/io.png", TEXTURE_PARAM);
-	tokenimages[2] = load_texture("art/Dont_ask.png", TEXTURE_PARAM);
-	tokenimages[3] = load_texture("art/VigilanteSquare.png", TEXTURE_PARAM);
-	tokenimages[4] = load_texture("art/GoldVigilanteSquare.png", TEXTURE_PARAM);
-	tokenimages[5] = load_texture("art/jojo.png", TEXTURE_PARAM);
-	tokenimages[6] = load_texture("art/jojo.png", TEXTURE_PARAM);
-	tokenimages[7] = load_texture("art/jojo.png", TEXTURE_PARAM);
-	tokenimages[8] = load_texture("art/jojo.png", TEXTURE_PARAM);
-	tokenimages[9] = load_texture("art/jojo.png", TEXTURE_PARAM);
-
-	select_button = load_texture("art/select_button.png", TEXTURE_PARAM);
-	layers_button = load_texture("art/layers_button.png", TEXTURE_PARAM);
-	square_button = load_texture("art/square_button.png", TEXTURE_PARAM);
-	circle_button = load_texture("art/circle_button.png", TEXTURE_PARAM);
-	char_sheet_icon = load_texture("art/char_sheet_icon.png", TEXTURE_PARAM);
-	turn_button = load_texture("art/turn_button.png", TEXTURE_PARAM);
-	roundabout_button = load_texture("art/roundabout_button.png", TEXTURE_PARAM);
-	battle_music_button = load_texture("art/battle_music_button.png", TEXTURE_PARAM);
-	menacing_button = load_texture("art/menacing_button.png", TEXTURE_PARAM);
-
-	menacing = load_texture("art/menacing.png", TEXTURE_PARAM);
-	to_be_continued = load_texture("art/to_be_continued.png", TEXTURE_PARAM);
-	settings_icon = load_texture("art/settings.png", TEXTURE_PARAM);
-	exit_icon = load_texture("art/exit.png", TEXTURE_PARAM);
-
-	music[0] = load_sound("audio/001.wav");
-	music[1] = load_sound("audio/002.wav");
-	music[2] = load_sound("audio/001.wav");
-	music[3] = load_sound("audio/001.wav");
-	music[4] = load_sound("audio/001.wav");
-	music[5] = load_sound("audio/001.wav");
-	music[6] = load_sound("audio/001.wav");
-	music[7] = load_sound("audio/001.wav");
-	music[8] = load_sound("audio/001.wav");
-	music[9] = load_sound("audio/001.wav");
-	int w;
-	int h;
-	int i = 0;
-	unsigned char* image = SOIL_load_image("art/menu.png", &w, &h, 0, SOIL_LOAD_RGBA);
-	for (int x = 0; x < 3; ++x)
-		for (int y = 0; y < 3; ++y)
-			menu_tex[i++] = getSubImage(image, w, x * (w / 3), y * (h / 3), w / 3, h / 3);
-	free(image);
-}
\ No newline at end of file
+	AssetLoader loader;
+	start_asset_loading(&loader);
+	while (!upload_assets(&loader))
+		boost::this_thread::sleep(boost::posix_time::millisec(1));
+}
@@ -23,7 +23,8 @@ struct ClientMessage {
 	std::string str;
 };
 
-typedef std::vector<Socket*>		ClientList;
+struct Transport;
+typedef std::vector<Transport*>		ClientList;
 typedef std::queue<ClientMessage>	MessageQueue;
 typedef std::queue<std::string>		StringQueue;
 typedef std::vector<std::string>	StringList;
@@ -94,6 +95,25 @@ StringList split_string(std::string string, char divider) {
 	return tokens;
 }
 
+//microseconds since 1970 on this machine's clock. the server and its clients swap these in
+//ping and pong to work out how far apart their clocks are
+static inline
+u64 clock_us() {
+	static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+	return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+}
+
+//moves a fully written temp file over path in one step, so a crash leaves either the old file
+//or the new one and never neither. rename only replaces an existing file atomically on POSIX
+static inline
+bool replace_file(const char* temp, const char* path) {
+#if defined(_WIN32) || defined(_WIN64)
+	return MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(temp, path) == 0;
+#endif
+}
+
 #include <random>
 namespace {
 	std::random_device rd;
@@ -119,7 +139,38 @@ namespace {
 }
 
 #include <SOIL.h>
+#include <boost/atomic.hpp>
+
+#define ASSET_WORKERS 4
+
+struct DecodedImage {
+	u32 asset;
+	unsigned char* pixels; //NULL if the file could not be read
+	i32 width;
+	i32 height;
+};
+
+//Loads every texture, sound and font in the background. Worker threads decode the files and
+//the thread that owns the gl context uploads the decoded images whenever it calls
+//upload_assets, so a window can keep drawing (a loading screen, say) while they load.
+struct AssetLoader {
+	AssetLoader();
+	boost::thread_group workers;
+	boost::atomic<u32> nextJob;
+	boost::atomic<u32> soundsLoaded;
+	boost::mutex mutex;
+	std::vector<DecodedImage> decoded; //waiting to be uploaded
+	u32 imagesUploaded;
+	bool fontsLoaded;
+	bool done;
+};
 
+void start_asset_loading(AssetLoader* loader, u32 workers = ASSET_WORKERS);
+//gl thread only. uploads what has been decoded since the last call (the fonts on the first
+//call) and returns true once everything is loaded
+bool upload_assets(AssetLoader* loader);
+f32 asset_progress(const AssetLoader* loader);
+//starts the workers and waits for them, for callers with nothing to draw in the meantime
 void load_all_textures();
 
 #endif
\ No newline at end of file
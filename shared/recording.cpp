@@ -0,0 +1,240 @@
+#include "recording.h"
+#include <algorithm>
+#include <string.h>
+
+INTERNAL const boost::posix_time::ptime RECORDING_EPOCH(boost::gregorian::date(1970, 1, 1));
+
+Recorder::Recorder() : file(NULL), last(0), nextStream(0), entries(0) {}
+
+Playback::Playback() : file(NULL), us(0) {}
+
+u64 recording_clock() {
+	return (boost::posix_time::microsec_clock::universal_time() - RECORDING_EPOCH).total_microseconds();
+}
+
+INTERNAL
+void write_varint(FILE* file, u64 value) {
+	u8 bytes[10];
+	u32 count = 0;
+	do {
+		bytes[count] = value & 0x7F;
+		value >>= 7;
+		if (value != 0)
+			bytes[count] |= 0x80;
+		count++;
+	} while (value != 0);
+	fwrite(bytes, 1, count, file);
+}
+
+INTERNAL
+bool read_varint(FILE* file, u64* value) {
+	*value = 0;
+	for (u32 shift = 0; shift < 64; shift += 7) {
+		i32 byte = fgetc(file);
+		if (byte == EOF)
+			return false;
+		*value |= (u64)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool start_recording(Recorder* recorder, const std::string& path) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		BMT_LOG(WARNING, "Could not open %s for recording", path.c_str());
+		return false;
+	}
+	//most entries are a few dozen bytes, only hand the disk whole blocks
+	setvbuf(file, NULL, _IOFBF, 64 * 1024);
+	u32 header[2] = { RECORDING_MAGIC, RECORDING_VERSION };
+	fwrite(header, sizeof(u32), 2, file);
+
+	recorder->mutex.lock();
+	recorder->last = recording_clock();
+	recorder->streams.clear();
+	recorder->aliases.clear();
+	recorder->nextStream = 0;
+	recorder->entries = 0;
+	recorder->file = file;
+	recorder->mutex.unlock();
+	BMT_LOG(INFO, "Recording the session to %s", path.c_str());
+	return true;
+}
+
+//finds where the field-th '|' separated field of line starts and ends
+INTERNAL
+bool find_field(const std::string& line, u32 field, size_t* start, size_t* end) {
+	*start = 0;
+	for (u32 i = 0; i < field; ++i) {
+		*start = line.find('|', *start);
+		if (*start == std::string::npos)
+			return false;
+		(*start)++;
+	}
+	*end = line.find('|', *start);
+	if (*end == std::string::npos)
+		*end = line.size();
+	return true;
+}
+
+INTERNAL inline
+bool starts_with(const std::string& line, const char* prefix) {
+	return line.compare(0, strlen(prefix), prefix) == 0;
+}
+
+//format: name|user|pass|password|room, login_success|user|password|sheets (login_created too),
+//session|ticket|seconds|seq and resume|ticket|last seq
+INTERNAL
+void redact_line_no_lock(Recorder* recorder, u32 stream, std::string* line) {
+	size_t start, end;
+	if (starts_with(*line, "name|") && find_field(*line, 3, &start, &end)) {
+		line->replace(start, end - start, RECORDING_REDACTED);
+	}
+	else if ((starts_with(*line, "login_success|") || starts_with(*line, "login_created|")) && find_field(*line, 2, &start, &end)) {
+		line->replace(start, end - start, RECORDING_REDACTED);
+	}
+	else if ((starts_with(*line, "session|") || starts_with(*line, "resume|")) && find_field(*line, 1, &start, &end)) {
+		//a resume with a ticket from before the recording started is named after its own stream
+		std::string ticket = line->substr(start, end - start);
+		std::map<std::string, u32>::iterator it = recorder->aliases.insert(std::make_pair(ticket, stream)).first;
+		line->replace(start, end - start, RECORDING_ALIAS + std::to_string(it->second));
+	}
+}
+
+//most messages carry no secret and are written as they are
+INTERNAL
+bool needs_redacting(const char* data, u32 size) {
+	const char* PREFIXES[] = { "name|", "login_success|", "login_created|", "session|", "resume|" };
+	for (u32 start = 0; start < size;) {
+		for (u32 i = 0; i < 5; ++i) {
+			u32 length = strlen(PREFIXES[i]);
+			if (size - start >= length && memcmp(data + start, PREFIXES[i], length) == 0)
+				return true;
+		}
+		const char* next = (const char*)memchr(data + start, '\n', size - start);
+		if (next == NULL)
+			break;
+		start = next - data + 1;
+	}
+	return false;
+}
+
+INTERNAL
+std::string redact_no_lock(Recorder* recorder, u32 stream, const char* data, u32 size) {
+	std::string result;
+	std::string line;
+	for (u32 start = 0; start < size;) {
+		const char* next = (const char*)memchr(data + start, '\n', size - start);
+		u32 stop = next != NULL ? next - data : size;
+		line.assign(data + start, stop - start);
+		redact_line_no_lock(recorder, stream, &line);
+		result.append(line);
+		if (next != NULL)
+			result.push_back('\n');
+		start = stop + 1;
+	}
+	return result;
+}
+
+INTERNAL
+void write_entry_no_lock(Recorder* recorder, RecordKind kind, u32 stream, const char* data, u32 size) {
+	//entries from several threads can take the lock out of clock order
+	u64 now = std::max(recording_clock(), recorder->last);
+	write_varint(recorder->file, now - recorder->last);
+	fputc(kind, recorder->file);
+	write_varint(recorder->file, stream);
+	write_varint(recorder->file, size);
+	fwrite(data, 1, size, recorder->file);
+	recorder->last = now;
+	recorder->entries++;
+}
+
+void record_entry(Recorder* recorder, RecordKind kind, const void* stream, const char* data, u32 size) {
+	if (recorder->file == NULL)
+		return;
+	recorder->mutex.lock();
+	if (recorder->file == NULL) {
+		recorder->mutex.unlock();
+		return;
+	}
+	std::map<const void*, u32>::iterator it = recorder->streams.find(stream);
+	if (it == recorder->streams.end())
+		it = recorder->streams.insert(std::make_pair(stream, recorder->nextStream++)).first;
+	u32 id = it->second;
+	if (kind == RECORD_CLOSE)
+		recorder->streams.erase(it);
+
+	if (needs_redacting(data, size)) {
+		std::string redacted = redact_no_lock(recorder, id, data, size);
+		write_entry_no_lock(recorder, kind, id, redacted.data(), redacted.size());
+	}
+	else {
+		write_entry_no_lock(recorder, kind, id, data, size);
+	}
+	recorder->mutex.unlock();
+}
+
+void record_seed(Recorder* recorder, u64 seed) {
+	std::string text = std::to_string(seed);
+	recorder->mutex.lock();
+	if (recorder->file != NULL)
+		write_entry_no_lock(recorder, RECORD_SEED, 0, text.data(), text.size());
+	recorder->mutex.unlock();
+}
+
+void stop_recording(Recorder* recorder) {
+	recorder->mutex.lock();
+	if (recorder->file != NULL) {
+		fclose(recorder->file);
+		recorder->file = NULL;
+		BMT_LOG(INFO, "Recorded %llu messages", (unsigned long long)recorder->entries);
+	}
+	recorder->mutex.unlock();
+}
+
+bool open_playback(Playback* playback, const std::string& path) {
+	playback->file = fopen(path.c_str(), "rb");
+	playback->us = 0;
+	if (playback->file == NULL) {
+		BMT_LOG(WARNING, "Could not open recording %s", path.c_str());
+		return false;
+	}
+	u32 header[2];
+	if (fread(header, sizeof(u32), 2, playback->file) != 2 || header[0] != RECORDING_MAGIC || header[1] != RECORDING_VERSION) {
+		BMT_LOG(WARNING, "%s is not a recording this version can play", path.c_str());
+		close_playback(playback);
+		return false;
+	}
+	return true;
+}
+
+bool next_entry(Playback* playback, RecordedEntry* entry) {
+	u64 delta, stream, size;
+	if (playback->file == NULL || !read_varint(playback->file, &delta))
+		return false;
+	i32 kind = fgetc(playback->file);
+	if (kind == EOF || kind > RECORD_SEED || !read_varint(playback->file, &stream) || !read_varint(playback->file, &size))
+		return false;
+	entry->data.resize(size);
+	if (size != 0 && fread(&entry->data[0], 1, size, playback->file) != size)
+		return false;
+	playback->us += delta;
+	entry->us = playback->us;
+	entry->kind = (RecordKind)kind;
+	entry->stream = (u32)stream;
+	return true;
+}
+
+void close_playback(Playback* playback) {
+	if (playback->file != NULL)
+		fclose(playback->file);
+	playback->file = NULL;
+}
+
+void wait_for_entry(const RecordedEntry* entry, u64 start) {
+	u64 now = recording_clock();
+	if (start + entry->us > now)
+		boost::this_thread::sleep(boost::posix_time::microseconds(start + entry->us - now));
+}
@@ -0,0 +1,86 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <boost/thread.hpp>
+#include "bahamut.h"
+
+#define RECORDING_MAGIC   0x43525454 //"TTRC"
+#define RECORDING_VERSION 2
+#define RECORDING_REDACTED "redacted" //written in place of a login's password
+#define RECORDING_ALIAS    '@'        //starts a session ticket's alias
+
+//A recording holds every message one end of a session saw, in order, so a heavy session can
+//be played again as a benchmark. The file is the magic and version as two u32s and then one
+//entry per message:
+//
+//  varint  microseconds since the previous entry
+//  u8      kind
+//  varint  stream, the connection the entry belongs to. the server numbers its clients in
+//          the order they connected, a client only has the one
+//  varint  length, followed by that many bytes. messages are stored without their newline,
+//          packets (several messages written at once) as they were written
+//
+//Passwords and session tickets are never written. A login's password is replaced by
+//RECORDING_REDACTED. A ticket is replaced by RECORDING_ALIAS and the number of the stream it
+//was issued on, in the session line that hands it out and in every resume that presents it,
+//so a replay can swap in the ticket that stream is issued when played back.
+enum RecordKind {
+	RECORD_OPEN,  //a connection was made, no message
+	RECORD_CLOSE, //and closed
+	RECORD_IN,    //a message this end received
+	RECORD_OUT,   //a message or packet this end sent
+	RECORD_SEED   //the seed the dice were drawn from as decimal text, stream 0
+};
+
+//Off until start_recording. Entries can be written from any thread.
+struct Recorder {
+	Recorder();
+	boost::mutex mutex;
+	FILE* file;
+	u64 last; //clock of the previous entry
+	std::map<const void*, u32> streams;
+	std::map<std::string, u32> aliases; //session ticket to the stream it was issued on
+	u32 nextStream;
+	u64 entries;
+};
+
+struct RecordedEntry {
+	u64 us; //since the recording started
+	RecordKind kind;
+	u32 stream;
+	std::string data;
+};
+
+struct Playback {
+	Playback();
+	FILE* file;
+	u64 us;
+};
+
+//microseconds on the clock entries are stamped and played back with
+u64 recording_clock();
+
+bool start_recording(Recorder* recorder, const std::string& path);
+//stream names the connection for the caller, a client's transport on the server. a stream
+//seen for the first time gets the next number, after RECORD_CLOSE the same pointer counts as
+//a new one
+void record_entry(Recorder* recorder, RecordKind kind, const void* stream, const char* data, u32 size);
+void record_seed(Recorder* recorder, u64 seed);
+void stop_recording(Recorder* recorder);
+
+INTERNAL inline
+void record_entry(Recorder* recorder, RecordKind kind, const void* stream, const std::string& message) {
+	record_entry(recorder, kind, stream, message.data(), message.size());
+}
+
+bool open_playback(Playback* playback, const std::string& path);
+//false at the end of the file or at an entry cut short
+bool next_entry(Playback* playback, RecordedEntry* entry);
+void close_playback(Playback* playback);
+//sleeps until the entry is due, start is recording_clock() when the playback began
+void wait_for_entry(const RecordedEntry* entry, u64 start);
+
+#endif
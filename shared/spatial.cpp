@@ -0,0 +1,149 @@
+#include "spatial.h"
+
+//rounds toward negative infinity, tokens can be dragged above or left of the map
+INTERNAL inline
+i32 cell_of(i32 pos) {
+	return pos >= 0 ? pos / SPATIAL_CELL_SIZE : -((-pos + SPATIAL_CELL_SIZE - 1) / SPATIAL_CELL_SIZE);
+}
+
+INTERNAL inline
+u32 bucket_of(i32 cellX, i32 cellY) {
+	return (((u32)cellX * 73856093u) ^ ((u32)cellY * 19349663u)) & (SPATIAL_BUCKETS - 1);
+}
+
+INTERNAL inline
+i32 max_i32(i32 a, i32 b) {
+	return a > b ? a : b;
+}
+
+INTERNAL inline
+i32 min_i32(i32 a, i32 b) {
+	return a < b ? a : b;
+}
+
+//a box is listed in several cells, it is reported from the first cell the query and the box share
+INTERNAL inline
+bool first_shared_cell(const SpatialEntry* entry, i32 queryCellX, i32 queryCellY) {
+	return entry->cellX == max_i32(cell_of(entry->x), queryCellX) && entry->cellY == max_i32(cell_of(entry->y), queryCellY);
+}
+
+//empty boxes still take up the cell they sit in
+INTERNAL inline
+void fix_size(i32* w, i32* h) {
+	if (*w < 1) *w = 1;
+	if (*h < 1) *h = 1;
+}
+
+void spatial_insert(SpatialGrid* grid, u32 id, i32 x, i32 y, i32 w, i32 h) {
+	if (grid->buckets.empty())
+		grid->buckets.resize(SPATIAL_BUCKETS);
+	fix_size(&w, &h);
+
+	SpatialEntry entry = { 0, 0, id, x, y, w, h };
+	for (i32 cy = cell_of(y); cy <= cell_of(y + h - 1); ++cy) {
+		for (i32 cx = cell_of(x); cx <= cell_of(x + w - 1); ++cx) {
+			entry.cellX = cx;
+			entry.cellY = cy;
+			grid->buckets[bucket_of(cx, cy)].push_back(entry);
+		}
+	}
+	grid->count++;
+}
+
+void spatial_remove(SpatialGrid* grid, u32 id, i32 x, i32 y, i32 w, i32 h) {
+	if (grid->buckets.empty())
+		return;
+	fix_size(&w, &h);
+
+	//an item that was never inserted with this rectangle is not counted out
+	bool removed = false;
+	for (i32 cy = cell_of(y); cy <= cell_of(y + h - 1); ++cy) {
+		for (i32 cx = cell_of(x); cx <= cell_of(x + w - 1); ++cx) {
+			std::vector<SpatialEntry>* bucket = &grid->buckets[bucket_of(cx, cy)];
+			for (u32 i = 0; i < bucket->size(); ++i) {
+				SpatialEntry* entry = &(*bucket)[i];
+				if (entry->id == id && entry->cellX == cx && entry->cellY == cy) {
+					*entry = bucket->back();
+					bucket->pop_back();
+					removed = true;
+					break;
+				}
+			}
+		}
+	}
+	if (removed)
+		grid->count--;
+}
+
+void spatial_move(SpatialGrid* grid, u32 id, i32 x, i32 y, i32 w, i32 h, i32 newX, i32 newY) {
+	spatial_remove(grid, id, x, y, w, h);
+	spatial_insert(grid, id, newX, newY, w, h);
+}
+
+void spatial_clear(SpatialGrid* grid) {
+	for (u32 i = 0; i < grid->buckets.size(); ++i)
+		grid->buckets[i].clear();
+	grid->count = 0;
+}
+
+INTERNAL inline
+bool overlaps_rect(const SpatialEntry* entry, i32 x, i32 y, i32 w, i32 h) {
+	return entry->x < x + w && x < entry->x + entry->w && entry->y < y + h && y < entry->y + entry->h;
+}
+
+INTERNAL inline
+bool overlaps_circle(const SpatialEntry* entry, i32 x, i32 y, i32 radius) {
+	i64 dx = x - max_i32(entry->x, min_i32(x, entry->x + entry->w - 1));
+	i64 dy = y - max_i32(entry->y, min_i32(y, entry->y + entry->h - 1));
+	return dx * dx + dy * dy <= (i64)radius * radius;
+}
+
+//walks the cells under a box, or every bucket once the box covers more cells than there are
+//buckets, and hands each entry that might overlap to test
+template <typename Test>
+INTERNAL
+void query_cells(const SpatialGrid* grid, i32 x, i32 y, i32 w, i32 h, std::vector<u32>* out, Test test) {
+	if (grid->buckets.empty() || w <= 0 || h <= 0)
+		return;
+
+	i32 x0 = cell_of(x), x1 = cell_of(x + w - 1);
+	i32 y0 = cell_of(y), y1 = cell_of(y + h - 1);
+	if ((i64)(x1 - x0 + 1) * (y1 - y0 + 1) > SPATIAL_BUCKETS) {
+		for (u32 b = 0; b < grid->buckets.size(); ++b) {
+			const std::vector<SpatialEntry>* bucket = &grid->buckets[b];
+			for (u32 i = 0; i < bucket->size(); ++i) {
+				const SpatialEntry* entry = &(*bucket)[i];
+				if (first_shared_cell(entry, x0, y0) && test(entry))
+					out->push_back(entry->id);
+			}
+		}
+		return;
+	}
+
+	for (i32 cy = y0; cy <= y1; ++cy) {
+		for (i32 cx = x0; cx <= x1; ++cx) {
+			const std::vector<SpatialEntry>* bucket = &grid->buckets[bucket_of(cx, cy)];
+			for (u32 i = 0; i < bucket->size(); ++i) {
+				const SpatialEntry* entry = &(*bucket)[i];
+				if (entry->cellX == cx && entry->cellY == cy && first_shared_cell(entry, x0, y0) && test(entry))
+					out->push_back(entry->id);
+			}
+		}
+	}
+}
+
+void spatial_query_point(const SpatialGrid* grid, i32 x, i32 y, std::vector<u32>* out) {
+	spatial_query_rect(grid, x, y, 1, 1, out);
+}
+
+void spatial_query_rect(const SpatialGrid* grid, i32 x, i32 y, i32 w, i32 h, std::vector<u32>* out) {
+	query_cells(grid, x, y, w, h, out, [=](const SpatialEntry* entry) {
+		return overlaps_rect(entry, x, y, w, h);
+	});
+}
+
+void spatial_query_radius(const SpatialGrid* grid, i32 x, i32 y, i32 radius, std::vector<u32>* out) {
+	query_cells(grid, x - radius, y - radius, radius * 2 + 1, radius * 2 + 1, out, [=](const SpatialEntry* entry) {
+		return overlaps_circle(entry, x, y, radius);
+	});
+}
@@ -0,0 +1,36 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include <vector>
+#include "bahamut.h"
+
+#define SPATIAL_CELL_SIZE 128  //one map tile (TILESIZE)
+#define SPATIAL_BUCKETS   1024 //power of two, cells hash into these so maps of any size fit
+
+//A uniform grid of SPATIAL_CELL_SIZE cells holding axis aligned boxes. Each box is listed
+//in every cell it covers, so a query only looks at the cells it touches instead of every
+//item. The grid does not own the items, it stores the id it was given with each box, and
+//the caller tells it the box again when the item moves or goes away.
+struct SpatialEntry {
+	i32 cellX;
+	i32 cellY;
+	u32 id;
+	i32 x, y, w, h;
+};
+
+struct SpatialGrid {
+	std::vector< std::vector<SpatialEntry> > buckets; //allocated on the first insert
+	u32 count;
+};
+
+void spatial_insert(SpatialGrid* grid, u32 id, i32 x, i32 y, i32 w, i32 h);
+void spatial_remove(SpatialGrid* grid, u32 id, i32 x, i32 y, i32 w, i32 h);
+void spatial_move(SpatialGrid* grid, u32 id, i32 x, i32 y, i32 w, i32 h, i32 newX, i32 newY);
+void spatial_clear(SpatialGrid* grid);
+
+//queries add the id of every box that overlaps to out, each id once and in no particular order
+void spatial_query_point(const SpatialGrid* grid, i32 x, i32 y, std::vector<u32>* out);
+void spatial_query_rect(const SpatialGrid* grid, i32 x, i32 y, i32 w, i32 h, std::vector<u32>* out);
+void spatial_query_radius(const SpatialGrid* grid, i32 x, i32 y, i32 radius, std::vector<u32>* out);
+
+#endif
@@ -0,0 +1,232 @@
+#include "tokens.h"
+#include <algorithm>
+
+INTERNAL inline
+u32 handle_slot(TokenHandle handle) {
+	return handle & TOKEN_SLOT_MASK;
+}
+
+INTERNAL inline
+u16 handle_generation(TokenHandle handle) {
+	return (u16)(handle >> TOKEN_SLOT_BITS);
+}
+
+INTERNAL inline
+TokenHandle make_handle(u32 slot, u16 generation) {
+	return ((TokenHandle)generation << TOKEN_SLOT_BITS) | slot;
+}
+
+//moves the last element of a column into index and drops the last one
+template <typename T>
+INTERNAL inline
+void remove_swap(std::vector<T>& column, u32 index) {
+	column[index] = column.back();
+	column.pop_back();
+}
+
+INTERNAL
+void push_token(TokenStore* store, TokenHandle handle, const Token* token) {
+	store->slots[handle_slot(handle)] = store->handles.size();
+	store->handles.push_back(handle);
+	store->xPos.push_back(token->xPos);
+	store->yPos.push_back(token->yPos);
+	store->imgindex.push_back(token->imgindex);
+	store->layer.push_back(token->layer);
+	store->tintColor.push_back(token->tintColor);
+	for (u32 i = 0; i < TOKEN_BARS; ++i)
+		store->bars[i].push_back(token->bars[i]);
+	store->anchorToTile.push_back(token->anchorToTile);
+	store->names.push_back(token->name);
+	spatial_insert(&store->grid, store->handles.size() - 1, token->xPos, token->yPos, TOKEN_SIZE, TOKEN_SIZE);
+}
+
+//retires the slot's generation so the handle that pointed at it goes stale
+INTERNAL
+void free_slot(TokenStore* store, u32 slot) {
+	u16 next = (store->generations[slot] + 1) & TOKEN_GEN_MASK;
+	store->generations[slot] = next == 0 ? 1 : next;
+	store->freeSlots.push_back(slot);
+}
+
+INTERNAL
+u32 grow_slots(TokenStore* store) {
+	u32 slot = store->slots.size();
+	store->slots.push_back(0);
+	store->generations.push_back(1);
+	return slot;
+}
+
+i32 token_index(const TokenStore* store, TokenHandle handle) {
+	u32 slot = handle_slot(handle);
+	if (slot >= store->slots.size())
+		return -1;
+	u32 index = store->slots[slot];
+	if (index >= store->handles.size() || store->handles[index] != handle)
+		return -1;
+	return index;
+}
+
+TokenHandle add_token(TokenStore* store, const Token* token) {
+	u32 slot;
+	if (!store->freeSlots.empty()) {
+		slot = store->freeSlots.back();
+		store->freeSlots.pop_back();
+	}
+	else if (store->slots.size() < TOKEN_MAX_SLOTS) {
+		slot = grow_slots(store);
+	}
+	else {
+		return TOKEN_NONE;
+	}
+	TokenHandle handle = make_handle(slot, store->generations[slot]);
+	push_token(store, handle, token);
+	return handle;
+}
+
+i32 insert_token(TokenStore* store, TokenHandle handle) {
+	i32 index = token_index(store, handle);
+	if (index != -1)
+		return index;
+
+	u32 slot = handle_slot(handle);
+	if (handle_generation(handle) == 0 || slot >= TOKEN_MAX_SLOTS)
+		return -1;
+	while (store->slots.size() <= slot) {
+		u32 grown = grow_slots(store);
+		if (grown != slot)
+			store->freeSlots.push_back(grown);
+	}
+	//a token we never heard was deleted still holds the slot
+	if (store->slots[slot] < store->handles.size() && handle_slot(store->handles[store->slots[slot]]) == slot)
+		remove_token(store, store->handles[store->slots[slot]]);
+	for (u32 i = 0; i < store->freeSlots.size(); ++i) {
+		if (store->freeSlots[i] == slot) {
+			remove_swap(store->freeSlots, i);
+			break;
+		}
+	}
+
+	store->generations[slot] = handle_generation(handle);
+	Token blank = { 0 };
+	push_token(store, handle, &blank);
+	return store->handles.size() - 1;
+}
+
+bool remove_token(TokenStore* store, TokenHandle handle) {
+	i32 found = token_index(store, handle);
+	if (found == -1)
+		return false;
+
+	u32 index = found;
+	u32 last = store->handles.size() - 1;
+	spatial_remove(&store->grid, index, store->xPos[index], store->yPos[index], TOKEN_SIZE, TOKEN_SIZE);
+	if (index != last) {
+		spatial_remove(&store->grid, last, store->xPos[last], store->yPos[last], TOKEN_SIZE, TOKEN_SIZE);
+		spatial_insert(&store->grid, index, store->xPos[last], store->yPos[last], TOKEN_SIZE, TOKEN_SIZE);
+	}
+
+	remove_swap(store->handles, index);
+	remove_swap(store->xPos, index);
+	remove_swap(store->yPos, index);
+	remove_swap(store->imgindex, index);
+	remove_swap(store->layer, index);
+	remove_swap(store->tintColor, index);
+	for (u32 i = 0; i < TOKEN_BARS; ++i)
+		remove_swap(store->bars[i], index);
+	remove_swap(store->anchorToTile, index);
+	remove_swap(store->names, index);
+	if (index < store->handles.size())
+		store->slots[handle_slot(store->handles[index])] = index;
+
+	free_slot(store, handle_slot(handle));
+	return true;
+}
+
+void clear_tokens(TokenStore* store) {
+	for (u32 i = 0; i < store->handles.size(); ++i)
+		free_slot(store, handle_slot(store->handles[i]));
+	store->handles.clear();
+	store->xPos.clear();
+	store->yPos.clear();
+	store->imgindex.clear();
+	store->layer.clear();
+	store->tintColor.clear();
+	for (u32 i = 0; i < TOKEN_BARS; ++i)
+		store->bars[i].clear();
+	store->anchorToTile.clear();
+	store->names.clear();
+	spatial_clear(&store->grid);
+}
+
+void resize_tokens(TokenStore* store, u32 count) {
+	Token blank = { 0 };
+	while (token_count(store) < count && add_token(store, &blank) != TOKEN_NONE);
+	while (token_count(store) > count)
+		remove_token(store, store->handles.back());
+}
+
+void get_token(const TokenStore* store, u32 index, Token* token) {
+	token->imgindex = store->imgindex[index];
+	for (u32 i = 0; i < TOKEN_BARS; ++i)
+		token->bars[i] = store->bars[i][index];
+	token->name = store->names[index];
+	token->tintColor = store->tintColor[index];
+	token->anchorToTile = store->anchorToTile[index] != 0;
+	token->xPos = store->xPos[index];
+	token->yPos = store->yPos[index];
+	token->layer = store->layer[index];
+}
+
+void set_token(TokenStore* store, u32 index, const Token* token) {
+	store->imgindex[index] = token->imgindex;
+	for (u32 i = 0; i < TOKEN_BARS; ++i)
+		store->bars[i][index] = token->bars[i];
+	store->names[index] = token->name;
+	store->tintColor[index] = token->tintColor;
+	store->anchorToTile[index] = token->anchorToTile;
+	store->layer[index] = token->layer;
+	move_token(store, index, token->xPos, token->yPos);
+}
+
+void move_token(TokenStore* store, u32 index, i32 x, i32 y) {
+	if (store->xPos[index] == x && store->yPos[index] == y)
+		return;
+	spatial_move(&store->grid, index, store->xPos[index], store->yPos[index], TOKEN_SIZE, TOKEN_SIZE, x, y);
+	store->xPos[index] = x;
+	store->yPos[index] = y;
+}
+
+INTERNAL
+void filter_layers(const TokenStore* store, u8 layerMask, std::vector<u32>* out) {
+	u32 kept = 0;
+	for (u32 i = 0; i < out->size(); ++i) {
+		if (layerMask & LAYER_BIT(store->layer[(*out)[i]]))
+			(*out)[kept++] = (*out)[i];
+	}
+	out->resize(kept);
+	std::sort(out->begin(), out->end());
+}
+
+i32 token_at(const TokenStore* store, i32 x, i32 y, u8 layerMask) {
+	std::vector<u32> found;
+	spatial_query_point(&store->grid, x, y, &found);
+	//later tokens are drawn on top
+	i32 top = -1;
+	for (u32 i = 0; i < found.size(); ++i) {
+		if ((layerMask & LAYER_BIT(store->layer[found[i]])) && (i32)found[i] > top)
+			top = found[i];
+	}
+	return top;
+}
+
+void tokens_in_rect(const TokenStore* store, i32 x, i32 y, i32 w, i32 h, u8 layerMask, std::vector<u32>* out) {
+	out->clear();
+	spatial_query_rect(&store->grid, x, y, w, h, out);
+	filter_layers(store, layerMask, out);
+}
+
+void tokens_in_radius(const TokenStore* store, i32 x, i32 y, i32 radius, u8 layerMask, std::vector<u32>* out) {
+	out->clear();
+	spatial_query_radius(&store->grid, x, y, radius, out);
+	filter_layers(store, layerMask, out);
+}
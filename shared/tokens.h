@@ -0,0 +1,104 @@
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include "bahamut.h"
+#include "spatial.h"
+
+enum Layer {
+	LAYER_MAP,
+	LAYER_GM,
+	LAYER_TOKEN
+};
+
+#define LAYER_BIT(layer) (1 << (layer))
+
+struct StatusBar {
+	i32 current;
+	i32 max;
+};
+
+#define TOKEN_BARS 3
+#define TOKEN_SIZE 128 //tokens cover one tile
+
+//one token by value, used to build, edit and serialize tokens. the store keeps them split up
+struct Token {
+	u16 imgindex;
+	StatusBar bars[TOKEN_BARS];
+	std::string name;
+	vec4 tintColor;
+	bool anchorToTile;
+	i32 xPos;
+	i32 yPos;
+	u8 layer;
+};
+
+//A handle names a token for as long as it exists, and is what goes over the wire. The low
+//bits pick a slot, the high bits are the slot's generation, which is bumped whenever the slot
+//is freed, so a handle to a deleted token never finds the token that reuses its slot.
+typedef u32 TokenHandle;
+
+#define TOKEN_NONE       0 //generations start at 1, so no live token has this handle
+#define TOKEN_SLOT_BITS  20
+#define TOKEN_SLOT_MASK  ((1u << TOKEN_SLOT_BITS) - 1)
+#define TOKEN_MAX_SLOTS  TOKEN_SLOT_MASK
+#define TOKEN_GEN_MASK   (0xFFFFFFFFu >> TOKEN_SLOT_BITS)
+
+//Tokens stored as columns. Index i of every column is the same token, the columns are dense
+//and in draw order, so drawing, hit testing and syncing walk only the arrays they read.
+//Removing a token moves the last one into its place, which is why indices are not stable
+//and everything outside the store refers to tokens by handle. Positions are also kept in a
+//spatial grid keyed by index, so they are only ever changed with move_token or set_token.
+struct TokenStore {
+	std::vector<i32> xPos;
+	std::vector<i32> yPos;
+	std::vector<u16> imgindex;
+	std::vector<u8> layer;
+	std::vector<vec4> tintColor;
+	std::vector<StatusBar> bars[TOKEN_BARS];
+	std::vector<u8> anchorToTile;
+	std::vector<std::string> names; //cold, only read to draw labels and save
+	std::vector<TokenHandle> handles;
+	SpatialGrid grid;
+
+	//indexed by slot
+	std::vector<u32> slots; //index of the slot's token while it is live
+	std::vector<u16> generations;
+	std::vector<u32> freeSlots;
+};
+
+//handles do not fit in an i32, so they are not read with stoi. anything that is not a number
+//becomes a handle no token has
+INTERNAL inline
+TokenHandle parse_handle(const std::string& str) {
+	return (TokenHandle)strtoul(str.c_str(), NULL, 10);
+}
+
+INTERNAL inline
+u32 token_count(const TokenStore* store) {
+	return store->handles.size();
+}
+
+//index of a live token, or -1 if the handle is stale or was never valid
+i32 token_index(const TokenStore* store, TokenHandle handle);
+TokenHandle add_token(TokenStore* store, const Token* token);
+//makes sure a handle chosen elsewhere (by the server) is live, adding a blank token in its
+//slot if needed. returns its index, or -1 if the handle can not be a valid one
+i32 insert_token(TokenStore* store, TokenHandle handle);
+//returns false if the handle is stale. the last token takes the removed token's index
+bool remove_token(TokenStore* store, TokenHandle handle);
+void clear_tokens(TokenStore* store);
+//adds blank tokens or removes them from the end until there are count tokens
+void resize_tokens(TokenStore* store, u32 count);
+void get_token(const TokenStore* store, u32 index, Token* token);
+void set_token(TokenStore* store, u32 index, const Token* token);
+void move_token(TokenStore* store, u32 index, i32 x, i32 y);
+//the topmost token whose tile covers x, y on one of the given layers, or -1
+i32 token_at(const TokenStore* store, i32 x, i32 y, u8 layerMask);
+//indices of the tokens on the given layers that overlap a rect or circle, in draw order
+void tokens_in_rect(const TokenStore* store, i32 x, i32 y, i32 w, i32 h, u8 layerMask, std::vector<u32>* out);
+void tokens_in_radius(const TokenStore* store, i32 x, i32 y, i32 radius, u8 layerMask, std::vector<u32>* out);
+
+#endif
@@ -0,0 +1,364 @@
+#include "transport.h"
+#include <string.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+//A socket is read and written on the io service. What comes in waits in inbox and the
+//watcher is told, writes are queued so nobody who sends to a client ever waits on it.
+//Completion handlers hold on to the connection, so the transport can be destroyed while
+//a read or write is still in flight.
+struct TcpConnection {
+	~TcpConnection() { delete socket; }
+	Socket* socket;
+	Transport* transport; //NULL once destroyed
+	boost::mutex mutex;
+	boost::condition_variable readable;
+	char readBuffer[BUFFER_SIZE];
+	std::string inbox;   //read from the socket, not taken by read yet
+	std::string queued;  //written since the socket was last handed something
+	std::string sending; //what the socket is writing, left alone until it is done
+	bool writing;
+	bool failed;         //the other end is gone, what is in inbox can still be read
+	TransportWatcher watcher;
+	void* user;
+};
+
+typedef boost::shared_ptr<TcpConnection> TcpPtr;
+
+INTERNAL
+TcpPtr tcp_connection(Transport* transport) {
+	return *(TcpPtr*)transport->impl;
+}
+
+//the caller holds conn->mutex and calls the watcher it returns once it has let go of it
+INTERNAL
+TransportWatcher changed(TcpConnection* conn, void** user, Transport** transport) {
+	conn->readable.notify_all();
+	*user = conn->user;
+	*transport = conn->transport;
+	return conn->transport != NULL ? conn->watcher : NULL;
+}
+
+INTERNAL void start_read(TcpPtr conn);
+INTERNAL void start_write(TcpPtr conn);
+
+//runs on the io service's thread
+INTERNAL
+void handle_read(TcpPtr conn, const boost::system::error_code& error, std::size_t bytes) {
+	conn->mutex.lock();
+	if (error || bytes == 0)
+		conn->failed = true;
+	else {
+		conn->inbox.append(conn->readBuffer, bytes);
+		start_read(conn);
+	}
+	void* user;
+	Transport* transport;
+	TransportWatcher watcher = changed(conn.get(), &user, &transport);
+	conn->mutex.unlock();
+	if (watcher != NULL)
+		watcher(user, transport);
+}
+
+//runs on the io service's thread
+INTERNAL
+void handle_write(TcpPtr conn, const boost::system::error_code& error) {
+	conn->mutex.lock();
+	conn->writing = false;
+	conn->sending.clear();
+	if (!error && !conn->queued.empty())
+		start_write(conn);
+	TransportWatcher watcher = NULL;
+	void* user;
+	Transport* transport;
+	if (error) {
+		conn->failed = true;
+		watcher = changed(conn.get(), &user, &transport);
+	}
+	conn->mutex.unlock();
+	if (watcher != NULL)
+		watcher(user, transport);
+}
+
+//the caller holds conn->mutex
+INTERNAL
+void start_read(TcpPtr conn) {
+	conn->socket->async_read_some(boost::asio::buffer(conn->readBuffer, BUFFER_SIZE), boost::bind(handle_read, conn, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+//the caller holds conn->mutex
+INTERNAL
+void start_write(TcpPtr conn) {
+	conn->sending.swap(conn->queued);
+	conn->writing = true;
+	boost::asio::async_write(*conn->socket, boost::asio::buffer(conn->sending), boost::bind(handle_write, conn, boost::asio::placeholders::error));
+}
+
+//the caller holds conn->mutex
+INTERNAL
+void close_connection(TcpConnection* conn) {
+	conn->watcher = NULL;
+	conn->readable.notify_all();
+	if (!conn->socket->is_open())
+		return;
+	boost::system::error_code ignored;
+	conn->socket->shutdown(Socket::shutdown_both, ignored);
+	conn->socket->close(ignored);
+}
+
+INTERNAL
+bool tcp_write(Transport* transport, const char* data, u32 size) {
+	TcpPtr conn = tcp_connection(transport);
+	boost::mutex::scoped_lock lock(conn->mutex);
+	if (conn->failed || !conn->socket->is_open())
+		return false;
+	//a client this far behind is not reading anymore, holding more for it only costs memory
+	if (conn->queued.size() + size > TRANSPORT_MAX_QUEUED) {
+		conn->failed = true;
+		close_connection(conn.get());
+		return false;
+	}
+	conn->queued.append(data, size);
+	if (!conn->writing)
+		start_write(conn);
+	return true;
+}
+
+INTERNAL
+u32 tcp_available(Transport* transport) {
+	TcpPtr conn = tcp_connection(transport);
+	boost::mutex::scoped_lock lock(conn->mutex);
+	return conn->inbox.size();
+}
+
+INTERNAL
+u32 tcp_read(Transport* transport, char* data, u32 size) {
+	TcpPtr conn = tcp_connection(transport);
+	boost::mutex::scoped_lock lock(conn->mutex);
+	while (conn->inbox.empty() && !conn->failed && conn->socket->is_open())
+		conn->readable.wait(lock);
+	u32 read = std::min(size, (u32)conn->inbox.size());
+	memcpy(data, conn->inbox.data(), read);
+	conn->inbox.erase(0, read);
+	return read;
+}
+
+INTERNAL
+void tcp_watch(Transport* transport, TransportWatcher watcher, void* user) {
+	TcpPtr conn = tcp_connection(transport);
+	conn->mutex.lock();
+	conn->watcher = watcher;
+	conn->user = user;
+	bool ready = !conn->inbox.empty() || conn->failed;
+	conn->mutex.unlock();
+	if (ready)
+		watcher(user, transport);
+}
+
+INTERNAL
+bool tcp_open(Transport* transport) {
+	TcpPtr conn = tcp_connection(transport);
+	boost::mutex::scoped_lock lock(conn->mutex);
+	return !conn->failed && conn->socket->is_open();
+}
+
+INTERNAL
+void tcp_close(Transport* transport) {
+	TcpPtr conn = tcp_connection(transport);
+	boost::mutex::scoped_lock lock(conn->mutex);
+	close_connection(conn.get());
+}
+
+INTERNAL
+void tcp_destroy(Transport* transport) {
+	TcpPtr conn = tcp_connection(transport);
+	conn->mutex.lock();
+	close_connection(conn.get());
+	conn->transport = NULL;
+	conn->mutex.unlock();
+	delete (TcpPtr*)transport->impl;
+	delete transport;
+}
+
+INTERNAL const TransportOps TCP_OPS = { tcp_write, tcp_available, tcp_read, tcp_watch, tcp_open, tcp_close, tcp_destroy };
+
+Transport* tcp_transport(Socket* socket) {
+	TcpPtr conn(new TcpConnection);
+	conn->socket = socket;
+	conn->writing = false;
+	conn->failed = false;
+	conn->watcher = NULL;
+	conn->user = NULL;
+	Transport* transport = new Transport;
+	transport->ops = &TCP_OPS;
+	transport->impl = new TcpPtr(conn);
+	conn->transport = transport;
+	conn->mutex.lock();
+	start_read(conn);
+	conn->mutex.unlock();
+	return transport;
+}
+
+//bytes one end has written and the other has not read yet
+struct LoopbackQueue {
+	std::string bytes;
+	u32 head; //bytes before this have been read
+};
+
+struct LoopbackPipe {
+	boost::mutex mutex;
+	boost::condition_variable readable;
+	LoopbackQueue queues[2]; //queues[i] is what end i reads
+	Transport* transports[2]; //NULL once that end is destroyed
+	TransportWatcher watchers[2];
+	void* users[2];
+	bool closed;
+	u32 ends; //not destroyed yet
+};
+
+struct LoopbackEnd {
+	LoopbackPipe* pipe;
+	u32 side;
+};
+
+INTERNAL
+LoopbackEnd* loopback_end(Transport* transport) {
+	return (LoopbackEnd*)transport->impl;
+}
+
+//the caller holds pipe->mutex and calls the watcher it returns once it has let go of it.
+//the other end's watcher is called on the writing end's thread
+INTERNAL
+TransportWatcher other_end_watcher(LoopbackPipe* pipe, u32 side, void** user, Transport** transport) {
+	u32 other = 1 - side;
+	*user = pipe->users[other];
+	*transport = pipe->transports[other];
+	return *transport != NULL ? pipe->watchers[other] : NULL;
+}
+
+INTERNAL
+bool loopback_write(Transport* transport, const char* data, u32 size) {
+	LoopbackEnd* end = loopback_end(transport);
+	LoopbackPipe* pipe = end->pipe;
+	pipe->mutex.lock();
+	if (pipe->closed) {
+		pipe->mutex.unlock();
+		return false;
+	}
+	pipe->queues[1 - end->side].bytes.append(data, size);
+	pipe->readable.notify_all();
+	void* user;
+	Transport* other;
+	TransportWatcher watcher = other_end_watcher(pipe, end->side, &user, &other);
+	pipe->mutex.unlock();
+	if (watcher != NULL)
+		watcher(user, other);
+	return true;
+}
+
+INTERNAL
+u32 loopback_available(Transport* transport) {
+	LoopbackEnd* end = loopback_end(transport);
+	boost::mutex::scoped_lock lock(end->pipe->mutex);
+	LoopbackQueue* queue = &end->pipe->queues[end->side];
+	return queue->bytes.size() - queue->head;
+}
+
+INTERNAL
+u32 loopback_read(Transport* transport, char* data, u32 size) {
+	LoopbackEnd* end = loopback_end(transport);
+	LoopbackPipe* pipe = end->pipe;
+	LoopbackQueue* queue = &pipe->queues[end->side];
+	boost::mutex::scoped_lock lock(pipe->mutex);
+	while (queue->head == queue->bytes.size() && !pipe->closed)
+		pipe->readable.wait(lock);
+
+	u32 read = std::min(size, (u32)(queue->bytes.size() - queue->head));
+	memcpy(data, queue->bytes.data() + queue->head, read);
+	queue->head += read;
+	//the queue only ever grows at the back, so it is emptied rather than trimmed
+	if (queue->head == queue->bytes.size()) {
+		queue->bytes.clear();
+		queue->head = 0;
+	}
+	return read;
+}
+
+INTERNAL
+void loopback_watch(Transport* transport, TransportWatcher watcher, void* user) {
+	LoopbackEnd* end = loopback_end(transport);
+	LoopbackPipe* pipe = end->pipe;
+	pipe->mutex.lock();
+	pipe->watchers[end->side] = watcher;
+	pipe->users[end->side] = user;
+	LoopbackQueue* queue = &pipe->queues[end->side];
+	bool ready = queue->head != queue->bytes.size() || pipe->closed;
+	pipe->mutex.unlock();
+	if (ready)
+		watcher(user, transport);
+}
+
+INTERNAL
+bool loopback_open(Transport* transport) {
+	LoopbackPipe* pipe = loopback_end(transport)->pipe;
+	boost::mutex::scoped_lock lock(pipe->mutex);
+	return !pipe->closed;
+}
+
+INTERNAL
+void loopback_close(Transport* transport) {
+	LoopbackEnd* end = loopback_end(transport);
+	LoopbackPipe* pipe = end->pipe;
+	pipe->mutex.lock();
+	pipe->closed = true;
+	pipe->readable.notify_all();
+	pipe->watchers[end->side] = NULL;
+	void* user;
+	Transport* other;
+	TransportWatcher watcher = other_end_watcher(pipe, end->side, &user, &other);
+	pipe->mutex.unlock();
+	if (watcher != NULL)
+		watcher(user, other);
+}
+
+INTERNAL
+void loopback_destroy(Transport* transport) {
+	LoopbackEnd* end = loopback_end(transport);
+	LoopbackPipe* pipe = end->pipe;
+	pipe->mutex.lock();
+	pipe->closed = true;
+	pipe->readable.notify_all();
+	pipe->transports[end->side] = NULL;
+	void* user;
+	Transport* other;
+	TransportWatcher watcher = other_end_watcher(pipe, end->side, &user, &other);
+	bool last = --pipe->ends == 0;
+	pipe->mutex.unlock();
+	if (watcher != NULL)
+		watcher(user, other);
+	if (last)
+		delete pipe;
+	delete end;
+	delete transport;
+}
+
+INTERNAL const TransportOps LOOPBACK_OPS = { loopback_write, loopback_available, loopback_read, loopback_watch, loopback_open, loopback_close, loopback_destroy };
+
+void loopback_pair(Transport** a, Transport** b) {
+	LoopbackPipe* pipe = new LoopbackPipe;
+	pipe->closed = false;
+	pipe->ends = 2;
+	Transport** ends[2] = { a, b };
+	for (u32 i = 0; i < 2; ++i) {
+		pipe->queues[i].head = 0;
+		pipe->watchers[i] = NULL;
+		pipe->users[i] = NULL;
+		LoopbackEnd* end = new LoopbackEnd;
+		end->pipe = pipe;
+		end->side = i;
+		*ends[i] = new Transport;
+		(*ends[i])->ops = &LOOPBACK_OPS;
+		(*ends[i])->impl = end;
+		pipe->transports[i] = *ends[i];
+	}
+}
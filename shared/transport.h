@@ -0,0 +1,84 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <string>
+#include "globals.h"
+
+#define TRANSPORT_MAX_QUEUED (8 * 1024 * 1024) //bytes waiting for a TCP client before it is dropped
+
+struct Transport;
+
+//told that a transport has something new to read or has closed. runs on whichever thread
+//noticed, so it should only hand the transport over to the thread that reads it
+typedef void (*TransportWatcher)(void* user, Transport* transport);
+
+//what one kind of transport does
+struct TransportOps {
+	//queues all size bytes to be sent and returns without waiting for the other end, false
+	//once the connection is gone
+	bool (*write)(Transport* transport, const char* data, u32 size);
+	//bytes that can be read without waiting
+	u32 (*available)(Transport* transport);
+	//waits for something to read and reads up to size bytes, 0 once the connection is gone
+	u32 (*read)(Transport* transport, char* data, u32 size);
+	//calls watcher from now on instead of anyone having to wait in read or poll available,
+	//and right away if there is something to read already
+	void (*watch)(Transport* transport, TransportWatcher watcher, void* user);
+	//false after either end has closed it, reads still return what was sent before that
+	bool (*open)(Transport* transport);
+	void (*close)(Transport* transport);
+	//closes the end if it is not closed yet and frees it
+	void (*destroy)(Transport* transport);
+};
+
+//One end of a connection, a TCP socket or half of an in-process pipe. The server and the
+//client session only talk to each other through these, so a player or bot in the same
+//process as the server goes through the same command pipeline without the network: a write
+//appends to the other end's queue and a read takes from it, no syscalls involved.
+struct Transport {
+	const TransportOps* ops;
+	void* impl;
+};
+
+//takes ownership of an open socket. it is read and written on the socket's io service,
+//which has to be running
+Transport* tcp_transport(Socket* socket);
+//two connected ends, what one writes the other reads. each end is destroyed on its own
+void loopback_pair(Transport** a, Transport** b);
+
+INTERNAL inline
+bool transport_write(Transport* transport, const std::string& data) {
+	return transport->ops->write(transport, data.data(), data.size());
+}
+
+INTERNAL inline
+u32 transport_available(Transport* transport) {
+	return transport->ops->available(transport);
+}
+
+INTERNAL inline
+u32 transport_read(Transport* transport, char* data, u32 size) {
+	return transport->ops->read(transport, data, size);
+}
+
+INTERNAL inline
+void watch_transport(Transport* transport, TransportWatcher watcher, void* user) {
+	transport->ops->watch(transport, watcher, user);
+}
+
+INTERNAL inline
+bool transport_open(Transport* transport) {
+	return transport->ops->open(transport);
+}
+
+INTERNAL inline
+void close_transport(Transport* transport) {
+	transport->ops->close(transport);
+}
+
+INTERNAL inline
+void free_transport(Transport* transport) {
+	transport->ops->destroy(transport);
+}
+
+#endif